@@ -0,0 +1,333 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "roms.h"
+#include "gbm.h"
+#include "cpu.h"
+#include "gpu.h"
+#include "cart.h"
+#include "lockstep.h"
+#include "prof.h"
+#include "constants.h"
+#include "errno.h"
+
+typedef struct ugb_bench_result
+{
+    uint64_t frames;
+    uint64_t cycles;
+    uint64_t instrs;
+    uint64_t ns;
+    ugb_prof prof;
+} ugb_bench_result;
+
+// Same workload on the lockstep core, with all the lanes and alone
+typedef struct ugb_bench_lockstep
+{
+    size_t lanes;
+    uint64_t instrs;
+    uint64_t groups;
+    uint64_t ns;
+    uint64_t one_lane_instrs;
+    uint64_t one_lane_ns;
+} ugb_bench_lockstep;
+
+static void _usage(const char* prog)
+{
+    printf("Usage: '%s [-f frames] [-l lanes] [workload...]'.\n", prog);
+    printf("  -f frames  Emulated frames per workload (default 300)\n");
+    printf("  -l lanes   Also run the workloads on the lockstep core with this many lanes\n");
+    printf("Workloads:\n");
+    for (const ugb_bench_workload* w = &ugb_bench_workloads[0]; w->name; ++w)
+        printf("  %-8s   %s%s\n", w->name, w->desc, (w->flags & UGB_BENCH_HALTS) ? " (not run on the lockstep core)" : "");
+}
+
+static int _run(const ugb_bench_workload* workload, size_t frames, ugb_bench_result* res)
+{
+    static uint8_t rom[UGB_BENCH_ROM_SZ];
+
+    int err;
+    if ((err = ugb_bench_build_rom(workload, &rom[0])) != UGB_ERR_OK)
+        return err;
+
+    ugb_gbm* gbm = ugb_gbm_create();
+    if (!gbm)
+        return UGB_ERR_MALLOC;
+
+    if ((err = ugb_cart_load(gbm->cart, &rom[0], sizeof(rom))) != UGB_ERR_OK ||
+        (err = ugb_gbm_skip_bios(gbm)) != UGB_ERR_OK)
+    {
+        ugb_gbm_destroy(gbm);
+        return err;
+    }
+
+    // Same loop as ugb_gbm_run_frames(), but counting instructions
+    //   apart from HALTed steps
+    uint64_t instrs = 0;
+    size_t target = gbm->gpu->frames + frames;
+
+#ifdef UGB_PROFILE
+    ugb_prof_start(&gbm->prof, UGB_PROF_DEFAULT_HZ);
+#endif
+
+    uint64_t start = ugb_prof_clock();
+    while (gbm->gpu->frames != target)
+    {
+        instrs += gbm->cpu->state == UGB_CPU_RUNNING;
+
+        if ((err = ugb_gbm_step(gbm, 0)) != UGB_ERR_OK)
+            break;
+    }
+    uint64_t end = ugb_prof_clock();
+
+#ifdef UGB_PROFILE
+    ugb_prof_stop(&gbm->prof);
+#endif
+
+    res->frames = frames;
+    res->cycles = gbm->cycles;
+    res->instrs = instrs;
+    res->ns = end - start;
+#ifdef UGB_PROFILE
+    memcpy(&res->prof, &gbm->prof, sizeof(ugb_prof));
+#else
+    ugb_prof_reset(&res->prof);
+#endif
+
+    ugb_gbm_destroy(gbm);
+    return err;
+}
+
+static int _run_lanes(uint8_t const* rom, size_t lanes, uint64_t cycles, uint64_t* instrs, uint64_t* groups, uint64_t* ns)
+{
+    ugb_lockstep* ls = ugb_lockstep_create(lanes);
+    if (!ls)
+        return UGB_ERR_MALLOC;
+
+    int err = ugb_lockstep_load(ls, rom, UGB_BENCH_ROM_SZ);
+
+    // Lanes only differ by their inputs
+    for (size_t l = 0; err == UGB_ERR_OK && l < lanes; ++l)
+        err = ugb_lockstep_set_buttons(ls, l, l & 0xFF);
+
+    uint64_t start = ugb_prof_clock();
+    if (err == UGB_ERR_OK)
+        err = ugb_lockstep_run(ls, cycles);
+    *ns = ugb_prof_clock() - start;
+
+    for (size_t l = 0; err == UGB_ERR_OK && l < lanes; ++l)
+        err = ls->err[l];
+
+    *instrs = ls->instructions;
+    *groups = ls->groups;
+
+    ugb_lockstep_destroy(ls);
+    return err;
+}
+
+static int _run_lockstep(const ugb_bench_workload* workload, size_t lanes, uint64_t cycles, ugb_bench_lockstep* res)
+{
+    static uint8_t rom[UGB_BENCH_ROM_SZ];
+
+    int err;
+    if ((err = ugb_bench_build_rom(workload, &rom[0])) != UGB_ERR_OK)
+        return err;
+
+    uint64_t groups = 0;
+    res->lanes = lanes;
+    if ((err = _run_lanes(&rom[0], lanes, cycles, &res->instrs, &res->groups, &res->ns)) != UGB_ERR_OK ||
+        (err = _run_lanes(&rom[0], 1, cycles, &res->one_lane_instrs, &groups, &res->one_lane_ns)) != UGB_ERR_OK)
+    {
+        return err;
+    }
+
+    return UGB_ERR_OK;
+}
+
+static double _mips(uint64_t instrs, uint64_t ns)
+{
+    return ns ? instrs * 1e3 / ns : 0.0;
+}
+
+static void _print_json(const ugb_bench_workload* workload, ugb_bench_result const* res, ugb_bench_lockstep const* ls, int lanes, int first)
+{
+    double secs = res->ns / 1e9;
+
+    printf("%s    {\n", first ? "" : ",\n");
+    printf("      \"name\": \"%s\",\n", workload->name);
+    printf("      \"frames\": %llu,\n", (unsigned long long) res->frames);
+    printf("      \"cycles\": %llu,\n", (unsigned long long) res->cycles);
+    printf("      \"instructions\": %llu,\n", (unsigned long long) res->instrs);
+    printf("      \"seconds\": %.6f,\n", secs);
+    printf("      \"emulated_mhz\": %.3f,\n", res->cycles / secs / 1e6);
+    printf("      \"fps\": %.2f,\n", res->frames / secs);
+    printf("      \"realtime_ratio\": %.3f,\n", (res->cycles / (double) UGB_CPU_CLOCK_FREQ) / secs);
+    printf("      \"ns_per_instruction\": %.3f,\n", res->instrs ? res->ns / (double) res->instrs : 0.0);
+
+    // Share of SIGPROF samples that landed in each component
+    uint64_t total = ugb_prof_total(&res->prof);
+    double scale = total ? 100.0 / total : 0.0;
+
+    printf("      \"split_percent\": {\n");
+    printf("        \"samples\": %llu,\n", (unsigned long long) total);
+    printf("        \"cpu\": %.2f,\n", scale * res->prof.hits[UGB_PROF_CPU]);
+    printf("        \"mmu\": %.2f,\n", scale * res->prof.hits[UGB_PROF_MMU]);
+    printf("        \"gpu\": %.2f,\n", scale * res->prof.hits[UGB_PROF_GPU]);
+    printf("        \"timer\": %.2f,\n", scale * res->prof.hits[UGB_PROF_TIMER]);
+    printf("        \"other\": %.2f\n", scale * res->prof.hits[UGB_PROF_OTHER]);
+    printf("      }%s\n", lanes ? "," : "");
+
+    // Instructions per second on one core, N lanes against N separate
+    //   machines (or N separate single-lane runs) one after the other
+    if (ls)
+    {
+        double mips = _mips(ls->instrs, ls->ns);
+        double machine_mips = _mips(res->instrs, res->ns);
+        double one_lane_mips = _mips(ls->one_lane_instrs, ls->one_lane_ns);
+
+        printf("      \"lockstep\": {\n");
+        printf("        \"lanes\": %zu,\n", ls->lanes);
+        printf("        \"instructions\": %llu,\n", (unsigned long long) ls->instrs);
+        printf("        \"lanes_per_pass\": %.2f,\n", ls->groups ? ls->instrs / (double) ls->groups : 0.0);
+        printf("        \"mips\": %.3f,\n", mips);
+        printf("        \"one_lane_mips\": %.3f,\n", one_lane_mips);
+        printf("        \"machine_mips\": %.3f,\n", machine_mips);
+        printf("        \"speedup_vs_one_lane\": %.2f,\n", one_lane_mips > 0.0 ? mips / one_lane_mips : 0.0);
+        printf("        \"speedup_vs_machine\": %.2f\n", machine_mips > 0.0 ? mips / machine_mips : 0.0);
+        printf("      }\n");
+    }
+    else if (lanes)
+    {
+        // Asked for, but HALTed lanes skip ahead so there's nothing
+        //   worth comparing
+        printf("      \"lockstep\": null\n");
+    }
+
+    printf("    }");
+}
+
+int main(int argc, char** argv)
+{
+    size_t frames = 300;
+    size_t lanes = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:l:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+            {
+                char* end = 0;
+                frames = strtoull(optarg, &end, 0);
+                if (!end || end == optarg || *end || !frames)
+                {
+                    printf("Invalid frame count \"%s\".\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+
+            case 'l':
+            {
+                char* end = 0;
+                lanes = strtoull(optarg, &end, 0);
+                if (!end || end == optarg || *end || !lanes)
+                {
+                    printf("Invalid lane count \"%s\".\n", optarg);
+                    return 1;
+                }
+                break;
+            }
+
+            default:
+                _usage(argv[0]);
+                return 1;
+        }
+    }
+
+    // Select workloads, all of them by default
+    const ugb_bench_workload* selected[32];
+    int count = 0;
+
+    for (const ugb_bench_workload* w = &ugb_bench_workloads[0]; w->name; ++w)
+    {
+        int wanted = optind >= argc;
+        for (int i = optind; i < argc; ++i)
+            wanted |= !strcmp(argv[i], w->name);
+
+        if (wanted && count < (int) (sizeof(selected) / sizeof(selected[0])))
+            selected[count++] = w;
+    }
+
+    if (!count)
+    {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    printf("{\n");
+    printf("  \"version\": 1,\n");
+#ifdef UGB_PROFILE
+    printf("  \"profiled\": true,\n");
+#else
+    printf("  \"profiled\": false,\n");
+#endif
+    printf("  \"sample_hz\": %d,\n", UGB_PROF_DEFAULT_HZ);
+    printf("  \"workloads\": [\n");
+
+    int ret = 0;
+    int printed = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        ugb_bench_result res;
+        memset(&res, 0, sizeof(ugb_bench_result));
+
+        // Failed workloads are left out of the report
+        int err;
+        if ((err = _run(selected[i], frames, &res)) != UGB_ERR_OK)
+        {
+            fprintf(stderr, "%s: %s\n", selected[i]->name, ugb_strerror(err));
+            ret = 1;
+            continue;
+        }
+
+        // Lanes run as many cycles as the whole machine did
+        ugb_bench_lockstep ls;
+        int lockstep = lanes && !(selected[i]->flags & UGB_BENCH_HALTS);
+        if (lockstep && (err = _run_lockstep(selected[i], lanes, res.cycles, &ls)) != UGB_ERR_OK)
+        {
+            fprintf(stderr, "%s (lockstep): %s\n", selected[i]->name, ugb_strerror(err));
+            ret = 1;
+            continue;
+        }
+
+        _print_json(selected[i], &res, lockstep ? &ls : 0, lanes, !printed++);
+    }
+
+    printf("\n  ]\n");
+    printf("}\n");
+
+    return ret;
+}
@@ -0,0 +1,238 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "roms.h"
+#include "errno.h"
+
+#include <string.h>
+
+/* Synthetic workloads, each one is a tiny hand-assembled program that
+ *   loops forever on one kind of work. They are meant to be run with
+ *   the BIOS skipped, so the cartridge header is left mostly empty.
+ */
+
+typedef struct ugb_asm
+{
+    uint8_t* rom;
+    uint16_t pc;
+} ugb_asm;
+
+static void _emit(ugb_asm* a, int n, const uint8_t* bytes)
+{
+    memcpy(&a->rom[a->pc], bytes, n);
+    a->pc += n;
+}
+
+#define EMIT(a, ...) do { \
+    const uint8_t _bytes[] = { __VA_ARGS__ }; \
+    _emit((a), sizeof(_bytes), &_bytes[0]); \
+} while (0)
+
+// Relative jump back to a label, opcode is JR or JR cc
+static void _jr(ugb_asm* a, uint8_t opcode, uint16_t label)
+{
+    EMIT(a, opcode, (uint8_t) (int8_t) (label - (a->pc + 2)));
+}
+
+static void _alu(uint8_t* rom)
+{
+    ugb_asm a = { rom, 0x0150 };
+
+    EMIT(&a, 0x3E, 0x5A,  // LD A, $5A
+             0x06, 0x13,  // LD B, $13
+             0x0E, 0x27,  // LD C, $27
+             0x16, 0x3C,  // LD D, $3C
+             0x1E, 0x81); // LD E, $81
+
+    uint16_t loop = a.pc;
+    EMIT(&a, 0x80,        // ADD A, B
+             0x89,        // ADC A, C
+             0x92,        // SUB D
+             0x9B,        // SBC A, E
+             0xA0,        // AND B
+             0xA9,        // XOR C
+             0xB2,        // OR D
+             0xBB,        // CP E
+             0x04,        // INC B
+             0x0D,        // DEC C
+             0x14,        // INC D
+             0x1D,        // DEC E
+             0x07,        // RLCA
+             0x27,        // DAA
+             0xC6, 0x11,  // ADD A, $11
+             0xEE, 0x5A,  // XOR $5A
+             0x09);       // ADD HL, BC
+    _jr(&a, 0x18, loop);  // JR loop
+}
+
+static void _mem(uint8_t* rom)
+{
+    ugb_asm a = { rom, 0x0150 };
+
+    uint16_t start = a.pc;
+    EMIT(&a, 0x21, 0x00, 0xC0,  // LD HL, $C000
+             0x11, 0x00, 0xD0,  // LD DE, $D000
+             0x06, 0x00);       // LD B, 0
+
+    uint16_t loop = a.pc;
+    EMIT(&a, 0x2A,              // LD A, (HL+)
+             0x12,              // LD (DE), A
+             0x13,              // INC DE
+             0x3C,              // INC A
+             0x77,              // LD (HL), A
+             0xF5,              // PUSH AF
+             0xF1,              // POP AF
+             0x05);             // DEC B
+    _jr(&a, 0x20, loop);        // JR NZ, loop
+    _jr(&a, 0x18, start);       // JR start
+}
+
+static void _cb(uint8_t* rom)
+{
+    ugb_asm a = { rom, 0x0150 };
+
+    uint16_t loop = a.pc;
+    EMIT(&a, 0xCB, 0x00,  // RLC B
+             0xCB, 0x09,  // RRC C
+             0xCB, 0x12,  // RL D
+             0xCB, 0x1B,  // RR E
+             0xCB, 0x24,  // SLA H
+             0xCB, 0x2D,  // SRA L
+             0xCB, 0x37,  // SWAP A
+             0xCB, 0x38,  // SRL B
+             0xCB, 0x41,  // BIT 0, C
+             0xCB, 0x5A,  // BIT 3, D
+             0xCB, 0xC3,  // SET 0, E
+             0xCB, 0x8C,  // RES 1, H
+             0xCB, 0xFF,  // SET 7, A
+             0xCB, 0xB8); // RES 7, B
+    _jr(&a, 0x18, loop);  // JR loop
+}
+
+static void _halt(uint8_t* rom)
+{
+    // VBlank handler does nothing
+    rom[0x0040] = 0xD9;   // RETI
+
+    ugb_asm a = { rom, 0x0150 };
+
+    EMIT(&a, 0x3E, 0x01,  // LD A, $01
+             0xE0, 0xFF,  // LDH ($FF), A  ; IE = VBlank
+             0xFB);       // EI
+
+    uint16_t loop = a.pc;
+    EMIT(&a, 0x76,        // HALT
+             0x00);       // NOP
+    _jr(&a, 0x18, loop);  // JR loop
+}
+
+static void _joypad(uint8_t* rom)
+{
+    ugb_asm a = { rom, 0x0150 };
+
+    // Read both halves of the joypad, B = pressed buttons
+    uint16_t loop = a.pc;
+    EMIT(&a, 0x3E, 0x20,  // LD A, $20
+             0xE0, 0x00,  // LDH ($00), A  ; select the d-pad
+             0xF0, 0x00,  // LDH A, ($00)
+             0xE6, 0x0F,  // AND $0F
+             0x47,        // LD B, A
+             0x3E, 0x10,  // LD A, $10
+             0xE0, 0x00,  // LDH ($00), A  ; select the buttons
+             0xF0, 0x00,  // LDH A, ($00)
+             0xCB, 0x37,  // SWAP A
+             0xE6, 0xF0,  // AND $F0
+             0xB0,        // OR B
+             0x2F,        // CPL
+             0x47);       // LD B, A
+
+    // Some more work for each pressed button, so that machines with
+    //   different inputs take different paths
+    for (int bit = 0; bit < 8; ++bit)
+    {
+        EMIT(&a, 0xCB, 0x40 | (bit << 3),  // BIT bit, B
+                 0x28, 0x04,               // JR Z, +4
+                 0x81,                     // ADD A, C
+                 0xAA,                     // XOR D
+                 0x0C,                     // INC C
+                 0x07);                    // RLCA
+    }
+
+    _jr(&a, 0x18, loop);  // JR loop
+}
+
+static void _scroll(uint8_t* rom)
+{
+    ugb_asm a = { rom, 0x0150 };
+
+    // Fill the character RAM with a pattern
+    EMIT(&a, 0x21, 0x00, 0x80);  // LD HL, $8000
+    uint16_t fill_chr = a.pc;
+    EMIT(&a, 0x7D,               // LD A, L
+             0x22,               // LD (HL+), A
+             0x7C,               // LD A, H
+             0xFE, 0x90);        // CP $90
+    _jr(&a, 0x20, fill_chr);     // JR NZ, fill_chr
+
+    // Fill the first BG map with varying tiles
+    EMIT(&a, 0x21, 0x00, 0x98);  // LD HL, $9800
+    uint16_t fill_map = a.pc;
+    EMIT(&a, 0x7D,               // LD A, L
+             0x22,               // LD (HL+), A
+             0x7C,               // LD A, H
+             0xFE, 0x9C);        // CP $9C
+    _jr(&a, 0x20, fill_map);     // JR NZ, fill_map
+
+    EMIT(&a, 0x3E, 0x91,         // LD A, $91
+             0xE0, 0x40);        // LDH ($40), A  ; LCD + BG on
+
+    // Change the scrolling on each line
+    uint16_t loop = a.pc;
+    EMIT(&a, 0xF0, 0x44,         // LDH A, ($44)  ; LY
+             0xE0, 0x43,         // LDH ($43), A  ; SCX
+             0x2F,               // CPL
+             0xE0, 0x42);        // LDH ($42), A  ; SCY
+    _jr(&a, 0x18, loop);         // JR loop
+}
+
+const ugb_bench_workload ugb_bench_workloads[] =
+{
+    { "alu",    "8-bit ALU register mix",                 &_alu,    0 },
+    { "mem",    "WRAM copy loop with stack traffic",      &_mem,    0 },
+    { "cb",     "CB-prefixed bit operations",             &_cb,     0 },
+    { "halt",   "HALT until VBlank every frame",          &_halt,   UGB_BENCH_HALTS },
+    { "joypad", "Branches on each pressed button",        &_joypad, 0 },
+    { "scroll", "Per-scanline scrolling over a full BG",  &_scroll, 0 },
+    { 0, 0, 0, 0 }
+};
+
+int ugb_bench_build_rom(const ugb_bench_workload* workload, uint8_t* rom)
+{
+    if (!workload || !rom)
+        return UGB_ERR_BADARGS;
+
+    memset(rom, 0, UGB_BENCH_ROM_SZ);
+
+    // Entry point : NOP; JP $0150
+    ugb_asm a = { rom, 0x0100 };
+    EMIT(&a, 0x00, 0xC3, 0x50, 0x01);
+
+    (*workload->build)(rom);
+
+    return UGB_ERR_OK;
+}
@@ -0,0 +1,47 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_BENCH_ROMS_H__
+#define __UGB_BENCH_ROMS_H__
+
+#include <stdint.h>
+#include <unistd.h>
+
+#define UGB_BENCH_ROM_SZ 0x8000
+
+// Spends most of its time HALTed, which the lockstep core doesn't run
+//   (its lanes jump right to the end), so comparing both is meaningless
+#define UGB_BENCH_HALTS 0x01
+
+typedef struct ugb_bench_workload
+{
+    const char* name;
+    const char* desc;
+
+    // Writes the program into a zeroed 32K ROM image
+    void(*build)(uint8_t* rom);
+
+    int flags;
+} ugb_bench_workload;
+
+// Terminated by an entry with a null name
+extern const ugb_bench_workload ugb_bench_workloads[];
+
+int ugb_bench_build_rom(const ugb_bench_workload* workload, uint8_t* rom);
+
+#endif // __UGB_BENCH_ROMS_H__
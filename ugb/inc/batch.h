@@ -0,0 +1,122 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_BATCH_H__
+#define __UGB_BATCH_H__
+
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// Runs many independent jobs on a pool of worker threads.
+// Each worker owns one machine for its whole life and swaps cartridges
+//   in and out of it. Jobs are dealt round-robin to per-worker queues,
+//   idle workers steal half of the remaining jobs of a busy one.
+
+#define UGB_BATCH_SERIAL_SZ 256
+
+// Joypad state to apply from a given frame on
+typedef struct ugb_batch_input
+{
+    size_t frame;
+    uint8_t buttons;
+} ugb_batch_input;
+
+typedef struct ugb_batch_result
+{
+    int err;
+
+    size_t frames;
+    uint64_t cycles;
+    uint64_t state_hash;
+    uint64_t framebuf_hash;
+    uint64_t ns;
+
+    // First bytes sent on the serial port
+    uint8_t serial[UGB_BATCH_SERIAL_SZ];
+    size_t serial_len;
+} ugb_batch_result;
+
+typedef struct ugb_batch_job
+{
+    // ROM image and input script (sorted by frame), owned by the caller
+    uint8_t const* rom;
+    size_t rom_size;
+    ugb_batch_input const* inputs;
+    size_t inputs_count;
+
+    size_t frames;
+    int skip_bios;
+
+    ugb_batch_result result;
+} ugb_batch_job;
+
+typedef struct ugb_batch_stats
+{
+    size_t jobs;
+    size_t failed;
+    size_t stolen;
+    uint64_t frames;
+    uint64_t cycles;
+    uint64_t ns;
+} ugb_batch_stats;
+
+struct ugb_batch;
+
+typedef struct ugb_batch_worker
+{
+    struct ugb_batch* batch;
+    int index;
+
+    pthread_t thread;
+    struct ugb_gbm* gbm;
+    uint8_t* state;
+    size_t state_size;
+
+    // Indices in the job array, only touched under the lock
+    pthread_mutex_t lock;
+    size_t* queue;
+    size_t head;
+    size_t tail;
+
+    size_t stolen;
+} ugb_batch_worker;
+
+typedef struct ugb_batch
+{
+    int threads;
+    int pin;
+
+    ugb_batch_worker* workers;
+
+    ugb_batch_job* jobs;
+    size_t count;
+
+    ugb_batch_stats stats;
+} ugb_batch;
+
+// Zero threads means one per online core
+ugb_batch* ugb_batch_create(int threads, int pin);
+void ugb_batch_destroy(ugb_batch* batch);
+
+// Blocks until all the jobs are done, results are stored in each job
+int ugb_batch_run(ugb_batch* batch, ugb_batch_job* jobs, size_t count);
+
+uint64_t ugb_batch_hash(uint8_t const* data, size_t size);
+
+#endif // __UGB_BATCH_H__
@@ -0,0 +1,105 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_CART_H__
+#define __UGB_CART_H__
+
+#include "gbm.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+// Cartridge header fields
+#define UGB_CART_TYPE_ADDR   0x0147
+#define UGB_CART_ROMSZ_ADDR  0x0148
+#define UGB_CART_RAMSZ_ADDR  0x0149
+
+// Largest external RAM of the supported controllers (MBC5)
+#define UGB_CART_RAM_MAX_SZ  0x20000
+
+enum
+{
+    UGB_MBC_NONE,
+    UGB_MBC_MBC1,
+    UGB_MBC_MBC3,
+    UGB_MBC_MBC5
+};
+
+// Memory bank controller registers, as written by the program
+typedef struct ugb_mbc
+{
+    uint16_t rom_bank;
+    uint8_t ram_bank;
+    uint8_t ram_enable;
+
+    // MBC1 banking mode
+    uint8_t mode;
+
+    // MBC3 clock registers (S, M, H, DL, DH) and last latch write.
+    // The clock doesn't tick, the registers only hold what was written.
+    uint8_t rtc[5];
+    uint8_t rtc_latch;
+} ugb_mbc;
+
+typedef struct ugb_cart
+{
+    ugb_gbm* gbm;
+
+    // ROM image, owned by the caller and never written to, so that
+    //   several machines can share the same (read-only) pages
+    uint8_t const* rom;
+    size_t rom_size;
+    size_t rom_banks;
+
+    // External cartridge RAM, at least UGB_CART_RAM_SZ
+    uint8_t* ram;
+    size_t ram_size;
+
+    int mbc_type;
+    ugb_mbc mbc;
+
+    struct ugb_mmu_map* rom0_map;
+    struct ugb_mmu_map* romx_map;
+    struct ugb_mmu_map* ram_map;
+
+    // Control flow graph of the image, analysed when first asked for
+    struct ugb_cfg* cfg;
+} ugb_cart;
+
+ugb_cart* ugb_cart_create(ugb_gbm* gbm);
+void ugb_cart_destroy(ugb_cart* cart);
+
+int ugb_cart_reset(ugb_cart* cart);
+int ugb_cart_load(ugb_cart* cart, uint8_t const* rom, size_t size);
+int ugb_cart_unload(ugb_cart* cart);
+
+// Point the memory maps to the banks selected in cart->mbc, to be
+//   called after changing it behind the MBC's back
+int ugb_cart_update_maps(ugb_cart* cart);
+
+// ROM bank currently mapped in ROMX, including the MBC1 upper bits
+size_t ugb_cart_romx_bank(ugb_cart const* cart);
+
+// Offset in the ROM image of what's currently mapped at addr, or a
+//   negative error when it isn't cartridge ROM (this includes the BIOS)
+ssize_t ugb_cart_rom_offset(ugb_cart* cart, uint16_t addr);
+
+// Control flow graph of the loaded image, or 0 if there's none
+struct ugb_cfg* ugb_cart_cfg(ugb_cart* cart);
+
+#endif // __UGB_CART_H__
@@ -0,0 +1,133 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __UGB_CFG_H__
+#define __UGB_CFG_H__
+
+#include <stdint.h>
+#include <unistd.h>
+
+// Control flow graph of a ROM image, found by recursive descent from the
+//   entry point and the RST and interrupt vectors: only bytes reached by
+//   following jumps, calls and fall-throughs are taken as code, the rest
+//   is data (or code only reached through JP (HL), until told otherwise).
+// Everything is indexed by ROM offset, code in ROMX being in the bank it
+//   was found in. Jumps from ROM0 into ROMX go to the bank last written
+//   to the MBC just before (LD A,n / LD (a16),A or LD HL,a16 / LD (HL),n)
+//   on the same path, and are lost when it can't be guessed that way.
+
+// Per-byte flags
+#define UGB_CFG_CODE   0x01 // Part of an instruction
+#define UGB_CFG_HEAD   0x02 // First byte of an instruction
+#define UGB_CFG_BLOCK  0x04 // Follows a branch or a call
+#define UGB_CFG_TARGET 0x08 // Jumped, called or vectored to
+
+// How basic blocks end
+enum
+{
+    UGB_CFG_FALL,     // Into the next one, which is jumped to
+    UGB_CFG_JUMP,     // JP, JR
+    UGB_CFG_BRANCH,   // Conditional JP, JR or RET
+    UGB_CFG_CALL,     // CALL, RST (assumed to return)
+    UGB_CFG_RETURN,   // RET, RETI
+    UGB_CFG_INDIRECT, // JP (HL)
+    UGB_CFG_STOP      // Bad opcode, crash, end of the bank or of the image
+};
+
+typedef struct ugb_cfg_block
+{
+    // ROM offsets, end excluded
+    uint32_t start;
+    uint32_t end;
+    int kind;
+
+    // Offsets of the fall-through and of the jump / call destination,
+    //   negative when there is none or it's unknown
+    int32_t next;
+    int32_t target;
+} ugb_cfg_block;
+
+typedef struct ugb_cfg_region
+{
+    uint32_t start;
+    uint32_t end;
+} ugb_cfg_region;
+
+typedef struct ugb_cfg_edge
+{
+    uint32_t from;
+    uint32_t to;
+} ugb_cfg_edge;
+
+typedef struct ugb_cfg_entry
+{
+    uint32_t offset;
+    int bank;
+} ugb_cfg_entry;
+
+typedef struct ugb_cfg
+{
+    uint8_t const* rom;
+    size_t rom_size;
+    size_t rom_banks;
+
+    // One UGB_CFG_* set per ROM byte
+    uint8_t* flags;
+
+    // Sorted by start, blocks never overlap
+    ugb_cfg_block* blocks;
+    size_t block_count;
+    size_t block_capacity;
+
+    // Runs of bytes not known to be code, sorted as well
+    ugb_cfg_region* data;
+    size_t data_count;
+    size_t data_capacity;
+
+    // Constant jump and call destinations, by instruction
+    ugb_cfg_edge* edges;
+    size_t edge_count;
+    size_t edge_capacity;
+
+    // Jumps into ROMX whose bank couldn't be guessed
+    size_t unresolved;
+
+    // Pending walks
+    ugb_cfg_entry* work;
+    size_t work_count;
+    size_t work_capacity;
+} ugb_cfg;
+
+// The image has to outlive the graph
+ugb_cfg* ugb_cfg_create(uint8_t const* rom, size_t size);
+void ugb_cfg_destroy(ugb_cfg* cfg);
+
+// Add code found some other way (it ran, or is a jump table entry), bank
+//   being what ROMX holds while it runs, or negative if unknown
+int ugb_cfg_add_entry(ugb_cfg* cfg, size_t offset, int bank);
+
+// Block holding the offset, if it's known code
+const ugb_cfg_block* ugb_cfg_block_at(const ugb_cfg* cfg, size_t offset);
+
+// Start of the instruction the offset is in, or a negative error if it
+//   isn't known code
+ssize_t ugb_cfg_head(const ugb_cfg* cfg, size_t offset);
+
+// Where the byte at that offset shows up when its bank is mapped
+uint16_t ugb_cfg_address(size_t offset);
+
+#endif // __UGB_CFG_H__
@@ -46,14 +46,30 @@
 #define UGB_CART_ROM0_HI 0x3FFF
 #define UGB_CART_ROM0_SZ 0x4000
 
+#define UGB_CART_ROMX_LO 0x4000
+#define UGB_CART_ROMX_HI 0x7FFF
+#define UGB_CART_ROMX_SZ 0x4000
+
+#define UGB_CART_RAM_LO  0xA000
+#define UGB_CART_RAM_HI  0xBFFF
+#define UGB_CART_RAM_SZ  0x2000
+
 #define UGB_RAM0_LO      0xC000
 #define UGB_RAM0_HI      0xDFFF
 #define UGB_RAM0_SZ      0x2000
 
+#define UGB_ECHO_LO      0xE000
+#define UGB_ECHO_HI      0xFDFF
+#define UGB_ECHO_SZ      0x1E00
+
 #define UGB_OAM_LO       0xFE00
 #define UGB_OAM_HI       0xFE9F
 #define UGB_OAM_SZ       0x00A0
 
+#define UGB_UNUSED_LO    0xFEA0
+#define UGB_UNUSED_HI    0xFEFF
+#define UGB_UNUSED_SZ    0x0060
+
 #define UGB_HWIO_LO      0xFF00
 #define UGB_HWIO_HI      0xFF7F
 #define UGB_HWIO_SZ      0x0080
@@ -0,0 +1,85 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_COVMAP_H__
+#define __UGB_COVMAP_H__
+
+#include "gbm.h"
+#include "symbols.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Code and data coverage, one bit per byte and per kind of access, kept
+//   through an MMU trap on the whole address space (so it costs nothing
+//   when not in use).
+// Bytes are identified by where they really live: the ROM image, then
+//   the cartridge RAM, then the rest of the address space by address.
+//   ROM writes are MBC register accesses, they are accounted there.
+
+#define UGB_COVMAP_MAGIC   0x43424755 // "UGBC"
+#define UGB_COVMAP_VERSION 1
+
+enum
+{
+    UGB_COVMAP_EXEC,
+    UGB_COVMAP_READ,
+    UGB_COVMAP_WRITE,
+
+    UGB_COVMAP_KINDS
+};
+
+// Saved maps are this header followed by the executed, read and written
+//   bitmaps, each of rom_size + ram_size + other_size bits
+typedef struct ugb_covmap_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rom_size;
+    uint32_t ram_size;
+    uint32_t other_size;
+    uint32_t pad;
+} ugb_covmap_header;
+
+typedef struct ugb_covmap
+{
+    ugb_gbm* gbm;
+    int trap;
+
+    size_t rom_size;
+    size_t ram_size;
+    size_t size;
+    uint8_t* bits[UGB_COVMAP_KINDS];
+} ugb_covmap;
+
+// The cartridge has to be loaded already
+ugb_covmap* ugb_covmap_create(ugb_gbm* gbm);
+void ugb_covmap_destroy(ugb_covmap* cov);
+void ugb_covmap_reset(ugb_covmap* cov);
+
+// Number of ROM bytes accessed that way
+size_t ugb_covmap_rom_count(const ugb_covmap* cov, int kind);
+
+int ugb_covmap_save(const ugb_covmap* cov, const char* path);
+
+// Label coverage in lcov's tracefile format, each ROM label being a line
+//   (numbered after its ROM offset + 1) covering the bytes up to the next
+//   one, and global labels being functions
+int ugb_covmap_write_lcov(const ugb_covmap* cov, FILE* f, const ugb_symbols* syms, const char* source);
+
+#endif // __UGB_COVMAP_H__
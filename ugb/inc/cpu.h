@@ -39,6 +39,8 @@ enum
     #include "cpu.def"
 };
 
+#define UGB_CPU_COVERAGE_SZ 0x10000
+
 enum
 {
     UGB_CPU_RUNNING,
@@ -62,6 +64,17 @@ typedef struct ugb_cpu
     int state;
     int ei_delayed;
     int repeat_next_byte;
+
+    // Optional edge coverage counters (UGB_CPU_COVERAGE_SZ of them),
+    //   indexed by the PCs of two consecutive instructions
+    uint8_t* coverage;
+    uint16_t coverage_prev;
+
+    // Optional execution trace, see trace.h
+    struct ugb_trace* trace;
+
+    // Guest code profiler, only used when built with UGB_GUEST_PROFILER
+    struct ugb_profiler* profiler;
 } ugb_cpu;
 
 ugb_cpu* ugb_cpu_create(ugb_gbm* gbm);
@@ -20,8 +20,12 @@
 #define __UGB_DEBUGGER_H__
 
 #include "gbm.h"
+#include "symbols.h"
+#include "expr.h"
+#include "history.h"
 
 #include <stdint.h>
+#include <setjmp.h>
 
 enum
 {
@@ -37,25 +41,137 @@ enum
     UGB_STS_CONTINUE
 };
 
+// Commands are sent to the frontend with its cookie, the status is
+//   provided by the debugger and called with its own cookie.
+// The frontend only needs to ask for the status when the breakpoint
+//   bitmap has the PC's bit set, or when the debugger flagged something
+//   during the last instruction (see ugb_debugger_break_at). The bitmap
+//   pointer is null when there are no breakpoints at all, watching is
+//   set while there are watchpoints.
+// The frontend sets running while its loop steps the machine, commands
+//   that step it from the debugger's thread are refused meanwhile.
 typedef struct ugb_debugger_interf
 {
     void* cookie;
     int(*command)(int, void*);
+
+    void* status_cookie;
     int(*status)(int, void*);
+
+    const uint8_t* breakmap;
+    int watching;
+    int pending;
+    int running;
 } ugb_debugger_interf;
 
+#define UGB_DEBUGGER_BREAKMAP_SZ (0x10000 / 8)
+
+// Breakpoints on ROMX addresses can be restricted to one bank
+#define UGB_BREAKPOINT_ANY_BANK -1
+
 typedef struct ugb_breakpoint
 {
     int id;
     uint16_t addr;
+    int bank;
+
+    // Optional condition, evaluated on each hit (after counting it, the
+    //   count being available as "hits")
+    uint32_t hits;
+    ugb_expr* cond;
+    char* cond_str;
 
     struct ugb_breakpoint* prev;
     struct ugb_breakpoint* next;
 } ugb_breakpoint;
 
-int ugb_debugger_add_breakpoint(uint16_t addr);
-int ugb_debugger_delete_breakpoint(int id);
+enum
+{
+    UGB_WATCH_READ   = (0x01 << 0),
+    UGB_WATCH_WRITE  = (0x01 << 1),
+    UGB_WATCH_CHANGE = (0x01 << 2)
+};
+
+// Watchpoints are checked through MMU traps, only the pages they cover
+//   leave the MMU's fast path
+typedef struct ugb_watchpoint
+{
+    int id;
+    uint16_t low_addr;
+    uint16_t high_addr;
+    int type;
+
+    struct ugb_watchpoint* prev;
+    struct ugb_watchpoint* next;
+} ugb_watchpoint;
+
+typedef struct ugb_debugger
+{
+    ugb_gbm* gbm;
+    ugb_debugger_interf* interf;
+
+    int next_breakpoint_id;
+    int break_hit;
+    ugb_breakpoint* breakpoints;
+    ugb_breakpoint* last_breakpoint;
+
+    // One bit per address having at least one breakpoint
+    uint8_t breakmap[UGB_DEBUGGER_BREAKMAP_SZ];
+
+    ugb_watchpoint* watchpoints;
+    ugb_watchpoint* last_watchpoint;
+    // MMU trap of the watchpoints, -1 when there are none
+    int trap;
+
+    // Null until a symbol file is loaded
+    ugb_symbols* symbols;
+
+    // Last watchpoint hit, id is zero if none since the last continue
+    struct ugb_watch_hit
+    {
+        int id;
+        int op;
+        uint16_t addr;
+        uint8_t old;
+        uint8_t data;
+    } watch_hit;
+
+    // Recorded while the machine runs, for reverse execution (null until
+    //   the "record" command), only owned if it wasn't attached yet
+    ugb_history* history;
+    int own_history;
+
+    int quit;
+    sigjmp_buf jmpbuf;
+} ugb_debugger;
+
+ugb_debugger* ugb_debugger_create(ugb_gbm* gbm, ugb_debugger_interf* interf);
+void ugb_debugger_destroy(ugb_debugger* dbg);
+
+static inline int ugb_debugger_break_at(const ugb_debugger_interf* interf, uint16_t pc)
+{
+    return interf->pending || (interf->breakmap && (interf->breakmap[pc >> 3] & (1 << (pc & 7))));
+}
+
+// Frames run other than instruction by instruction through the checks
+//   above (hidden or speculative ones) would miss a stop, or report one
+//   that didn't happen
+static inline int ugb_debugger_armed(const ugb_debugger_interf* interf)
+{
+    return interf->breakmap || interf->watching;
+}
+
+int ugb_debugger_add_breakpoint(ugb_debugger* dbg, uint16_t addr, int bank);
+int ugb_debugger_delete_breakpoint(ugb_debugger* dbg, int id);
+int ugb_debugger_set_condition(ugb_debugger* dbg, int id, const char* cond, const char** error_pos);
+
+int ugb_debugger_add_watchpoint(ugb_debugger* dbg, uint16_t low_addr, uint16_t high_addr, int type);
+int ugb_debugger_delete_watchpoint(ugb_debugger* dbg, int id);
+
+// Symbols are then accepted instead of addresses, and used to annotate
+//   the disassembly ; returns the number of symbols read
+ssize_t ugb_debugger_load_symbols(ugb_debugger* dbg, const char* path);
 
-int ugb_debugger_mainloop(ugb_gbm* gbm, ugb_debugger_interf* interf);
+int ugb_debugger_mainloop(ugb_debugger* dbg);
 
 #endif // __UGB_DEBUGGER_H__
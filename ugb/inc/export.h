@@ -0,0 +1,109 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_EXPORT_H__
+#define __UGB_EXPORT_H__
+
+#include "gbm.h"
+#include "constants.h"
+
+#include <stdint.h>
+
+// Completed frames are published into a POSIX shared memory ring, so that
+//   other processes can consume them in place. The producer copies each
+//   frame into the next slot from the GPU's VBlank hook, readers only ever
+//   touch the mapping, except to sleep when they're ahead of it.
+//
+// The layout is a header page followed by the slots. Every slot has the
+//   sequence number of the frame it holds (0 while it's being written),
+//   so a reader checks it again once done to know if it was overwritten
+//   in the meantime. The header's futex word is the low part of the last
+//   published sequence number, the producer only wakes it up when some
+//   reader is sleeping on it.
+
+#define UGB_EXPORT_MAGIC     0x58424755 // "UGBX"
+#define UGB_EXPORT_VERSION   1
+#define UGB_EXPORT_HEADER_SZ 4096
+
+enum
+{
+    // Also copy WRAM and HRAM along with the frame
+    UGB_EXPORT_MEMORY = (0x01 << 0)
+};
+
+typedef struct ugb_export_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint32_t slots;
+    uint32_t slot_size;
+
+    // Number of readers sleeping on the futex word
+    uint32_t waiters;
+    // Futex word, low 32 bits of the last published sequence number
+    uint32_t futex;
+    uint32_t pad;
+
+    // Last published sequence number, 0 when nothing was published yet
+    uint64_t last;
+} ugb_export_header;
+
+typedef struct ugb_export_slot
+{
+    uint64_t seq;
+    uint64_t frame;
+    uint64_t cycles;
+
+    uint8_t framebuf[UGB_GPU_SCREEN_W * UGB_GPU_SCREEN_H];
+    uint8_t wram[UGB_RAM0_SZ];
+    uint8_t hram[UGB_ZPAGE_SZ];
+} ugb_export_slot;
+
+typedef struct ugb_export
+{
+    ugb_gbm* gbm;
+
+    char* name;
+    size_t size;
+    ugb_export_header* header;
+} ugb_export;
+
+// Producer side, creates (or replaces) the named shared memory object and
+//   starts publishing from the next frame on
+ugb_export* ugb_export_create(ugb_gbm* gbm, const char* name, size_t slots, int flags);
+void ugb_export_destroy(ugb_export* exp);
+
+int ugb_export_vblank_hook(struct ugb_gpu* gpu, void* cookie);
+
+// Reader side, maps an existing ring
+ugb_export* ugb_export_open(const char* name);
+void ugb_export_close(ugb_export* exp);
+
+// Wait for a frame newer than the one given, for at most the given time
+//   (or forever if negative). The last published sequence number is
+//   returned, it isn't newer if the wait timed out.
+uint64_t ugb_export_wait(ugb_export* exp, uint64_t after, int timeout_ms);
+
+// The slot holding the given frame, or 0 if it was already overwritten.
+// Once done with the slot, ugb_export_valid tells if its data is still
+//   the requested frame.
+const ugb_export_slot* ugb_export_get(ugb_export* exp, uint64_t seq);
+int ugb_export_valid(const ugb_export_slot* slot, uint64_t seq);
+
+#endif // __UGB_EXPORT_H__
@@ -0,0 +1,53 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_EXPR_H__
+#define __UGB_EXPR_H__
+
+#include "gbm.h"
+
+#include <stdint.h>
+
+// Expressions are compiled once to a small stack bytecode, that can then
+//   be evaluated against a machine as often as needed, without parsing
+//   nor allocating anything.
+//
+// The syntax is C's integer expressions (with the same precedences) over
+//   CPU registers (A, F, ..., AF, ..., SP, PC, IE), memory bytes ([addr])
+//   and the caller's named variables. Numbers are hexadecimal like the
+//   addresses elsewhere in the debugger, unless prefixed with '#' for
+//   decimal ; registers win over numbers, so use the 0x or $ prefix to
+//   get the number 0xAF rather than the AF register.
+
+#define UGB_EXPR_MAX_CODE  128
+#define UGB_EXPR_MAX_STACK 16
+
+typedef struct ugb_expr
+{
+    uint8_t code[UGB_EXPR_MAX_CODE];
+    size_t len;
+} ugb_expr;
+
+// The variables list is null terminated and can be null, errors are
+//   located in the string through error_pos when given
+int ugb_expr_compile(ugb_expr* expr, const char* str, const char* const* vars, const char** error_pos);
+
+// Variables are given by index, in the order they had when compiling
+int ugb_expr_eval(const ugb_expr* expr, ugb_gbm* gbm, const int32_t* vars, int32_t* value);
+
+#endif // __UGB_EXPR_H__
@@ -0,0 +1,87 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_FUZZ_H__
+#define __UGB_FUZZ_H__
+
+#include "gbm.h"
+#include "batch.h"
+#include "snapshot.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+// Trials for fuzzing and state-space exploration : a machine brought
+//   to an interesting point (past the BIOS and intro) is held as a
+//   template, each trial starts again from it, plays an input script
+//   (same format as the batch jobs) and reports the edge coverage it
+//   reached.
+// In place, the machine goes back to the template through a snapshot
+//   with dirty page tracking, which only copies what the last trial
+//   wrote. With fork, every trial runs in a child process on a
+//   copy-on-write image of the template and the machine never moves.
+
+enum
+{
+    UGB_FUZZ_IN_PLACE,
+    UGB_FUZZ_FORK
+};
+
+typedef struct ugb_fuzz_result
+{
+    int err;
+    size_t frames;
+    uint64_t cycles;
+
+    // Time spent getting back to the template, and running
+    uint64_t reset_ns;
+    uint64_t run_ns;
+
+    // Edges hit by this trial, and how many of them (or of their hit
+    //   count buckets) were never seen before
+    size_t edges;
+    size_t new_edges;
+} ugb_fuzz_result;
+
+typedef struct ugb_fuzz
+{
+    // Owned by the caller, must not be touched while the fuzzer exists
+    ugb_gbm* gbm;
+    int mode;
+
+    ugb_gbm_snapshot* snapshot;
+
+    // Hit counts of the last trial, shared with the children when
+    //   forking, along with the result they report
+    uint8_t* coverage;
+    ugb_fuzz_result* child_result;
+
+    // Hit count buckets seen over all the trials
+    uint8_t* seen;
+
+    uint64_t trials;
+} ugb_fuzz;
+
+// The template is the machine as it is when the fuzzer is created
+ugb_fuzz* ugb_fuzz_create(ugb_gbm* gbm, int mode);
+void ugb_fuzz_destroy(ugb_fuzz* fuzz);
+
+// Play inputs (sorted by frame) for this many frames from the template
+int ugb_fuzz_trial(ugb_fuzz* fuzz, ugb_batch_input const* inputs, size_t count, size_t frames, ugb_fuzz_result* res);
+
+#endif // __UGB_FUZZ_H__
@@ -22,6 +22,8 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#include "prof.h"
+
 struct ugb_cpu;
 struct ugb_mmu;
 struct ugb_mmu_map;
@@ -30,6 +32,9 @@ struct ugb_hwreg;
 struct ugb_gpu;
 struct ugb_timer;
 struct ugb_joypad;
+struct ugb_serial;
+struct ugb_cart;
+struct ugb_history;
 
 typedef struct ugb_gbm
 {
@@ -38,14 +43,27 @@ typedef struct ugb_gbm
     struct ugb_gpu* gpu;
     struct ugb_timer* timer;
     struct ugb_joypad* joypad;
+    struct ugb_serial* serial;
+    struct ugb_cart* cart;
 
     struct ugb_mmu* mmu;
 
+    // Total emulated CPU cycles since the last reset
+    uint64_t cycles;
+
+    // Execution history for reverse debugging, off if null
+    struct ugb_history* history;
+
+#ifdef UGB_PROFILE
+    ugb_prof prof;
+#endif
+
     struct
     {
         struct ugb_mmu_map* bios_map;
         uint8_t* ram0;
         uint8_t* zpage;
+        uint8_t* unused;
     } mem;
 } ugb_gbm;
 
@@ -53,7 +71,11 @@ ugb_gbm* ugb_gbm_create();
 void ugb_gbm_destroy(ugb_gbm* gbm);
 
 int ugb_gbm_reset(ugb_gbm* gbm);
+int ugb_gbm_clear_memory(ugb_gbm* gbm);
+int ugb_gbm_skip_bios(ugb_gbm* gbm);
 int ugb_gbm_step(ugb_gbm* gbm, double* us);
+int ugb_gbm_run_frames(ugb_gbm* gbm, size_t frames);
+int ugb_gbm_run_cycles(ugb_gbm* gbm, uint64_t cycles);
 
 int ugb_gbm_bdreg_hook(struct ugb_hwreg* reg, void* cookie);
 
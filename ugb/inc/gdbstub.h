@@ -0,0 +1,93 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __UGB_GDBSTUB_H__
+#define __UGB_GDBSTUB_H__
+
+#include "gbm.h"
+
+#include <stdint.h>
+
+// GDB remote serial protocol server, on a localhost TCP port or a Unix
+//   socket, for one debugger session at a time. It drives the machine
+//   itself: while GDB lets it run, instructions are stepped in a tight
+//   loop only testing a breakpoint bitmap, and the socket is only polled
+//   (for GDB's interrupt) once per UGB_GDBSTUB_POLL_CYCLES.
+// Registers are AF, BC, DE, HL, SP and PC (0 to 5), 16 bits each, and
+//   described to GDB as a gbz80 target. Breakpoints of both kinds go in
+//   the bitmap, watchpoints are MMU traps on the pages they cover.
+//
+//   $ ugb-headless -g 1234 game.gb
+//   (gdb) target remote :1234
+
+#define UGB_GDBSTUB_PACKET_SZ  0x4000
+#define UGB_GDBSTUB_POLL_CYCLES 70224
+#define UGB_GDBSTUB_MAX_WATCHES 16
+
+#define UGB_GDBSTUB_BREAKMAP_SZ (0x10000 / 8)
+
+typedef struct ugb_gdbstub_watch
+{
+    uint16_t addr;
+    uint16_t len;
+    // GDB's Z type, 2 for writes, 3 for reads and 4 for both
+    int type;
+} ugb_gdbstub_watch;
+
+typedef struct ugb_gdbstub
+{
+    ugb_gbm* gbm;
+
+    int listen_fd;
+    int fd;
+    // Unix socket to remove when done, null for TCP
+    char* path;
+
+    int no_ack;
+    int signal;
+
+    uint8_t breakmap[UGB_GDBSTUB_BREAKMAP_SZ];
+
+    ugb_gdbstub_watch watches[UGB_GDBSTUB_MAX_WATCHES];
+    size_t watch_count;
+    // MMU trap of the watchpoints, -1 when there are none
+    int trap;
+    // Set by the trap during the last instruction, type is zero if none
+    ugb_gdbstub_watch watch_hit;
+    // Memory written by GDB doesn't hit the watchpoints
+    int poking;
+
+    // Received bytes not handled yet
+    uint8_t rx[4096];
+    size_t rx_pos;
+    size_t rx_len;
+
+    // Binary data can hold null bytes, so the length is kept too
+    char packet[UGB_GDBSTUB_PACKET_SZ + 1];
+    size_t packet_len;
+    char reply[UGB_GDBSTUB_PACKET_SZ + 1];
+} ugb_gdbstub;
+
+// Listen on "port" (localhost only) or on a Unix socket at that path
+ugb_gdbstub* ugb_gdbstub_create(ugb_gbm* gbm, const char* where);
+void ugb_gdbstub_destroy(ugb_gdbstub* stub);
+
+// Wait for GDB, then do what it says until it detaches or kills us, the
+//   machine being stopped in between
+int ugb_gdbstub_serve(ugb_gdbstub* stub);
+
+#endif // __UGB_GDBSTUB_H__
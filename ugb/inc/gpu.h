@@ -30,6 +30,18 @@ typedef struct ugb_gpu
     size_t clock;
     size_t mode_clocks[4];
 
+    // Number of frames completed so far (incremented when entering VBlank)
+    size_t frames;
+
+    // When set, scanlines are not drawn to the framebuffer but LY / STAT
+    //   timings are still emulated
+    int skip_render;
+
+    // Called each time a frame is complete, right when entering VBlank
+    //   (the framebuffer is then stable until the next frame starts)
+    int(*vblank_hook)(struct ugb_gpu*, void*);
+    void* vblank_cookie;
+
     uint8_t* framebuf;
     uint8_t* vram;
     uint8_t* oam;
@@ -41,6 +53,8 @@ void ugb_gpu_destroy(ugb_gpu* gpu);
 int ugb_gpu_reset(ugb_gpu* gpu);
 int ugb_gpu_step(ugb_gpu* gpu, size_t cycles);
 
+int ugb_gpu_set_vblank_hook(ugb_gpu* gpu, int(*hook)(ugb_gpu*, void*), void* cookie);
+
 int ugb_gpu_lyc_hook(struct ugb_hwreg* reg, void* cookie);
 
 #endif // __GBM_GPU_H__
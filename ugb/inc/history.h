@@ -0,0 +1,94 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __UGB_HISTORY_H__
+#define __UGB_HISTORY_H__
+
+#include "gbm.h"
+#include "snapshot.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+// Execution history for reverse debugging, recorded by ugb_gbm_step
+//   once attached as gbm->history.
+// It is a ring of in-memory snapshots, one taken every interval cycles,
+//   and a log of the joypad changes in between. The machine being
+//   deterministic given its input, any earlier instruction boundary the
+//   ring still covers is reached by restoring the closest snapshot
+//   before it and running forward from there.
+// Positions count the instructions started since the history was reset,
+//   the joypad changes logged at a position being part of its state.
+//   Resetting the machine or loading an older state starts it over.
+
+#define UGB_HISTORY_INTERVAL  100000
+#define UGB_HISTORY_SNAPSHOTS 64
+
+typedef struct ugb_history_snapshot
+{
+    uint64_t step;
+    ugb_gbm_snapshot state;
+} ugb_history_snapshot;
+
+typedef struct ugb_history_input
+{
+    uint64_t step;
+    uint8_t buttons;
+} ugb_history_input;
+
+typedef struct ugb_history
+{
+    ugb_gbm* gbm;
+    uint64_t step;
+
+    // Snapshot ring, oldest at first
+    uint64_t interval;
+    uint64_t next_cycles;
+    ugb_history_snapshot* snaps;
+    size_t max_snaps;
+    size_t first;
+    size_t count;
+
+    // Joypad changes since the oldest snapshot, in order
+    ugb_history_input* inputs;
+    size_t input_count;
+    size_t input_capacity;
+    uint8_t buttons;
+} ugb_history;
+
+ugb_history* ugb_history_create(ugb_gbm* gbm, uint64_t interval, size_t snapshots);
+void ugb_history_destroy(ugb_history* hist);
+
+// Forget everything, starting over from the current state
+int ugb_history_reset(ugb_history* hist);
+
+// Called before each instruction
+int ugb_history_record(ugb_history* hist);
+
+// Earliest position that can still be gone back to
+uint64_t ugb_history_oldest(const ugb_history* hist);
+
+// Go back to an earlier position, what came after it is forgotten
+int ugb_history_seek(ugb_history* hist, uint64_t step);
+
+// Go back to the latest position before the given one where match()
+//   holds, it being called at each position with after_step set unless
+//   it's a snapshot being restored. Goes to the oldest position and
+//   returns UGB_ERR_NOENT when there is none.
+int ugb_history_find(ugb_history* hist, uint64_t before, int(*match)(void*, int), void* cookie);
+
+#endif // __UGB_HISTORY_H__
@@ -0,0 +1,101 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_LOCKSTEP_H__
+#define __UGB_LOCKSTEP_H__
+
+#include <stdint.h>
+#include <unistd.h>
+
+// Experimental interpreter running many copies of the same ROM in
+//   lockstep, for batches that only differ by their inputs.
+// The lanes' registers and memory are laid out as structures of
+//   arrays. All the lanes sitting at the same PC execute the same
+//   instruction in one pass over the arrays : when every lane takes
+//   part the loop has no per-lane test, and GCC vectorizes it for the
+//   register and ALU opcodes at -O3 (check with -fopt-info-vec, memory
+//   accesses stay scalar). Once they diverge each group of lanes is
+//   run on its own, down to a single lane.
+// Lanes only have a CPU, their own memory from 0x8000 up and a
+//   joypad. There is no GPU, timer nor any interrupt source (HALTed
+//   lanes sleep until the end of the run), and the ROM is mapped as
+//   is, without MBC.
+
+// Cold per-lane CPU state, named after the ugb_cpu fields so that
+//   the opcode definitions work on it unchanged
+typedef struct ugb_lockstep_cpu
+{
+    uint8_t state;
+    uint8_t ei_delayed;
+    uint8_t repeat_next_byte;
+} ugb_lockstep_cpu;
+
+typedef struct ugb_lockstep
+{
+    size_t lanes;
+
+    // ROM image shared by every lane, owned by the caller
+    uint8_t const* rom;
+    size_t rom_size;
+
+    // One array per register, indexed by lane
+    uint16_t* af;
+    uint16_t* bc;
+    uint16_t* de;
+    uint16_t* hl;
+    uint16_t* sp;
+    uint16_t* pc;
+    uint8_t* ie;
+    ugb_lockstep_cpu* cpu;
+
+    uint64_t* cycles;
+    uint8_t* buttons;
+
+    // Error that stopped each lane, if any
+    int* err;
+
+    // Memory from 0x8000 up, interleaved so that the same address
+    //   of every lane is contiguous : mem[(addr - 0x8000) * lanes + lane]
+    uint8_t* mem;
+
+    // Lanes taking part in the current instruction
+    uint8_t* active;
+
+    // Some lanes have an EI to complete
+    int ei_pending;
+
+    // Instructions executed over all lanes, and how many passes
+    //   (one per group of lanes sharing a PC) it took
+    uint64_t instructions;
+    uint64_t groups;
+} ugb_lockstep;
+
+ugb_lockstep* ugb_lockstep_create(size_t lanes);
+void ugb_lockstep_destroy(ugb_lockstep* ls);
+
+// Clears the lanes and sets them up as left by the BIOS
+int ugb_lockstep_reset(ugb_lockstep* ls);
+int ugb_lockstep_load(ugb_lockstep* ls, uint8_t const* rom, size_t size);
+
+int ugb_lockstep_set_buttons(ugb_lockstep* ls, size_t lane, uint8_t buttons);
+
+// Run every lane for this many more cycles. Lanes hitting an error
+//   stop there (see ls->err), the others go on.
+int ugb_lockstep_run(ugb_lockstep* ls, uint64_t cycles);
+
+#endif // __UGB_LOCKSTEP_H__
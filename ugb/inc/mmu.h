@@ -23,6 +23,13 @@
 
 #include "gbm.h"
 
+// Dirty page tracking granularity, one bit per page of the address space
+#define UGB_MMU_PAGE_SHIFT 8
+#define UGB_MMU_PAGES      (0x10000 >> UGB_MMU_PAGE_SHIFT)
+
+// Independent trap handlers (debugger, coverage, ...)
+#define UGB_MMU_MAX_TRAPS  4
+
 enum
 {
     UGB_MMU_NONE,
@@ -34,7 +41,9 @@ enum
 enum
 {
     UGB_MMU_READ,
-    UGB_MMU_WRITE
+    UGB_MMU_WRITE,
+    // Instruction fetches, only reported to traps (maps see reads)
+    UGB_MMU_FETCH
 };
 
 typedef struct ugb_mmu_map
@@ -42,6 +51,10 @@ typedef struct ugb_mmu_map
     uint16_t low_addr;
     uint16_t high_addr;
 
+    // Where writes are accounted in the dirty bitmap, only differs
+    //   from low_addr for mirrors
+    uint16_t dirty_addr;
+
     int type;
     union
     {
@@ -55,16 +68,47 @@ typedef struct ugb_mmu_map
         } soft;
     };
 
+    // Optional handler for writes to UGB_MMU_RODATA maps, which
+    //   fail otherwise (cartridge MBC registers live under the ROM)
+    struct
+    {
+        int (*handler)(void*, int, uint16_t, uint8_t*);
+        void* cookie;
+    } ro_write;
+
     struct ugb_mmu_map* prev;
     struct ugb_mmu_map* next;
 } ugb_mmu_map;
 
+typedef struct ugb_mmu_trap
+{
+    int (*handler)(void*, int, uint16_t, uint8_t);
+    void* cookie;
+    uint8_t pages[UGB_MMU_PAGES / 8];
+} ugb_mmu_trap;
+
 typedef struct ugb_mmu
 {
     ugb_gbm* gbm;
 
     ugb_mmu_map* maps;
     ugb_mmu_map* last_map;
+
+    // Pages written through UGB_MMU_DATA maps since the last clear.
+    // The epoch changes on each clear, so that a consumer can tell
+    //   whether the bitmap is still relative to its own checkpoint.
+    // Several consumers may need it, track_dirty counts them.
+    int track_dirty;
+    uint64_t dirty_epoch;
+    uint8_t dirty[UGB_MMU_PAGES / 8];
+
+    // Accesses to trapped pages are reported to the trap handlers, once
+    //   reads are done (with the value read) or before writes happen
+    //   (with the value to be written). Each handler only gets its own
+    //   pages, trapped holds them all so that other accesses only cost
+    //   a bit test.
+    ugb_mmu_trap traps[UGB_MMU_MAX_TRAPS];
+    uint8_t trapped[UGB_MMU_PAGES / 8];
 } ugb_mmu;
 
 ugb_mmu* ugb_mmu_create(ugb_gbm* gbm);
@@ -79,5 +123,33 @@ ugb_mmu_map* ugb_mmu_resolve_map(ugb_mmu* mmu, uint16_t addr);
 
 int ugb_mmu_read(ugb_mmu* mmu, uint16_t addr, uint8_t* data);
 int ugb_mmu_write(ugb_mmu* mmu, uint16_t addr, uint8_t data);
+// Same as a read, for the CPU to fetch instructions
+int ugb_mmu_fetch(ugb_mmu* mmu, uint16_t addr, uint8_t* data);
+
+// Read without triggering traps, for inspection (soft maps are still
+//   called, so it's only side effect free for memory maps)
+int ugb_mmu_peek(ugb_mmu* mmu, uint16_t addr, uint8_t* data);
+
+// Each call enabling the tracking must be matched by one disabling it
+int ugb_mmu_track_dirty(ugb_mmu* mmu, int enable);
+int ugb_mmu_clear_dirty(ugb_mmu* mmu);
+int ugb_mmu_mark_dirty(ugb_mmu* mmu, uint16_t low_addr, uint16_t high_addr);
+
+// Traps are designated by the index returned when adding them
+int ugb_mmu_add_trap(ugb_mmu* mmu, int (*handler)(void*, int, uint16_t, uint8_t), void* cookie);
+int ugb_mmu_remove_trap(ugb_mmu* mmu, int trap);
+int ugb_mmu_clear_traps(ugb_mmu* mmu, int trap);
+int ugb_mmu_trap_range(ugb_mmu* mmu, int trap, uint16_t low_addr, uint16_t high_addr);
+
+static inline int ugb_mmu_page_dirty(ugb_mmu const* mmu, unsigned page)
+{
+    return mmu->dirty[page >> 3] & (1 << (page & 7));
+}
+
+static inline int ugb_mmu_page_trapped(ugb_mmu const* mmu, uint16_t addr)
+{
+    unsigned page = addr >> UGB_MMU_PAGE_SHIFT;
+    return mmu->trapped[page >> 3] & (1 << (page & 7));
+}
 
 #endif // __UGB_MMU_H__
@@ -35,10 +35,14 @@ typedef struct ugb_opcode
     int(*microcode)(struct ugb_cpu*, uint8_t[], size_t*);
 } ugb_opcode;
 
-extern ugb_opcode ugb_opcodes_table[];
-extern ugb_opcode ugb_opcodes_tableCB[];
+extern const ugb_opcode ugb_opcodes_table[0x100];
+extern const ugb_opcode ugb_opcodes_tableCB[0x100];
 
 ssize_t ugb_read_opcode(uint8_t* buf, ugb_gbm* gbm, uint16_t addr);
 ssize_t ugb_disassemble(char* str, size_t size, uint8_t* code, ssize_t addr);
 
+// Destination of the jumps, calls and RSTs having a constant one, or a
+//   negative error for other instructions (JP (HL) included)
+ssize_t ugb_opcode_target(uint8_t const* code, uint16_t addr);
+
 #endif // __UGB_OPCODES_H__
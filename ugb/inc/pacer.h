@@ -0,0 +1,72 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_PACER_H__
+#define __UGB_PACER_H__
+
+#include <stdint.h>
+
+// Maximum deviation from the nominal rate allowed to the rate control
+#define UGB_PACER_MAX_SKEW 0.005
+
+enum
+{
+    UGB_PACER_FREE,  // Fixed nominal rate
+    UGB_PACER_AUDIO, // Rate follows the audio buffer fill level
+    UGB_PACER_VSYNC  // Rate locks onto the host refresh rate
+};
+
+typedef struct ugb_pacer_stats
+{
+    uint64_t ticks;
+    uint64_t missed;
+    uint64_t jitter_sum_ns;
+    uint64_t jitter_max_ns;
+} ugb_pacer_stats;
+
+typedef struct ugb_pacer
+{
+    int mode;
+
+    // Nominal tick period, and the busy-wait tail used to hit
+    //   deadlines more precisely than the scheduler does
+    uint64_t period_ns;
+    uint64_t spin_ns;
+
+    // Current rate adjustment factor (> 1 runs faster)
+    double rate;
+
+    // Next absolute deadline on CLOCK_MONOTONIC
+    uint64_t deadline_ns;
+
+    ugb_pacer_stats stats;
+} ugb_pacer;
+
+ugb_pacer* ugb_pacer_create(double freq);
+void ugb_pacer_destroy(ugb_pacer* pacer);
+
+int ugb_pacer_reset(ugb_pacer* pacer);
+int ugb_pacer_wait(ugb_pacer* pacer);
+int ugb_pacer_resync(ugb_pacer* pacer);
+
+int ugb_pacer_audio_feedback(ugb_pacer* pacer, double fill);
+int ugb_pacer_vsync_feedback(ugb_pacer* pacer, double host_freq);
+
+uint64_t ugb_pacer_now();
+
+#endif // __UGB_PACER_H__
@@ -0,0 +1,70 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_PROF_H__
+#define __UGB_PROF_H__
+
+#include <stdint.h>
+#include <signal.h>
+
+// Statistical per-component profiling, only built in with UGB_PROFILE.
+// Components only record which of them is currently running (a single
+//   store on entry and exit), a SIGPROF timer samples that periodically.
+
+#define UGB_PROF_DEFAULT_HZ 1000
+
+enum
+{
+    UGB_PROF_OTHER,
+    UGB_PROF_CPU,
+    UGB_PROF_MMU,
+    UGB_PROF_GPU,
+    UGB_PROF_TIMER,
+
+    UGB_PROF_SIZE
+};
+
+typedef struct ugb_prof
+{
+    volatile sig_atomic_t current;
+    volatile uint64_t hits[UGB_PROF_SIZE];
+} ugb_prof;
+
+void ugb_prof_reset(ugb_prof* prof);
+int ugb_prof_start(ugb_prof* prof, int hz);
+int ugb_prof_stop(ugb_prof* prof);
+uint64_t ugb_prof_clock();
+
+// Total number of samples taken
+uint64_t ugb_prof_total(const ugb_prof* prof);
+
+#ifdef UGB_PROFILE
+
+#define UGB_PROF_BEGIN(prof, slot) \
+    sig_atomic_t _prof_prev_ ## slot = (prof)->current; \
+    (prof)->current = (slot)
+#define UGB_PROF_END(prof, slot) (prof)->current = _prof_prev_ ## slot
+
+#else
+
+#define UGB_PROF_BEGIN(prof, slot)
+#define UGB_PROF_END(prof, slot)
+
+#endif
+
+#endif // __UGB_PROF_H__
@@ -0,0 +1,96 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_PROFILER_H__
+#define __UGB_PROFILER_H__
+
+#include "gbm.h"
+#include "symbols.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Guest code profiling, only built in with UGB_GUEST_PROFILER (prof.h is
+//   about the emulator itself).
+//
+// Emulated cycles are accumulated per instruction address into a flat
+//   array indexed by ROM offset, followed by the non-ROM 0x8000-0xFFFF
+//   range. They are also charged to the current call stack, which is
+//   tracked by the CALL, RST, RET and interrupt microcode: each distinct
+//   stack is a node of a call tree, children being found by hashing.
+// A RET pops every frame whose return address is at or below SP, so that
+//   code dropping return addresses from the stack doesn't derail it.
+
+#define UGB_PROFILER_MAX_DEPTH 128
+#define UGB_PROFILER_ROOT      0
+
+typedef struct ugb_profiler_node
+{
+    uint32_t parent;
+    // Callee, as bank << 16 | address
+    uint32_t func;
+    uint64_t cycles;
+    uint64_t calls;
+} ugb_profiler_node;
+
+typedef struct ugb_profiler_frame
+{
+    uint32_t node;
+    uint16_t sp;
+} ugb_profiler_frame;
+
+typedef struct ugb_profiler
+{
+    ugb_gbm* gbm;
+
+    uint64_t* flat;
+    size_t flat_rom;
+    size_t flat_size;
+
+    ugb_profiler_node* nodes;
+    size_t node_count;
+    size_t node_capacity;
+
+    // Open addressing, 0 is free as the root is nobody's child
+    uint32_t* children;
+    size_t children_mask;
+
+    uint32_t current;
+    ugb_profiler_frame stack[UGB_PROFILER_MAX_DEPTH];
+    size_t depth;
+    uint64_t overflows;
+} ugb_profiler;
+
+// Attaches to the machine's CPU, the cartridge has to be loaded already
+ugb_profiler* ugb_profiler_create(ugb_gbm* gbm);
+void ugb_profiler_destroy(ugb_profiler* prof);
+void ugb_profiler_reset(ugb_profiler* prof);
+
+// Hooks, called from the CPU with PC and SP as they are after the jump
+//   for calls and before popping for returns
+void ugb_profiler_call(ugb_profiler* prof, uint16_t pc, uint16_t sp);
+void ugb_profiler_ret(ugb_profiler* prof, uint16_t sp);
+void ugb_profiler_charge(ugb_profiler* prof, uint32_t node, uint16_t pc, size_t cycles);
+
+// Flat profile, most expensive addresses first, at most limit lines (or
+//   all of them if 0)
+int ugb_profiler_write_flat(ugb_profiler* prof, FILE* f, const ugb_symbols* syms, size_t limit);
+// Collapsed stacks ("a;b;c cycles" lines) as taken by flamegraph.pl
+int ugb_profiler_write_stacks(ugb_profiler* prof, FILE* f, const ugb_symbols* syms);
+
+#endif // __UGB_PROFILER_H__
@@ -0,0 +1,81 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_REWIND_H__
+#define __UGB_REWIND_H__
+
+#include "gbm.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+// Rewind history, a fixed-size ring of save states.
+// Only the latest state is kept whole, each ring entry is the XOR of
+//   two consecutive states, run-length encoded. Going back undoes the
+//   deltas one by one, starting from the most recent.
+// When the ring is full the oldest entries are dropped.
+
+typedef struct ugb_rewind_entry
+{
+    uint32_t offset;
+    uint32_t len;
+} ugb_rewind_entry;
+
+typedef struct ugb_rewind
+{
+    ugb_gbm* gbm;
+
+    // Capture one state every this many emulated frames
+    size_t interval;
+    size_t last_frame;
+
+    // Latest state (valid if has_head), and the new one being captured
+    size_t state_size;
+    uint8_t* head;
+    uint8_t* scratch;
+    int has_head;
+
+    // Encoded deltas, the index is a ring too (oldest at first)
+    uint8_t* ring;
+    size_t ring_size;
+    size_t ring_pos;
+
+    ugb_rewind_entry* entries;
+    size_t max_entries;
+    size_t first;
+    size_t count;
+    size_t used;
+} ugb_rewind;
+
+ugb_rewind* ugb_rewind_create(ugb_gbm* gbm, size_t budget, size_t interval);
+void ugb_rewind_destroy(ugb_rewind* rw);
+
+int ugb_rewind_reset(ugb_rewind* rw);
+
+// To be called after each emulated frame, captures as needed
+int ugb_rewind_update(ugb_rewind* rw);
+int ugb_rewind_capture(ugb_rewind* rw);
+
+// Load the latest captured state and forget it, UGB_ERR_NOENT
+//   when there's nothing left
+int ugb_rewind_step_back(ugb_rewind* rw);
+
+// Number of states that can be stepped back to
+size_t ugb_rewind_depth(ugb_rewind* rw);
+
+#endif // __UGB_REWIND_H__
@@ -23,7 +23,7 @@
 
 #include "constants.h"
 
-static uint8_t ugb_rom_bios[UGB_BIOS_SZ] =
+static const uint8_t ugb_rom_bios[UGB_BIOS_SZ] =
 {
     0x31, 0xfe, 0xff, 0xaf, 0x21, 0xff, 0x9f, 0x32, 0xcb, 0x7c, 0x20, 0xfb, 0x21, 0x26, 0xff, 0x0e,
     0x11, 0x3e, 0x80, 0x32, 0xe2, 0x0c, 0x3e, 0xf3, 0xe2, 0x32, 0x3e, 0x77, 0x77, 0x3e, 0xfc, 0xe0,
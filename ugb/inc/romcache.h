@@ -0,0 +1,55 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_ROMCACHE_H__
+#define __UGB_ROMCACHE_H__
+
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// A ROM image mapped read-only and shared with every other user
+//   of the same file, never modify it (the pages are PROT_READ)
+typedef struct ugb_rom
+{
+    uint8_t const* data;
+    size_t size;
+
+    // Files are identified by device and inode, so that different
+    //   paths to the same image still share the mapping
+    dev_t dev;
+    ino_t ino;
+    size_t refs;
+
+    struct ugb_rom* next;
+} ugb_rom;
+
+typedef struct ugb_romcache
+{
+    pthread_mutex_t lock;
+    ugb_rom* roms;
+} ugb_romcache;
+
+ugb_romcache* ugb_romcache_create();
+void ugb_romcache_destroy(ugb_romcache* cache);
+
+int ugb_romcache_open(ugb_romcache* cache, const char* path, ugb_rom** rom);
+int ugb_romcache_close(ugb_romcache* cache, ugb_rom* rom);
+
+#endif // __UGB_ROMCACHE_H__
@@ -0,0 +1,52 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GBM_SERIAL_H__
+#define __GBM_SERIAL_H__
+
+#include "gbm.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+#define UGB_SERIAL_BUF_SZ 4096
+
+typedef struct ugb_serial
+{
+    ugb_gbm* gbm;
+
+    // Bytes sent on the link port, only the first ones are
+    //   kept if the buffer overflows
+    uint8_t out[UGB_SERIAL_BUF_SZ];
+    size_t len;
+    size_t dropped;
+
+    // Optional sink called for each byte sent
+    int(*sink)(uint8_t, void*);
+    void* cookie;
+} ugb_serial;
+
+ugb_serial* ugb_serial_create(ugb_gbm* gbm);
+void ugb_serial_destroy(ugb_serial* serial);
+
+int ugb_serial_reset(ugb_serial* serial);
+int ugb_serial_set_sink(ugb_serial* serial, int(*sink)(uint8_t, void*), void* cookie);
+
+int ugb_serial_sc_hook(struct ugb_hwreg* reg, void* cookie);
+
+#endif // __GBM_SERIAL_H__
@@ -0,0 +1,82 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_SNAPSHOT_H__
+#define __UGB_SNAPSHOT_H__
+
+#include "gbm.h"
+#include "cpu.h"
+#include "hwio.h"
+#include "cart.h"
+#include "constants.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+// In-memory image of a whole GBM, meant to be kept around by the
+//   caller (no allocation is done when saving or restoring).
+// This is not a serialization format, it is only valid for the
+//   process (and build) that created it.
+// With dirty page tracking enabled in the MMU, saving and restoring
+//   only copy the pages written since the snapshot was last synced
+//   with the same GBM (banked cartridge RAM is always copied whole).
+// It must be zeroed before its first use.
+typedef struct ugb_gbm_snapshot
+{
+    // GBM and MMU dirty epoch this snapshot was last synced with
+    ugb_gbm const* base;
+    uint64_t epoch;
+
+    struct
+    {
+        uint8_t regs[UGB_REGS_SIZE];
+        int state;
+        int ei_delayed;
+        int repeat_next_byte;
+    } cpu;
+
+    uint8_t hwio[UGB_HWIO_REG_SIZE];
+
+    uint8_t vram[UGB_VRAM_SZ];
+    uint8_t oam[UGB_OAM_SZ];
+    uint8_t ram0[UGB_RAM0_SZ];
+    uint8_t zpage[UGB_ZPAGE_SZ];
+    uint8_t cram[UGB_CART_RAM_MAX_SZ];
+    ugb_mbc mbc;
+
+    struct
+    {
+        size_t clock;
+        size_t frames;
+    } gpu;
+
+    struct
+    {
+        size_t clock0;
+        size_t clock1;
+    } timer;
+
+    uint8_t buttons;
+    int bios_enabled;
+    uint64_t cycles;
+} ugb_gbm_snapshot;
+
+int ugb_gbm_snapshot_save(ugb_gbm* gbm, ugb_gbm_snapshot* snap);
+int ugb_gbm_snapshot_restore(ugb_gbm* gbm, ugb_gbm_snapshot* snap);
+
+#endif // __UGB_SNAPSHOT_H__
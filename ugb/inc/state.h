@@ -0,0 +1,50 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_STATE_H__
+#define __UGB_STATE_H__
+
+#include "gbm.h"
+
+#include <stdint.h>
+#include <unistd.h>
+
+// Save states are a small header followed by a list of chunks :
+//
+//   header: "uGBS" | u16 version | u16 chunk count
+//   chunk:  4-char tag | u32 payload length | payload
+//
+// All integers are little-endian. Unknown chunks are skipped when
+//   loading, chunks missing from the state leave the corresponding
+//   part of the machine untouched.
+// Bump the version for any change in the layout of an existing chunk.
+
+#define UGB_STATE_MAGIC   "uGBS"
+#define UGB_STATE_VERSION 1
+
+// Size of a state of this machine, to size buffers. It depends on
+//   the external RAM of the loaded cartridge.
+size_t ugb_gbm_state_size(ugb_gbm* gbm);
+
+// Returns the number of bytes written, or an error code
+ssize_t ugb_gbm_save_state(ugb_gbm* gbm, uint8_t* buf, size_t size);
+
+// The state is entirely validated before touching the machine
+int ugb_gbm_load_state(ugb_gbm* gbm, const uint8_t* buf, size_t size);
+
+#endif // __UGB_STATE_H__
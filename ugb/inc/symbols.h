@@ -0,0 +1,62 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_SYMBOLS_H__
+#define __UGB_SYMBOLS_H__
+
+#include <stdint.h>
+#include <unistd.h>
+
+// Symbol tables as written by rgblink -n, one "BB:AAAA Name" per line,
+//   or the symbols listed under each section of rgblink -m map files.
+// Bank numbers only matter for ROMX (0x4000-0x7FFF) addresses, all the
+//   others are looked up in bank 0.
+
+typedef struct ugb_symbol
+{
+    uint16_t bank;
+    uint16_t addr;
+    char* name;
+} ugb_symbol;
+
+typedef struct ugb_symbols
+{
+    // Sorted by bank then address, so that lookups are binary searches
+    ugb_symbol* list;
+    size_t count;
+    size_t capacity;
+
+    // Pointers into the list, sorted by name
+    const ugb_symbol** by_name;
+} ugb_symbols;
+
+ugb_symbols* ugb_symbols_create();
+void ugb_symbols_destroy(ugb_symbols* syms);
+
+// Add the symbols from a .sym or .map file, returns how many were read
+ssize_t ugb_symbols_load(ugb_symbols* syms, const char* path);
+int ugb_symbols_add(ugb_symbols* syms, uint16_t bank, uint16_t addr, const char* name);
+
+// Closest symbol at or before addr in the same bank and memory region
+const ugb_symbol* ugb_symbols_lookup(const ugb_symbols* syms, uint16_t bank, uint16_t addr);
+const ugb_symbol* ugb_symbols_find(const ugb_symbols* syms, const char* name);
+
+// Write "Name" or "Name+off", or "BB:AAAA" when there's no symbol
+int ugb_symbols_format(const ugb_symbols* syms, uint16_t bank, uint16_t addr, char* str, size_t size);
+
+#endif // __UGB_SYMBOLS_H__
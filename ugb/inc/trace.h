@@ -0,0 +1,87 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_TRACE_H__
+#define __UGB_TRACE_H__
+
+#include "gbm.h"
+#include "opcodes.h"
+
+#include <stdint.h>
+
+// Execution traces are written to a memory-mapped file used as a ring
+//   buffer of fixed-width records, one per executed instruction (taken
+//   right before it runs). The file is a header page followed by the
+//   records, and can be decoded offline with ugb-trace.
+
+#define UGB_TRACE_MAGIC     0x54424755 // "UGBT"
+#define UGB_TRACE_VERSION   1
+#define UGB_TRACE_HEADER_SZ 4096
+
+typedef struct ugb_trace_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t pad;
+
+    // Ring size (a power of two) and number of records ever written
+    uint64_t capacity;
+    uint64_t count;
+} ugb_trace_header;
+
+typedef struct ugb_trace_record
+{
+    uint64_t cycles;
+    uint16_t pc;
+    // ROMX bank, even when running from elsewhere
+    uint16_t bank;
+    uint16_t af;
+    uint16_t bc;
+    uint16_t de;
+    uint16_t hl;
+    uint16_t sp;
+    uint8_t ie;
+    uint8_t size;
+    uint8_t code[4];
+    uint8_t pad[4];
+} ugb_trace_record;
+
+typedef struct ugb_trace
+{
+    ugb_gbm* gbm;
+
+    size_t size;
+    ugb_trace_header* header;
+    ugb_trace_record* records;
+    uint64_t mask;
+} ugb_trace;
+
+// Create the file and start tracing the machine's CPU, the number of
+//   records is rounded up to a power of two
+ugb_trace* ugb_trace_create(ugb_gbm* gbm, const char* path, size_t records);
+// Map an existing trace file for reading
+ugb_trace* ugb_trace_open(const char* path);
+void ugb_trace_destroy(ugb_trace* trace);
+
+int ugb_trace_step(ugb_trace* trace, uint16_t pc, const ugb_opcode* opcode, uint8_t const* imm);
+
+// Records still in the ring are the last capacity ones, others are null
+const ugb_trace_record* ugb_trace_get(ugb_trace* trace, uint64_t index);
+
+#endif // __UGB_TRACE_H__
@@ -0,0 +1,99 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __UGB_H__
+#define __UGB_H__
+
+// Embedding API of the emulator, built as bin/libugb.a and bin/libugb.so.
+// This header is self-contained : the machine is an opaque handle and only
+//   plain C types cross the boundary, so that it is easy to bind from other
+//   languages. Only the functions declared here are exported by the shared
+//   library.
+// Functions returning an int return 0 on success and a negative error code
+//   otherwise, see ugb_error_string().
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UGB_API_VERSION 1
+
+#define UGB_API __attribute__((visibility("default")))
+
+// Framebuffer geometry, one RGB332 byte per pixel
+#define UGB_SCREEN_W 160
+#define UGB_SCREEN_H 144
+
+// Bits for ugb_set_input()
+enum
+{
+    UGB_BUTTON_RIGHT  = (0x01 << 0),
+    UGB_BUTTON_LEFT   = (0x01 << 1),
+    UGB_BUTTON_UP     = (0x01 << 2),
+    UGB_BUTTON_DOWN   = (0x01 << 3),
+
+    UGB_BUTTON_A      = (0x01 << 4),
+    UGB_BUTTON_B      = (0x01 << 5),
+    UGB_BUTTON_SELECT = (0x01 << 6),
+    UGB_BUTTON_START  = (0x01 << 7)
+};
+
+typedef struct ugb ugb;
+
+// Version of this API the library was built with, to be checked
+//   against UGB_API_VERSION when loading it dynamically
+UGB_API int ugb_api_version(void);
+UGB_API const char* ugb_error_string(int err);
+
+UGB_API ugb* ugb_create(void);
+UGB_API void ugb_destroy(ugb* gb);
+
+// The ROM is copied, the buffer can be released right after this call.
+// The machine is then reset, starting from the BIOS.
+UGB_API int ugb_load_rom(ugb* gb, const void* rom, size_t size);
+UGB_API int ugb_reset(ugb* gb, int skip_bios);
+
+// Run until the next VBlank
+UGB_API int ugb_run_frame(ugb* gb);
+UGB_API int ugb_run_frames(ugb* gb, size_t frames);
+
+// Buttons held from now on, as an OR of UGB_BUTTON_* values
+UGB_API void ugb_set_input(ugb* gb, uint8_t buttons);
+
+// The machine's own framebuffer, UGB_SCREEN_W * UGB_SCREEN_H bytes.
+// It stays valid as long as the handle, and is updated in place while
+//   running (it's complete right after ugb_run_frame returns).
+UGB_API const uint8_t* ugb_framebuffer(ugb* gb);
+
+UGB_API size_t ugb_frame_count(ugb* gb);
+UGB_API uint64_t ugb_cycle_count(ugb* gb);
+
+// Save states, in the same format as the frontend and the tools
+UGB_API size_t ugb_state_size(ugb* gb);
+UGB_API ssize_t ugb_save_state(ugb* gb, void* buf, size_t size);
+UGB_API int ugb_load_state(ugb* gb, const void* buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __UGB_H__
@@ -0,0 +1,346 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "batch.h"
+#include "gbm.h"
+#include "gpu.h"
+#include "joypad.h"
+#include "serial.h"
+#include "cart.h"
+#include "state.h"
+#include "constants.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+static uint64_t _now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t ugb_batch_hash(uint8_t const* data, size_t size)
+{
+    // 64-bit FNV-1a
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; ++i)
+    {
+        h ^= data[i];
+        h *= 0x100000001B3ULL;
+    }
+
+    return h;
+}
+
+/******************/
+/*** Job queues ***/
+/******************/
+
+static int _pop(ugb_batch_worker* w, size_t* job)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->head != w->tail)
+    {
+        *job = w->queue[w->head++];
+        found = 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return found;
+}
+
+// Take the back half of some other worker's queue, run the first
+//   stolen job right away and keep the rest
+static int _steal(ugb_batch_worker* w, size_t* job)
+{
+    ugb_batch* batch = w->batch;
+
+    for (int i = 1; i < batch->threads; ++i)
+    {
+        ugb_batch_worker* victim = &batch->workers[(w->index + i) % batch->threads];
+
+        // Both queues are locked while the jobs move, always in the same
+        //   order so that two workers stealing from each other can't
+        //   deadlock, otherwise the victim could reuse its slots first
+        ugb_batch_worker* first = w->index < victim->index ? w : victim;
+        ugb_batch_worker* second = first == w ? victim : w;
+        pthread_mutex_lock(&first->lock);
+        pthread_mutex_lock(&second->lock);
+
+        size_t left = victim->tail - victim->head;
+        size_t take = (left + 1) / 2;
+        size_t from = victim->tail - take;
+
+        // Our own queue is empty, it's safe to reuse it from the start
+        if (take)
+        {
+            victim->tail = from;
+
+            *job = victim->queue[from];
+            memcpy(&w->queue[0], &victim->queue[from + 1], (take - 1) * sizeof(size_t));
+            w->head = 0;
+            w->tail = take - 1;
+            w->stolen += take;
+        }
+
+        pthread_mutex_unlock(&second->lock);
+        pthread_mutex_unlock(&first->lock);
+
+        if (take)
+            return 1;
+    }
+
+    return 0;
+}
+
+/***************/
+/*** Workers ***/
+/***************/
+
+static void _set_buttons(ugb_gbm* gbm, uint8_t buttons)
+{
+    ugb_joypad_release(gbm->joypad, ~buttons);
+    ugb_joypad_press(gbm->joypad, buttons);
+}
+
+static int _run_job(ugb_batch_worker* w, ugb_batch_job* job)
+{
+    ugb_gbm* gbm = w->gbm;
+    ugb_batch_result* res = &job->result;
+
+    // Power the machine up again with the new cartridge
+    int err;
+    if ((err = ugb_cart_load(gbm->cart, job->rom, job->rom_size)) != UGB_ERR_OK ||
+        (err = ugb_gbm_clear_memory(gbm)) != UGB_ERR_OK ||
+        (err = job->skip_bios ? ugb_gbm_skip_bios(gbm) : ugb_gbm_reset(gbm)) != UGB_ERR_OK)
+        return err;
+
+    _set_buttons(gbm, 0);
+
+    // Run up to the next input change each time
+    size_t next = 0;
+    size_t frame = 0;
+    while (frame < job->frames)
+    {
+        while (next < job->inputs_count && job->inputs[next].frame <= frame)
+            _set_buttons(gbm, job->inputs[next++].buttons);
+
+        size_t until = job->frames;
+        if (next < job->inputs_count && job->inputs[next].frame < until)
+            until = job->inputs[next].frame;
+
+        if ((err = ugb_gbm_run_frames(gbm, until - frame)) != UGB_ERR_OK)
+            break;
+        frame = until;
+    }
+
+    res->frames = frame;
+    res->cycles = gbm->cycles;
+    res->framebuf_hash = ugb_batch_hash(gbm->gpu->framebuf, UGB_GPU_SCREEN_W * UGB_GPU_SCREEN_H);
+
+    // States grow with the cartridge RAM
+    size_t state_size = ugb_gbm_state_size(gbm);
+    if (state_size > w->state_size)
+    {
+        uint8_t* state = realloc(w->state, state_size);
+        if (state)
+        {
+            w->state = state;
+            w->state_size = state_size;
+        }
+    }
+
+    ssize_t len = ugb_gbm_save_state(gbm, w->state, w->state_size);
+    res->state_hash = len > 0 ? ugb_batch_hash(w->state, len) : 0;
+
+    res->serial_len = gbm->serial->len < UGB_BATCH_SERIAL_SZ ? gbm->serial->len : UGB_BATCH_SERIAL_SZ;
+    memcpy(&res->serial[0], &gbm->serial->out[0], res->serial_len);
+
+    int unload_err = ugb_cart_unload(gbm->cart);
+    return err != UGB_ERR_OK ? err : unload_err;
+}
+
+static void* _worker_main(void* cookie)
+{
+    ugb_batch_worker* w = (ugb_batch_worker*) cookie;
+    ugb_batch* batch = w->batch;
+
+    if (batch->pin)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->index % CPU_SETSIZE, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    size_t index;
+    while (_pop(w, &index) || _steal(w, &index))
+    {
+        ugb_batch_job* job = &batch->jobs[index];
+
+        uint64_t start = _now();
+        job->result.err = _run_job(w, job);
+        job->result.ns = _now() - start;
+    }
+
+    return 0;
+}
+
+/******************/
+/*** Public API ***/
+/******************/
+
+ugb_batch* ugb_batch_create(int threads, int pin)
+{
+    if (threads < 0)
+        return 0;
+
+    if (!threads)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? cores : 1;
+    }
+
+    ugb_batch* batch = malloc(sizeof(ugb_batch));
+    if (!batch)
+        return 0;
+
+    memset(batch, 0, sizeof(ugb_batch));
+    batch->threads = threads;
+    batch->pin = pin;
+
+    if (!(batch->workers = malloc(threads * sizeof(ugb_batch_worker))))
+    {
+        free(batch);
+        return 0;
+    }
+    memset(batch->workers, 0, threads * sizeof(ugb_batch_worker));
+
+    // Machines are created once and for all
+    for (int i = 0; i < threads; ++i)
+    {
+        ugb_batch_worker* w = &batch->workers[i];
+        w->batch = batch;
+        w->index = i;
+        pthread_mutex_init(&w->lock, 0);
+
+        if (!(w->gbm = ugb_gbm_create()))
+            goto fail;
+
+        w->state_size = ugb_gbm_state_size(w->gbm);
+        if (!(w->state = malloc(w->state_size)))
+            goto fail;
+    }
+
+    return batch;
+
+fail:
+    ugb_batch_destroy(batch);
+    return 0;
+}
+
+void ugb_batch_destroy(ugb_batch* batch)
+{
+    if (batch)
+    {
+        for (int i = 0; i < batch->threads; ++i)
+        {
+            ugb_batch_worker* w = &batch->workers[i];
+
+            pthread_mutex_destroy(&w->lock);
+            free(w->queue);
+            free(w->state);
+            ugb_gbm_destroy(w->gbm);
+        }
+
+        free(batch->workers);
+        free(batch);
+    }
+}
+
+int ugb_batch_run(ugb_batch* batch, ugb_batch_job* jobs, size_t count)
+{
+    if (!batch || (!jobs && count))
+        return UGB_ERR_BADARGS;
+
+    batch->jobs = jobs;
+    batch->count = count;
+    memset(&batch->stats, 0, sizeof(ugb_batch_stats));
+
+    // Any queue may end up holding half of any other
+    for (int i = 0; i < batch->threads; ++i)
+    {
+        ugb_batch_worker* w = &batch->workers[i];
+
+        free(w->queue);
+        if (!(w->queue = malloc((count + 1) * sizeof(size_t))))
+            return UGB_ERR_MALLOC;
+
+        w->head = 0;
+        w->tail = 0;
+        w->stolen = 0;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        ugb_batch_worker* w = &batch->workers[i % batch->threads];
+        w->queue[w->tail++] = i;
+    }
+
+    uint64_t start = _now();
+
+    int started = 0;
+    for (; started < batch->threads; ++started)
+    {
+        ugb_batch_worker* w = &batch->workers[started];
+        if (pthread_create(&w->thread, 0, &_worker_main, (void*) w) != 0)
+            break;
+    }
+
+    // If some threads could not be started, the others steal their jobs
+    for (int i = 0; i < started; ++i)
+        pthread_join(batch->workers[i].thread, 0);
+
+    if (!started)
+        return UGB_ERR_MALLOC;
+
+    ugb_batch_stats* stats = &batch->stats;
+    stats->ns = _now() - start;
+    stats->jobs = count;
+
+    for (int i = 0; i < batch->threads; ++i)
+        stats->stolen += batch->workers[i].stolen;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        stats->failed += jobs[i].result.err != UGB_ERR_OK;
+        stats->cycles += jobs[i].result.cycles;
+        stats->frames += jobs[i].result.frames;
+    }
+
+    return UGB_ERR_OK;
+}
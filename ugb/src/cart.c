@@ -0,0 +1,430 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cart.h"
+#include "mmu.h"
+#include "cfg.h"
+#include "constants.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/********************/
+/*** Bank mapping ***/
+/********************/
+
+// Disabled external RAM reads back as 0xFF and ignores writes
+static int _ram_off_handler(void* cookie, int op, uint16_t offset, uint8_t* data)
+{
+    if (op == UGB_MMU_READ)
+        *data = 0xFF;
+
+    return UGB_ERR_OK;
+}
+
+// MBC3 clock registers, mapped in place of the RAM
+static int _rtc_handler(void* cookie, int op, uint16_t offset, uint8_t* data)
+{
+    ugb_cart* cart = (ugb_cart*) cookie;
+    uint8_t* reg = &cart->mbc.rtc[cart->mbc.ram_bank - 0x08];
+
+    if (op == UGB_MMU_READ)
+        *data = *reg;
+    else
+        *reg = *data;
+
+    return UGB_ERR_OK;
+}
+
+size_t ugb_cart_romx_bank(ugb_cart const* cart)
+{
+    if (!cart || !cart->rom_banks)
+        return 0;
+
+    ugb_mbc const* mbc = &cart->mbc;
+
+    size_t bank = mbc->rom_bank;
+    if (cart->mbc_type == UGB_MBC_MBC1)
+        bank |= mbc->ram_bank << 5;
+    else if (cart->mbc_type == UGB_MBC_NONE)
+        bank = 1;
+
+    return bank % cart->rom_banks;
+}
+
+int ugb_cart_update_maps(ugb_cart* cart)
+{
+    if (!cart)
+        return UGB_ERR_BADARGS;
+
+    ugb_mbc* mbc = &cart->mbc;
+
+    /*** ROM banks ***/
+
+    if (cart->rom)
+    {
+        size_t bankx = ugb_cart_romx_bank(cart);
+
+        // The MBC1 upper bits also apply to ROM0 in the second mode
+        size_t bank0 = 0;
+        if (cart->mbc_type == UGB_MBC_MBC1 && mbc->mode)
+            bank0 = (mbc->ram_bank << 5) % cart->rom_banks;
+
+        cart->rom0_map->rodata = cart->rom + bank0 * UGB_CART_ROM0_SZ;
+        cart->romx_map->rodata = cart->rom + bankx * UGB_CART_ROMX_SZ;
+
+        // Images smaller than 32K only get what they have mapped
+        size_t avail = cart->rom_size - bankx * UGB_CART_ROMX_SZ;
+        if (cart->rom_size <= UGB_CART_ROM0_SZ)
+            cart->romx_map->type = UGB_MMU_NONE;
+        else
+            cart->romx_map->high_addr = UGB_CART_ROMX_LO + (avail < UGB_CART_ROMX_SZ ? avail : UGB_CART_ROMX_SZ) - 1;
+    }
+
+    /*** RAM banks ***/
+
+    ugb_mmu_map* map = cart->ram_map;
+
+    if (cart->mbc_type == UGB_MBC_NONE)
+    {
+        // Always there
+        map->type = UGB_MMU_DATA;
+        map->data = cart->ram;
+    }
+    else if (!mbc->ram_enable)
+    {
+        map->type = UGB_MMU_SOFT;
+        map->soft.handler = &_ram_off_handler;
+        map->soft.cookie = cart;
+    }
+    else if (cart->mbc_type == UGB_MBC_MBC3 && mbc->ram_bank >= 0x08 && mbc->ram_bank <= 0x0C)
+    {
+        map->type = UGB_MMU_SOFT;
+        map->soft.handler = &_rtc_handler;
+        map->soft.cookie = cart;
+    }
+    else
+    {
+        size_t bank = mbc->ram_bank;
+        if (cart->mbc_type == UGB_MBC_MBC1 && !mbc->mode)
+            bank = 0;
+
+        bank %= cart->ram_size / UGB_CART_RAM_SZ;
+
+        map->type = UGB_MMU_DATA;
+        map->data = cart->ram + bank * UGB_CART_RAM_SZ;
+    }
+
+    return UGB_ERR_OK;
+}
+
+ssize_t ugb_cart_rom_offset(ugb_cart* cart, uint16_t addr)
+{
+    if (!cart || !cart->rom)
+        return UGB_ERR_BADARGS;
+
+    // Images smaller than ROM0 don't fill the whole area
+    ugb_mmu_map* map = 0;
+    if (addr <= cart->rom0_map->high_addr)
+        map = cart->rom0_map;
+    else if (addr <= UGB_CART_ROM0_HI)
+        return UGB_ERR_MMU_MAP;
+    else if (addr <= cart->romx_map->high_addr && cart->romx_map->type != UGB_MMU_NONE)
+        map = cart->romx_map;
+    else
+        return UGB_ERR_MMU_MAP;
+
+    // The BIOS is mapped over the start of ROM0 until it's done
+    ugb_mmu_map* bios = cart->gbm->mem.bios_map;
+    if (bios->type != UGB_MMU_NONE && addr >= bios->low_addr && addr <= bios->high_addr)
+        return UGB_ERR_MMU_MAP;
+
+    return (map->rodata - cart->rom) + (addr - map->low_addr);
+}
+
+struct ugb_cfg* ugb_cart_cfg(ugb_cart* cart)
+{
+    if (!cart || !cart->rom)
+        return 0;
+
+    // Walking a big image takes a while, and few users need it
+    if (!cart->cfg)
+        cart->cfg = ugb_cfg_create(cart->rom, cart->rom_size);
+
+    return cart->cfg;
+}
+
+/*********************/
+/*** MBC registers ***/
+/*********************/
+
+static int _mbc_write(ugb_cart* cart, uint16_t addr, uint8_t value)
+{
+    ugb_mbc* mbc = &cart->mbc;
+
+    // Every controller has the RAM enable register first
+    if (addr < 0x2000)
+    {
+        mbc->ram_enable = (value & 0x0F) == 0x0A;
+        return ugb_cart_update_maps(cart);
+    }
+
+    switch (cart->mbc_type)
+    {
+        case UGB_MBC_MBC1:
+            if (addr < 0x4000)
+                mbc->rom_bank = (value & 0x1F) ? (value & 0x1F) : 1;
+            else if (addr < 0x6000)
+                mbc->ram_bank = value & 0x03;
+            else
+                mbc->mode = value & 0x01;
+            break;
+
+        case UGB_MBC_MBC3:
+            if (addr < 0x4000)
+            {
+                mbc->rom_bank = (value & 0x7F) ? (value & 0x7F) : 1;
+            }
+            else if (addr < 0x6000)
+            {
+                mbc->ram_bank = value;
+            }
+            else
+            {
+                // Latching (writing 0 then 1) is a no-op as long as
+                //   the clock doesn't tick
+                mbc->rtc_latch = value;
+            }
+            break;
+
+        case UGB_MBC_MBC5:
+            if (addr < 0x3000)
+                mbc->rom_bank = (mbc->rom_bank & 0x100) | value;
+            else if (addr < 0x4000)
+                mbc->rom_bank = (mbc->rom_bank & 0xFF) | ((value & 0x01) << 8);
+            else if (addr < 0x6000)
+                mbc->ram_bank = value & 0x0F;
+            break;
+
+        // Cartridges without MBC just ignore writes to the ROM
+        default:
+            return UGB_ERR_OK;
+    }
+
+    return ugb_cart_update_maps(cart);
+}
+
+static int _rom0_write_handler(void* cookie, int op, uint16_t offset, uint8_t* data)
+{
+    return _mbc_write((ugb_cart*) cookie, UGB_CART_ROM0_LO + offset, *data);
+}
+
+static int _romx_write_handler(void* cookie, int op, uint16_t offset, uint8_t* data)
+{
+    return _mbc_write((ugb_cart*) cookie, UGB_CART_ROMX_LO + offset, *data);
+}
+
+/**********************/
+/*** Header parsing ***/
+/**********************/
+
+static int _parse_header(uint8_t const* rom, size_t size, int* mbc_type, size_t* ram_size)
+{
+    if (size <= UGB_CART_RAMSZ_ADDR)
+        return UGB_ERR_BADCART;
+
+    int has_ram = 0;
+    switch (rom[UGB_CART_TYPE_ADDR])
+    {
+        case 0x00:                         *mbc_type = UGB_MBC_NONE; break;
+        case 0x08: case 0x09: has_ram = 1; *mbc_type = UGB_MBC_NONE; break;
+        case 0x01:                         *mbc_type = UGB_MBC_MBC1; break;
+        case 0x02: case 0x03: has_ram = 1; *mbc_type = UGB_MBC_MBC1; break;
+        case 0x0F: case 0x11:              *mbc_type = UGB_MBC_MBC3; break;
+        case 0x10: case 0x12: case 0x13:
+                              has_ram = 1; *mbc_type = UGB_MBC_MBC3; break;
+        case 0x19: case 0x1C:              *mbc_type = UGB_MBC_MBC5; break;
+        case 0x1A: case 0x1B: case 0x1D: case 0x1E:
+                              has_ram = 1; *mbc_type = UGB_MBC_MBC5; break;
+
+        default:
+            return UGB_ERR_BADCART;
+    }
+
+    // Banked images must be made of whole banks
+    if (*mbc_type != UGB_MBC_NONE && size % UGB_CART_ROMX_SZ)
+        return UGB_ERR_BADCART;
+
+    static const size_t ram_sizes[] = { 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+    uint8_t code = rom[UGB_CART_RAMSZ_ADDR];
+    size_t ram = has_ram && code < sizeof(ram_sizes) / sizeof(ram_sizes[0]) ? ram_sizes[code] : 0;
+
+    // There has always been 8K of RAM, keep at least that
+    *ram_size = ram > UGB_CART_RAM_SZ ? ram : UGB_CART_RAM_SZ;
+
+    return UGB_ERR_OK;
+}
+
+/******************/
+/*** Public API ***/
+/******************/
+
+ugb_cart* ugb_cart_create(ugb_gbm* gbm)
+{
+    if (!gbm || !gbm->mmu)
+        return 0;
+
+    ugb_cart* cart = malloc(sizeof(ugb_cart));
+    if (!cart)
+        return 0;
+
+    memset(cart, 0, sizeof(ugb_cart));
+    cart->gbm = gbm;
+    cart->ram_size = UGB_CART_RAM_SZ;
+
+    if (!(cart->ram = malloc(cart->ram_size)) ||
+        !(cart->rom0_map = ugb_mmu_map_create(UGB_CART_ROM0_LO, UGB_CART_ROM0_HI)) ||
+        !(cart->romx_map = ugb_mmu_map_create(UGB_CART_ROMX_LO, UGB_CART_ROMX_HI)) ||
+        !(cart->ram_map = ugb_mmu_map_create(UGB_CART_RAM_LO, UGB_CART_RAM_HI)))
+    {
+        free(cart->romx_map);
+        free(cart->rom0_map);
+        free(cart->ram);
+        free(cart);
+        return 0;
+    }
+
+    memset(cart->ram, 0, cart->ram_size);
+
+    // ROM writes go to the MBC
+    cart->rom0_map->ro_write.handler = &_rom0_write_handler;
+    cart->rom0_map->ro_write.cookie = cart;
+    cart->romx_map->ro_write.handler = &_romx_write_handler;
+    cart->romx_map->ro_write.cookie = cart;
+
+    // The RAM is always there, the ROM maps are only added once
+    //   an image is loaded
+    ugb_cart_reset(cart);
+    ugb_mmu_add_map(gbm->mmu, cart->ram_map);
+
+    return cart;
+}
+
+void ugb_cart_destroy(ugb_cart* cart)
+{
+    if (cart)
+    {
+        // Maps added to the MMU are owned by it
+        if (!cart->rom)
+        {
+            free(cart->rom0_map);
+            free(cart->romx_map);
+        }
+
+        ugb_cfg_destroy(cart->cfg);
+        free(cart->ram);
+        free(cart);
+    }
+}
+
+int ugb_cart_reset(ugb_cart* cart)
+{
+    if (!cart)
+        return UGB_ERR_BADARGS;
+
+    // External RAM is usually battery-backed, keep it as is,
+    //   only the controller goes back to its power-on state
+    memset(&cart->mbc, 0, sizeof(ugb_mbc));
+    cart->mbc.rom_bank = 1;
+
+    return ugb_cart_update_maps(cart);
+}
+
+int ugb_cart_load(ugb_cart* cart, uint8_t const* rom, size_t size)
+{
+    if (!cart || !rom || !size)
+        return UGB_ERR_BADARGS;
+
+    int err;
+    if ((err = ugb_cart_unload(cart)) != UGB_ERR_OK)
+        return err;
+
+    int mbc_type;
+    size_t ram_size;
+    if ((err = _parse_header(rom, size, &mbc_type, &ram_size)) != UGB_ERR_OK)
+        return err;
+
+    if (ram_size != cart->ram_size)
+    {
+        uint8_t* ram = realloc(cart->ram, ram_size);
+        if (!ram)
+            return UGB_ERR_MALLOC;
+
+        cart->ram = ram;
+        cart->ram_size = ram_size;
+    }
+    memset(cart->ram, 0, cart->ram_size);
+    ugb_mmu_mark_dirty(cart->gbm->mmu, UGB_CART_RAM_LO, UGB_CART_RAM_HI);
+
+    cart->rom = rom;
+    cart->rom_size = size;
+    cart->rom_banks = (size + UGB_CART_ROMX_SZ - 1) / UGB_CART_ROMX_SZ;
+    cart->mbc_type = mbc_type;
+
+    // Both ROM areas are read-only views of the (shared) image
+    cart->rom0_map->high_addr = UGB_CART_ROM0_LO + (size < UGB_CART_ROM0_SZ ? size : UGB_CART_ROM0_SZ) - 1;
+    cart->rom0_map->type = UGB_MMU_RODATA;
+    cart->romx_map->high_addr = UGB_CART_ROMX_HI;
+    cart->romx_map->type = UGB_MMU_RODATA;
+
+    if ((err = ugb_cart_reset(cart)) != UGB_ERR_OK ||
+        (err = ugb_mmu_add_map(cart->gbm->mmu, cart->rom0_map)) != UGB_ERR_OK ||
+        (err = ugb_mmu_add_map(cart->gbm->mmu, cart->romx_map)) != UGB_ERR_OK)
+    {
+        return err;
+    }
+
+    return UGB_ERR_OK;
+}
+
+int ugb_cart_unload(ugb_cart* cart)
+{
+    if (!cart)
+        return UGB_ERR_BADARGS;
+
+    if (!cart->rom)
+        return UGB_ERR_OK;
+
+    int err;
+    if ((err = ugb_mmu_remove_map(cart->gbm->mmu, cart->rom0_map)) != UGB_ERR_OK ||
+        (err = ugb_mmu_remove_map(cart->gbm->mmu, cart->romx_map)) != UGB_ERR_OK)
+    {
+        return err;
+    }
+
+    ugb_cfg_destroy(cart->cfg);
+    cart->cfg = 0;
+
+    cart->rom = 0;
+    cart->rom_size = 0;
+    cart->rom_banks = 0;
+    cart->mbc_type = UGB_MBC_NONE;
+
+    return ugb_cart_reset(cart);
+}
@@ -0,0 +1,469 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cfg.h"
+#include "gbm.h"
+#include "opcodes.h"
+#include "constants.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Grow one of the arrays to hold at least one more element
+static int _reserve(void** list, size_t* capacity, size_t count, size_t elem_size)
+{
+    if (count < *capacity)
+        return UGB_ERR_OK;
+
+    size_t new_capacity = *capacity ? 2 * *capacity : 256;
+    void* new_list = realloc(*list, new_capacity * elem_size);
+    if (!new_list)
+        return UGB_ERR_MALLOC;
+
+    *list = new_list;
+    *capacity = new_capacity;
+
+    return UGB_ERR_OK;
+}
+
+uint16_t ugb_cfg_address(size_t offset)
+{
+    if (offset < UGB_CART_ROM0_SZ)
+        return offset;
+
+    return UGB_CART_ROMX_LO + offset % UGB_CART_ROMX_SZ;
+}
+
+static const ugb_opcode* _decode(const ugb_cfg* cfg, size_t offset)
+{
+    const ugb_opcode* opcode = &ugb_opcodes_table[cfg->rom[offset]];
+    if (cfg->rom[offset] == 0xCB)
+    {
+        if (offset + 1 >= cfg->rom_size)
+            return 0;
+        opcode = &ugb_opcodes_tableCB[cfg->rom[offset + 1]];
+    }
+
+    return opcode->microcode ? opcode : 0;
+}
+
+static int _kind(uint8_t op)
+{
+    switch (op)
+    {
+        case 0xC3: case 0x18:
+            return UGB_CFG_JUMP;
+
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+        case 0x20: case 0x28: case 0x30: case 0x38:
+        case 0xC0: case 0xC8: case 0xD0: case 0xD8:
+            return UGB_CFG_BRANCH;
+
+        case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF:
+        case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+            return UGB_CFG_CALL;
+
+        case 0xC9: case 0xD9:
+            return UGB_CFG_RETURN;
+
+        case 0xE9:
+            return UGB_CFG_INDIRECT;
+    }
+
+    return UGB_CFG_FALL;
+}
+
+// RST $38 into an unused (0xFF-filled) vector calls itself until the
+//   stack wipes everything out, that's a crash rather than a call
+static int _crashes(const ugb_cfg* cfg, size_t offset)
+{
+    return cfg->rom[offset] == 0xFF && cfg->rom_size > 0x38 && cfg->rom[0x38] == 0xFF;
+}
+
+// Offset of addr seen from code at from, bank being what's believed to
+//   be mapped in ROMX
+static ssize_t _resolve(ugb_cfg* cfg, size_t from, uint16_t addr, int bank)
+{
+    size_t offset;
+    if (addr <= UGB_CART_ROM0_HI)
+    {
+        offset = addr;
+    }
+    else if (addr <= UGB_CART_ROMX_HI)
+    {
+        // ROMX code stays in its own bank, small images have only one
+        if (from >= UGB_CART_ROM0_SZ)
+            bank = from / UGB_CART_ROMX_SZ;
+        else if (bank < 0 && cfg->rom_banks <= 2)
+            bank = 1;
+
+        if (bank < 0)
+        {
+            ++cfg->unresolved;
+            return UGB_ERR_NOENT;
+        }
+
+        offset = bank * UGB_CART_ROMX_SZ + addr - UGB_CART_ROMX_LO;
+    }
+    // Code copied to RAM isn't ours to analyse
+    else
+    {
+        return UGB_ERR_NOENT;
+    }
+
+    return offset < cfg->rom_size ? (ssize_t) offset : UGB_ERR_NOENT;
+}
+
+static int _push(ugb_cfg* cfg, size_t offset, int bank)
+{
+    // Jumping into the middle of an instruction is someone else's trick
+    uint8_t flags = cfg->flags[offset];
+    if ((flags & UGB_CFG_CODE) && !(flags & UGB_CFG_HEAD))
+        return UGB_ERR_OK;
+
+    cfg->flags[offset] |= UGB_CFG_TARGET;
+    if (flags & UGB_CFG_CODE)
+        return UGB_ERR_OK;
+
+    int err = _reserve((void**) &cfg->work, &cfg->work_capacity, cfg->work_count, sizeof(ugb_cfg_entry));
+    if (err != UGB_ERR_OK)
+        return err;
+
+    cfg->work[cfg->work_count].offset = offset;
+    cfg->work[cfg->work_count].bank = bank;
+    ++cfg->work_count;
+
+    return UGB_ERR_OK;
+}
+
+// Bank selected by the instruction at offset, given the one before it
+static int _bank_switch(const ugb_cfg* cfg, size_t prev, size_t offset, int bank)
+{
+    uint8_t const* rom = cfg->rom;
+
+    // LD (a16),A then LD (HL),d8
+    uint16_t reg = 0;
+    int value = -1;
+    if (rom[offset] == 0xEA)
+    {
+        reg = rom[offset + 1] | (rom[offset + 2] << 8);
+        if (prev != offset && rom[prev] == 0x3E)
+            value = rom[prev + 1];
+    }
+    else if (rom[offset] == 0x36 && prev != offset && rom[prev] == 0x21)
+    {
+        reg = rom[prev + 1] | (rom[prev + 2] << 8);
+        value = rom[offset + 1];
+    }
+
+    if (reg < 0x2000 || reg > 0x3FFF)
+        return bank;
+
+    if (value < 0)
+        return -1;
+
+    value %= cfg->rom_banks;
+    return value ? value : 1;
+}
+
+// Decode everything reachable from the pending entries
+static int _walk(ugb_cfg* cfg)
+{
+    int err;
+
+    while (cfg->work_count)
+    {
+        ugb_cfg_entry entry = cfg->work[--cfg->work_count];
+        size_t offset = entry.offset;
+        size_t prev = offset;
+        int bank = entry.bank;
+
+        while (offset < cfg->rom_size && !(cfg->flags[offset] & UGB_CFG_CODE))
+        {
+            const ugb_opcode* opcode = _decode(cfg, offset);
+            if (!opcode)
+                break;
+
+            // Instructions don't straddle banks, nor other instructions
+            size_t size = opcode->size;
+            if (offset + size > cfg->rom_size ||
+                offset / UGB_CART_ROMX_SZ != (offset + size - 1) / UGB_CART_ROMX_SZ)
+            {
+                break;
+            }
+
+            size_t i;
+            for (i = 1; i < size && !(cfg->flags[offset + i] & UGB_CFG_CODE); ++i);
+            if (i < size)
+                break;
+
+            cfg->flags[offset] |= UGB_CFG_HEAD;
+            for (i = 0; i < size; ++i)
+                cfg->flags[offset + i] |= UGB_CFG_CODE;
+
+            if (offset < UGB_CART_ROM0_SZ)
+                bank = _bank_switch(cfg, prev, offset, bank);
+
+            if (_crashes(cfg, offset))
+                break;
+
+            ssize_t target = ugb_opcode_target(&cfg->rom[offset], ugb_cfg_address(offset));
+            if (target >= 0 && (target = _resolve(cfg, offset, target, bank)) >= 0)
+            {
+                if ((err = _reserve((void**) &cfg->edges, &cfg->edge_capacity, cfg->edge_count, sizeof(ugb_cfg_edge))) != UGB_ERR_OK ||
+                    (err = _push(cfg, target, bank)) != UGB_ERR_OK)
+                {
+                    return err;
+                }
+
+                cfg->edges[cfg->edge_count].from = offset;
+                cfg->edges[cfg->edge_count].to = target;
+                ++cfg->edge_count;
+            }
+
+            int kind = _kind(cfg->rom[offset]);
+            if (kind == UGB_CFG_JUMP || kind == UGB_CFG_RETURN || kind == UGB_CFG_INDIRECT)
+                break;
+
+            prev = offset;
+            offset += size;
+
+            if (kind != UGB_CFG_FALL && offset < cfg->rom_size)
+                cfg->flags[offset] |= UGB_CFG_BLOCK;
+        }
+    }
+
+    return UGB_ERR_OK;
+}
+
+static int _by_source(const void* a, const void* b)
+{
+    uint32_t fa = ((const ugb_cfg_edge*) a)->from;
+    uint32_t fb = ((const ugb_cfg_edge*) b)->from;
+
+    return (fa > fb) - (fa < fb);
+}
+
+static int32_t _edge(const ugb_cfg* cfg, size_t from)
+{
+    size_t lo = 0;
+    size_t hi = cfg->edge_count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cfg->edges[mid].from < from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo < cfg->edge_count && cfg->edges[lo].from == from ? (int32_t) cfg->edges[lo].to : -1;
+}
+
+// Cut the decoded instructions into blocks, and what's left into data
+static int _build(ugb_cfg* cfg)
+{
+    int err;
+
+    qsort(cfg->edges, cfg->edge_count, sizeof(ugb_cfg_edge), &_by_source);
+    cfg->block_count = 0;
+    cfg->data_count = 0;
+
+    size_t offset = 0;
+    while (offset < cfg->rom_size)
+    {
+        uint8_t const* flags = cfg->flags;
+
+        if (!(flags[offset] & UGB_CFG_HEAD))
+        {
+            size_t start = offset;
+            while (offset < cfg->rom_size && !(flags[offset] & UGB_CFG_CODE))
+                ++offset;
+
+            // Can only be a mid-instruction jump target otherwise
+            if (offset == start)
+            {
+                ++offset;
+                continue;
+            }
+
+            if ((err = _reserve((void**) &cfg->data, &cfg->data_capacity, cfg->data_count, sizeof(ugb_cfg_region))) != UGB_ERR_OK)
+                return err;
+
+            cfg->data[cfg->data_count].start = start;
+            cfg->data[cfg->data_count].end = offset;
+            ++cfg->data_count;
+            continue;
+        }
+
+        if ((err = _reserve((void**) &cfg->blocks, &cfg->block_capacity, cfg->block_count, sizeof(ugb_cfg_block))) != UGB_ERR_OK)
+            return err;
+
+        ugb_cfg_block* block = &cfg->blocks[cfg->block_count++];
+        block->start = offset;
+        block->next = -1;
+        block->target = -1;
+
+        for (;;)
+        {
+            size_t last = offset;
+            offset += _decode(cfg, offset)->size;
+
+            block->kind = _crashes(cfg, last) ? UGB_CFG_STOP : _kind(cfg->rom[last]);
+            if (block->kind != UGB_CFG_FALL)
+            {
+                block->target = _edge(cfg, last);
+                break;
+            }
+
+            // Falling off the bank or into data is as far as we know it goes
+            if (offset >= cfg->rom_size || !(flags[offset] & UGB_CFG_HEAD) || !(offset % UGB_CART_ROMX_SZ))
+            {
+                block->kind = UGB_CFG_STOP;
+                break;
+            }
+
+            if (flags[offset] & (UGB_CFG_TARGET | UGB_CFG_BLOCK))
+                break;
+        }
+
+        block->end = offset;
+        if (block->kind == UGB_CFG_FALL || block->kind == UGB_CFG_BRANCH || block->kind == UGB_CFG_CALL)
+            block->next = offset < cfg->rom_size ? (int32_t) offset : -1;
+    }
+
+    return UGB_ERR_OK;
+}
+
+ugb_cfg* ugb_cfg_create(uint8_t const* rom, size_t size)
+{
+    if (!rom || !size)
+        return 0;
+
+    ugb_cfg* cfg = malloc(sizeof(ugb_cfg));
+    if (!cfg)
+        return 0;
+
+    memset(cfg, 0, sizeof(ugb_cfg));
+    cfg->rom = rom;
+    cfg->rom_size = size;
+    cfg->rom_banks = (size + UGB_CART_ROMX_SZ - 1) / UGB_CART_ROMX_SZ;
+
+    cfg->flags = malloc(size);
+    if (!cfg->flags)
+    {
+        ugb_cfg_destroy(cfg);
+        return 0;
+    }
+    memset(cfg->flags, 0, size);
+
+    // Entry point, RST then interrupt vectors (unless left blank)
+    int err = UGB_ERR_OK;
+    if (size > 0x0100)
+        err = _push(cfg, 0x0100, -1);
+    for (size_t vector = 0x00; vector <= 0x60 && vector < size && err == UGB_ERR_OK; vector += 0x08)
+    {
+        if (!_crashes(cfg, vector))
+            err = _push(cfg, vector, -1);
+    }
+
+    if (err != UGB_ERR_OK ||
+        (err = _walk(cfg)) != UGB_ERR_OK ||
+        (err = _build(cfg)) != UGB_ERR_OK)
+    {
+        ugb_cfg_destroy(cfg);
+        return 0;
+    }
+
+    return cfg;
+}
+
+void ugb_cfg_destroy(ugb_cfg* cfg)
+{
+    if (cfg)
+    {
+        free(cfg->work);
+        free(cfg->edges);
+        free(cfg->data);
+        free(cfg->blocks);
+        free(cfg->flags);
+        free(cfg);
+    }
+}
+
+int ugb_cfg_add_entry(ugb_cfg* cfg, size_t offset, int bank)
+{
+    if (!cfg || offset >= cfg->rom_size)
+        return UGB_ERR_BADARGS;
+
+    uint8_t flags = cfg->flags[offset];
+    if ((flags & UGB_CFG_CODE) && !(flags & UGB_CFG_HEAD))
+        return UGB_ERR_BADARGS;
+
+    if ((flags & UGB_CFG_TARGET) && (flags & UGB_CFG_HEAD))
+        return UGB_ERR_OK;
+
+    int err;
+    if ((err = _push(cfg, offset, bank)) != UGB_ERR_OK ||
+        (err = _walk(cfg)) != UGB_ERR_OK)
+    {
+        return err;
+    }
+
+    // Everything after it may have changed, but it's cheap enough
+    return _build(cfg);
+}
+
+const ugb_cfg_block* ugb_cfg_block_at(const ugb_cfg* cfg, size_t offset)
+{
+    if (!cfg || offset >= cfg->rom_size || !(cfg->flags[offset] & UGB_CFG_CODE))
+        return 0;
+
+    // Last block starting at or before the offset
+    size_t lo = 0;
+    size_t hi = cfg->block_count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cfg->blocks[mid].start <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (!lo || cfg->blocks[lo - 1].end <= offset)
+        return 0;
+
+    return &cfg->blocks[lo - 1];
+}
+
+ssize_t ugb_cfg_head(const ugb_cfg* cfg, size_t offset)
+{
+    if (!cfg || offset >= cfg->rom_size)
+        return UGB_ERR_BADARGS;
+
+    if (!(cfg->flags[offset] & UGB_CFG_CODE))
+        return UGB_ERR_NOENT;
+
+    // Instructions are at most 3 bytes long
+    while (!(cfg->flags[offset] & UGB_CFG_HEAD))
+        --offset;
+
+    return offset;
+}
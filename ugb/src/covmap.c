@@ -0,0 +1,271 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "covmap.h"
+#include "mmu.h"
+#include "cart.h"
+#include "constants.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define UGB_COVMAP_OTHER_SZ 0x10000
+
+static size_t _index(ugb_covmap* cov, int op, uint16_t addr)
+{
+    ugb_cart* cart = cov->gbm->cart;
+
+    if (addr < UGB_CART_RAM_LO)
+    {
+        ssize_t offset;
+        if (op != UGB_MMU_WRITE && (offset = ugb_cart_rom_offset(cart, addr)) >= 0)
+            return offset;
+    }
+    else if (addr <= UGB_CART_RAM_HI)
+    {
+        ugb_mmu_map* map = cart->ram_map;
+        if (map->type == UGB_MMU_DATA && cart->ram)
+            return cov->rom_size + (map->data - cart->ram) + (addr - map->low_addr);
+    }
+
+    return cov->rom_size + cov->ram_size + addr;
+}
+
+static int _trap(void* cookie, int op, uint16_t addr, uint8_t data)
+{
+    ugb_covmap* cov = (ugb_covmap*) cookie;
+
+    int kind = UGB_COVMAP_WRITE;
+    if (op == UGB_MMU_FETCH)
+        kind = UGB_COVMAP_EXEC;
+    else if (op == UGB_MMU_READ)
+        kind = UGB_COVMAP_READ;
+
+    size_t i = _index(cov, op, addr);
+    cov->bits[kind][i >> 3] |= 1 << (i & 7);
+
+    return UGB_ERR_OK;
+}
+
+ugb_covmap* ugb_covmap_create(ugb_gbm* gbm)
+{
+    if (!gbm)
+        return 0;
+
+    ugb_covmap* cov = malloc(sizeof(ugb_covmap));
+    if (!cov)
+        return 0;
+
+    memset(cov, 0, sizeof(ugb_covmap));
+    cov->gbm = gbm;
+    cov->trap = -1;
+    cov->rom_size = gbm->cart->rom_banks * UGB_CART_ROMX_SZ;
+    cov->ram_size = gbm->cart->ram_size;
+    cov->size = cov->rom_size + cov->ram_size + UGB_COVMAP_OTHER_SZ;
+
+    for (int k = 0; k < UGB_COVMAP_KINDS; ++k)
+    {
+        if (!(cov->bits[k] = calloc(cov->size / 8, 1)))
+        {
+            ugb_covmap_destroy(cov);
+            return 0;
+        }
+    }
+
+    if ((cov->trap = ugb_mmu_add_trap(gbm->mmu, &_trap, cov)) < 0 ||
+        ugb_mmu_trap_range(gbm->mmu, cov->trap, 0x0000, 0xFFFF) != UGB_ERR_OK)
+    {
+        ugb_covmap_destroy(cov);
+        return 0;
+    }
+
+    return cov;
+}
+
+void ugb_covmap_destroy(ugb_covmap* cov)
+{
+    if (cov)
+    {
+        if (cov->trap >= 0)
+            ugb_mmu_remove_trap(cov->gbm->mmu, cov->trap);
+
+        for (int k = 0; k < UGB_COVMAP_KINDS; ++k)
+            free(cov->bits[k]);
+
+        free(cov);
+    }
+}
+
+void ugb_covmap_reset(ugb_covmap* cov)
+{
+    if (!cov)
+        return;
+
+    for (int k = 0; k < UGB_COVMAP_KINDS; ++k)
+        memset(cov->bits[k], 0, cov->size / 8);
+}
+
+static int _covered(const ugb_covmap* cov, int kind, size_t i)
+{
+    return cov->bits[kind][i >> 3] & (1 << (i & 7));
+}
+
+size_t ugb_covmap_rom_count(const ugb_covmap* cov, int kind)
+{
+    if (!cov || kind < 0 || kind >= UGB_COVMAP_KINDS)
+        return 0;
+
+    size_t count = 0;
+    for (size_t i = 0; i < cov->rom_size / 8; ++i)
+        count += __builtin_popcount(cov->bits[kind][i]);
+
+    return count;
+}
+
+int ugb_covmap_save(const ugb_covmap* cov, const char* path)
+{
+    if (!cov || !path)
+        return UGB_ERR_BADARGS;
+
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return UGB_ERR_NOENT;
+
+    ugb_covmap_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = UGB_COVMAP_MAGIC;
+    header.version = UGB_COVMAP_VERSION;
+    header.rom_size = cov->rom_size;
+    header.ram_size = cov->ram_size;
+    header.other_size = UGB_COVMAP_OTHER_SZ;
+
+    int ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    for (int k = 0; k < UGB_COVMAP_KINDS && ok; ++k)
+        ok = fwrite(cov->bits[k], 1, cov->size / 8, f) == cov->size / 8;
+
+    ok = !fclose(f) && ok;
+    return ok ? UGB_ERR_OK : UGB_ERR_NOSPACE;
+}
+
+/******************/
+/*** lcov files ***/
+/******************/
+
+static int _rom_symbol(const ugb_symbol* sym)
+{
+    return sym->addr <= UGB_CART_ROMX_HI;
+}
+
+static size_t _rom_offset(const ugb_symbol* sym)
+{
+    if (sym->addr <= UGB_CART_ROM0_HI)
+        return sym->addr;
+
+    // Unbanked 32K images have their second half in bank 0
+    size_t bank = sym->bank ? sym->bank : 1;
+    return bank * UGB_CART_ROMX_SZ + (sym->addr - UGB_CART_ROMX_LO);
+}
+
+// Whether any byte of the label got executed, up to the next label
+//   in the same bank or the end of the bank
+static int _label_hit(const ugb_covmap* cov, const ugb_symbols* syms, size_t i)
+{
+    const ugb_symbol* sym = &syms->list[i];
+    size_t start = _rom_offset(sym);
+    size_t end = (start | (UGB_CART_ROMX_SZ - 1)) + 1;
+
+    if (i + 1 < syms->count && _rom_symbol(&syms->list[i + 1]))
+    {
+        size_t next = _rom_offset(&syms->list[i + 1]);
+        if (next >= start && next < end)
+            end = next;
+    }
+
+    if (end <= start)
+        end = start + 1;
+    if (end > cov->rom_size)
+        end = cov->rom_size;
+
+    for (size_t j = start; j < end; ++j)
+    {
+        if (_covered(cov, UGB_COVMAP_EXEC, j))
+            return 1;
+    }
+
+    return 0;
+}
+
+static int _reported(const ugb_covmap* cov, const ugb_symbol* sym)
+{
+    return _rom_symbol(sym) && _rom_offset(sym) < cov->rom_size;
+}
+
+int ugb_covmap_write_lcov(const ugb_covmap* cov, FILE* f, const ugb_symbols* syms, const char* source)
+{
+    if (!cov || !f || !syms || !source)
+        return UGB_ERR_BADARGS;
+
+    uint8_t* hits = malloc(syms->count ? syms->count : 1);
+    if (!hits)
+        return UGB_ERR_MALLOC;
+
+    for (size_t i = 0; i < syms->count; ++i)
+        hits[i] = _reported(cov, &syms->list[i]) && _label_hit(cov, syms, i);
+
+    fprintf(f, "TN:\nSF:%s\n", source);
+
+    // Functions first, then their hits
+    size_t functions = 0, functions_hit = 0;
+    for (size_t i = 0; i < syms->count; ++i)
+    {
+        const ugb_symbol* sym = &syms->list[i];
+        if (_reported(cov, sym) && !strchr(sym->name, '.'))
+            fprintf(f, "FN:%zu,%s\n", _rom_offset(sym) + 1, sym->name);
+    }
+
+    for (size_t i = 0; i < syms->count; ++i)
+    {
+        const ugb_symbol* sym = &syms->list[i];
+        if (_reported(cov, sym) && !strchr(sym->name, '.'))
+        {
+            fprintf(f, "FNDA:%d,%s\n", hits[i], sym->name);
+            ++functions;
+            functions_hit += hits[i];
+        }
+    }
+
+    fprintf(f, "FNF:%zu\nFNH:%zu\n", functions, functions_hit);
+
+    size_t lines = 0, lines_hit = 0;
+    for (size_t i = 0; i < syms->count; ++i)
+    {
+        const ugb_symbol* sym = &syms->list[i];
+        if (_reported(cov, sym))
+        {
+            fprintf(f, "DA:%zu,%d\n", _rom_offset(sym) + 1, hits[i]);
+            ++lines;
+            lines_hit += hits[i];
+        }
+    }
+
+    fprintf(f, "LF:%zu\nLH:%zu\nend_of_record\n", lines, lines_hit);
+
+    free(hits);
+    return UGB_ERR_OK;
+}
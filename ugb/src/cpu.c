@@ -20,9 +20,12 @@
 #include "mmu.h"
 #include "opcodes.h"
 #include "hwio.h"
+#include "trace.h"
+#include "profiler.h"
 #include "errno.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 
 ugb_cpu* ugb_cpu_create(ugb_gbm* gbm)
@@ -87,8 +90,10 @@ ssize_t ugb_cpu_step(ugb_cpu* cpu, size_t* cycles)
     // Exit HALT even if IME == 0
     if (*hwreg_if & *cpu->regs.IE)
     {
+#ifdef UGB_VERBOSE
         if (cpu->state == UGB_CPU_HALTED)
             printf("Waking up.\n");
+#endif
         cpu->state = UGB_CPU_RUNNING;
     }
 
@@ -100,6 +105,7 @@ ssize_t ugb_cpu_step(ugb_cpu* cpu, size_t* cycles)
             if (!(*hwreg_if & *cpu->regs.IE & (0x01 << line)))
                 continue;
 
+#ifdef UGB_VERBOSE
             const char* intname = 0;
             if ((0x01 << line) & UGB_REG_IE_V_MSK) intname = "VBlank";
             if ((0x01 << line) & UGB_REG_IE_L_MSK) intname = "LCD Stat";
@@ -107,6 +113,7 @@ ssize_t ugb_cpu_step(ugb_cpu* cpu, size_t* cycles)
             if ((0x01 << line) & UGB_REG_IE_X_MSK) intname = "Joypad";
             if (intname)
                 printf("Interrupt #%d (%s)\n", line, intname);
+#endif
 
             // Clear IME
             *cpu->regs.IE &= ~UGB_REG_IE_IME_MSK;
@@ -126,6 +133,11 @@ ssize_t ugb_cpu_step(ugb_cpu* cpu, size_t* cycles)
             // Jump to interrupt vector
             *cpu->regs.PC = 0x0040 + (line << 3);
 
+#ifdef UGB_GUEST_PROFILER
+            if (cpu->profiler)
+                ugb_profiler_call(cpu->profiler, *cpu->regs.PC, *cpu->regs.SP);
+#endif
+
             // Only process one interrupt at a time
             break;
         }
@@ -146,12 +158,20 @@ ssize_t ugb_cpu_step(ugb_cpu* cpu, size_t* cycles)
     }
 
     // Decoded instruction will be placed here
-    ugb_opcode* opcode = 0;
+    const ugb_opcode* opcode = 0;
     uint8_t imm[4];
 
+    // Count the edge from the previous instruction
+    if (cpu->coverage)
+    {
+        ++cpu->coverage[*cpu->regs.PC ^ cpu->coverage_prev];
+        cpu->coverage_prev = *cpu->regs.PC >> 1;
+    }
+
     // Fetch instruction opcode
+    uint16_t pc = *cpu->regs.PC;
     uint8_t op;
-    if ((err = ugb_mmu_read(cpu->gbm->mmu, (*cpu->regs.PC)++, &op)) != UGB_ERR_OK)
+    if ((err = ugb_mmu_fetch(cpu->gbm->mmu, (*cpu->regs.PC)++, &op)) != UGB_ERR_OK)
         return err;
 
     // Handle HALT bug
@@ -172,7 +192,7 @@ ssize_t ugb_cpu_step(ugb_cpu* cpu, size_t* cycles)
         // Get immediate data
         for (int i = 0; i < opcode->size - 1; ++i)
         {
-            if ((err = ugb_mmu_read(cpu->gbm->mmu, (*cpu->regs.PC)++, &imm[i])) != UGB_ERR_OK)
+            if ((err = ugb_mmu_fetch(cpu->gbm->mmu, (*cpu->regs.PC)++, &imm[i])) != UGB_ERR_OK)
                 return err;
         }
     }
@@ -180,7 +200,7 @@ ssize_t ugb_cpu_step(ugb_cpu* cpu, size_t* cycles)
     else
     {
         // Read actual prefixed opcode
-        if ((err = ugb_mmu_read(cpu->gbm->mmu, (*cpu->regs.PC)++, &op)) != UGB_ERR_OK)
+        if ((err = ugb_mmu_fetch(cpu->gbm->mmu, (*cpu->regs.PC)++, &op)) != UGB_ERR_OK)
                 return err;
 
         // Decode
@@ -191,15 +211,29 @@ ssize_t ugb_cpu_step(ugb_cpu* cpu, size_t* cycles)
         // Get immediate data
         for (int i = 0; i < opcode->size - 2; ++i)
         {
-            if ((err = ugb_mmu_read(cpu->gbm->mmu, (*cpu->regs.PC)++, &imm[i])) != UGB_ERR_OK)
+            if ((err = ugb_mmu_fetch(cpu->gbm->mmu, (*cpu->regs.PC)++, &imm[i])) != UGB_ERR_OK)
                 return err;
         }
     }
 
+    // Record the instruction about to run
+    if (cpu->trace)
+        ugb_trace_step(cpu->trace, pc, opcode, imm);
+
+#ifdef UGB_GUEST_PROFILER
+    // Charge the instruction to the call stack it started in
+    uint32_t prof_node = cpu->profiler ? cpu->profiler->current : 0;
+#endif
+
     // Execute instruction
     if ((err = (*opcode->microcode)(cpu, imm, cycles)) != UGB_ERR_OK)
         return err;
 
+#ifdef UGB_GUEST_PROFILER
+    if (cpu->profiler)
+        ugb_profiler_charge(cpu->profiler, prof_node, pc, cycles ? *cycles : 0);
+#endif
+
     return UGB_ERR_OK;
 }
 
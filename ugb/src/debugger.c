@@ -16,12 +16,15 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#define _POSIX_SOURCE
+#define _POSIX_C_SOURCE 200809L
 
 #include "debugger.h"
 #include "cpu.h"
 #include "mmu.h"
 #include "opcodes.h"
+#include "cart.h"
+#include "cfg.h"
+#include "constants.h"
 #include "errno.h"
 
 #include <stdlib.h>
@@ -31,51 +34,60 @@
 #include <readline/readline.h>
 #include <readline/history.h>
 
-static int _breakpoint_id = 1;
-static ugb_breakpoint* _breakpoints = 0;
-static ugb_breakpoint* _last_breakpoint = 0;
-
-static char _quit;
-static ugb_gbm* _gbm;
-static sigjmp_buf _jmpbuf;
-static ugb_debugger_interf* _interf;
+// SIGINT can only be routed to one debugger, the one reading the
+//   terminal (all the other state is per-instance)
+static ugb_debugger* volatile _sigint_target = 0;
 
 static char* _skip_whitespace(char* line);
 static char* _strip_whitespace(char* line);
 static void _handle_signals(int signo);
-static void _com_help(char* args);
-static void _com_quit(char* args);
-static void _com_breakpoint(char* args);
-static void _com_delete(char* args);
-static void _com_info(char* args);
-static void _com_disassemble(char* args);
-static void _com_step(char* args);
-static void _com_continue(char* args);
-static void _com_reset(char* args);
-static void _com_register(char* args);
-static void _com_print(char* args);
+static void _com_help(ugb_debugger* dbg, char* args);
+static void _com_quit(ugb_debugger* dbg, char* args);
+static void _com_breakpoint(ugb_debugger* dbg, char* args);
+static void _com_watch(ugb_debugger* dbg, char* args);
+static void _com_delete(ugb_debugger* dbg, char* args);
+static void _com_info(ugb_debugger* dbg, char* args);
+static void _com_disassemble(ugb_debugger* dbg, char* args);
+static void _com_block(ugb_debugger* dbg, char* args);
+static void _com_step(ugb_debugger* dbg, char* args);
+static void _com_continue(ugb_debugger* dbg, char* args);
+static void _com_record(ugb_debugger* dbg, char* args);
+static void _com_rstep(ugb_debugger* dbg, char* args);
+static void _com_rcontinue(ugb_debugger* dbg, char* args);
+static void _com_reset(ugb_debugger* dbg, char* args);
+static void _com_register(ugb_debugger* dbg, char* args);
+static void _com_print(ugb_debugger* dbg, char* args);
+static void _com_symbols(ugb_debugger* dbg, char* args);
 
 typedef struct ugb_command
 {
     const char* name;
-    void(*func)(char*);
+    void(*func)(ugb_debugger*, char*);
     const char* desc;
 } ugb_command;
 
-static ugb_command _commands[] =
+static const ugb_command _commands[] =
 {
     { "help",        &_com_help,        "Display this text"  },
     { "?",           &_com_help,        "Synonym for \"help\"" },
     { "quit",        &_com_quit,        "Exit the uGB debugger" },
     { "breakpoint",  &_com_breakpoint,  "Add a new breakpoint" },
-    { "delete",      &_com_delete,      "Remove a breakpoint" },
-    { "info",        &_com_info,        "List breakpoints" },
+    { "b",           &_com_breakpoint,  "Synonym for \"breakpoint\"" },
+    { "watch",       &_com_watch,       "Add a watchpoint on [read|write|change|access] to a range" },
+    { "delete",      &_com_delete,      "Remove a breakpoint or a watchpoint" },
+    { "info",        &_com_info,        "List breakpoints and watchpoints" },
     { "disassemble", &_com_disassemble, "Disassemble GB instructions" },
+    { "block",       &_com_block,       "Show the basic block an address is in" },
     { "step",        &_com_step,        "Execute a single GB instruction then pause" },
+    { "s",           &_com_step,        "Synonym for \"step\"" },
     { "continue",    &_com_continue,    "Continue execution until a breakpoint is hit" },
+    { "record",      &_com_record,      "Start or stop recording execution for going back [on|off]" },
+    { "rstep",       &_com_rstep,       "Go back by one (or a given count of) GB instructions" },
+    { "rcontinue",   &_com_rcontinue,   "Go back until a breakpoint or watchpoint is hit" },
     { "reset",       &_com_reset,       "Reset the GBM processor" },
     { "register",    &_com_register,    "Examine registers" },
     { "print",       &_com_print,       "Examine memory contents" },
+    { "symbols",     &_com_symbols,     "Load an RGBDS .sym or .map file" },
     { 0, 0, 0}
 };
 
@@ -90,6 +102,21 @@ char* _skip_whitespace(char* line)
     return line;
 }
 
+void _com_symbols(ugb_debugger* dbg, char* args)
+{
+    if (!args || !*args)
+    {
+        printf("Expecting a symbol file.\n");
+        return;
+    }
+
+    ssize_t count = ugb_debugger_load_symbols(dbg, args);
+    if (count < 0)
+        printf("Error: %s.\n", ugb_strerror(count));
+    else
+        printf("%zd symbols read from \"%s\".\n", count, args);
+}
+
 char* _strip_whitespace(char* line)
 {
     line = _skip_whitespace(line);
@@ -102,45 +129,261 @@ char* _strip_whitespace(char* line)
     return line;
 }
 
+// Parse a symbol name or else an hexadecimal address, bank being only
+//   set for symbols in a ROM bank
+static int _parse_addr(ugb_debugger* dbg, char* str, char** end, uint16_t* addr, int* bank)
+{
+    // Names stop where range expressions go on
+    size_t len = strcspn(str, " \t-+:");
+    if (dbg->symbols && len)
+    {
+        char c = str[len];
+        str[len] = '\0';
+        const ugb_symbol* sym = ugb_symbols_find(dbg->symbols, str);
+        str[len] = c;
+
+        if (sym)
+        {
+            *addr = sym->addr;
+            if (bank && sym->bank)
+                *bank = sym->bank;
+            *end = str + len;
+            return 1;
+        }
+    }
+
+    unsigned long value = (unsigned long) strtol(str, end, 16);
+    if (!*end || *end == str || value > 0xFFFF)
+        return 0;
+
+    *addr = value;
+    return 1;
+}
+
+// Parse "first", "first-last" or "first+size", complaining if invalid
+static int _parse_range(ugb_debugger* dbg, char* args, uint16_t* first, uint16_t* last)
+{
+    // Get start address
+    char* end = 0;
+    if (!_parse_addr(dbg, args, &end, first, 0))
+    {
+        printf("Invalid address \"%s\".\n", args);
+        return 0;
+    }
+
+    *last = *first;
+
+    end = _skip_whitespace(end);
+    if (*end == '-')
+    {
+        char* range = _skip_whitespace(++end);
+        if (!_parse_addr(dbg, range, &end, last, 0))
+        {
+            printf("Invalid address \"%s\".\n", range);
+            return 0;
+        }
+    }
+    else if (*end == '+')
+    {
+        char* size = ++end;
+        unsigned long addr = (unsigned long) strtol(size, &end, 0);
+
+        if (!end || end == size ||
+            addr > 0xFFFF)
+        {
+            printf("Invalid size \"%s\".\n", size);
+            return 0;
+        }
+
+        *last = *first + addr;
+    }
+    else if (*end)
+    {
+        printf("Invalid address range expression \"%s\".\n", args);
+        return 0;
+    }
+
+    if (*last < *first)
+    {
+        printf("Invalid address range expression \"%s\".\n", args);
+        return 0;
+    }
+
+    return 1;
+}
+
 void _handle_signals(int signo)
 {
-    if (signo == SIGINT)
+    ugb_debugger* dbg = _sigint_target;
+
+    if (signo == SIGINT && dbg)
     {
-        (_interf->command)(UGB_CMD_STOP, _interf->cookie);
+        (dbg->interf->command)(UGB_CMD_STOP, dbg->interf->cookie);
 
         printf("Interrupted.\n");
-        _com_disassemble(0);
-        siglongjmp(_jmpbuf, 1);
+        _com_disassemble(dbg, 0);
+        siglongjmp(dbg->jmpbuf, 1);
     }
 }
 
+// Only ROMX is banked as far as breakpoints are concerned
+static int _current_bank(ugb_debugger* dbg, uint16_t addr)
+{
+    if (addr >= UGB_CART_ROMX_LO && addr <= UGB_CART_ROMX_HI)
+        return ugb_cart_romx_bank(dbg->gbm->cart);
+
+    return 0;
+}
+
+// Bank of what's mapped at addr, numbered like in symbol files
+static int _mapped_bank(ugb_debugger* dbg, uint16_t addr)
+{
+    if (addr < UGB_CART_ROMX_LO || addr > UGB_CART_ROMX_HI)
+        return 0;
+
+    ssize_t offset = ugb_cart_rom_offset(dbg->gbm->cart, addr);
+    return offset < 0 ? 0 : offset / UGB_CART_ROMX_SZ;
+}
+
+// " (Name+off)" when there's a symbol for addr, nothing otherwise
+static const char* _describe(ugb_debugger* dbg, int bank, uint16_t addr, char* str, size_t size)
+{
+    str[0] = '\0';
+
+    if (bank == UGB_BREAKPOINT_ANY_BANK)
+        bank = _mapped_bank(dbg, addr);
+
+    if (ugb_symbols_lookup(dbg->symbols, bank, addr))
+    {
+        snprintf(str, size, " (");
+        ugb_symbols_format(dbg->symbols, bank, addr, str + 2, size - 3);
+        strcat(str, ")");
+    }
+
+    return str;
+}
+
+// Variables available to breakpoint conditions
+static const char* const _breakpoint_vars[] = { "hits", 0 };
+
+// Count the hit (unless going backwards) and check the condition of a
+//   breakpoint at PC
+static int _breakpoint_triggers(ugb_debugger* dbg, ugb_breakpoint* bp, int count)
+{
+    if (bp->bank != UGB_BREAKPOINT_ANY_BANK && bp->bank != _current_bank(dbg, bp->addr))
+        return 0;
+
+    if (count)
+        ++bp->hits;
+    if (!bp->cond)
+        return 1;
+
+    // Evaluation errors stop too, so that they can be looked at
+    int32_t vars[1] = { bp->hits };
+    int32_t value = 0;
+    return ugb_expr_eval(bp->cond, dbg->gbm, &vars[0], &value) != UGB_ERR_OK || value;
+}
+
 int _interf_status(int last_cmd, void* cookie)
 {
-    if (last_cmd == UGB_CMD_CONTINUE)
+    ugb_debugger* dbg = (ugb_debugger*) cookie;
+
+    // A watchpoint was hit by the instruction that just ran
+    int pending = dbg->interf->pending;
+    dbg->interf->pending = 0;
+
+    if (last_cmd != UGB_CMD_CONTINUE)
+        return UGB_STS_CONTINUE;
+
+    if (pending)
+        return UGB_STS_STOP;
+
+    // Only called on a bitmap hit, so walking the list is fine
+    uint16_t pc = *dbg->gbm->cpu->regs.PC;
+    for (ugb_breakpoint* bp = dbg->breakpoints; bp; bp = bp->next)
     {
-        ugb_breakpoint* match = 0;
-        for (ugb_breakpoint* bp = _breakpoints; bp; bp = bp->next)
+        if (bp->addr == pc && _breakpoint_triggers(dbg, bp, 1))
         {
-            if (bp->addr == *_gbm->cpu->regs.PC)
-            {
-                match = bp;
-                break;
-            }
-        }
-
-        if (match)
+            dbg->break_hit = bp->id;
             return UGB_STS_STOP;
+        }
     }
 
     return UGB_STS_CONTINUE;
 }
 
-void _com_help(char* args)
+static int _watch_trap(void* cookie, int op, uint16_t addr, uint8_t data)
+{
+    ugb_debugger* dbg = (ugb_debugger*) cookie;
+
+    // Instruction fetches are reads as far as watchpoints go
+    if (op == UGB_MMU_FETCH)
+        op = UGB_MMU_READ;
+
+    for (ugb_watchpoint* wp = dbg->watchpoints; wp; wp = wp->next)
+    {
+        if (addr < wp->low_addr || addr > wp->high_addr)
+            continue;
+
+        // Writes are trapped before they happen
+        uint8_t old = data;
+        if (op == UGB_MMU_WRITE)
+            ugb_mmu_peek(dbg->gbm->mmu, addr, &old);
+
+        if ((op == UGB_MMU_READ && (wp->type & UGB_WATCH_READ)) ||
+            (op == UGB_MMU_WRITE && (wp->type & UGB_WATCH_WRITE)) ||
+            (op == UGB_MMU_WRITE && (wp->type & UGB_WATCH_CHANGE) && old != data))
+        {
+            dbg->watch_hit.id = wp->id;
+            dbg->watch_hit.op = op;
+            dbg->watch_hit.addr = addr;
+            dbg->watch_hit.old = old;
+            dbg->watch_hit.data = data;
+
+            // Stop once the instruction is done
+            dbg->interf->pending = 1;
+            break;
+        }
+    }
+
+    return UGB_ERR_OK;
+}
+
+// Only the pages with watchpoints are trapped, and nothing when there
+//   are none
+static void _update_traps(ugb_debugger* dbg)
+{
+    ugb_mmu* mmu = dbg->gbm->mmu;
+
+    dbg->interf->watching = 0;
+    if (!dbg->watchpoints)
+    {
+        if (dbg->trap >= 0)
+            ugb_mmu_remove_trap(mmu, dbg->trap);
+        dbg->trap = -1;
+        return;
+    }
+
+    if (dbg->trap < 0 && (dbg->trap = ugb_mmu_add_trap(mmu, &_watch_trap, dbg)) < 0)
+    {
+        printf("Error: %s.\n", ugb_strerror(dbg->trap));
+        dbg->trap = -1;
+        return;
+    }
+
+    dbg->interf->watching = 1;
+
+    ugb_mmu_clear_traps(mmu, dbg->trap);
+    for (ugb_watchpoint* wp = dbg->watchpoints; wp; wp = wp->next)
+        ugb_mmu_trap_range(mmu, dbg->trap, wp->low_addr, wp->high_addr);
+}
+
+void _com_help(ugb_debugger* dbg, char* args)
 {
     if (args && *args)
     {
         int found = 0;
-        for (ugb_command* cmd = _commands; cmd->name; ++cmd)
+        for (const ugb_command* cmd = _commands; cmd->name; ++cmd)
         {
             if (!strcmp(cmd->name, args))
             {
@@ -157,19 +400,19 @@ void _com_help(char* args)
     }
     else
     {
-        for (ugb_command* cmd = _commands; cmd->name; ++cmd)
+        for (const ugb_command* cmd = _commands; cmd->name; ++cmd)
         {
             printf("%-10s\t%s.\n", cmd->name, cmd->desc);
         }
     }
 }
 
-void _com_quit(char* args)
+void _com_quit(ugb_debugger* dbg, char* args)
 {
-    _quit = 1;
+    dbg->quit = 1;
 }
 
-void _com_breakpoint(char* args)
+void _com_breakpoint(ugb_debugger* dbg, char* args)
 {
     if (!args || !*args)
     {
@@ -177,32 +420,145 @@ void _com_breakpoint(char* args)
         return;
     }
 
+    // Either addr or bank:addr, then an optional condition
+    char* cond = 0;
+    for (char* c = args; *c; ++c)
+    {
+        if (isspace(*c))
+        {
+            *c = '\0';
+            cond = _skip_whitespace(c + 1);
+            break;
+        }
+    }
+
+    if (cond && (strncmp(cond, "if", 2) || !isspace(cond[2])))
+    {
+        printf("Expecting \"if <condition>\" after the address.\n");
+        return;
+    }
+
+    int bank = UGB_BREAKPOINT_ANY_BANK;
     char* end = 0;
-    unsigned long in_addr = (unsigned long) strtol(args, &end, 16);
+    char* str = args;
+    unsigned long in_bank = (unsigned long) strtol(str, &end, 16);
 
-    if (!end || end == args || *end ||
-        in_addr > 0xFFFF)
+    if (end && end != str && *end == ':')
+    {
+        if (in_bank > 0x1FF)
+        {
+            printf("Invalid bank \"%s\".\n", args);
+            return;
+        }
+
+        bank = in_bank;
+        str = end + 1;
+    }
+
+    // Banked symbols only break in their own bank
+    uint16_t addr = 0;
+    int sym_bank = UGB_BREAKPOINT_ANY_BANK;
+    if (!_parse_addr(dbg, str, &end, &addr, &sym_bank) || *end)
     {
         printf("Invalid address \"%s\".\n", args);
         return;
     }
 
-    uint16_t addr = in_addr;
+    if (bank == UGB_BREAKPOINT_ANY_BANK)
+        bank = sym_bank;
+
+    if (bank != UGB_BREAKPOINT_ANY_BANK && (addr < UGB_CART_ROMX_LO || addr > UGB_CART_ROMX_HI))
+    {
+        printf("Only ROMX addresses are banked.\n");
+        return;
+    }
 
-    for (ugb_breakpoint* bp = _breakpoints; bp; bp = bp->next)
+    for (ugb_breakpoint* bp = dbg->breakpoints; !cond && bp; bp = bp->next)
     {
-        if (bp->addr == addr)
+        if (bp->addr == addr && bp->bank == bank && !bp->cond)
         {
             printf("Breakpoint #%d also set at 0x%04X.\n", bp->id, addr);
             return;
         }
     }
 
-    int id = ugb_debugger_add_breakpoint(addr);
-    printf("Breakpoint #%d set at 0x%04X.\n", id, addr);
+    int id = ugb_debugger_add_breakpoint(dbg, addr, bank);
+    if (id >= 0 && cond)
+    {
+        const char* error_pos = 0;
+        cond = _skip_whitespace(cond + 2);
+
+        int err = ugb_debugger_set_condition(dbg, id, cond, &error_pos);
+        if (err != UGB_ERR_OK)
+        {
+            ugb_debugger_delete_breakpoint(dbg, id);
+
+            if (err == UGB_ERR_BADEXPR && error_pos)
+                printf("Invalid condition at \"%s\".\n", error_pos);
+            else
+                printf("Error: %s.\n", ugb_strerror(err));
+            return;
+        }
+    }
+
+    char name[128];
+    _describe(dbg, bank, addr, name, sizeof(name));
+
+    if (id < 0)
+        printf("Error: %s.\n", ugb_strerror(id));
+    else if (bank == UGB_BREAKPOINT_ANY_BANK)
+        printf("Breakpoint #%d set at 0x%04X%s.\n", id, addr, name);
+    else
+        printf("Breakpoint #%d set at 0x%04X in bank %d%s.\n", id, addr, bank, name);
 }
 
-void _com_delete(char* args)
+void _com_watch(ugb_debugger* dbg, char* args)
+{
+    static const struct
+    {
+        const char* name;
+        int type;
+    } types[] =
+    {
+        { "read",   UGB_WATCH_READ },
+        { "write",  UGB_WATCH_WRITE },
+        { "change", UGB_WATCH_CHANGE },
+        { "access", UGB_WATCH_READ | UGB_WATCH_WRITE },
+        { 0, 0 }
+    };
+
+    if (!args || !*args)
+    {
+        printf("Expecting address range.\n");
+        return;
+    }
+
+    // Writes are watched by default
+    int type = UGB_WATCH_WRITE;
+    for (int i = 0; types[i].name; ++i)
+    {
+        size_t len = strlen(types[i].name);
+        if (!strncmp(args, types[i].name, len) && isspace(args[len]))
+        {
+            type = types[i].type;
+            args = _skip_whitespace(&args[len]);
+            break;
+        }
+    }
+
+    uint16_t first = 0;
+    uint16_t last = 0;
+    if (!_parse_range(dbg, args, &first, &last))
+        return;
+
+    int id = ugb_debugger_add_watchpoint(dbg, first, last, type);
+    if (id < 0)
+        printf("Error: %s.\n", ugb_strerror(id));
+    else
+        printf("Watchpoint #%d set on 0x%04X-0x%04X.\n", id, first, last);
+}
+
+void _com_delete(ugb_debugger* dbg, char* args)
 {
     if (!args || !*args)
     {
@@ -219,162 +575,451 @@ void _com_delete(char* args)
         return;
     }
 
-    int err = ugb_debugger_delete_breakpoint(id);
-
-    if (err == UGB_ERR_NOENT)
-        printf("No breakpoint #%d.\n", id);
-    else
+    // Both share the same ids
+    if (ugb_debugger_delete_breakpoint(dbg, id) == UGB_ERR_OK)
         printf("Removed breakpoint #%d.\n", id);
+    else if (ugb_debugger_delete_watchpoint(dbg, id) == UGB_ERR_OK)
+        printf("Removed watchpoint #%d.\n", id);
+    else
+        printf("No breakpoint or watchpoint #%d.\n", id);
 }
 
-void _com_info(char* args)
+void _com_info(ugb_debugger* dbg, char* args)
 {
-    for (ugb_breakpoint* bp = _breakpoints; bp; bp = bp->next)
+    char name[128];
+
+    for (ugb_breakpoint* bp = dbg->breakpoints; bp; bp = bp->next)
+    {
+        _describe(dbg, bp->bank, bp->addr, name, sizeof(name));
+
+        if (bp->bank == UGB_BREAKPOINT_ANY_BANK)
+            printf("#%2d at 0x%04X%s", bp->id, bp->addr, name);
+        else
+            printf("#%2d at 0x%04X in bank %d%s", bp->id, bp->addr, bp->bank, name);
+
+        if (bp->cond_str)
+            printf(" if %s", bp->cond_str);
+        printf(", hit %u times\n", bp->hits);
+    }
+
+    for (ugb_watchpoint* wp = dbg->watchpoints; wp; wp = wp->next)
     {
-        printf("#%2d at 0x%04X\n", bp->id, bp->addr);
+        _describe(dbg, 0, wp->low_addr, name, sizeof(name));
+
+        printf("#%2d on 0x%04X-0x%04X%s (%s%s%s)\n", wp->id, wp->low_addr, wp->high_addr, name,
+            wp->type & UGB_WATCH_READ ? "r" : "",
+            wp->type & UGB_WATCH_WRITE ? "w" : "",
+            wp->type & UGB_WATCH_CHANGE ? "c" : "");
     }
 }
 
-void _com_disassemble(char* args)
+void _com_disassemble(ugb_debugger* dbg, char* args)
 {
-    uint16_t first = *_gbm->cpu->regs.PC;
+    uint16_t first = *dbg->gbm->cpu->regs.PC;
     uint16_t last = first;
 
-    if (args && *args)
-    {
-        // Get start address
-        char* end = 0;
-        unsigned long addr = (unsigned long) strtol(args, &end, 16);
+    int at_pc = !args || !*args;
+    if (!at_pc && !_parse_range(dbg, args, &first, &last))
+        return;
 
-        if (!end || end == args ||
-            addr > 0xFFFF)
-        {
-            printf("Invalid address \"%s\".\n", args);
-            return;
-        }
+    // What PC points to is code, whether the analysis found it or not
+    ugb_cart* cart = dbg->gbm->cart;
+    ugb_cfg* cfg = ugb_cart_cfg(cart);
+    ssize_t offset = cfg ? ugb_cart_rom_offset(cart, first) : UGB_ERR_NOENT;
+    if (offset >= 0 && (size_t) offset >= cfg->rom_size)
+        offset = UGB_ERR_NOENT;
+    if (offset >= 0 && at_pc)
+        ugb_cfg_add_entry(cfg, offset, ugb_cart_romx_bank(cart));
+
+    // Start at the instruction the address is in and skip over data if
+    //   it's known code, otherwise decode from there as asked
+    ssize_t head = offset >= 0 ? ugb_cfg_head(cfg, offset) : UGB_ERR_NOENT;
+    if (head >= 0)
+        first -= offset - head;
 
-        first = addr;
-        last = first;
+    char str[256];
+    uint8_t data[8];
 
-        end = _skip_whitespace(end);
-        if (*end == '-')
+    uint16_t addr = first;
+    while (addr <= last)
+    {
+        if (dbg->symbols)
         {
-            char* range = ++end;
-            addr = (unsigned long) strtol(range, &end, 16);
+            const ugb_symbol* sym = ugb_symbols_lookup(dbg->symbols, _mapped_bank(dbg, addr), addr);
+            if (sym && sym->addr == addr)
+                printf("%s:\n", sym->name);
+        }
 
-            if (!end || end == range ||
-                addr > 0xFFFF)
+        offset = head >= 0 ? ugb_cart_rom_offset(cart, addr) : UGB_ERR_NOENT;
+        if (offset >= 0 && (size_t) offset < cfg->rom_size && !(cfg->flags[offset] & UGB_CFG_CODE))
+        {
+            // Up to 8 bytes of data per line, in the same ROM area
+            size_t len = 0;
+            size_t pos = snprintf(&str[0], sizeof(str), "db   ");
+            do
             {
-                printf("Invalid address \"%s\".\n", range);
-                return;
+                pos += snprintf(&str[pos], sizeof(str) - pos, "%s$%02X", len ? "," : "", cfg->rom[offset + len]);
+                ++len;
             }
+            while (len < 8 && addr + len <= last && (addr + len) % UGB_CART_ROMX_SZ &&
+                   offset + len < cfg->rom_size && !(cfg->flags[offset + len] & UGB_CFG_CODE));
 
-            last = addr;
+            printf("%04X: %s\n", addr, &str[0]);
+            addr += len;
+            continue;
         }
-        else if (*end == '+')
+
+        ssize_t len = ugb_read_opcode(&data[0], dbg->gbm, addr);
+        if (len <= 0)
+        {
+            printf("%04X: <%s>\n", addr, ugb_strerror(len));
+            ++addr;
+        }
+        else
         {
-            char* size = ++end;
-            addr = (unsigned long) strtol(size, &end, 0);
+            ugb_disassemble(&str[0], sizeof(str), &data[0], addr);
 
-            if (!end || end == size ||
-                addr > 0xFFFF)
+            // Name where it goes
+            ssize_t target = ugb_opcode_target(&data[0], addr);
+            int bank = target >= 0 ? _mapped_bank(dbg, target) : 0;
+            if (dbg->symbols && target >= 0 && ugb_symbols_lookup(dbg->symbols, bank, target))
             {
-                printf("Invalid size \"%s\".\n", size);
-                return;
+                size_t pos = strlen(str);
+                pos += snprintf(&str[pos], sizeof(str) - pos, "  ; ");
+                ugb_symbols_format(dbg->symbols, bank, target, &str[pos], sizeof(str) - pos);
             }
 
-            last = first + addr;
-        }
-        else if (*end)
-        {
-            printf("Invalid address range expression \"%s\".\n", args);
-            return;
+            printf("%04X: %s\n", addr, &str[0]);
+            addr += len;
         }
     }
+}
+
+void _com_block(ugb_debugger* dbg, char* args)
+{
+    uint16_t addr = *dbg->gbm->cpu->regs.PC;
+    int bank = 0;
 
-    if (last < first)
+    char* end = 0;
+    if (args && *args && !_parse_addr(dbg, args, &end, &addr, &bank))
     {
-        printf("Invalid address range expression \"%s\".\n", args);
+        printf("Invalid address \"%s\".\n", args);
         return;
     }
 
-    char str[256];
-    uint8_t data[8];
+    // Symbols say which bank they're in, addresses are what's mapped
+    ugb_cart* cart = dbg->gbm->cart;
+    ugb_cfg* cfg = ugb_cart_cfg(cart);
+    ssize_t offset = UGB_ERR_NOENT;
+    if (cfg && bank && addr >= UGB_CART_ROMX_LO && addr <= UGB_CART_ROMX_HI)
+        offset = bank * UGB_CART_ROMX_SZ + addr - UGB_CART_ROMX_LO;
+    else if (cfg)
+        offset = ugb_cart_rom_offset(cart, addr);
 
-    uint16_t addr = first;
-    while (addr <= last)
+    if (offset < 0 || (size_t) offset >= cfg->rom_size)
     {
-        ssize_t len = ugb_read_opcode(&data[0], _gbm, addr);
-        if (len <= 0)
-        {
-            printf("%04X: <%s>\n", addr, ugb_strerror(len));
-            ++addr;
-        }
-        else
-        {
-            ugb_disassemble(&str[0], sizeof(str), &data[0], addr);
+        printf("0x%04X isn't cartridge ROM.\n", addr);
+        return;
+    }
 
-            printf("%04X: %s\n", addr, &str[0]);
-            addr += len;
-        }
+    const ugb_cfg_block* block = ugb_cfg_block_at(cfg, offset);
+    if (!block)
+    {
+        printf("0x%04X isn't known code.\n", addr);
+        return;
     }
+
+    static const char* const kinds[] =
+    {
+        "Falls through to", "Jumps to", "Branches to", "Calls",
+        "Returns", "Jumps to (HL)", "Stops"
+    };
+
+    char str[128];
+    int start_bank = block->start / UGB_CART_ROMX_SZ;
+    printf("Block %02X:%04X-%04X%s.\n", start_bank,
+        ugb_cfg_address(block->start), ugb_cfg_address(block->end - 1),
+        _describe(dbg, start_bank, ugb_cfg_address(block->start), &str[0], sizeof(str)));
+
+    int32_t dest = block->kind == UGB_CFG_FALL ? block->next : block->target;
+    if (dest >= 0)
+        printf("%s %02X:%04X%s.\n", kinds[block->kind], dest / UGB_CART_ROMX_SZ, ugb_cfg_address(dest),
+            _describe(dbg, dest / UGB_CART_ROMX_SZ, ugb_cfg_address(dest), &str[0], sizeof(str)));
+    else if (block->kind == UGB_CFG_JUMP || block->kind == UGB_CFG_BRANCH || block->kind == UGB_CFG_CALL)
+        printf("%s somewhere unknown.\n", kinds[block->kind]);
+    else
+        printf("%s.\n", kinds[block->kind]);
+
+    if (block->kind != UGB_CFG_FALL && block->next >= 0)
+        printf("Then goes on at %02X:%04X.\n", block->next / UGB_CART_ROMX_SZ, ugb_cfg_address(block->next));
+}
+
+// Say why continuing stopped
+static void _report_stop(ugb_debugger* dbg)
+{
+    ugb_breakpoint* match = dbg->breakpoints;
+    while (match && (!dbg->break_hit || match->id != dbg->break_hit))
+        match = match->next;
+
+    if (dbg->watch_hit.id && dbg->watch_hit.op == UGB_MMU_READ)
+        printf("Stopped at watchpoint #%d, read $%02X at 0x%04X.\n",
+            dbg->watch_hit.id, dbg->watch_hit.data, dbg->watch_hit.addr);
+    else if (dbg->watch_hit.id)
+        printf("Stopped at watchpoint #%d, wrote $%02X over $%02X at 0x%04X.\n",
+            dbg->watch_hit.id, dbg->watch_hit.data, dbg->watch_hit.old, dbg->watch_hit.addr);
+    else if (match)
+        printf("Stopped at breakpoint #%d (0x%04X), hit %u times.\n", match->id, match->addr, match->hits);
+    else
+        printf("Target stopped unexpectedly at 0x%04X.\n", *dbg->gbm->cpu->regs.PC);
 }
 
-void _com_step(char* args)
+void _com_step(ugb_debugger* dbg, char* args)
 {
     int err;
-    if ((err = (*_interf->command)(UGB_CMD_STEP, _interf->cookie)) != UGB_ERR_OK)
+    if ((err = (*dbg->interf->command)(UGB_CMD_STEP, dbg->interf->cookie)) != UGB_ERR_OK)
     {
         printf("Error: %s.\n", ugb_strerror(err));
         return;
     }
 
-    _com_disassemble(0);
+    _com_disassemble(dbg, 0);
 }
 
-void _com_continue(char* args)
+void _com_continue(ugb_debugger* dbg, char* args)
 {
     int err;
 
-    if ((err = (*_interf->command)(UGB_CMD_CONTINUE, _interf->cookie)) != UGB_ERR_OK)
+    dbg->watch_hit.id = 0;
+    dbg->break_hit = 0;
+    if ((err = (*dbg->interf->command)(UGB_CMD_CONTINUE, dbg->interf->cookie)) != UGB_ERR_OK)
     {
         printf("Error: %s.\n", ugb_strerror(err));
         return;
     }
 
-    ugb_breakpoint* match = 0;
-    for (ugb_breakpoint* bp = _breakpoints; bp; bp = bp->next)
+    _report_stop(dbg);
+    _com_disassemble(dbg, 0);
+}
+
+// Going back restores and steps the machine from this thread, and the
+//   history is attached to it from here too : the frontend's loop
+//   mustn't be stepping it at the same time
+static int _stopped(ugb_debugger* dbg)
+{
+    if (dbg->interf->running)
+    {
+        printf("The target is running, stop it first.\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+static int _can_reverse(ugb_debugger* dbg)
+{
+    if (!dbg->history)
+    {
+        printf("Execution isn't being recorded, see \"record\".\n");
+        return 0;
+    }
+
+    return _stopped(dbg);
+}
+
+static void _release_history(ugb_debugger* dbg)
+{
+    if (dbg->own_history)
+    {
+        if (dbg->gbm->history == dbg->history)
+            dbg->gbm->history = 0;
+        ugb_history_destroy(dbg->history);
+    }
+
+    dbg->history = 0;
+    dbg->own_history = 0;
+}
+
+// Recording snapshots the machine and hooks every step, so it's only
+//   done once asked for
+void _com_record(ugb_debugger* dbg, char* args)
+{
+    int on = 1;
+    if (args && *args)
     {
-        if (bp->addr == *_gbm->cpu->regs.PC)
+        if (!strcmp(args, "off"))
+            on = 0;
+        else if (strcmp(args, "on"))
         {
-            match = bp;
-            break;
+            printf("Expecting \"on\" or \"off\".\n");
+            return;
+        }
+    }
+
+    if (!_stopped(dbg))
+        return;
+
+    if (!on)
+    {
+        if (dbg->history)
+            printf("Stopped recording execution.\n");
+        _release_history(dbg);
+        return;
+    }
+
+    if (dbg->history)
+    {
+        printf("Execution is already being recorded.\n");
+        return;
+    }
+
+    // Use the machine's history if something records it already
+    ugb_gbm* gbm = dbg->gbm;
+    if (gbm->history)
+        dbg->history = gbm->history;
+    else if ((dbg->history = ugb_history_create(gbm, UGB_HISTORY_INTERVAL, UGB_HISTORY_SNAPSHOTS)))
+    {
+        dbg->own_history = 1;
+        gbm->history = dbg->history;
+    }
+    else
+    {
+        printf("Error: %s.\n", ugb_strerror(UGB_ERR_MALLOC));
+        return;
+    }
+
+    printf("Recording execution from here.\n");
+}
+
+void _com_rstep(ugb_debugger* dbg, char* args)
+{
+    if (!_can_reverse(dbg))
+        return;
+
+    unsigned long count = 1;
+    if (args && *args)
+    {
+        char* end;
+        count = strtoul(args, &end, 0);
+        if (*end || !count)
+        {
+            printf("Invalid count \"%s\".\n", args);
+            return;
+        }
+    }
+
+    // Don't go further back than what was recorded
+    uint64_t step = dbg->history->step;
+    uint64_t oldest = ugb_history_oldest(dbg->history);
+    if (step == oldest)
+    {
+        printf("Reached the start of the recorded history.\n");
+        return;
+    }
+
+    int clamped = step - oldest < count;
+
+    int err = ugb_history_seek(dbg->history, clamped ? oldest : step - count);
+    dbg->interf->pending = 0;
+    if (err != UGB_ERR_OK)
+    {
+        printf("Error: %s.\n", ugb_strerror(err));
+        return;
+    }
+
+    if (clamped)
+        printf("Reached the start of the recorded history.\n");
+
+    _com_disassemble(dbg, 0);
+}
+
+// What stopped reverse execution last
+typedef struct _reverse_hit
+{
+    ugb_debugger* dbg;
+    int break_hit;
+    struct ugb_watch_hit watch_hit;
+} _reverse_hit;
+
+// Where continue would have stopped, without counting breakpoint hits
+static int _reverse_match(void* cookie, int after_step)
+{
+    _reverse_hit* hit = (_reverse_hit*) cookie;
+    ugb_debugger* dbg = hit->dbg;
+
+    // Restoring a snapshot doesn't access memory, so a watchpoint only
+    //   counts when it was hit getting there
+    int pending = dbg->interf->pending;
+    dbg->interf->pending = 0;
+
+    if (pending && after_step)
+    {
+        hit->break_hit = 0;
+        hit->watch_hit = dbg->watch_hit;
+        return 1;
+    }
+
+    uint16_t pc = *dbg->gbm->cpu->regs.PC;
+    if (!(dbg->breakmap[pc >> 3] & (1 << (pc & 7))))
+        return 0;
+
+    for (ugb_breakpoint* bp = dbg->breakpoints; bp; bp = bp->next)
+    {
+        if (bp->addr == pc && _breakpoint_triggers(dbg, bp, 0))
+        {
+            hit->break_hit = bp->id;
+            hit->watch_hit.id = 0;
+            return 1;
         }
     }
 
-    if (match)
-        printf("Stopped at breakpoint #%d (0x%04X).\n", match->id, match->addr);
+    return 0;
+}
+
+void _com_rcontinue(ugb_debugger* dbg, char* args)
+{
+    if (!_can_reverse(dbg))
+        return;
+
+    _reverse_hit hit;
+    memset(&hit, 0, sizeof(_reverse_hit));
+    hit.dbg = dbg;
+
+    dbg->interf->pending = 0;
+    int err = ugb_history_find(dbg->history, dbg->history->step, &_reverse_match, &hit);
+    dbg->interf->pending = 0;
+
+    // Replaying up to the match hits watchpoints along the way
+    dbg->break_hit = hit.break_hit;
+    dbg->watch_hit = hit.watch_hit;
+
+    if (err == UGB_ERR_NOENT)
+        printf("Reached the start of the recorded history.\n");
+    else if (err != UGB_ERR_OK)
+    {
+        printf("Error: %s.\n", ugb_strerror(err));
+        return;
+    }
     else
-        printf("Target stopped unexpectedly at 0x%04X.\n", *_gbm->cpu->regs.PC);
+        _report_stop(dbg);
 
-    _com_disassemble(0);
+    _com_disassemble(dbg, 0);
 }
 
-void _com_reset(char* args)
+void _com_reset(ugb_debugger* dbg, char* args)
 {
     int err;
-    if ((err = (*_interf->command)(UGB_CMD_RESET, _interf->cookie)) != UGB_ERR_OK)
+    if ((err = (*dbg->interf->command)(UGB_CMD_RESET, dbg->interf->cookie)) != UGB_ERR_OK)
     {
         printf("Error: %s.\n", ugb_strerror(err));
         return;
     }
 
-    _com_disassemble(0);
+    _com_disassemble(dbg, 0);
 }
 
-void _com_register(char* args)
+void _com_register(ugb_debugger* dbg, char* args)
 {
-    static struct reg_t
+    static const struct reg_t
     {
         const char* name;
         int word;
@@ -388,13 +1033,13 @@ void _com_register(char* args)
         { 0, 0, 0}
     };
 
-    for (struct reg_t* r = &regs[0]; r->name; ++r)
+    for (const struct reg_t* r = &regs[0]; r->name; ++r)
     {
         if (!strcmp(r->name, args))
         {
             printf("%s = ", r->name);
 
-            void* data_ptr = &_gbm->cpu->regs.data[r->offset];
+            void* data_ptr = &dbg->gbm->cpu->regs.data[r->offset];
 
             if (r->word)
                 printf("$%04X", *((uint16_t*) data_ptr));
@@ -405,10 +1050,10 @@ void _com_register(char* args)
             {
                 char flags[5] = "____";
 
-                flags[0] = (*_gbm->cpu->regs.F) & UGB_REG_F_Z_MSK ? 'Z' : '_';
-                flags[1] = (*_gbm->cpu->regs.F) & UGB_REG_F_N_MSK ? 'N' : '_';
-                flags[2] = (*_gbm->cpu->regs.F) & UGB_REG_F_H_MSK ? 'H' : '_';
-                flags[3] = (*_gbm->cpu->regs.F) & UGB_REG_F_C_MSK ? 'C' : '_';
+                flags[0] = (*dbg->gbm->cpu->regs.F) & UGB_REG_F_Z_MSK ? 'Z' : '_';
+                flags[1] = (*dbg->gbm->cpu->regs.F) & UGB_REG_F_N_MSK ? 'N' : '_';
+                flags[2] = (*dbg->gbm->cpu->regs.F) & UGB_REG_F_H_MSK ? 'H' : '_';
+                flags[3] = (*dbg->gbm->cpu->regs.F) & UGB_REG_F_C_MSK ? 'C' : '_';
 
                 printf(" %s", &flags[0]);
             }
@@ -421,7 +1066,7 @@ void _com_register(char* args)
     printf("No register named \"%s\".\n", args);
 }
 
-void _com_print(char* args)
+void _com_print(ugb_debugger* dbg, char* args)
 {
     if (!args || !*args)
     {
@@ -431,61 +1076,8 @@ void _com_print(char* args)
 
     uint16_t first = 0;
     uint16_t last = 0;
-
-    // Get start address
-    char* end = 0;
-    unsigned long addr = (unsigned long) strtol(args, &end, 16);
-
-    if (!end || end == args ||
-        addr > 0xFFFF)
-    {
-        printf("Invalid address \"%s\".\n", args);
-        return;
-    }
-
-    first = addr;
-    last = first;
-
-    end = _skip_whitespace(end);
-    if (*end == '-')
-    {
-        char* range = ++end;
-        addr = (unsigned long) strtol(range, &end, 16);
-
-        if (!end || end == range ||
-            addr > 0xFFFF)
-        {
-            printf("Invalid address \"%s\".\n", range);
-            return;
-        }
-
-        last = addr;
-    }
-    else if (*end == '+')
-    {
-        char* size = ++end;
-        addr = (unsigned long) strtol(size, &end, 0);
-
-        if (!end || end == size ||
-            addr > 0xFFFF)
-        {
-            printf("Invalid size \"%s\".\n", size);
-            return;
-        }
-
-        last = first + addr;
-    }
-    else if (*end)
-    {
-        printf("Invalid address range expression \"%s\".\n", args);
-        return;
-    }
-
-    if (last < first)
-    {
-        printf("Invalid address range expression \"%s\".\n", args);
+    if (!_parse_range(dbg, args, &first, &last))
         return;
-    }
 
     int row = 0;
     int col = 0;
@@ -497,7 +1089,7 @@ void _com_print(char* args)
 
         int err;
         uint8_t value;
-        if ((err = ugb_mmu_read(_gbm->mmu, addr, &value)) != UGB_ERR_OK)
+        if ((err = ugb_mmu_peek(dbg->gbm->mmu, addr, &value)) != UGB_ERR_OK)
         {
             printf("Error: %s\n", ugb_strerror(err));
             return;
@@ -520,43 +1112,229 @@ void _com_print(char* args)
     }
 }
 
-int ugb_debugger_add_breakpoint(uint16_t addr)
+static void _free_breakpoint(ugb_breakpoint* bp)
+{
+    free(bp->cond);
+    free(bp->cond_str);
+    free(bp);
+}
+
+ugb_debugger* ugb_debugger_create(ugb_gbm* gbm, ugb_debugger_interf* interf)
+{
+    if (!gbm || !interf)
+        return 0;
+
+    ugb_debugger* dbg = malloc(sizeof(ugb_debugger));
+    if (!dbg)
+        return 0;
+
+    memset(dbg, 0, sizeof(ugb_debugger));
+    dbg->gbm = gbm;
+    dbg->interf = interf;
+    dbg->next_breakpoint_id = 1;
+    dbg->trap = -1;
+
+    interf->status = &_interf_status;
+    interf->status_cookie = dbg;
+
+    return dbg;
+}
+
+void ugb_debugger_destroy(ugb_debugger* dbg)
+{
+    if (dbg)
+    {
+        if (dbg->interf->status_cookie == dbg)
+        {
+            dbg->interf->status = 0;
+            dbg->interf->status_cookie = 0;
+            dbg->interf->breakmap = 0;
+            dbg->interf->watching = 0;
+            dbg->interf->pending = 0;
+        }
+
+        if (dbg->trap >= 0)
+            ugb_mmu_remove_trap(dbg->gbm->mmu, dbg->trap);
+
+        _release_history(dbg);
+
+        ugb_symbols_destroy(dbg->symbols);
+
+        for (ugb_watchpoint* wp = dbg->watchpoints; wp; )
+        {
+            ugb_watchpoint* next = wp->next;
+            free(wp);
+            wp = next;
+        }
+
+        for (ugb_breakpoint* bp = dbg->breakpoints; bp; )
+        {
+            ugb_breakpoint* next = bp->next;
+            _free_breakpoint(bp);
+            bp = next;
+        }
+
+        free(dbg);
+    }
+}
+
+int ugb_debugger_add_breakpoint(ugb_debugger* dbg, uint16_t addr, int bank)
 {
+    if (!dbg)
+        return UGB_ERR_BADARGS;
+
     ugb_breakpoint* bp = malloc(sizeof(ugb_breakpoint));
     if (!bp)
         return UGB_ERR_MALLOC;
 
-    bp->id = _breakpoint_id++;
+    bp->id = dbg->next_breakpoint_id++;
     bp->addr = addr;
+    bp->bank = bank;
+    bp->hits = 0;
+    bp->cond = 0;
+    bp->cond_str = 0;
 
     bp->next = 0;
-    bp->prev = _last_breakpoint;
+    bp->prev = dbg->last_breakpoint;
     if (bp->prev)
         bp->prev->next = bp;
     else
-        _breakpoints = bp;
-    _last_breakpoint = bp;
+        dbg->breakpoints = bp;
+    dbg->last_breakpoint = bp;
+
+    dbg->breakmap[addr >> 3] |= 1 << (addr & 7);
+    dbg->interf->breakmap = &dbg->breakmap[0];
 
     return bp->id;
 }
 
-int ugb_debugger_delete_breakpoint(int id)
+int ugb_debugger_delete_breakpoint(ugb_debugger* dbg, int id)
 {
-    for (ugb_breakpoint* bp = _breakpoints; bp; bp = bp->next)
+    if (!dbg)
+        return UGB_ERR_BADARGS;
+
+    for (ugb_breakpoint* bp = dbg->breakpoints; bp; bp = bp->next)
     {
         if (bp->id == id)
         {
             if (bp->prev)
                 bp->prev->next = bp->next;
             else
-                _breakpoints = bp->next;
+                dbg->breakpoints = bp->next;
 
             if (bp->next)
                 bp->next->prev = bp->prev;
             else
-                _last_breakpoint = bp->prev;
+                dbg->last_breakpoint = bp->prev;
+
+            // Other breakpoints (in other banks) may share the address
+            uint16_t addr = bp->addr;
+            _free_breakpoint(bp);
+
+            dbg->breakmap[addr >> 3] &= ~(1 << (addr & 7));
+            for (bp = dbg->breakpoints; bp; bp = bp->next)
+                if (bp->addr == addr)
+                    dbg->breakmap[addr >> 3] |= 1 << (addr & 7);
+
+            if (!dbg->breakpoints)
+                dbg->interf->breakmap = 0;
+
+            return 0;
+        }
+    }
+
+    return UGB_ERR_NOENT;
+}
+
+int ugb_debugger_set_condition(ugb_debugger* dbg, int id, const char* cond, const char** error_pos)
+{
+    if (!dbg)
+        return UGB_ERR_BADARGS;
+
+    ugb_breakpoint* bp = dbg->breakpoints;
+    while (bp && bp->id != id)
+        bp = bp->next;
+
+    if (!bp)
+        return UGB_ERR_NOENT;
+
+    // Compiled once here, the hits only evaluate it
+    ugb_expr* expr = 0;
+    char* str = 0;
+    if (cond)
+    {
+        if (!(expr = malloc(sizeof(ugb_expr))) || !(str = strdup(cond)))
+        {
+            free(expr);
+            return UGB_ERR_MALLOC;
+        }
+
+        int err = ugb_expr_compile(expr, cond, &_breakpoint_vars[0], error_pos);
+        if (err != UGB_ERR_OK)
+        {
+            free(expr);
+            free(str);
+            return err;
+        }
+    }
+
+    free(bp->cond);
+    free(bp->cond_str);
+    bp->cond = expr;
+    bp->cond_str = str;
+
+    return UGB_ERR_OK;
+}
+
+int ugb_debugger_add_watchpoint(ugb_debugger* dbg, uint16_t low_addr, uint16_t high_addr, int type)
+{
+    if (!dbg || low_addr > high_addr || !type)
+        return UGB_ERR_BADARGS;
+
+    ugb_watchpoint* wp = malloc(sizeof(ugb_watchpoint));
+    if (!wp)
+        return UGB_ERR_MALLOC;
+
+    wp->id = dbg->next_breakpoint_id++;
+    wp->low_addr = low_addr;
+    wp->high_addr = high_addr;
+    wp->type = type;
+
+    wp->next = 0;
+    wp->prev = dbg->last_watchpoint;
+    if (wp->prev)
+        wp->prev->next = wp;
+    else
+        dbg->watchpoints = wp;
+    dbg->last_watchpoint = wp;
+
+    _update_traps(dbg);
+
+    return wp->id;
+}
+
+int ugb_debugger_delete_watchpoint(ugb_debugger* dbg, int id)
+{
+    if (!dbg)
+        return UGB_ERR_BADARGS;
+
+    for (ugb_watchpoint* wp = dbg->watchpoints; wp; wp = wp->next)
+    {
+        if (wp->id == id)
+        {
+            if (wp->prev)
+                wp->prev->next = wp->next;
+            else
+                dbg->watchpoints = wp->next;
+
+            if (wp->next)
+                wp->next->prev = wp->prev;
+            else
+                dbg->last_watchpoint = wp->prev;
+
+            free(wp);
+            _update_traps(dbg);
 
-            free(bp);
             return 0;
         }
     }
@@ -564,18 +1342,27 @@ int ugb_debugger_delete_breakpoint(int id)
     return UGB_ERR_NOENT;
 }
 
-int ugb_debugger_mainloop(ugb_gbm* gbm, ugb_debugger_interf* interf)
+ssize_t ugb_debugger_load_symbols(ugb_debugger* dbg, const char* path)
 {
-    if (!gbm || !interf)
+    if (!dbg || !path)
         return UGB_ERR_BADARGS;
 
-    _gbm = gbm;
-    _interf = interf;
-    _interf->status = &_interf_status;
+    if (!dbg->symbols && !(dbg->symbols = ugb_symbols_create()))
+        return UGB_ERR_MALLOC;
+
+    return ugb_symbols_load(dbg->symbols, path);
+}
+
+int ugb_debugger_mainloop(ugb_debugger* dbg)
+{
+    if (!dbg)
+        return UGB_ERR_BADARGS;
 
-    while (sigsetjmp(_jmpbuf, 1) != 0);
+    _sigint_target = dbg;
 
-    for (_quit = 0; !_quit; )
+    while (sigsetjmp(dbg->jmpbuf, 1) != 0);
+
+    for (dbg->quit = 0; !dbg->quit; )
     {
         signal(SIGINT, _handle_signals);
         rl_catch_signals = 1;
@@ -619,39 +1406,41 @@ int ugb_debugger_mainloop(ugb_gbm* gbm, ugb_debugger_interf* interf)
 
             char* args = exec_len > cmd_len ? _strip_whitespace(&exec[cmd_len+1]) : 0;
 
-            // Match the command against our list, handle GDB-like short commands
-            ugb_command* match = 0;
-            int ok = 1;
-            for (ugb_command* cmd = _commands; cmd->name; ++cmd)
+            // Match the command against our list, handle GDB-like short commands,
+            //   an exact name (or synonym) wins over the longer ones it prefixes
+            const ugb_command* match = 0;
+            int count = 0;
+            for (const ugb_command* cmd = _commands; cmd->name; ++cmd)
             {
+                if (!strcmp(cmd->name, exec))
+                {
+                    match = cmd;
+                    count = 1;
+                    break;
+                }
+
                 if (!strncmp(cmd->name, exec, cmd_len))
                 {
-                    int exact = !strcmp(cmd->name, exec);
-
-                    if (match && !exact)
-                    {
-                        printf("Ambiguous command \"%s\" : ", exec);
-
-                        for (cmd = _commands; cmd->name; ++cmd)
-                            if (!strncmp(cmd->name, exec, cmd_len))
-                                printf("%s, ", cmd->name);
-
-                        printf("\b\b.\n");
-                        ok = 0;
-                        break;
-                    }
-                    else
-                    {
-                        match = cmd;
-                    }
+                    match = cmd;
+                    ++count;
                 }
             }
 
-            if (match && ok)
+            if (count > 1)
             {
-                (*match->func)(args);
+                printf("Ambiguous command \"%s\" : ", exec);
+
+                for (const ugb_command* cmd = _commands; cmd->name; ++cmd)
+                    if (!strncmp(cmd->name, exec, cmd_len))
+                        printf("%s, ", cmd->name);
+
+                printf("\b\b.\n");
             }
-            else if (!match)
+            else if (match)
+            {
+                (*match->func)(dbg, args);
+            }
+            else
             {
                 printf("Undefined command: \"%s\".  Try \"help\".\n", exec);
             }
@@ -660,6 +1449,6 @@ int ugb_debugger_mainloop(ugb_gbm* gbm, ugb_debugger_interf* interf)
         free(input_line);
     }
 
-    _gbm = 0;
+    _sigint_target = 0;
     return UGB_ERR_OK;
 }
@@ -0,0 +1,290 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "export.h"
+#include "gpu.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Slots are kept cache line aligned
+#define _UGB_EXPORT_SLOT_SZ ((sizeof(ugb_export_slot) + 63) & ~(size_t) 63)
+
+static ugb_export_slot* _slot(ugb_export_header* header, uint64_t seq)
+{
+    uint8_t* base = (uint8_t*) header + UGB_EXPORT_HEADER_SZ;
+    return (ugb_export_slot*) (base + (seq % header->slots) * header->slot_size);
+}
+
+static int _futex(uint32_t* word, int op, uint32_t value, const struct timespec* timeout)
+{
+    // Not private, the word is shared between processes
+    return syscall(SYS_futex, word, op, value, timeout, 0, 0);
+}
+
+static ugb_export* _map(const char* name, int fd, size_t size)
+{
+    ugb_export* exp = malloc(sizeof(ugb_export));
+    if (!exp)
+        return 0;
+
+    memset(exp, 0, sizeof(ugb_export));
+
+    void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED || !(exp->name = strdup(name)))
+    {
+        if (ptr != MAP_FAILED)
+            munmap(ptr, size);
+        free(exp);
+        return 0;
+    }
+
+    exp->size = size;
+    exp->header = (ugb_export_header*) ptr;
+
+    return exp;
+}
+
+static void _unmap(ugb_export* exp)
+{
+    munmap(exp->header, exp->size);
+    free(exp->name);
+    free(exp);
+}
+
+/*********************/
+/*** Producer side ***/
+/*********************/
+
+ugb_export* ugb_export_create(ugb_gbm* gbm, const char* name, size_t slots, int flags)
+{
+    if (!gbm || !name || !slots || slots > UINT32_MAX)
+        return 0;
+
+    size_t size = UGB_EXPORT_HEADER_SZ + slots * _UGB_EXPORT_SLOT_SZ;
+
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0)
+        return 0;
+
+    ugb_export* exp = 0;
+    if (ftruncate(fd, size) == 0)
+        exp = _map(name, fd, size);
+
+    close(fd);
+
+    if (!exp)
+    {
+        shm_unlink(name);
+        return 0;
+    }
+
+    exp->gbm = gbm;
+
+    // The mapping is zero-filled, readers check the magic last
+    ugb_export_header* header = exp->header;
+    header->version = UGB_EXPORT_VERSION;
+    header->flags = flags;
+    header->slots = slots;
+    header->slot_size = _UGB_EXPORT_SLOT_SZ;
+    __atomic_store_n(&header->magic, UGB_EXPORT_MAGIC, __ATOMIC_RELEASE);
+
+    if (ugb_gpu_set_vblank_hook(gbm->gpu, &ugb_export_vblank_hook, exp) != UGB_ERR_OK)
+    {
+        ugb_export_destroy(exp);
+        return 0;
+    }
+
+    return exp;
+}
+
+void ugb_export_destroy(ugb_export* exp)
+{
+    if (exp)
+    {
+        if (exp->gbm && exp->gbm->gpu->vblank_cookie == exp)
+            ugb_gpu_set_vblank_hook(exp->gbm->gpu, 0, 0);
+
+        // Readers can keep their own mappings
+        shm_unlink(exp->name);
+        _unmap(exp);
+    }
+}
+
+int ugb_export_vblank_hook(struct ugb_gpu* gpu, void* cookie)
+{
+    if (!gpu || !cookie)
+        return UGB_ERR_BADARGS;
+
+    ugb_export* exp = (ugb_export*) cookie;
+    ugb_export_header* header = exp->header;
+
+    uint64_t seq = header->last + 1;
+    ugb_export_slot* slot = _slot(header, seq);
+
+    // Readers must see the slot as busy before any of the data changes
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->frame = gpu->frames;
+    slot->cycles = exp->gbm->cycles;
+    memcpy(&slot->framebuf[0], gpu->framebuf, sizeof(slot->framebuf));
+
+    if (header->flags & UGB_EXPORT_MEMORY)
+    {
+        memcpy(&slot->wram[0], exp->gbm->mem.ram0, UGB_RAM0_SZ);
+        memcpy(&slot->hram[0], exp->gbm->mem.zpage, UGB_ZPAGE_SZ);
+    }
+
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&header->last, seq, __ATOMIC_RELEASE);
+
+    // Pairs with the waiter count being raised before the futex word is
+    //   checked, one of both sides always sees the other
+    __atomic_store_n(&header->futex, (uint32_t) seq, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&header->waiters, __ATOMIC_SEQ_CST))
+        _futex(&header->futex, FUTEX_WAKE, INT_MAX, 0);
+
+    return UGB_ERR_OK;
+}
+
+/*******************/
+/*** Reader side ***/
+/*******************/
+
+ugb_export* ugb_export_open(const char* name)
+{
+    if (!name)
+        return 0;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    ugb_export* exp = 0;
+    if (fstat(fd, &st) == 0 && st.st_size >= UGB_EXPORT_HEADER_SZ)
+        exp = _map(name, fd, st.st_size);
+
+    close(fd);
+
+    if (!exp)
+        return 0;
+
+    // Check that the producer is done setting it up, and that the slots
+    //   fit in what was mapped
+    ugb_export_header* header = exp->header;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != UGB_EXPORT_MAGIC ||
+        header->version != UGB_EXPORT_VERSION ||
+        header->slot_size < sizeof(ugb_export_slot) ||
+        UGB_EXPORT_HEADER_SZ + (uint64_t) header->slots * header->slot_size > exp->size)
+    {
+        _unmap(exp);
+        return 0;
+    }
+
+    return exp;
+}
+
+void ugb_export_close(ugb_export* exp)
+{
+    if (exp)
+        _unmap(exp);
+}
+
+uint64_t ugb_export_wait(ugb_export* exp, uint64_t after, int timeout_ms)
+{
+    if (!exp)
+        return 0;
+
+    ugb_export_header* header = exp->header;
+
+    uint64_t last = __atomic_load_n(&header->last, __ATOMIC_ACQUIRE);
+    if (last > after || !timeout_ms)
+        return last;
+
+    struct timespec deadline, timeout;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_nsec -= 1000000000L;
+        ++deadline.tv_sec;
+    }
+
+    __atomic_add_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+
+    for (;;)
+    {
+        uint32_t word = __atomic_load_n(&header->futex, __ATOMIC_SEQ_CST);
+        if ((last = __atomic_load_n(&header->last, __ATOMIC_ACQUIRE)) > after)
+            break;
+
+        if (timeout_ms < 0)
+        {
+            _futex(&header->futex, FUTEX_WAIT, word, 0);
+            continue;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        timeout.tv_sec = deadline.tv_sec - now.tv_sec;
+        timeout.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+        if (timeout.tv_nsec < 0)
+        {
+            timeout.tv_nsec += 1000000000L;
+            --timeout.tv_sec;
+        }
+
+        if (timeout.tv_sec < 0)
+            break;
+
+        _futex(&header->futex, FUTEX_WAIT, word, &timeout);
+    }
+
+    __atomic_sub_fetch(&header->waiters, 1, __ATOMIC_SEQ_CST);
+
+    return last;
+}
+
+const ugb_export_slot* ugb_export_get(ugb_export* exp, uint64_t seq)
+{
+    if (!exp || !seq)
+        return 0;
+
+    const ugb_export_slot* slot = _slot(exp->header, seq);
+    return ugb_export_valid(slot, seq) ? slot : 0;
+}
+
+int ugb_export_valid(const ugb_export_slot* slot, uint64_t seq)
+{
+    // Order the reads of the data before reading the sequence number again
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return slot && __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == seq;
+}
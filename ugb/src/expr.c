@@ -0,0 +1,428 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "expr.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+enum
+{
+    _UGB_EXPR_END,
+
+    // Operands (followed by a 32 bits immediate or a 1 byte index)
+    _UGB_EXPR_PUSH,
+    _UGB_EXPR_REGB,
+    _UGB_EXPR_REGW,
+    _UGB_EXPR_VAR,
+
+    // Unary operators
+    _UGB_EXPR_LOAD,
+    _UGB_EXPR_NOT,
+    _UGB_EXPR_CPL,
+    _UGB_EXPR_NEG,
+
+    // Binary operators
+    _UGB_EXPR_OR,
+    _UGB_EXPR_AND,
+    _UGB_EXPR_BOR,
+    _UGB_EXPR_XOR,
+    _UGB_EXPR_BAND,
+    _UGB_EXPR_EQ,
+    _UGB_EXPR_NE,
+    _UGB_EXPR_LE,
+    _UGB_EXPR_GE,
+    _UGB_EXPR_LT,
+    _UGB_EXPR_GT,
+    _UGB_EXPR_SHL,
+    _UGB_EXPR_SHR,
+    _UGB_EXPR_ADD,
+    _UGB_EXPR_SUB,
+    _UGB_EXPR_MUL,
+    _UGB_EXPR_DIV,
+    _UGB_EXPR_MOD
+};
+
+// Longest tokens first, so that "<=" isn't taken for "<"
+static const struct
+{
+    const char* str;
+    uint8_t op;
+    int prec;
+} _binops[] =
+{
+    { "||", _UGB_EXPR_OR,   1 },
+    { "&&", _UGB_EXPR_AND,  2 },
+    { "==", _UGB_EXPR_EQ,   6 },
+    { "!=", _UGB_EXPR_NE,   6 },
+    { "<=", _UGB_EXPR_LE,   7 },
+    { ">=", _UGB_EXPR_GE,   7 },
+    { "<<", _UGB_EXPR_SHL,  8 },
+    { ">>", _UGB_EXPR_SHR,  8 },
+    { "|",  _UGB_EXPR_BOR,  3 },
+    { "^",  _UGB_EXPR_XOR,  4 },
+    { "&",  _UGB_EXPR_BAND, 5 },
+    { "<",  _UGB_EXPR_LT,   7 },
+    { ">",  _UGB_EXPR_GT,   7 },
+    { "+",  _UGB_EXPR_ADD,  9 },
+    { "-",  _UGB_EXPR_SUB,  9 },
+    { "*",  _UGB_EXPR_MUL,  10 },
+    { "/",  _UGB_EXPR_DIV,  10 },
+    { "%",  _UGB_EXPR_MOD,  10 },
+    { 0, 0, 0 }
+};
+
+static const struct
+{
+    const char* name;
+    int word;
+    int offset;
+} _regs[] =
+{
+    #define DEF_REGB(name, offset) { #name, 0, offset },
+    #define DEF_REGW(name, offset) { #name, 1, offset },
+    #include "cpu.def"
+
+    { 0, 0, 0 }
+};
+
+/****************/
+/*** Compiler ***/
+/****************/
+
+typedef struct _ugb_expr_parser
+{
+    const char* s;
+    const char* const* vars;
+    ugb_expr* expr;
+    int depth;
+    int err;
+} _ugb_expr_parser;
+
+static int _parse_binary(_ugb_expr_parser* p, int min_prec);
+
+static void _skip(_ugb_expr_parser* p)
+{
+    while (isspace(*p->s))
+        ++p->s;
+}
+
+static void _emit(_ugb_expr_parser* p, uint8_t const* bytes, size_t len, int push)
+{
+    if (p->err)
+        return;
+
+    p->depth += push;
+    if (p->expr->len + len >= UGB_EXPR_MAX_CODE || p->depth > UGB_EXPR_MAX_STACK)
+    {
+        p->err = UGB_ERR_NOSPACE;
+        return;
+    }
+
+    memcpy(&p->expr->code[p->expr->len], bytes, len);
+    p->expr->len += len;
+}
+
+static void _emit_op(_ugb_expr_parser* p, uint8_t op, int push)
+{
+    _emit(p, &op, 1, push);
+}
+
+static void _emit_operand(_ugb_expr_parser* p, uint8_t op, int32_t value)
+{
+    uint8_t bytes[5] = { op };
+
+    if (op == _UGB_EXPR_PUSH)
+    {
+        memcpy(&bytes[1], &value, sizeof(int32_t));
+        _emit(p, &bytes[0], 5, 1);
+    }
+    else
+    {
+        bytes[1] = value;
+        _emit(p, &bytes[0], 2, 1);
+    }
+}
+
+static int _parse_word(_ugb_expr_parser* p)
+{
+    const char* start = p->s;
+    while (isalnum(*p->s) || *p->s == '_')
+        ++p->s;
+
+    size_t len = p->s - start;
+
+    for (int i = 0; _regs[i].name; ++i)
+    {
+        if (strlen(_regs[i].name) == len && !strncasecmp(_regs[i].name, start, len))
+        {
+            _emit_operand(p, _regs[i].word ? _UGB_EXPR_REGW : _UGB_EXPR_REGB, _regs[i].offset);
+            return p->err;
+        }
+    }
+
+    for (int i = 0; p->vars && p->vars[i]; ++i)
+    {
+        if (strlen(p->vars[i]) == len && !strncmp(p->vars[i], start, len))
+        {
+            _emit_operand(p, _UGB_EXPR_VAR, i);
+            return p->err;
+        }
+    }
+
+    // Otherwise it has to be a plain hexadecimal number
+    char* end = 0;
+    unsigned long value = strtoul(start, &end, 16);
+    if (end != p->s)
+    {
+        p->s = start;
+        return p->err = UGB_ERR_BADEXPR;
+    }
+
+    _emit_operand(p, _UGB_EXPR_PUSH, (int32_t) value);
+    return p->err;
+}
+
+static int _parse_unary(_ugb_expr_parser* p)
+{
+    _skip(p);
+
+    char c = *p->s;
+    switch (c)
+    {
+        case '!':
+        case '~':
+        case '-':
+            ++p->s;
+            if (_parse_unary(p) != UGB_ERR_OK)
+                return p->err;
+
+            _emit_op(p, c == '!' ? _UGB_EXPR_NOT : c == '~' ? _UGB_EXPR_CPL : _UGB_EXPR_NEG, 0);
+            return p->err;
+
+        case '(':
+        case '[':
+            ++p->s;
+            if (_parse_binary(p, 1) != UGB_ERR_OK)
+                return p->err;
+
+            _skip(p);
+            if (*p->s != (c == '(' ? ')' : ']'))
+                return p->err = UGB_ERR_BADEXPR;
+            ++p->s;
+
+            if (c == '[')
+                _emit_op(p, _UGB_EXPR_LOAD, 0);
+            return p->err;
+
+        case '$':
+        case '#':
+        {
+            char* end = 0;
+            unsigned long value = strtoul(p->s + 1, &end, c == '$' ? 16 : 10);
+            if (end == p->s + 1)
+                return p->err = UGB_ERR_BADEXPR;
+
+            p->s = end;
+            _emit_operand(p, _UGB_EXPR_PUSH, (int32_t) value);
+            return p->err;
+        }
+
+        default:
+            if (c == '0' && (p->s[1] == 'x' || p->s[1] == 'X'))
+            {
+                char* end = 0;
+                unsigned long value = strtoul(p->s + 2, &end, 16);
+                if (end == p->s + 2)
+                    return p->err = UGB_ERR_BADEXPR;
+
+                p->s = end;
+                _emit_operand(p, _UGB_EXPR_PUSH, (int32_t) value);
+                return p->err;
+            }
+
+            if (!isalnum(c) && c != '_')
+                return p->err = UGB_ERR_BADEXPR;
+
+            return _parse_word(p);
+    }
+}
+
+// Precedence climbing, operators are all left associative
+static int _parse_binary(_ugb_expr_parser* p, int min_prec)
+{
+    if (_parse_unary(p) != UGB_ERR_OK)
+        return p->err;
+
+    for (;;)
+    {
+        _skip(p);
+
+        int i;
+        for (i = 0; _binops[i].str; ++i)
+            if (!strncmp(p->s, _binops[i].str, strlen(_binops[i].str)))
+                break;
+
+        if (!_binops[i].str || _binops[i].prec < min_prec)
+            return p->err;
+
+        p->s += strlen(_binops[i].str);
+        if (_parse_binary(p, _binops[i].prec + 1) != UGB_ERR_OK)
+            return p->err;
+
+        _emit_op(p, _binops[i].op, -1);
+        if (p->err)
+            return p->err;
+    }
+}
+
+int ugb_expr_compile(ugb_expr* expr, const char* str, const char* const* vars, const char** error_pos)
+{
+    if (!expr || !str)
+        return UGB_ERR_BADARGS;
+
+    _ugb_expr_parser p = { str, vars, expr, 0, UGB_ERR_OK };
+    expr->len = 0;
+
+    if (_parse_binary(&p, 1) == UGB_ERR_OK)
+    {
+        _skip(&p);
+        if (*p.s)
+            p.err = UGB_ERR_BADEXPR;
+    }
+
+    _emit_op(&p, _UGB_EXPR_END, -1);
+
+    if (p.err != UGB_ERR_OK && error_pos)
+        *error_pos = p.s;
+
+    return p.err;
+}
+
+/*****************/
+/*** Evaluator ***/
+/*****************/
+
+int ugb_expr_eval(const ugb_expr* expr, ugb_gbm* gbm, const int32_t* vars, int32_t* value)
+{
+    if (!expr || !gbm || !value)
+        return UGB_ERR_BADARGS;
+
+    // The compiler made sure this is deep enough
+    int32_t stack[UGB_EXPR_MAX_STACK];
+    int32_t* sp = &stack[0];
+
+    uint8_t const* regs = &gbm->cpu->regs.data[0];
+    uint8_t const* pc = &expr->code[0];
+
+    for (;;)
+    {
+        uint8_t op = *pc++;
+
+        // Binary operators
+        if (op >= _UGB_EXPR_OR)
+        {
+            int32_t b = *--sp;
+            int32_t a = sp[-1];
+            int32_t r = 0;
+
+            switch (op)
+            {
+                case _UGB_EXPR_OR:   r = a || b; break;
+                case _UGB_EXPR_AND:  r = a && b; break;
+                case _UGB_EXPR_BOR:  r = a | b; break;
+                case _UGB_EXPR_XOR:  r = a ^ b; break;
+                case _UGB_EXPR_BAND: r = a & b; break;
+                case _UGB_EXPR_EQ:   r = a == b; break;
+                case _UGB_EXPR_NE:   r = a != b; break;
+                case _UGB_EXPR_LE:   r = a <= b; break;
+                case _UGB_EXPR_GE:   r = a >= b; break;
+                case _UGB_EXPR_LT:   r = a < b; break;
+                case _UGB_EXPR_GT:   r = a > b; break;
+                case _UGB_EXPR_SHL:  r = (uint32_t) a << (b & 31); break;
+                case _UGB_EXPR_SHR:  r = (uint32_t) a >> (b & 31); break;
+                case _UGB_EXPR_ADD:  r = (uint32_t) a + (uint32_t) b; break;
+                case _UGB_EXPR_SUB:  r = (uint32_t) a - (uint32_t) b; break;
+                case _UGB_EXPR_MUL:  r = (uint32_t) a * (uint32_t) b; break;
+
+                case _UGB_EXPR_DIV:
+                case _UGB_EXPR_MOD:
+                    if (!b || (a == INT32_MIN && b == -1))
+                        return UGB_ERR_BADEXPR;
+
+                    r = op == _UGB_EXPR_DIV ? a / b : a % b;
+                    break;
+            }
+
+            sp[-1] = r;
+            continue;
+        }
+
+        switch (op)
+        {
+            case _UGB_EXPR_END:
+                *value = sp[-1];
+                return UGB_ERR_OK;
+
+            case _UGB_EXPR_PUSH:
+                memcpy(sp++, pc, sizeof(int32_t));
+                pc += sizeof(int32_t);
+                break;
+
+            case _UGB_EXPR_REGB:
+                *sp++ = regs[*pc++];
+                break;
+
+            case _UGB_EXPR_REGW:
+                *sp++ = *((uint16_t const*) &regs[*pc++]);
+                break;
+
+            case _UGB_EXPR_VAR:
+                if (!vars)
+                    return UGB_ERR_BADARGS;
+
+                *sp++ = vars[*pc++];
+                break;
+
+            case _UGB_EXPR_LOAD:
+            {
+                uint8_t data;
+                int err = ugb_mmu_peek(gbm->mmu, (uint16_t) sp[-1], &data);
+                if (err != UGB_ERR_OK)
+                    return err;
+
+                sp[-1] = data;
+                break;
+            }
+
+            case _UGB_EXPR_NOT: sp[-1] = !sp[-1]; break;
+            case _UGB_EXPR_CPL: sp[-1] = ~sp[-1]; break;
+            case _UGB_EXPR_NEG: sp[-1] = -(uint32_t) sp[-1]; break;
+
+            default:
+                return UGB_ERR_BADEXPR;
+        }
+    }
+}
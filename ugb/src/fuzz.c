@@ -0,0 +1,249 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "fuzz.h"
+#include "cpu.h"
+#include "gpu.h"
+#include "mmu.h"
+#include "joypad.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+static uint64_t _now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Hit counts only matter by order of magnitude, so that looping one
+//   more time doesn't look like new behaviour
+static inline uint8_t _bucket(uint8_t hits)
+{
+    if (hits <= 3)   return hits == 3 ? 0x04 : hits;
+    if (hits <= 7)   return 0x08;
+    if (hits <= 15)  return 0x10;
+    if (hits <= 31)  return 0x20;
+    if (hits <= 127) return 0x40;
+    return 0x80;
+}
+
+static void _set_buttons(ugb_gbm* gbm, uint8_t buttons)
+{
+    ugb_joypad_release(gbm->joypad, ~buttons);
+    ugb_joypad_press(gbm->joypad, buttons);
+}
+
+// Play the inputs from wherever the machine is
+static int _play(ugb_gbm* gbm, ugb_batch_input const* inputs, size_t count, size_t frames, ugb_fuzz_result* res)
+{
+    int err = UGB_ERR_OK;
+    size_t start = gbm->gpu->frames;
+    uint64_t cycles = gbm->cycles;
+
+    gbm->cpu->coverage_prev = 0;
+
+    size_t next = 0;
+    size_t frame = 0;
+    while (frame < frames)
+    {
+        while (next < count && inputs[next].frame <= frame)
+            _set_buttons(gbm, inputs[next++].buttons);
+
+        size_t until = frames;
+        if (next < count && inputs[next].frame < until)
+            until = inputs[next].frame;
+
+        if ((err = ugb_gbm_run_frames(gbm, until - frame)) != UGB_ERR_OK)
+            break;
+        frame = until;
+    }
+
+    res->err = err;
+    res->frames = gbm->gpu->frames - start;
+    res->cycles = gbm->cycles - cycles;
+
+    return err;
+}
+
+static void _account(ugb_fuzz* fuzz, ugb_fuzz_result* res)
+{
+    size_t edges = 0;
+    size_t new_edges = 0;
+
+    // Most of the map is empty, go through it a word at a time
+    uint64_t const* words = (uint64_t const*) fuzz->coverage;
+    for (size_t i = 0; i < UGB_CPU_COVERAGE_SZ / 8; ++i)
+    {
+        if (!words[i])
+            continue;
+
+        for (size_t j = 8 * i; j < 8 * i + 8; ++j)
+        {
+            if (!fuzz->coverage[j])
+                continue;
+
+            uint8_t bucket = _bucket(fuzz->coverage[j]);
+            ++edges;
+
+            if (bucket & ~fuzz->seen[j])
+            {
+                ++new_edges;
+                fuzz->seen[j] |= bucket;
+            }
+        }
+    }
+
+    res->edges = edges;
+    res->new_edges = new_edges;
+}
+
+/******************/
+/*** Public API ***/
+/******************/
+
+ugb_fuzz* ugb_fuzz_create(ugb_gbm* gbm, int mode)
+{
+    if (!gbm || (mode != UGB_FUZZ_IN_PLACE && mode != UGB_FUZZ_FORK))
+        return 0;
+
+    ugb_fuzz* fuzz = malloc(sizeof(ugb_fuzz));
+    if (!fuzz)
+        return 0;
+
+    memset(fuzz, 0, sizeof(ugb_fuzz));
+    fuzz->gbm = gbm;
+    fuzz->mode = mode;
+
+    // The children write straight into the parent's coverage map
+    size_t shared = UGB_CPU_COVERAGE_SZ + sizeof(ugb_fuzz_result);
+    void* map = mmap(0, shared, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        free(fuzz);
+        return 0;
+    }
+
+    fuzz->coverage = map;
+    fuzz->child_result = (ugb_fuzz_result*) (fuzz->coverage + UGB_CPU_COVERAGE_SZ);
+
+    if (!(fuzz->seen = malloc(UGB_CPU_COVERAGE_SZ)))
+    {
+        ugb_fuzz_destroy(fuzz);
+        return 0;
+    }
+    memset(fuzz->seen, 0, UGB_CPU_COVERAGE_SZ);
+
+    // Trials only leave a few pages dirty, going back to the template
+    //   only copies those
+    if (mode == UGB_FUZZ_IN_PLACE)
+    {
+        if (!(fuzz->snapshot = malloc(sizeof(ugb_gbm_snapshot))))
+        {
+            ugb_fuzz_destroy(fuzz);
+            return 0;
+        }
+
+        memset(fuzz->snapshot, 0, sizeof(ugb_gbm_snapshot));
+        ugb_mmu_track_dirty(gbm->mmu, 1);
+        ugb_gbm_snapshot_save(gbm, fuzz->snapshot);
+    }
+
+    gbm->cpu->coverage = fuzz->coverage;
+
+    return fuzz;
+}
+
+void ugb_fuzz_destroy(ugb_fuzz* fuzz)
+{
+    if (fuzz)
+    {
+        if (fuzz->gbm->cpu->coverage == fuzz->coverage)
+            fuzz->gbm->cpu->coverage = 0;
+
+        if (fuzz->snapshot)
+            ugb_mmu_track_dirty(fuzz->gbm->mmu, 0);
+
+        munmap(fuzz->coverage, UGB_CPU_COVERAGE_SZ + sizeof(ugb_fuzz_result));
+        free(fuzz->snapshot);
+        free(fuzz->seen);
+        free(fuzz);
+    }
+}
+
+int ugb_fuzz_trial(ugb_fuzz* fuzz, ugb_batch_input const* inputs, size_t count, size_t frames, ugb_fuzz_result* res)
+{
+    if (!fuzz || (count && !inputs) || !res)
+        return UGB_ERR_BADARGS;
+
+    memset(res, 0, sizeof(ugb_fuzz_result));
+    memset(fuzz->coverage, 0, UGB_CPU_COVERAGE_SZ);
+
+    uint64_t start = _now();
+
+    if (fuzz->mode == UGB_FUZZ_IN_PLACE)
+    {
+        int err;
+        if ((err = ugb_gbm_snapshot_restore(fuzz->gbm, fuzz->snapshot)) != UGB_ERR_OK)
+            return err;
+
+        uint64_t ready = _now();
+        _play(fuzz->gbm, inputs, count, frames, res);
+
+        res->reset_ns = ready - start;
+        res->run_ns = _now() - ready;
+    }
+    else
+    {
+        memset(fuzz->child_result, 0, sizeof(ugb_fuzz_result));
+
+        pid_t pid = fork();
+        if (pid < 0)
+            return UGB_ERR_MALLOC;
+
+        if (!pid)
+        {
+            uint64_t ready = _now();
+            _play(fuzz->gbm, inputs, count, frames, fuzz->child_result);
+            fuzz->child_result->run_ns = _now() - ready;
+            _exit(0);
+        }
+
+        int status;
+        if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status))
+            return UGB_ERR_BADSTATE;
+
+        // Whatever wasn't spent running was spent forking and reaping
+        memcpy(res, fuzz->child_result, sizeof(ugb_fuzz_result));
+        uint64_t total = _now() - start;
+        res->reset_ns = total > res->run_ns ? total - res->run_ns : 0;
+    }
+
+    _account(fuzz, res);
+    ++fuzz->trials;
+
+    return UGB_ERR_OK;
+}
@@ -22,6 +22,9 @@
 #include "gpu.h"
 #include "timer.h"
 #include "joypad.h"
+#include "serial.h"
+#include "cart.h"
+#include "history.h"
 #include "constants.h"
 #include "errno.h"
 
@@ -45,7 +48,9 @@ ugb_gbm* ugb_gbm_create()
         !(gbm->gpu = ugb_gpu_create(gbm)) ||
         !(gbm->mmu = ugb_mmu_create(gbm)) ||
         !(gbm->timer = ugb_timer_create(gbm)) ||
-        !(gbm->joypad = ugb_joypad_create(gbm)))
+        !(gbm->joypad = ugb_joypad_create(gbm)) ||
+        !(gbm->serial = ugb_serial_create(gbm)) ||
+        !(gbm->cart = ugb_cart_create(gbm)))
     {
         goto fail;
     }
@@ -53,9 +58,12 @@ ugb_gbm* ugb_gbm_create()
     /*** Allocate internal GBM memory ***/
 
     if (!(gbm->mem.zpage = malloc(UGB_ZPAGE_SZ)) ||
-        !(gbm->mem.ram0 = malloc(UGB_RAM0_SZ)))
+        !(gbm->mem.ram0 = malloc(UGB_RAM0_SZ)) ||
+        !(gbm->mem.unused = malloc(UGB_UNUSED_SZ)))
         goto fail;
 
+    ugb_gbm_clear_memory(gbm);
+
     /*** Create internal memory maps ***/
 
     // Map the BIOS first
@@ -73,6 +81,15 @@ ugb_gbm* ugb_gbm_create()
     ram0->data = &gbm->mem.ram0[0];
     ugb_mmu_add_map(gbm->mmu, ram0);
 
+    // Map the RAM0 echo
+    ugb_mmu_map* echo;
+    if (!(echo = ugb_mmu_map_create(UGB_ECHO_LO, UGB_ECHO_HI)))
+        goto fail;
+    echo->type = UGB_MMU_DATA;
+    echo->data = &gbm->mem.ram0[0];
+    echo->dirty_addr = UGB_RAM0_LO;
+    ugb_mmu_add_map(gbm->mmu, echo);
+
     // Map the GPU's video RAM (character ram + BG maps 1 and 2)
     ugb_mmu_map* vram;
     if (!(vram = ugb_mmu_map_create(UGB_VRAM_LO, UGB_VRAM_HI)))
@@ -89,6 +106,14 @@ ugb_gbm* ugb_gbm_create()
     oam->data = gbm->gpu->oam;
     ugb_mmu_add_map(gbm->mmu, oam);
 
+    // Map the unusable area right after the OAM
+    ugb_mmu_map* unused;
+    if (!(unused = ugb_mmu_map_create(UGB_UNUSED_LO, UGB_UNUSED_HI)))
+        goto fail;
+    unused->type = UGB_MMU_DATA;
+    unused->data = &gbm->mem.unused[0];
+    ugb_mmu_add_map(gbm->mmu, unused);
+
     // Map hardware IO registers
     ugb_mmu_map* hwio;
     if (!(hwio = ugb_mmu_map_create(UGB_HWIO_LO, UGB_HWIO_HI)))
@@ -136,10 +161,13 @@ void ugb_gbm_destroy(ugb_gbm* gbm)
 {
     if (gbm)
     {
+        free(gbm->mem.unused);
         free(gbm->mem.zpage);
         free(gbm->mem.ram0);
 
         ugb_mmu_destroy(gbm->mmu);
+        ugb_cart_destroy(gbm->cart);
+        ugb_serial_destroy(gbm->serial);
         ugb_joypad_destroy(gbm->joypad);
         ugb_timer_destroy(gbm->timer);
         ugb_gpu_destroy(gbm->gpu);
@@ -157,6 +185,10 @@ int ugb_gbm_reset(ugb_gbm* gbm)
 
     // Enable the BIOS ROM
     gbm->mem.bios_map->type = UGB_MMU_RODATA;
+    gbm->cycles = 0;
+#ifdef UGB_PROFILE
+    ugb_prof_reset(&gbm->prof);
+#endif
 
     // Reset hardware components
     int err;
@@ -164,9 +196,60 @@ int ugb_gbm_reset(ugb_gbm* gbm)
         (err = ugb_gpu_reset(gbm->gpu)) != UGB_ERR_OK ||
         (err = ugb_timer_reset(gbm->timer)) != UGB_ERR_OK ||
         (err = ugb_joypad_reset(gbm->joypad)) != UGB_ERR_OK ||
+        (err = ugb_serial_reset(gbm->serial)) != UGB_ERR_OK ||
+        (err = ugb_cart_reset(gbm->cart)) != UGB_ERR_OK ||
         (err = ugb_hwio_reset(gbm->hwio)) != UGB_ERR_OK)
         return err;
 
+    // The recorded past doesn't lead here anymore
+    if (gbm->history)
+        ugb_history_reset(gbm->history);
+
+    // Components may have cleared their memory behind the MMU's back
+    return ugb_mmu_mark_dirty(gbm->mmu, 0x0000, 0xFFFF);
+}
+
+int ugb_gbm_clear_memory(ugb_gbm* gbm)
+{
+    if (!gbm)
+        return UGB_ERR_BADARGS;
+
+    memset(gbm->mem.ram0, 0, UGB_RAM0_SZ);
+    memset(gbm->mem.zpage, 0, UGB_ZPAGE_SZ);
+    memset(gbm->mem.unused, 0, UGB_UNUSED_SZ);
+    memset(gbm->gpu->vram, 0, UGB_VRAM_SZ);
+    memset(gbm->gpu->oam, 0, UGB_OAM_SZ);
+    memset(gbm->gpu->framebuf, 0, UGB_GPU_SCREEN_W * UGB_GPU_SCREEN_H);
+    memset(gbm->cart->ram, 0, gbm->cart->ram_size);
+
+    if (gbm->history)
+        ugb_history_reset(gbm->history);
+
+    return ugb_mmu_mark_dirty(gbm->mmu, 0x0000, 0xFFFF);
+}
+
+int ugb_gbm_skip_bios(ugb_gbm* gbm)
+{
+    if (!gbm)
+        return UGB_ERR_BADARGS;
+
+    int err;
+    if ((err = ugb_gbm_reset(gbm)) != UGB_ERR_OK)
+        return err;
+
+    // Registers as left by the DMG BIOS when jumping to the cartridge
+    ugb_cpu* cpu = gbm->cpu;
+    *cpu->regs.AF = 0x01B0;
+    *cpu->regs.BC = 0x0013;
+    *cpu->regs.DE = 0x00D8;
+    *cpu->regs.HL = 0x014D;
+    *cpu->regs.SP = 0xFFFE;
+    *cpu->regs.PC = 0x0100;
+
+    // Unmap the BIOS ROM as it would have done
+    gbm->hwio->data[UGB_HWIO_REG_BD] = 0x01;
+    gbm->mem.bios_map->type = UGB_MMU_NONE;
+
     return UGB_ERR_OK;
 }
 
@@ -178,18 +261,70 @@ int ugb_gbm_step(ugb_gbm* gbm, double* us)
     int err;
     size_t cycles = 0;
 
-    if ((err = ugb_cpu_step(gbm->cpu, &cycles)) != UGB_ERR_OK ||
-        (err = ugb_gpu_step(gbm->gpu, cycles)) != UGB_ERR_OK ||
-        (err = ugb_timer_step(gbm->timer, cycles)) != UGB_ERR_OK ||
-        (err = ugb_joypad_step(gbm->joypad)) != UGB_ERR_OK)
+    if (gbm->history && (err = ugb_history_record(gbm->history)) != UGB_ERR_OK)
+        return err;
+
+    UGB_PROF_BEGIN(&gbm->prof, UGB_PROF_CPU);
+    err = ugb_cpu_step(gbm->cpu, &cycles);
+    UGB_PROF_END(&gbm->prof, UGB_PROF_CPU);
+    if (err != UGB_ERR_OK)
         return err;
 
+    UGB_PROF_BEGIN(&gbm->prof, UGB_PROF_GPU);
+    err = ugb_gpu_step(gbm->gpu, cycles);
+    UGB_PROF_END(&gbm->prof, UGB_PROF_GPU);
+    if (err != UGB_ERR_OK)
+        return err;
+
+    UGB_PROF_BEGIN(&gbm->prof, UGB_PROF_TIMER);
+    if ((err = ugb_timer_step(gbm->timer, cycles)) == UGB_ERR_OK)
+        err = ugb_joypad_step(gbm->joypad);
+    UGB_PROF_END(&gbm->prof, UGB_PROF_TIMER);
+    if (err != UGB_ERR_OK)
+        return err;
+
+    gbm->cycles += cycles;
+
     if (us)
         *us = (cycles * 1000000.0L) / UGB_CPU_CLOCK_FREQ;
 
     return UGB_ERR_OK;
 }
 
+int ugb_gbm_run_frames(ugb_gbm* gbm, size_t frames)
+{
+    if (!gbm)
+        return UGB_ERR_BADARGS;
+
+    // Run until the GPU has entered VBlank the requested number of times
+    int err;
+    size_t target = gbm->gpu->frames + frames;
+    while (gbm->gpu->frames != target)
+    {
+        if ((err = ugb_gbm_step(gbm, 0)) != UGB_ERR_OK)
+            return err;
+    }
+
+    return UGB_ERR_OK;
+}
+
+int ugb_gbm_run_cycles(ugb_gbm* gbm, uint64_t cycles)
+{
+    if (!gbm)
+        return UGB_ERR_BADARGS;
+
+    // The last instruction may overshoot the requested count
+    int err;
+    uint64_t target = gbm->cycles + cycles;
+    while (gbm->cycles < target)
+    {
+        if ((err = ugb_gbm_step(gbm, 0)) != UGB_ERR_OK)
+            return err;
+    }
+
+    return UGB_ERR_OK;
+}
+
 int ugb_gbm_bdreg_hook(struct ugb_hwreg* reg, void* cookie)
 {
     if (!reg || !cookie)
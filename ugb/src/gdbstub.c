@@ -0,0 +1,893 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "gdbstub.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Signals as GDB numbers them
+#define _SIGINT  2
+#define _SIGILL  4
+#define _SIGTRAP 5
+#define _SIGSEGV 11
+
+// Resuming modes
+enum
+{
+    _CONTINUE,
+    _STEP,
+    _RANGE
+};
+
+static const char _target_xml[] =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<architecture>gbz80</architecture>"
+    "<feature name=\"org.gnu.gdb.z80.cpu\">"
+    "<reg name=\"af\" bitsize=\"16\" type=\"int\" regnum=\"0\"/>"
+    "<reg name=\"bc\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"de\" bitsize=\"16\" type=\"int\"/>"
+    "<reg name=\"hl\" bitsize=\"16\" type=\"data_ptr\"/>"
+    "<reg name=\"sp\" bitsize=\"16\" type=\"data_ptr\"/>"
+    "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+    "</feature>"
+    "</target>";
+
+static const char _hex[] = "0123456789abcdef";
+
+static int _unhex(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Parse hex digits up to something else, returns the number of digits
+static int _parse_hex(const char** str, unsigned long* value)
+{
+    int digits = 0;
+    for (*value = 0; _unhex(**str) >= 0; ++*str, ++digits)
+        *value = (*value << 4) | _unhex(**str);
+
+    return digits;
+}
+
+static uint16_t* _reg(ugb_gdbstub* stub, unsigned long n)
+{
+    ugb_cpu* cpu = stub->gbm->cpu;
+    switch (n)
+    {
+        case 0: return cpu->regs.AF;
+        case 1: return cpu->regs.BC;
+        case 2: return cpu->regs.DE;
+        case 3: return cpu->regs.HL;
+        case 4: return cpu->regs.SP;
+        case 5: return cpu->regs.PC;
+    }
+
+    return 0;
+}
+
+static char* _put_u16(char* out, uint16_t value)
+{
+    // Target byte order
+    *out++ = _hex[(value >> 4) & 0xF];
+    *out++ = _hex[value & 0xF];
+    *out++ = _hex[(value >> 12) & 0xF];
+    *out++ = _hex[(value >> 8) & 0xF];
+
+    return out;
+}
+
+static int _get_u16(const char* in, uint16_t* value)
+{
+    int digits[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        if ((digits[i] = _unhex(in[i])) < 0)
+            return 0;
+    }
+
+    *value = (digits[0] << 4) | digits[1] | (digits[2] << 12) | (digits[3] << 8);
+    return 1;
+}
+
+/*****************/
+/*** Transport ***/
+/*****************/
+
+// Next byte from GDB, -1 when the connection is gone
+static int _getc(ugb_gdbstub* stub)
+{
+    if (stub->rx_pos == stub->rx_len)
+    {
+        ssize_t len = read(stub->fd, &stub->rx[0], sizeof(stub->rx));
+        if (len <= 0)
+            return -1;
+
+        stub->rx_pos = 0;
+        stub->rx_len = len;
+    }
+
+    return stub->rx[stub->rx_pos++];
+}
+
+static int _write_all(ugb_gdbstub* stub, const char* data, size_t len)
+{
+    while (len)
+    {
+        ssize_t done = write(stub->fd, data, len);
+        if (done <= 0)
+            return UGB_ERR_NOENT;
+
+        data += done;
+        len -= done;
+    }
+
+    return UGB_ERR_OK;
+}
+
+static int _send(ugb_gdbstub* stub, const char* data)
+{
+    size_t len = strlen(data);
+
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; ++i)
+        sum += (uint8_t) data[i];
+
+    char trailer[3] = { '#', _hex[sum >> 4], _hex[sum & 0xF] };
+
+    for (;;)
+    {
+        int err;
+        if ((err = _write_all(stub, "$", 1)) != UGB_ERR_OK ||
+            (err = _write_all(stub, data, len)) != UGB_ERR_OK ||
+            (err = _write_all(stub, &trailer[0], 3)) != UGB_ERR_OK)
+        {
+            return err;
+        }
+
+        if (stub->no_ack)
+            return UGB_ERR_OK;
+
+        // Resend until acknowledged
+        int c;
+        while ((c = _getc(stub)) != '+' && c != '-')
+        {
+            if (c < 0)
+                return UGB_ERR_NOENT;
+        }
+
+        if (c == '+')
+            return UGB_ERR_OK;
+    }
+}
+
+// Read the next packet into stub->packet, unescaped and null-terminated
+static int _receive(ugb_gdbstub* stub)
+{
+    for (;;)
+    {
+        int c;
+        while ((c = _getc(stub)) != '$')
+        {
+            if (c < 0)
+                return UGB_ERR_NOENT;
+        }
+
+        size_t len = 0;
+        uint8_t sum = 0;
+        int overflow = 0;
+        while ((c = _getc(stub)) != '#')
+        {
+            if (c < 0)
+                return UGB_ERR_NOENT;
+
+            sum += c;
+            if (c == '}')
+            {
+                if ((c = _getc(stub)) < 0)
+                    return UGB_ERR_NOENT;
+                sum += c;
+                c ^= 0x20;
+            }
+
+            if (len < UGB_GDBSTUB_PACKET_SZ)
+                stub->packet[len++] = c;
+            else
+                overflow = 1;
+        }
+        stub->packet[len] = '\0';
+        stub->packet_len = len;
+
+        int hi = _getc(stub);
+        int lo = _getc(stub);
+        if (hi < 0 || lo < 0)
+            return UGB_ERR_NOENT;
+
+        int ok = !overflow && _unhex(hi) >= 0 && _unhex(lo) >= 0 && ((_unhex(hi) << 4) | _unhex(lo)) == sum;
+        if (stub->no_ack && ok)
+            return UGB_ERR_OK;
+
+        if (!stub->no_ack)
+        {
+            int err = _write_all(stub, ok ? "+" : "-", 1);
+            if (err != UGB_ERR_OK)
+                return err;
+
+            if (ok)
+                return UGB_ERR_OK;
+        }
+    }
+}
+
+// Whether GDB asked to stop, without waiting
+static int _interrupted(ugb_gdbstub* stub)
+{
+    struct pollfd pfd = { stub->fd, POLLIN, 0 };
+    while (stub->rx_pos < stub->rx_len || poll(&pfd, 1, 0) > 0)
+    {
+        int c = _getc(stub);
+        if (c < 0 || c == 0x03)
+            return 1;
+    }
+
+    return 0;
+}
+
+/*******************/
+/*** Watchpoints ***/
+/*******************/
+
+static int _watch_trap(void* cookie, int op, uint16_t addr, uint8_t data)
+{
+    ugb_gdbstub* stub = (ugb_gdbstub*) cookie;
+
+    // GDB has no idea of instruction fetches
+    if (op == UGB_MMU_FETCH || stub->poking || stub->watch_hit.type)
+        return UGB_ERR_OK;
+
+    for (size_t i = 0; i < stub->watch_count; ++i)
+    {
+        ugb_gdbstub_watch* watch = &stub->watches[i];
+        if (addr < watch->addr || addr - watch->addr >= watch->len)
+            continue;
+
+        if ((op == UGB_MMU_WRITE && watch->type != 3) ||
+            (op == UGB_MMU_READ && watch->type != 2))
+        {
+            // Stop once the instruction is done
+            stub->watch_hit.type = watch->type;
+            stub->watch_hit.addr = addr;
+            break;
+        }
+    }
+
+    return UGB_ERR_OK;
+}
+
+// Only the pages with watchpoints are trapped, and nothing when there
+//   are none
+static int _update_traps(ugb_gdbstub* stub)
+{
+    ugb_mmu* mmu = stub->gbm->mmu;
+
+    if (!stub->watch_count)
+    {
+        if (stub->trap >= 0)
+            ugb_mmu_remove_trap(mmu, stub->trap);
+        stub->trap = -1;
+        return UGB_ERR_OK;
+    }
+
+    if (stub->trap < 0)
+    {
+        int trap = ugb_mmu_add_trap(mmu, &_watch_trap, stub);
+        if (trap < 0)
+            return trap;
+        stub->trap = trap;
+    }
+
+    ugb_mmu_clear_traps(mmu, stub->trap);
+    for (size_t i = 0; i < stub->watch_count; ++i)
+    {
+        ugb_gdbstub_watch* watch = &stub->watches[i];
+        uint32_t last = (uint32_t) watch->addr + watch->len - 1;
+        ugb_mmu_trap_range(mmu, stub->trap, watch->addr, last > 0xFFFF ? 0xFFFF : last);
+    }
+
+    return UGB_ERR_OK;
+}
+
+// Insert or remove a breakpoint (types 0 and 1) or a watchpoint
+static int _set_point(ugb_gdbstub* stub, int insert, int type, uint16_t addr, uint16_t len)
+{
+    if (type <= 1)
+    {
+        if (insert)
+            stub->breakmap[addr >> 3] |= 1 << (addr & 7);
+        else
+            stub->breakmap[addr >> 3] &= ~(1 << (addr & 7));
+
+        return UGB_ERR_OK;
+    }
+
+    size_t i;
+    for (i = 0; i < stub->watch_count; ++i)
+    {
+        ugb_gdbstub_watch* watch = &stub->watches[i];
+        if (watch->addr == addr && watch->len == len && watch->type == type)
+            break;
+    }
+
+    if (insert)
+    {
+        if (i < stub->watch_count)
+            return UGB_ERR_OK;
+        if (stub->watch_count == UGB_GDBSTUB_MAX_WATCHES)
+            return UGB_ERR_NOSPACE;
+
+        ugb_gdbstub_watch* watch = &stub->watches[stub->watch_count++];
+        watch->addr = addr;
+        watch->len = len ? len : 1;
+        watch->type = type;
+    }
+    else
+    {
+        if (i == stub->watch_count)
+            return UGB_ERR_NOENT;
+
+        stub->watches[i] = stub->watches[--stub->watch_count];
+    }
+
+    return _update_traps(stub);
+}
+
+/*****************/
+/*** Execution ***/
+/*****************/
+
+static int _breakpoint_at(const ugb_gdbstub* stub, uint16_t pc)
+{
+    return stub->breakmap[pc >> 3] & (1 << (pc & 7));
+}
+
+// Stop reply, with the registers GDB wants right away
+static void _stop_reply(ugb_gdbstub* stub, char* out)
+{
+    static const char* const kinds[] = { "watch", "rwatch", "awatch" };
+
+    out += sprintf(out, "T%02x", stub->signal);
+    if (stub->watch_hit.type)
+        out += sprintf(out, "%s:%04x;", kinds[stub->watch_hit.type - 2], stub->watch_hit.addr);
+    else if (stub->signal == _SIGTRAP && _breakpoint_at(stub, *stub->gbm->cpu->regs.PC))
+        out += sprintf(out, "swbreak:;");
+
+    for (int n = 4; n <= 5; ++n)
+    {
+        out += sprintf(out, "%02x:", n);
+        out = _put_u16(out, *_reg(stub, n));
+        *out++ = ';';
+    }
+
+    sprintf(out, "thread:1;");
+}
+
+// Run until something stops us, the instruction we're at being run
+//   even if there's a breakpoint on it (that's what GDB resumes from).
+// Range stepping goes on while PC is within [low, high).
+static void _resume(ugb_gdbstub* stub, int mode, uint16_t low, uint16_t high)
+{
+    ugb_gbm* gbm = stub->gbm;
+    uint16_t* PC = gbm->cpu->regs.PC;
+
+    uint64_t poll_at = gbm->cycles + UGB_GDBSTUB_POLL_CYCLES;
+    stub->watch_hit.type = 0;
+    stub->signal = _SIGTRAP;
+
+    for (int first = 1; ; first = 0)
+    {
+        if (!first && _breakpoint_at(stub, *PC))
+            return;
+
+        int err = ugb_gbm_step(gbm, 0);
+        if (err != UGB_ERR_OK)
+        {
+            stub->signal = err == UGB_ERR_BADOP ? _SIGILL : _SIGSEGV;
+            return;
+        }
+
+        if (stub->watch_hit.type || mode == _STEP)
+            return;
+
+        if (mode == _RANGE && (*PC < low || *PC >= high))
+            return;
+
+        // Don't make a syscall per instruction
+        if (gbm->cycles >= poll_at)
+        {
+            if (_interrupted(stub))
+            {
+                stub->signal = _SIGINT;
+                return;
+            }
+            poll_at = gbm->cycles + UGB_GDBSTUB_POLL_CYCLES;
+        }
+    }
+}
+
+/***************/
+/*** Packets ***/
+/***************/
+
+static void _read_memory(ugb_gdbstub* stub, const char* args, char* out)
+{
+    unsigned long addr, len;
+    if (!_parse_hex(&args, &addr) || *args++ != ',' || !_parse_hex(&args, &len) || addr > 0xFFFF)
+    {
+        strcpy(out, "E01");
+        return;
+    }
+
+    // Whole pages in one go, as far as the packet allows
+    if (len > (UGB_GDBSTUB_PACKET_SZ - 4) / 2)
+        len = (UGB_GDBSTUB_PACKET_SZ - 4) / 2;
+    if (addr + len > 0x10000)
+        len = 0x10000 - addr;
+
+    size_t done;
+    for (done = 0; done < len; ++done)
+    {
+        uint8_t data;
+        if (ugb_mmu_peek(stub->gbm->mmu, addr + done, &data) != UGB_ERR_OK)
+            break;
+
+        *out++ = _hex[data >> 4];
+        *out++ = _hex[data & 0xF];
+    }
+
+    if (!done && len)
+        strcpy(out, "E14");
+    else
+        *out = '\0';
+}
+
+// Hex ('M') or binary ('X') data, written as the program would
+static void _write_memory(ugb_gdbstub* stub, const char* args, int binary, char* out)
+{
+    unsigned long addr, len;
+    if (!_parse_hex(&args, &addr) || *args++ != ',' || !_parse_hex(&args, &len) || *args++ != ':' ||
+        addr + len > 0x10000)
+    {
+        strcpy(out, "E01");
+        return;
+    }
+
+    // Check that all the data is there before writing any of it
+    size_t left = stub->packet_len - (args - &stub->packet[0]);
+    int ok = binary ? len <= left : len <= left / 2;
+    for (size_t i = 0; ok && !binary && i < 2 * len; ++i)
+        ok = _unhex(args[i]) >= 0;
+
+    if (!ok)
+    {
+        strcpy(out, "E01");
+        return;
+    }
+
+    stub->poking = 1;
+    for (size_t i = 0; i < len; ++i)
+    {
+        uint8_t data;
+        if (binary)
+            data = args[i];
+        else
+            data = (_unhex(args[2 * i]) << 4) | _unhex(args[2 * i + 1]);
+
+        if (ugb_mmu_write(stub->gbm->mmu, addr + i, data) != UGB_ERR_OK)
+        {
+            stub->poking = 0;
+            strcpy(out, "E14");
+            return;
+        }
+    }
+    stub->poking = 0;
+
+    strcpy(out, "OK");
+}
+
+static void _write_register(ugb_gdbstub* stub, unsigned long n, const char* value, char* out)
+{
+    uint16_t* reg = _reg(stub, n);
+    uint16_t data;
+    if (!reg || !_get_u16(value, &data))
+    {
+        strcpy(out, "E01");
+        return;
+    }
+
+    // The low nibble of F doesn't exist
+    *reg = n == 0 ? data & 0xFFF0 : data;
+    strcpy(out, "OK");
+}
+
+static void _query(ugb_gdbstub* stub, const char* packet, char* out)
+{
+    const char* features = "qXfer:features:read:target.xml:";
+
+    if (!strncmp(packet, "qSupported", 10))
+    {
+        sprintf(out, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+;swbreak+;hwbreak+;vContSupported+",
+            UGB_GDBSTUB_PACKET_SZ);
+    }
+    else if (!strncmp(packet, features, strlen(features)))
+    {
+        const char* args = packet + strlen(features);
+        unsigned long offset, len;
+        if (!_parse_hex(&args, &offset) || *args++ != ',' || !_parse_hex(&args, &len))
+        {
+            strcpy(out, "E01");
+            return;
+        }
+
+        size_t size = sizeof(_target_xml) - 1;
+        if (offset > size)
+            offset = size;
+        if (len > UGB_GDBSTUB_PACKET_SZ - 2)
+            len = UGB_GDBSTUB_PACKET_SZ - 2;
+
+        // 'm' for more to come, 'l' for the last chunk
+        int last = offset + len >= size;
+        if (last)
+            len = size - offset;
+
+        *out++ = last ? 'l' : 'm';
+        memcpy(out, &_target_xml[offset], len);
+        out[len] = '\0';
+    }
+    else if (!strcmp(packet, "QStartNoAckMode"))
+    {
+        strcpy(out, "OK");
+    }
+    else if (!strcmp(packet, "qAttached"))
+    {
+        strcpy(out, "1");
+    }
+    else if (!strcmp(packet, "qC"))
+    {
+        strcpy(out, "QC1");
+    }
+    else if (!strcmp(packet, "qfThreadInfo"))
+    {
+        strcpy(out, "m1");
+    }
+    else if (!strcmp(packet, "qsThreadInfo"))
+    {
+        strcpy(out, "l");
+    }
+    else
+    {
+        *out = '\0';
+    }
+}
+
+// Resuming packets, returns zero if the packet isn't understood
+static int _resume_packet(ugb_gdbstub* stub, const char* packet, char* out)
+{
+    unsigned long low = 0, high = 0;
+    int mode;
+
+    if (packet[0] == 'c' || packet[0] == 'C')
+    {
+        mode = _CONTINUE;
+    }
+    else if (packet[0] == 's' || packet[0] == 'S')
+    {
+        mode = _STEP;
+    }
+    else
+    {
+        // There's only one thread, the first action is for it
+        const char* action = packet + 6;
+        if (*action == 'c' || *action == 'C')
+        {
+            mode = _CONTINUE;
+        }
+        else if (*action == 's' || *action == 'S')
+        {
+            mode = _STEP;
+        }
+        else if (*action == 'r')
+        {
+            ++action;
+            if (!_parse_hex(&action, &low) || *action++ != ',' || !_parse_hex(&action, &high))
+                return 0;
+            mode = _RANGE;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    // "c addr" and "s addr" resume somewhere else
+    if (packet[0] == 'c' || packet[0] == 's')
+    {
+        const char* args = packet + 1;
+        unsigned long addr;
+        if (_parse_hex(&args, &addr))
+            *stub->gbm->cpu->regs.PC = addr;
+    }
+
+    _resume(stub, mode, low, high);
+    _stop_reply(stub, out);
+
+    return 1;
+}
+
+// Handle the packet, returns zero when the session is over
+static int _handle(ugb_gdbstub* stub)
+{
+    const char* packet = &stub->packet[0];
+    const char* args = packet + 1;
+    char* out = &stub->reply[0];
+    unsigned long n;
+
+    out[0] = '\0';
+    switch (packet[0])
+    {
+        case '?':
+            _stop_reply(stub, out);
+            break;
+
+        case 'g':
+            for (n = 0; n <= 5; ++n)
+                out = _put_u16(out, *_reg(stub, n));
+            *out = '\0';
+            break;
+
+        case 'G':
+            for (n = 0; n <= 5 && strlen(args) >= 4 * (n + 1); ++n)
+                _write_register(stub, n, args + 4 * n, out);
+            strcpy(out, "OK");
+            break;
+
+        case 'p':
+            if (!_parse_hex(&args, &n) || !_reg(stub, n))
+                strcpy(out, "E01");
+            else
+                *_put_u16(out, *_reg(stub, n)) = '\0';
+            break;
+
+        case 'P':
+            if (!_parse_hex(&args, &n) || *args++ != '=')
+                strcpy(out, "E01");
+            else
+                _write_register(stub, n, args, out);
+            break;
+
+        case 'm':
+            _read_memory(stub, args, out);
+            break;
+
+        case 'M':
+        case 'X':
+            _write_memory(stub, args, packet[0] == 'X', out);
+            break;
+
+        case 'Z':
+        case 'z':
+        {
+            unsigned long type, addr, len;
+            if (!_parse_hex(&args, &type) || *args++ != ',' || !_parse_hex(&args, &addr) ||
+                *args++ != ',' || !_parse_hex(&args, &len) || type > 4 || addr > 0xFFFF)
+            {
+                strcpy(out, "E01");
+            }
+            else if (_set_point(stub, packet[0] == 'Z', type, addr, len) != UGB_ERR_OK)
+            {
+                strcpy(out, "E0e");
+            }
+            else
+            {
+                strcpy(out, "OK");
+            }
+            break;
+        }
+
+        case 'c':
+        case 'C':
+        case 's':
+        case 'S':
+            _resume_packet(stub, packet, out);
+            break;
+
+        case 'v':
+            if (!strcmp(packet, "vCont?"))
+                strcpy(out, "vCont;c;C;s;S;r");
+            else if (!strncmp(packet, "vCont;", 6))
+                _resume_packet(stub, packet, out);
+            else if (!strncmp(packet, "vKill", 5))
+            {
+                _send(stub, "OK");
+                return 0;
+            }
+            break;
+
+        case 'H':
+        case 'T':
+            strcpy(out, "OK");
+            break;
+
+        case 'q':
+        case 'Q':
+            _query(stub, packet, out);
+            break;
+
+        case 'D':
+            _send(stub, "OK");
+            return 0;
+
+        case 'k':
+            return 0;
+    }
+
+    int err = _send(stub, &stub->reply[0]);
+
+    // Acks stop once the reply to the request went out
+    if (!strcmp(packet, "QStartNoAckMode"))
+        stub->no_ack = 1;
+
+    return err == UGB_ERR_OK;
+}
+
+/*****************/
+/*** Interface ***/
+/*****************/
+
+ugb_gdbstub* ugb_gdbstub_create(ugb_gbm* gbm, const char* where)
+{
+    if (!gbm || !where || !*where)
+        return 0;
+
+    ugb_gdbstub* stub = malloc(sizeof(ugb_gdbstub));
+    if (!stub)
+        return 0;
+
+    memset(stub, 0, sizeof(ugb_gdbstub));
+    stub->gbm = gbm;
+    stub->listen_fd = -1;
+    stub->fd = -1;
+    stub->trap = -1;
+    stub->signal = _SIGTRAP;
+
+    // A port number, or else a path
+    char* end = 0;
+    unsigned long port = strtoul(where, &end, 10);
+    if (!*end)
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        int one = 1;
+        stub->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (port > 0xFFFF || stub->listen_fd < 0 ||
+            setsockopt(stub->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+            bind(stub->listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+        {
+            ugb_gdbstub_destroy(stub);
+            return 0;
+        }
+    }
+    else
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(where) >= sizeof(addr.sun_path))
+        {
+            ugb_gdbstub_destroy(stub);
+            return 0;
+        }
+        strcpy(addr.sun_path, where);
+
+        // Replace a stale socket, but nothing else
+        struct stat st;
+        if (stat(where, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(where);
+
+        stub->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (stub->listen_fd < 0 || bind(stub->listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+        {
+            ugb_gdbstub_destroy(stub);
+            return 0;
+        }
+
+        if ((stub->path = malloc(strlen(where) + 1)))
+            strcpy(stub->path, where);
+    }
+
+    if (listen(stub->listen_fd, 1) < 0)
+    {
+        ugb_gdbstub_destroy(stub);
+        return 0;
+    }
+
+    return stub;
+}
+
+void ugb_gdbstub_destroy(ugb_gdbstub* stub)
+{
+    if (stub)
+    {
+        if (stub->trap >= 0)
+            ugb_mmu_remove_trap(stub->gbm->mmu, stub->trap);
+
+        if (stub->fd >= 0)
+            close(stub->fd);
+        if (stub->listen_fd >= 0)
+            close(stub->listen_fd);
+
+        if (stub->path)
+            unlink(stub->path);
+
+        free(stub->path);
+        free(stub);
+    }
+}
+
+int ugb_gdbstub_serve(ugb_gdbstub* stub)
+{
+    if (!stub)
+        return UGB_ERR_BADARGS;
+
+    if ((stub->fd = accept(stub->listen_fd, 0, 0)) < 0)
+        return UGB_ERR_NOENT;
+
+    stub->no_ack = 0;
+    stub->rx_pos = stub->rx_len = 0;
+    while (_receive(stub) == UGB_ERR_OK && _handle(stub));
+
+    // Nothing is left behind for a run without GDB
+    memset(&stub->breakmap[0], 0, sizeof(stub->breakmap));
+    stub->watch_count = 0;
+    _update_traps(stub);
+
+    close(stub->fd);
+    stub->fd = -1;
+
+    return UGB_ERR_OK;
+}
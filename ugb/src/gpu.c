@@ -78,6 +78,18 @@ int ugb_gpu_reset(ugb_gpu* gpu)
 
     //TODO: reset buffers and everything
     gpu->clock = 0;
+    gpu->frames = 0;
+
+    return UGB_ERR_OK;
+}
+
+int ugb_gpu_set_vblank_hook(ugb_gpu* gpu, int(*hook)(ugb_gpu*, void*), void* cookie)
+{
+    if (!gpu)
+        return UGB_ERR_BADARGS;
+
+    gpu->vblank_hook = hook;
+    gpu->vblank_cookie = cookie;
 
     return UGB_ERR_OK;
 }
@@ -246,7 +258,8 @@ int ugb_gpu_step(ugb_gpu* gpu, size_t cycles)
 
             case 3: // VRAM read
             {
-                if ((err = _render_scanline(gpu)) != UGB_ERR_OK)
+                if (!gpu->skip_render &&
+                    (err = _render_scanline(gpu)) != UGB_ERR_OK)
                     return err;
 
                 // Goto HBlank
@@ -263,9 +276,12 @@ int ugb_gpu_step(ugb_gpu* gpu, size_t cycles)
 
                     // After the last line, go to the VBlank mode
                     mode = 1;
+                    ++gpu->frames;
 
-                    //TODO: send frame to display
-                    //TODO: eventually use a double buffer ?
+                    // The frame is complete
+                    if (gpu->vblank_hook &&
+                        (err = (*gpu->vblank_hook)(gpu, gpu->vblank_cookie)) != UGB_ERR_OK)
+                        return err;
                 }
                 else
                 {
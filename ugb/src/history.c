@@ -0,0 +1,310 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "history.h"
+#include "mmu.h"
+#include "joypad.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+ugb_history* ugb_history_create(ugb_gbm* gbm, uint64_t interval, size_t snapshots)
+{
+    if (!gbm || !interval || !snapshots)
+        return 0;
+
+    ugb_history* hist = malloc(sizeof(ugb_history));
+    if (!hist)
+        return 0;
+
+    memset(hist, 0, sizeof(ugb_history));
+    hist->gbm = gbm;
+    hist->interval = interval;
+    hist->max_snaps = snapshots;
+
+    // Snapshots have to be zeroed before their first use
+    hist->snaps = calloc(snapshots, sizeof(ugb_history_snapshot));
+    if (!hist->snaps)
+    {
+        ugb_history_destroy(hist);
+        return 0;
+    }
+
+    // Going back to the latest snapshot only copies the pages written
+    //   since, which is what stepping back a few instructions does
+    ugb_mmu_track_dirty(gbm->mmu, 1);
+
+    ugb_history_reset(hist);
+
+    return hist;
+}
+
+void ugb_history_destroy(ugb_history* hist)
+{
+    if (hist)
+    {
+        if (hist->snaps)
+            ugb_mmu_track_dirty(hist->gbm->mmu, 0);
+
+        free(hist->inputs);
+        free(hist->snaps);
+        free(hist);
+    }
+}
+
+static ugb_history_snapshot* _snap(ugb_history* hist, size_t i)
+{
+    return &hist->snaps[(hist->first + i) % hist->max_snaps];
+}
+
+int ugb_history_reset(ugb_history* hist)
+{
+    if (!hist)
+        return UGB_ERR_BADARGS;
+
+    hist->step = 0;
+    hist->first = 0;
+    hist->count = 0;
+    hist->input_count = 0;
+    hist->buttons = hist->gbm->joypad->buttons;
+
+    // Take the first snapshot right away
+    hist->next_cycles = hist->gbm->cycles;
+
+    return UGB_ERR_OK;
+}
+
+static int _log_input(ugb_history* hist, uint8_t buttons)
+{
+    if (hist->input_count == hist->input_capacity)
+    {
+        size_t capacity = hist->input_capacity ? 2 * hist->input_capacity : 256;
+        ugb_history_input* inputs = realloc(hist->inputs, capacity * sizeof(ugb_history_input));
+        if (!inputs)
+            return UGB_ERR_MALLOC;
+
+        hist->inputs = inputs;
+        hist->input_capacity = capacity;
+    }
+
+    hist->inputs[hist->input_count].step = hist->step;
+    hist->inputs[hist->input_count].buttons = buttons;
+    ++hist->input_count;
+
+    return UGB_ERR_OK;
+}
+
+int ugb_history_record(ugb_history* hist)
+{
+    if (!hist)
+        return UGB_ERR_BADARGS;
+
+    ugb_gbm* gbm = hist->gbm;
+    int err;
+
+    // Time going backwards means the machine was reset or a state was
+    //   loaded behind our back, what we have doesn't lead here anymore
+    if (gbm->cycles + hist->interval < hist->next_cycles)
+        ugb_history_reset(hist);
+
+    uint8_t buttons = gbm->joypad->buttons;
+    if (buttons != hist->buttons)
+    {
+        if ((err = _log_input(hist, buttons)) != UGB_ERR_OK)
+            return err;
+        hist->buttons = buttons;
+    }
+
+    if (gbm->cycles >= hist->next_cycles)
+    {
+        // The oldest snapshot makes room when the ring is full
+        if (hist->count == hist->max_snaps)
+        {
+            hist->first = (hist->first + 1) % hist->max_snaps;
+            --hist->count;
+        }
+
+        ugb_history_snapshot* snap = _snap(hist, hist->count++);
+        snap->step = hist->step;
+        if ((err = ugb_gbm_snapshot_save(gbm, &snap->state)) != UGB_ERR_OK)
+            return err;
+
+        hist->next_cycles = gbm->cycles + hist->interval;
+
+        // Inputs up to the oldest snapshot are part of it
+        uint64_t oldest = _snap(hist, 0)->step;
+        size_t drop = 0;
+        while (drop < hist->input_count && hist->inputs[drop].step <= oldest)
+            ++drop;
+
+        if (drop)
+        {
+            hist->input_count -= drop;
+            memmove(&hist->inputs[0], &hist->inputs[drop], hist->input_count * sizeof(ugb_history_input));
+        }
+    }
+
+    ++hist->step;
+
+    return UGB_ERR_OK;
+}
+
+uint64_t ugb_history_oldest(const ugb_history* hist)
+{
+    if (!hist || !hist->count)
+        return hist ? hist->step : 0;
+
+    return hist->snaps[hist->first].step;
+}
+
+/**************/
+/*** Replay ***/
+/**************/
+
+// Press and release the buttons logged at the current position
+static void _apply_inputs(ugb_history* hist, size_t* input)
+{
+    ugb_joypad* joypad = hist->gbm->joypad;
+
+    for (; *input < hist->input_count && hist->inputs[*input].step == hist->step; ++*input)
+    {
+        uint8_t buttons = hist->inputs[*input].buttons;
+        ugb_joypad_press(joypad, buttons & ~joypad->buttons);
+        ugb_joypad_release(joypad, joypad->buttons & ~buttons);
+    }
+}
+
+static int _restore(ugb_history* hist, size_t i, size_t* input)
+{
+    ugb_history_snapshot* snap = _snap(hist, i);
+
+    int err = ugb_gbm_snapshot_restore(hist->gbm, &snap->state);
+    if (err != UGB_ERR_OK)
+        return err;
+
+    hist->step = snap->step;
+
+    // Those logged at the snapshot's position are in it already
+    for (*input = 0; *input < hist->input_count && hist->inputs[*input].step <= snap->step; ++*input);
+
+    return UGB_ERR_OK;
+}
+
+// Run the next instruction again, without recording it
+static int _advance(ugb_history* hist, size_t* input)
+{
+    ugb_gbm* gbm = hist->gbm;
+
+    struct ugb_history* attached = gbm->history;
+    gbm->history = 0;
+    int err = ugb_gbm_step(gbm, 0);
+    gbm->history = attached;
+
+    ++hist->step;
+    _apply_inputs(hist, input);
+
+    return err;
+}
+
+// Forget what comes after the current position
+static void _truncate(ugb_history* hist)
+{
+    while (hist->count && _snap(hist, hist->count - 1)->step > hist->step)
+        --hist->count;
+
+    while (hist->input_count && hist->inputs[hist->input_count - 1].step > hist->step)
+        --hist->input_count;
+
+    hist->buttons = hist->gbm->joypad->buttons;
+    hist->next_cycles = hist->count ? _snap(hist, hist->count - 1)->state.cycles + hist->interval : hist->gbm->cycles;
+}
+
+int ugb_history_seek(ugb_history* hist, uint64_t step)
+{
+    if (!hist || step > hist->step)
+        return UGB_ERR_BADARGS;
+
+    // Closest snapshot at or before the position
+    size_t i = hist->count;
+    while (i && _snap(hist, i - 1)->step > step)
+        --i;
+
+    if (!i)
+        return UGB_ERR_NOENT;
+
+    size_t input;
+    int err = _restore(hist, i - 1, &input);
+    while (err == UGB_ERR_OK && hist->step < step)
+        err = _advance(hist, &input);
+
+    _truncate(hist);
+
+    return err;
+}
+
+int ugb_history_find(ugb_history* hist, uint64_t before, int(*match)(void*, int), void* cookie)
+{
+    if (!hist || !match || before > hist->step)
+        return UGB_ERR_BADARGS;
+
+    if (!hist->count)
+        return UGB_ERR_NOENT;
+
+    // Replay one interval at a time, latest first, keeping the last match
+    uint64_t end = before;
+    for (size_t i = hist->count; i-- > 0; )
+    {
+        if (_snap(hist, i)->step >= end)
+            continue;
+
+        size_t input;
+        int err = _restore(hist, i, &input);
+
+        int found = 0;
+        uint64_t last = 0;
+        for (int after_step = 0; err == UGB_ERR_OK; after_step = 1)
+        {
+            if ((*match)(cookie, after_step))
+            {
+                found = 1;
+                last = hist->step;
+            }
+
+            if (hist->step + 1 >= end)
+                break;
+
+            err = _advance(hist, &input);
+        }
+
+        if (err != UGB_ERR_OK)
+        {
+            _truncate(hist);
+            return err;
+        }
+
+        if (found)
+            return ugb_history_seek(hist, last);
+
+        // Older intervals go up to the snapshot that follows them, which
+        //   is where what its step did shows
+        end = _snap(hist, i)->step + 1;
+    }
+
+    ugb_history_seek(hist, ugb_history_oldest(hist));
+    return UGB_ERR_NOENT;
+}
@@ -30,7 +30,7 @@ ugb_hwio* ugb_hwio_create(ugb_gbm* gbm)
         return 0;
 
     memset(hwio, 0, sizeof(ugb_hwio));
-    hwio->gbm = 0;
+    hwio->gbm = gbm;
 
     #define DEF_HWREG(offset, name_, reset_, wmask_, rmask_, umask_) \
     hwio->regs[0x ## offset].name = #name_; \
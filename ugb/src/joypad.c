@@ -24,6 +24,7 @@
 #include "errno.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 
 ugb_joypad* ugb_joypad_create(ugb_gbm* gbm)
@@ -61,7 +62,9 @@ int ugb_joypad_press(ugb_joypad* joypad, uint8_t keys)
 
     if (~(joypad->buttons & keys) & keys)
     {
+#ifdef UGB_VERBOSE
         printf("JOYPAD\n");
+#endif
         joypad->gbm->hwio->data[UGB_HWIO_REG_IF] |= UGB_REG_IE_X_MSK;
     }
 
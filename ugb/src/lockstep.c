@@ -0,0 +1,634 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "lockstep.h"
+#include "cpu.h"
+#include "opcodes.h"
+#include "constants.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define UGB_LOCKSTEP_MEM_LO 0x8000
+#define UGB_LOCKSTEP_MEM_SZ 0x8000
+
+/*********************/
+/*** Lane memories ***/
+/*********************/
+
+static inline uint8_t* _lane_mem(ugb_lockstep* ls, size_t lane, uint16_t addr)
+{
+    return &ls->mem[(size_t) (addr - UGB_LOCKSTEP_MEM_LO) * ls->lanes + lane];
+}
+
+static inline int _read(ugb_lockstep* ls, size_t lane, uint16_t addr, uint8_t* data)
+{
+    if (addr < UGB_LOCKSTEP_MEM_LO)
+    {
+        *data = addr < ls->rom_size ? ls->rom[addr] : 0xFF;
+        return UGB_ERR_OK;
+    }
+
+    if (addr >= UGB_ECHO_LO && addr <= UGB_ECHO_HI)
+        addr -= UGB_ECHO_LO - UGB_RAM0_LO;
+
+    if (addr == UGB_HWIO_LO)
+    {
+        // P1, low bits are the selected half of the buttons, active low
+        uint8_t select = *_lane_mem(ls, lane, addr) & 0x30;
+        uint8_t lines = 0x0F;
+        if (!(select & 0x10))
+            lines &= ~(ls->buttons[lane] & 0x0F);
+        if (!(select & 0x20))
+            lines &= ~(ls->buttons[lane] >> 4);
+
+        *data = 0xC0 | select | lines;
+        return UGB_ERR_OK;
+    }
+
+    if (addr == UGB_IEREG_LO)
+    {
+        *data = ls->ie[lane] & 0x1F;
+        return UGB_ERR_OK;
+    }
+
+    *data = *_lane_mem(ls, lane, addr);
+    return UGB_ERR_OK;
+}
+
+static inline int _write(ugb_lockstep* ls, size_t lane, uint16_t addr, uint8_t data)
+{
+    // There's no MBC to talk to
+    if (addr < UGB_LOCKSTEP_MEM_LO)
+        return UGB_ERR_OK;
+
+    if (addr >= UGB_ECHO_LO && addr <= UGB_ECHO_HI)
+        addr -= UGB_ECHO_LO - UGB_RAM0_LO;
+
+    if (addr == UGB_IEREG_LO)
+    {
+        ls->ie[lane] = (ls->ie[lane] & ~0x1F) | (data & 0x1F);
+        return UGB_ERR_OK;
+    }
+
+    *_lane_mem(ls, lane, addr) = data;
+    return UGB_ERR_OK;
+}
+
+static inline void _flag_masks(const char flags[], uint8_t* set, uint8_t* clr)
+{
+    static const uint8_t msk[4] = {
+        UGB_REG_F_Z_MSK,
+        UGB_REG_F_N_MSK,
+        UGB_REG_F_H_MSK,
+        UGB_REG_F_C_MSK
+    };
+
+    *set = 0;
+    *clr = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        if (flags[i] == '0') *clr |= msk[i];
+        else if (flags[i] == '1') *set |= msk[i];
+    }
+}
+
+/****************************************/
+/*** Opcode implementation, per lanes ***/
+/****************************************/
+
+// Same framework as opcodes.c, every name refers to the lane l. The
+//   registers are copied to locals around the microcode, so that the
+//   conditional flag updates can become selects. Pairs and their
+//   halves are separate locals : going through a byte pointer would
+//   keep the pair in memory, and the loop from being vectorized.
+#define SP  _sp
+#define SPl ((uint8_t*) &SP)[0]
+#define SPh ((uint8_t*) &SP)[1]
+#define PC  _pc
+#define PCl ((uint8_t*) &PC)[0]
+#define PCh ((uint8_t*) &PC)[1]
+#define IE  (ls->ie[l])
+#define AF  _af
+#define AFl _f
+#define AFh _a
+#define BC  _bc
+#define BCl _c
+#define BCh _b
+#define DE  _de
+#define DEl _e
+#define DEh _d
+#define HL  _hl
+#define HLl _l
+#define HLh _h
+#define A   AFh
+#define F   AFl
+#define B   BCh
+#define C   BCl
+#define D   DEh
+#define E   DEl
+#define H   HLh
+#define L   HLl
+
+#define cpu (&ls->cpu[l])
+
+#define d8  _imm8
+#define a8  _imm8
+#define r8  ((int8_t) _imm8)
+#define d16 _imm16
+#define a16 _imm16
+
+#define _fZ ((F & UGB_REG_F_Z_MSK) >> UGB_REG_F_Z_BIT)
+#define _fN ((F & UGB_REG_F_N_MSK) >> UGB_REG_F_N_BIT)
+#define _fH ((F & UGB_REG_F_H_MSK) >> UGB_REG_F_H_BIT)
+#define _fC ((F & UGB_REG_F_C_MSK) >> UGB_REG_F_C_BIT)
+
+// A lane failing a memory access stops after the instruction, the
+//   others go on
+#define r(addr, data) do { err |= _read(ls, l, (addr), (data)); } while (0);
+#define w(addr, data) do { err |= _write(ls, l, (addr), (data)); } while (0);
+
+#define _Za(x) do { \
+    if (x) F |= UGB_REG_F_Z_MSK; \
+    else   F &= ~UGB_REG_F_Z_MSK; \
+} while (0);
+
+#define _Ha(x) do { \
+    if (x) F |= UGB_REG_F_H_MSK; \
+    else   F &= ~UGB_REG_F_H_MSK; \
+} while (0);
+
+#define _Ca(x) do { \
+    if (x) F |= UGB_REG_F_C_MSK; \
+    else   F &= ~UGB_REG_F_C_MSK; \
+} while (0);
+
+#define _Zv(x) do { \
+    if (!(x)) F |= UGB_REG_F_Z_MSK; \
+    else      F &= ~UGB_REG_F_Z_MSK; \
+} while (0);
+
+#define _IF(cond, code, overhead) do { if ((cond)) { code; _cycles += (overhead); } } while (0);
+
+#define _EI() do { \
+    cpu->ei_delayed = 1; \
+} while (0);
+
+#define _DI() do { \
+    cpu->ei_delayed = 0; \
+    IE &= ~UGB_REG_IE_IME_MSK; \
+} while (0);
+
+// Lanes aren't profiled
+#define _CALLED()
+#define _RETURNING()
+
+extern const uint16_t mednafen_daa_lookup[];
+
+// An instruction writes a pair either whole or by halves, the one that
+//   changed is kept
+static inline uint16_t _pair(uint16_t old, uint16_t pair, uint8_t hi, uint8_t lo)
+{
+    return pair != old ? pair : (uint16_t) ((hi << 8) | lo);
+}
+
+// The lane arrays are passed as restrict parameters : the compiler
+//   then knows they don't overlap, and that the byte stores of the
+//   microcode can't change them nor the number of lanes
+#define _UGB_LANE_PARAMS \
+    ugb_lockstep* ls, size_t lanes, const uint8_t* restrict active, \
+    uint8_t _imm8, uint16_t _imm16, uint8_t set, uint8_t clr, \
+    uint16_t* restrict af, uint16_t* restrict bc, uint16_t* restrict de, \
+    uint16_t* restrict hl, uint16_t* restrict sp, uint16_t* restrict pc, \
+    uint64_t* restrict cycles, int* restrict errs
+
+#define _UGB_LANE_ARGS(active) \
+    ls, ls->lanes, (active), imm[0], imm[0] | (imm[1] << 8), set, clr, \
+    ls->af, ls->bc, ls->de, ls->hl, ls->sp, ls->pc, ls->cycles, ls->err
+
+#define _UGB_LANE_BODY(size_, cycles_, microcode) \
+    int __attribute__((unused)) err = 0; \
+    uint8_t __attribute__((unused)) t8 = 0; \
+    uint8_t __attribute__((unused)) t8_ = 0; \
+    uint16_t __attribute__((unused)) t16 = 0; \
+    uint16_t __attribute__((unused)) t16_ = 0; \
+    uint16_t __attribute__((unused)) v16_ = 0; \
+    uint32_t __attribute__((unused)) t32_ = 0; \
+    uint16_t _af = af[l], _bc = bc[l], _de = de[l], _hl = hl[l]; \
+    uint8_t _a = _af >> 8, _f = _af, _b = _bc >> 8, _c = _bc; \
+    uint8_t _d = _de >> 8, _e = _de, _h = _hl >> 8, _l = _hl; \
+    uint16_t _sp = sp[l], _pc = pc[l]; \
+    uint64_t _cycles = (cycles_); \
+    PC += (size_); \
+    microcode; \
+    _af = _pair(af[l], _af, _a, _f); \
+    af[l] = (_af & 0xFF00) | (((_af & ~clr) | set) & 0xF0); \
+    bc[l] = _pair(bc[l], _bc, _b, _c); \
+    de[l] = _pair(de[l], _de, _d, _e); \
+    hl[l] = _pair(hl[l], _hl, _h, _l); \
+    sp[l] = _sp; \
+    pc[l] = _pc; \
+    cycles[l] += _cycles; \
+    errs[l] = err;
+
+// Two versions of each opcode : one for all the lanes at once, where the
+//   active test folds away once inlined, and one for the active lanes
+//   only. Only register and ALU opcodes vectorize, memory accesses go
+//   through _read() and _write() which branch on the address.
+#define DEF_OPCODE(prefix, opcode, size_, cycles_, flags_, mnemonic_, microcode) \
+static inline __attribute__((always_inline)) \
+void _ugb_lockstep_lanes ## prefix ## opcode(_UGB_LANE_PARAMS) \
+{ \
+    for (size_t l = 0; l < lanes; ++l) \
+    { \
+        if (active && !active[l]) \
+            continue; \
+        _UGB_LANE_BODY(size_, cycles_, microcode) \
+    } \
+} \
+static void _ugb_lockstep_all ## prefix ## opcode(ugb_lockstep* ls, uint8_t imm[]) \
+{ \
+    uint8_t set, clr; \
+    _flag_masks((flags_), &set, &clr); \
+    _ugb_lockstep_lanes ## prefix ## opcode(_UGB_LANE_ARGS(0)); \
+} \
+static void _ugb_lockstep_some ## prefix ## opcode(ugb_lockstep* ls, uint8_t imm[]) \
+{ \
+    uint8_t set, clr; \
+    _flag_masks((flags_), &set, &clr); \
+    _ugb_lockstep_lanes ## prefix ## opcode(_UGB_LANE_ARGS(ls->active)); \
+}
+#include "opcodes.def"
+
+#undef _UGB_LANE_BODY
+#undef _UGB_LANE_ARGS
+#undef _UGB_LANE_PARAMS
+#undef _RETURNING
+#undef _CALLED
+#undef _DI
+#undef _EI
+#undef _IF
+#undef _Zv
+#undef _Ca
+#undef _Ha
+#undef _Za
+#undef w
+#undef r
+#undef _fC
+#undef _fH
+#undef _fN
+#undef _fZ
+#undef a16
+#undef d16
+#undef r8
+#undef a8
+#undef d8
+#undef cpu
+#undef L
+#undef H
+#undef E
+#undef D
+#undef C
+#undef B
+#undef F
+#undef A
+#undef HLh
+#undef HLl
+#undef HL
+#undef DEh
+#undef DEl
+#undef DE
+#undef BCh
+#undef BCl
+#undef BC
+#undef AFh
+#undef AFl
+#undef AF
+#undef IE
+#undef PCh
+#undef PCl
+#undef PC
+#undef SPh
+#undef SPl
+#undef SP
+
+/*********************/
+/*** Opcode tables ***/
+/*********************/
+
+typedef struct ugb_lockstep_op
+{
+    void(*all)(ugb_lockstep*, uint8_t[]);
+    void(*some)(ugb_lockstep*, uint8_t[]);
+} ugb_lockstep_op;
+
+// Same prefix selection trick as the tables in opcodes.c
+#define _UGB_LS_KEEP(...) __VA_ARGS__
+#define _UGB_LS_DROP(...)
+
+#define _UGB_LS_ENTRY(prefix_, opcode_) \
+    [0x ## opcode_] = { &_ugb_lockstep_all ## prefix_ ## opcode_, &_ugb_lockstep_some ## prefix_ ## opcode_ },
+
+#define _UGB_LS_TABLE_  _UGB_LS_KEEP
+#define _UGB_LS_TABLE_CB _UGB_LS_DROP
+
+static const ugb_lockstep_op _ops[0x100] =
+{
+#define DEF_OPCODE(prefix_, opcode_, ...) _UGB_LS_TABLE_ ## prefix_(_UGB_LS_ENTRY(prefix_, opcode_))
+#include "opcodes.def"
+};
+
+#undef _UGB_LS_TABLE_
+#undef _UGB_LS_TABLE_CB
+#define _UGB_LS_TABLE_  _UGB_LS_DROP
+#define _UGB_LS_TABLE_CB _UGB_LS_KEEP
+
+static const ugb_lockstep_op _opsCB[0x100] =
+{
+#define DEF_OPCODE(prefix_, opcode_, ...) _UGB_LS_TABLE_ ## prefix_(_UGB_LS_ENTRY(prefix_, opcode_))
+#include "opcodes.def"
+};
+
+/*****************/
+/*** Execution ***/
+/*****************/
+
+static inline int _runnable(ugb_lockstep* ls, size_t lane, uint64_t target)
+{
+    return !ls->err[lane] & (ls->cpu[lane].state == UGB_CPU_RUNNING) & (ls->cycles[lane] < target);
+}
+
+// Run one instruction for the group of lanes with the lowest PC, which
+//   lets lanes that went different ways meet again where the paths
+//   join. Returns 0 once every lane is done.
+static int _step(ugb_lockstep* ls, uint64_t target)
+{
+    size_t lanes = ls->lanes;
+
+    // Lowest and highest PC of the lanes still running
+    unsigned lo = 0x10000;
+    unsigned hi = 0;
+    size_t runnable = 0;
+    for (size_t l = 0; l < lanes; ++l)
+    {
+        unsigned ok = _runnable(ls, l, target);
+        unsigned pc = ls->pc[l];
+
+        runnable += ok;
+        lo = ok && pc < lo ? pc : lo;
+        hi = ok && pc > hi ? pc : hi;
+    }
+
+    if (!runnable)
+        return 0;
+
+    uint16_t pc = lo;
+    size_t lead = 0;
+    while (!_runnable(ls, lead, target) || ls->pc[lead] != pc)
+        ++lead;
+
+    // Decode once for the whole group
+    uint8_t code[4] = { 0, 0, 0, 0 };
+    _read(ls, lead, pc, &code[0]);
+
+    const ugb_opcode* opcode;
+    const ugb_lockstep_op* op;
+    int skip = 1;
+    if (code[0] != 0xCB)
+    {
+        opcode = &ugb_opcodes_table[code[0]];
+        op = &_ops[code[0]];
+    }
+    else
+    {
+        _read(ls, lead, pc + 1, &code[1]);
+        opcode = &ugb_opcodes_tableCB[code[1]];
+        op = &_opsCB[code[1]];
+        skip = 2;
+    }
+
+    for (int i = skip; i < opcode->size; ++i)
+        _read(ls, lead, pc + i, &code[i]);
+
+    // Every lane at the same place in the ROM is the fast path, only
+    //   build the list of lanes taking part otherwise (code outside of
+    //   the ROM may also differ between lanes)
+    int all = runnable == lanes && lo == hi && pc < UGB_LOCKSTEP_MEM_LO;
+    size_t count = lanes;
+    if (all)
+    {
+        memset(ls->active, 1, lanes);
+    }
+    else
+    {
+        count = 0;
+        for (size_t l = 0; l < lanes; ++l)
+        {
+            int same = _runnable(ls, l, target) && ls->pc[l] == pc;
+            for (int i = 0; same && pc >= UGB_LOCKSTEP_MEM_LO && i < opcode->size; ++i)
+            {
+                uint8_t byte;
+                _read(ls, l, pc + i, &byte);
+                same = byte == code[i];
+            }
+
+            ls->active[l] = same;
+            count += same;
+        }
+    }
+
+    if (!opcode->microcode)
+    {
+        for (size_t l = 0; l < lanes; ++l)
+        {
+            if (ls->active[l])
+                ls->err[l] = UGB_ERR_BADOP;
+        }
+        return 1;
+    }
+
+    // There are no interrupts, but keep IME right after EI / RETI
+    if (ls->ei_pending)
+    {
+        ls->ei_pending = 0;
+        for (size_t l = 0; l < lanes; ++l)
+        {
+            if (ls->cpu[l].ei_delayed && ls->active[l])
+            {
+                ls->ie[l] |= UGB_REG_IE_IME_MSK;
+                ls->cpu[l].ei_delayed = 0;
+            }
+
+            ls->ei_pending |= ls->cpu[l].ei_delayed;
+        }
+    }
+
+    if (all)
+        (*op->all)(ls, &code[skip]);
+    else
+        (*op->some)(ls, &code[skip]);
+
+    if (code[0] == 0xFB || code[0] == 0xD9)
+        ls->ei_pending = 1;
+
+    ls->instructions += count;
+    ++ls->groups;
+
+    return 1;
+}
+
+/******************/
+/*** Public API ***/
+/******************/
+
+ugb_lockstep* ugb_lockstep_create(size_t lanes)
+{
+    if (!lanes)
+        return 0;
+
+    ugb_lockstep* ls = malloc(sizeof(ugb_lockstep));
+    if (!ls)
+        return 0;
+
+    memset(ls, 0, sizeof(ugb_lockstep));
+    ls->lanes = lanes;
+
+    if (!(ls->af = malloc(lanes * sizeof(uint16_t))) ||
+        !(ls->bc = malloc(lanes * sizeof(uint16_t))) ||
+        !(ls->de = malloc(lanes * sizeof(uint16_t))) ||
+        !(ls->hl = malloc(lanes * sizeof(uint16_t))) ||
+        !(ls->sp = malloc(lanes * sizeof(uint16_t))) ||
+        !(ls->pc = malloc(lanes * sizeof(uint16_t))) ||
+        !(ls->ie = malloc(lanes)) ||
+        !(ls->cpu = malloc(lanes * sizeof(ugb_lockstep_cpu))) ||
+        !(ls->cycles = malloc(lanes * sizeof(uint64_t))) ||
+        !(ls->buttons = malloc(lanes)) ||
+        !(ls->err = malloc(lanes * sizeof(int))) ||
+        !(ls->mem = malloc(lanes * UGB_LOCKSTEP_MEM_SZ)) ||
+        !(ls->active = malloc(lanes)))
+    {
+        ugb_lockstep_destroy(ls);
+        return 0;
+    }
+
+    ugb_lockstep_reset(ls);
+
+    return ls;
+}
+
+void ugb_lockstep_destroy(ugb_lockstep* ls)
+{
+    if (ls)
+    {
+        free(ls->af);
+        free(ls->bc);
+        free(ls->de);
+        free(ls->hl);
+        free(ls->sp);
+        free(ls->pc);
+        free(ls->ie);
+        free(ls->cpu);
+        free(ls->cycles);
+        free(ls->buttons);
+        free(ls->err);
+        free(ls->mem);
+        free(ls->active);
+        free(ls);
+    }
+}
+
+int ugb_lockstep_reset(ugb_lockstep* ls)
+{
+    if (!ls)
+        return UGB_ERR_BADARGS;
+
+    size_t lanes = ls->lanes;
+
+    // Registers as left by the DMG BIOS, see ugb_gbm_skip_bios()
+    for (size_t l = 0; l < lanes; ++l)
+    {
+        ls->af[l] = 0x01B0;
+        ls->bc[l] = 0x0013;
+        ls->de[l] = 0x00D8;
+        ls->hl[l] = 0x014D;
+        ls->sp[l] = 0xFFFE;
+        ls->pc[l] = 0x0100;
+    }
+
+    memset(ls->ie, 0, lanes);
+    memset(ls->cpu, 0, lanes * sizeof(ugb_lockstep_cpu));
+    memset(ls->cycles, 0, lanes * sizeof(uint64_t));
+    memset(ls->buttons, 0, lanes);
+    memset(ls->err, 0, lanes * sizeof(int));
+    memset(ls->mem, 0, lanes * UGB_LOCKSTEP_MEM_SZ);
+
+    ls->ei_pending = 0;
+    ls->instructions = 0;
+    ls->groups = 0;
+
+    return UGB_ERR_OK;
+}
+
+int ugb_lockstep_load(ugb_lockstep* ls, uint8_t const* rom, size_t size)
+{
+    if (!ls || !rom || !size)
+        return UGB_ERR_BADARGS;
+
+    ls->rom = rom;
+    ls->rom_size = size;
+
+    return ugb_lockstep_reset(ls);
+}
+
+int ugb_lockstep_set_buttons(ugb_lockstep* ls, size_t lane, uint8_t buttons)
+{
+    if (!ls || lane >= ls->lanes)
+        return UGB_ERR_BADARGS;
+
+    ls->buttons[lane] = buttons;
+
+    return UGB_ERR_OK;
+}
+
+int ugb_lockstep_run(ugb_lockstep* ls, uint64_t cycles)
+{
+    if (!ls || !ls->rom)
+        return UGB_ERR_BADARGS;
+
+    // Every lane runs up to the same point in time
+    uint64_t target = 0;
+    for (size_t l = 0; l < ls->lanes; ++l)
+    {
+        if (ls->cycles[l] > target)
+            target = ls->cycles[l];
+    }
+    target += cycles;
+
+    while (_step(ls, target))
+        ;
+
+    // HALTed lanes would only have waited
+    for (size_t l = 0; l < ls->lanes; ++l)
+    {
+        if (!ls->err[l] && ls->cycles[l] < target)
+            ls->cycles[l] = target;
+    }
+
+    return UGB_ERR_OK;
+}
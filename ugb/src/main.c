@@ -22,10 +22,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
-#include <sys/mman.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
+#include <getopt.h>
 
 #include <SDL2/SDL.h>
 
@@ -34,8 +31,14 @@
 #include "hwio.h"
 #include "gpu.h"
 #include "joypad.h"
+#include "cart.h"
+#include "romcache.h"
 #include "opcodes.h"
 #include "gbm.h"
+#include "snapshot.h"
+#include "state.h"
+#include "rewind.h"
+#include "pacer.h"
 #include "debugger.h"
 #include "constants.h"
 #include "errno.h"
@@ -51,10 +54,32 @@ typedef struct ugb_context
 {
     ugb_gbm* gbm;
     ugb_debugger_interf* interf;
+    ugb_debugger* debugger;
 
     int state;
     int last_debugger_cmd;
 
+    // Run-ahead configuration, disabled if zero
+    size_t runahead;
+    ugb_gbm_snapshot* snapshot;
+
+    // Fast-forward configuration, speed is a multiplier of real
+    //   time or zero to run as fast as possible
+    int turbo;
+    double turbo_speed;
+
+    // Rewind history (hold BACKSPACE), disabled if null
+    ugb_rewind* rewind;
+    int rewinding;
+
+    // Quick save slot (F5 to save, F7 to load), empty if len is zero
+    uint8_t* quick_state;
+    size_t quick_state_len;
+
+    // Host-side frame pacing
+    ugb_pacer* pacer;
+    int vsync;
+
     pthread_mutex_t mutex;
 } ugb_context;
 
@@ -81,7 +106,8 @@ void* sdl_main(void* cookie)
         return 0;
     }
 
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, 0);
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1,
+        ctx->vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
 
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
@@ -97,13 +123,28 @@ void* sdl_main(void* cookie)
 
     SDL_Event event;
 
-    float perf_freq = SDL_GetPerformanceFrequency();
-    float last_perf = 0.0;
+    ugb_pacer* pacer = ctx->pacer;
+    ugb_pacer_reset(pacer);
+
+    // Lock the emulated rate onto the display if asked to, after the
+    //   reset which puts it back to nominal
+    if (ctx->vsync)
+    {
+        SDL_DisplayMode mode;
+        if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0 &&
+            mode.refresh_rate > 0)
+            ugb_pacer_vsync_feedback(pacer, mode.refresh_rate);
+    }
 
-    double cpu_timer = 0.0;
-    double sync_freq = 60.0;
+    // Emulated time is accounted in whole CPU cycles, each host tick
+    //   grants CLOCK_FREQ / sync_freq of them and the remainder is
+    //   carried over so that nothing drifts
+    const uint64_t sync_freq = 60;
+    uint64_t cycle_acc = 0;
+    uint64_t cycle_target = gbm->cycles;
 
-    double sync_usecs = 1e6 / sync_freq;
+    // Fractional count of hidden frames to run in turbo mode
+    double turbo_frames = 0.0;
 
     for (;;)
     {
@@ -131,6 +172,30 @@ void* sdl_main(void* cookie)
                     case SDLK_z:      ugb_joypad_press(gbm->joypad, UGB_JOYPAD_B); break;
                     case SDLK_SPACE:  ugb_joypad_press(gbm->joypad, UGB_JOYPAD_START); break;
                     case SDLK_RETURN: ugb_joypad_press(gbm->joypad, UGB_JOYPAD_SELECT); break;
+
+                    case SDLK_TAB:    ctx->turbo = 1; break;
+                    case SDLK_BACKSPACE: ctx->rewinding = ctx->rewind != 0; break;
+
+                    case SDLK_F5:
+                    {
+                        ssize_t len = ugb_gbm_save_state(gbm, ctx->quick_state, ugb_gbm_state_size(gbm));
+                        if (len < 0)
+                            printf("Error: %s\n", ugb_strerror(len));
+                        else
+                            ctx->quick_state_len = len;
+                        break;
+                    }
+
+                    case SDLK_F7:
+                    {
+                        int err;
+                        if (ctx->quick_state_len &&
+                            (err = ugb_gbm_load_state(gbm, ctx->quick_state, ctx->quick_state_len)) != UGB_ERR_OK)
+                        {
+                            printf("Error: %s\n", ugb_strerror(err));
+                        }
+                        break;
+                    }
                 }
                 break;
             }
@@ -148,23 +213,86 @@ void* sdl_main(void* cookie)
                     case SDLK_z:      ugb_joypad_release(gbm->joypad, UGB_JOYPAD_B); break;
                     case SDLK_SPACE:  ugb_joypad_release(gbm->joypad, UGB_JOYPAD_START); break;
                     case SDLK_RETURN: ugb_joypad_release(gbm->joypad, UGB_JOYPAD_SELECT); break;
+
+                    case SDLK_TAB:    ctx->turbo = 0; turbo_frames = 0.0; break;
+                    case SDLK_BACKSPACE: ctx->rewinding = 0; break;
                 }
                 break;
             }
         }
 
+        cycle_acc += (uint64_t) UGB_CPU_CLOCK_FREQ;
+        cycle_target += cycle_acc / sync_freq;
+        cycle_acc %= sync_freq;
+
+        /**************/
+        /*** Rewind ***/
+        /**************/
+
+        // Go back one captured state per host refresh instead of running,
+        //   the framebuffer isn't part of the state so draw one frame
+        if (ctx->rewinding && ctx->state == UGB_CTX_RUNNING)
+        {
+            if (ugb_rewind_step_back(ctx->rewind) == UGB_ERR_OK)
+                ugb_gbm_run_frames(gbm, 1);
+
+            cycle_target = gbm->cycles;
+        }
+
+        /********************/
+        /*** Fast-forward ***/
+        /********************/
+
+        // Run whole frames without drawing them before the presented slice,
+        //   either a fixed amount per host refresh or as many as fit in it.
+        // They don't go through the debugger's checks, it's off while
+        //   there are breakpoints or watchpoints.
+        int armed = interf && ugb_debugger_armed(interf);
+        if (ctx->turbo && !ctx->rewinding && ctx->state == UGB_CTX_RUNNING && !armed)
+        {
+            int err = UGB_ERR_OK;
+            uint64_t hidden = gbm->cycles;
+            gbm->gpu->skip_render = 1;
+
+            if (ctx->turbo_speed > 0.0)
+            {
+                turbo_frames += ctx->turbo_speed - 1.0;
+                if (turbo_frames >= 1.0)
+                {
+                    size_t frames = (size_t) turbo_frames;
+                    turbo_frames -= frames;
+                    err = ugb_gbm_run_frames(gbm, frames);
+                }
+            }
+            else
+            {
+                uint64_t start = ugb_pacer_now();
+                while (err == UGB_ERR_OK && ugb_pacer_now() - start < pacer->period_ns)
+                    err = ugb_gbm_run_frames(gbm, 1);
+            }
+
+            gbm->gpu->skip_render = 0;
+
+            // Hidden frames don't eat into the presented slice
+            cycle_target += gbm->cycles - hidden;
+
+            if (err != UGB_ERR_OK)
+                printf("Error: %s\n", ugb_strerror(err));
+        }
+
         /**********************/
         /*** Execution loop ***/
         /**********************/
 
-        while (ctx->state != UGB_CTX_STOPPED && cpu_timer < sync_usecs)
+        while (ctx->state != UGB_CTX_STOPPED && gbm->cycles < cycle_target)
         {
             if (ctx->state != UGB_CTX_STOPPED)
             {
-                // Get current status from debugger
+                // Get current status from debugger, only when there's
+                //   a breakpoint here
                 int sts = UGB_STS_CONTINUE;
-                if (interf && interf->status)
-                    sts = (*interf->status)(ctx->last_debugger_cmd, interf->cookie);
+                if (interf && interf->status && ugb_debugger_break_at(interf, *gbm->cpu->regs.PC))
+                    sts = (*interf->status)(ctx->last_debugger_cmd, interf->status_cookie);
 
                 if (sts == UGB_STS_STOP)
                     ctx->state = UGB_CTX_STOPPED;
@@ -172,11 +300,8 @@ void* sdl_main(void* cookie)
                 if (ctx->state != UGB_CTX_STOPPED)
                 {
                     int err;
-                    double usecs = 0.0;
-                    if ((err = ugb_gbm_step(gbm, &usecs)) != UGB_ERR_OK)
+                    if ((err = ugb_gbm_step(gbm, 0)) != UGB_ERR_OK)
                         printf("Error: %s\n", ugb_strerror(err));
-
-                    cpu_timer += usecs;
                 }
             }
 
@@ -184,6 +309,52 @@ void* sdl_main(void* cookie)
                 ctx->state = UGB_CTX_STOPPED;
         }
 
+        if (interf)
+            interf->running = ctx->state != UGB_CTX_STOPPED;
+
+        // Only the real timeline goes in the history
+        if (ctx->rewind && !ctx->rewinding && ctx->state == UGB_CTX_RUNNING)
+        {
+            int err;
+            if ((err = ugb_rewind_update(ctx->rewind)) != UGB_ERR_OK)
+                printf("Error: %s\n", ugb_strerror(err));
+        }
+
+        /*****************/
+        /*** Run-ahead ***/
+        /*****************/
+
+        // Speculatively run the next frames with the current input, only
+        //   drawing the last one, then go back to the real timeline. The
+        //   history mustn't record frames that are about to be undone,
+        //   and the debugger mustn't stop on what happens in them.
+        int ahead = ctx->runahead && ctx->state == UGB_CTX_RUNNING && !armed;
+        ugb_history* history = gbm->history;
+        if (ahead)
+        {
+            int err;
+            if ((err = ugb_gbm_snapshot_save(gbm, ctx->snapshot)) != UGB_ERR_OK)
+            {
+                printf("Error: %s\n", ugb_strerror(err));
+                ahead = 0;
+            }
+            else
+            {
+                gbm->history = 0;
+                gbm->gpu->skip_render = 1;
+                if ((err = ugb_gbm_run_frames(gbm, ctx->runahead - 1)) == UGB_ERR_OK)
+                {
+                    gbm->gpu->skip_render = 0;
+                    err = ugb_gbm_run_frames(gbm, 1);
+                }
+                gbm->gpu->skip_render = 0;
+                gbm->history = history;
+
+                if (err != UGB_ERR_OK)
+                    printf("Error: %s\n", ugb_strerror(err));
+            }
+        }
+
         /***************************/
         /*** Display framebuffer ***/
         /***************************/
@@ -194,32 +365,22 @@ void* sdl_main(void* cookie)
         SDL_RenderCopy(renderer, tex, 0, 0);
         SDL_RenderPresent(renderer);
 
+        if (ahead)
+            ugb_gbm_snapshot_restore(gbm, ctx->snapshot);
+
         /********************/
         /*** Speed adjust ***/
         /********************/
 
-        if (ctx->state != UGB_CTX_STOPPED)
-        {
-            float perf = SDL_GetPerformanceCounter();
-            double usecs = (1e6 * (perf - last_perf)) / perf_freq;
-            last_perf = perf;
-
-            double to_sleep = 0.0;
-            while (cpu_timer >= sync_usecs)
-            {
-                cpu_timer -= sync_usecs;
-                to_sleep += sync_usecs;
-            }
+        // Don't accumulate emulated time while stopped
+        if (ctx->state == UGB_CTX_STOPPED)
+            cycle_target = gbm->cycles;
 
-            if (to_sleep < usecs)
-                ; // printf("Overshoot.\n");
-            else
-                SDL_Delay((to_sleep - usecs) / 1e3);
-        }
+        // Unthrottled, the hidden frames already filled the host refresh
+        if (ctx->turbo && ctx->turbo_speed <= 0.0 && ctx->state == UGB_CTX_RUNNING)
+            ugb_pacer_resync(pacer);
         else
-        {
-            SDL_Delay(10);
-        }
+            ugb_pacer_wait(pacer);
     }
 
     SDL_DestroyWindow(window);
@@ -254,67 +415,125 @@ int debugger_command(int cmd, void* cookie)
 void* debugger_main(void* arg)
 {
     ugb_context* ctx = (ugb_context*) arg;
-    ugb_debugger_mainloop(ctx->gbm, ctx->interf);
+    if (!(ctx->debugger = ugb_debugger_create(ctx->gbm, ctx->interf)))
+        return 0;
+
+    ugb_debugger_mainloop(ctx->debugger);
 
     return 0;
 }
 
+static void usage(const char* prog)
+{
+    printf("Usage: '%s [-r frames] [-t speed] [-w usecs] [-v] [-R megs] <rom>'.\n", prog);
+    printf("  -r frames  Run-ahead by this many frames to hide input latency\n");
+    printf("  -t speed   Fast-forward speed while TAB is held (0 = unlimited, default)\n");
+    printf("  -w usecs   Busy-wait this long before each frame deadline\n");
+    printf("  -v         Sync to the display refresh, adjusting speed by up to 0.5%%\n");
+    printf("  -R megs    Keep this much rewind history, BACKSPACE goes back (0 = off, default)\n");
+}
+
 int main(int argc, char** argv)
 {
-    if (argc < 2)
+    size_t runahead = 0;
+    double turbo_speed = 0.0;
+    long spin_usecs = 0;
+    int vsync = 0;
+    long rewind_megs = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:t:w:vR:")) != -1)
     {
-        printf("Usage: '%s <rom>'.\n", argv[0]);
-        return 0;
+        switch (opt)
+        {
+            case 'r':
+            {
+                char* end = 0;
+                long frames = strtol(optarg, &end, 0);
+                if (!end || end == optarg || *end || frames < 0)
+                {
+                    printf("Invalid run-ahead frame count \"%s\".\n", optarg);
+                    return 0;
+                }
+                runahead = frames;
+                break;
+            }
+
+            case 't':
+            {
+                char* end = 0;
+                double speed = strtod(optarg, &end);
+                if (!end || end == optarg || *end || speed < 0.0 ||
+                    (speed > 0.0 && speed < 1.0))
+                {
+                    printf("Invalid fast-forward speed \"%s\".\n", optarg);
+                    return 0;
+                }
+                turbo_speed = speed;
+                break;
+            }
+
+            case 'w':
+            {
+                char* end = 0;
+                spin_usecs = strtol(optarg, &end, 0);
+                if (!end || end == optarg || *end || spin_usecs < 0)
+                {
+                    printf("Invalid busy-wait time \"%s\".\n", optarg);
+                    return 0;
+                }
+                break;
+            }
+
+            case 'v':
+                vsync = 1;
+                break;
+
+            case 'R':
+            {
+                char* end = 0;
+                rewind_megs = strtol(optarg, &end, 0);
+                if (!end || end == optarg || *end || rewind_megs < 0)
+                {
+                    printf("Invalid rewind budget \"%s\".\n", optarg);
+                    return 0;
+                }
+                break;
+            }
+
+            default:
+                usage(argv[0]);
+                return 0;
+        }
     }
 
-    // Get input file, map it
-    int fd = open(argv[1], O_RDONLY);
-    if (fd < 0)
+    if (optind >= argc)
     {
-        printf("Unable to open \"%s\".\n", argv[1]);
+        usage(argv[0]);
         return 0;
     }
 
-    struct stat sb;
-    fstat(fd, &sb);
-    void* file = mmap(0, sb.st_size, PROT_WRITE, MAP_PRIVATE, fd, 0);
+    const char* rom_path = argv[optind];
+
+    // Get input file, map it (read-only)
+    ugb_romcache* romcache = ugb_romcache_create();
+    ugb_rom* rom = 0;
+    if (!romcache || ugb_romcache_open(romcache, rom_path, &rom) != UGB_ERR_OK)
+    {
+        printf("Unable to open \"%s\".\n", rom_path);
+        return 0;
+    }
 
     // Create a fresh GameBoy
     ugb_gbm* gbm = ugb_gbm_create();
 
-    // Add the cartridge map
-    ugb_mmu_map* rom0 = malloc(sizeof(ugb_mmu_map));
-    rom0->low_addr = UGB_CART_ROM0_LO;
-    rom0->high_addr = 0x7FFF;
-    rom0->type = UGB_MMU_DATA;
-    rom0->data = file;
-    ugb_mmu_add_map(gbm->mmu, rom0);
-
-    // Map RAM1
-    uint8_t ram1_data[0x2000];
-    ugb_mmu_map* ram1 = malloc(sizeof(ugb_mmu_map));
-    ram1->low_addr = 0xA000;
-    ram1->high_addr = 0xBFFF;
-    ram1->type = UGB_MMU_DATA;
-    ram1->data = &ram1_data[0];
-    ugb_mmu_add_map(gbm->mmu, ram1);
-
-    // Map echo internal RAM0
-    ugb_mmu_map* ram0 = malloc(sizeof(ugb_mmu_map));
-    ram0->low_addr = 0xE000;
-    ram0->high_addr = 0xFDFF;
-    ram0->type = UGB_MMU_DATA;
-    ram0->data = &gbm->mem.ram0[0];
-    ugb_mmu_add_map(gbm->mmu, ram0);
-
-    // Map echo internal RAM0
-    uint8_t ill_data[0x60];
-    ugb_mmu_map* ill = malloc(sizeof(ugb_mmu_map));
-    ill->low_addr = 0xFEA0;
-    ill->high_addr = 0xFEFF;
-    ill->type = UGB_MMU_DATA;
-    ill->data = &ill_data[0];
-    ugb_mmu_add_map(gbm->mmu, ill);
+    // Insert the cartridge
+    int err;
+    if ((err = ugb_cart_load(gbm->cart, rom->data, rom->size)) != UGB_ERR_OK)
+    {
+        printf("Error: %s\n", ugb_strerror(err));
+        return 0;
+    }
 
     /*************************************************************/
 
@@ -325,7 +544,60 @@ int main(int argc, char** argv)
     ctx.interf->cookie = &ctx;
     ctx.interf->command = &debugger_command;
     ctx.interf->status = 0;
+    ctx.interf->status_cookie = 0;
+    ctx.interf->breakmap = 0;
+    ctx.interf->watching = 0;
+    ctx.interf->pending = 0;
+    ctx.interf->running = 1;
+    ctx.debugger = 0;
     ctx.gbm = gbm;
+    ctx.state = UGB_CTX_RUNNING;
+    ctx.last_debugger_cmd = UGB_CMD_CONTINUE;
+
+    ctx.runahead = runahead;
+    ctx.turbo = 0;
+    ctx.turbo_speed = turbo_speed;
+    ctx.vsync = vsync;
+
+    if (!(ctx.pacer = ugb_pacer_create(60.0)))
+    {
+        printf("Error: %s\n", ugb_strerror(UGB_ERR_MALLOC));
+        return 0;
+    }
+    ctx.pacer->mode = vsync ? UGB_PACER_VSYNC : UGB_PACER_FREE;
+    ctx.pacer->spin_ns = spin_usecs * 1000;
+
+    ctx.rewinding = 0;
+    ctx.rewind = 0;
+    // Capture every other frame, 32M hold well over a minute
+    if (rewind_megs && !(ctx.rewind = ugb_rewind_create(gbm, rewind_megs << 20, 2)))
+    {
+        printf("Error: %s\n", ugb_strerror(UGB_ERR_MALLOC));
+        return 0;
+    }
+
+    ctx.quick_state_len = 0;
+    if (!(ctx.quick_state = malloc(ugb_gbm_state_size(gbm))))
+    {
+        printf("Error: %s\n", ugb_strerror(UGB_ERR_MALLOC));
+        return 0;
+    }
+
+    // The snapshot is big, allocate it once and for all
+    ctx.snapshot = 0;
+    if (runahead && !(ctx.snapshot = malloc(sizeof(ugb_gbm_snapshot))))
+    {
+        printf("Error: %s\n", ugb_strerror(UGB_ERR_MALLOC));
+        return 0;
+    }
+
+    // Run-ahead goes back to the same snapshot every frame, only copy
+    //   the pages written in between
+    if (runahead)
+    {
+        memset(ctx.snapshot, 0, sizeof(ugb_gbm_snapshot));
+        ugb_mmu_track_dirty(gbm->mmu, 1);
+    }
 
     // Start SDL display thread
     pthread_t debugger;
@@ -333,11 +605,27 @@ int main(int argc, char** argv)
 
     sdl_main((void*) &ctx);
 
+    ugb_pacer_stats* stats = &ctx.pacer->stats;
+    if (stats->ticks)
+    {
+        printf("Pacing: %llu frames, %llu missed deadlines, jitter %.1f us avg / %.1f us max.\n",
+            (unsigned long long) stats->ticks, (unsigned long long) stats->missed,
+            stats->jitter_sum_ns / 1e3 / stats->ticks, stats->jitter_max_ns / 1e3);
+    }
+
     // Cleanup
     pthread_mutex_destroy(&ctx.mutex);
+    ugb_debugger_destroy(ctx.debugger);
+    free(ctx.interf);
+    if (ctx.snapshot)
+        ugb_mmu_track_dirty(gbm->mmu, 0);
+    free(ctx.snapshot);
+    free(ctx.quick_state);
+    ugb_rewind_destroy(ctx.rewind);
+    ugb_pacer_destroy(ctx.pacer);
     ugb_gbm_destroy(gbm);
-    munmap(file, sb.st_size);
-    close(fd);
+    ugb_romcache_close(romcache, rom);
+    ugb_romcache_destroy(romcache);
 
     return 0;
 }
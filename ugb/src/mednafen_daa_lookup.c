@@ -2,7 +2,7 @@
 
 // Credits to mednafen for this wonderful table
 // https://github.com/libretro-mirrors/mednafen-git/blob/master/src/gb/gbCodes.h
-uint16_t mednafen_daa_lookup[] = {
+const uint16_t mednafen_daa_lookup[] = {
   0x0080,0x0100,0x0200,0x0300,0x0400,0x0500,0x0600,0x0700,
   0x0800,0x0900,0x1000,0x1100,0x1200,0x1300,0x1400,0x1500,
   0x1000,0x1100,0x1200,0x1300,0x1400,0x1500,0x1600,0x1700,
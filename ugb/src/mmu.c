@@ -61,7 +61,10 @@ ugb_mmu_map* ugb_mmu_map_create(uint16_t low_addr, uint16_t high_addr)
 
     map->low_addr = low_addr;
     map->high_addr = high_addr;
+    map->dirty_addr = low_addr;
     map->type = UGB_MMU_NONE;
+    map->ro_write.handler = 0;
+    map->ro_write.cookie = 0;
 
     return map;
 }
@@ -114,7 +117,7 @@ ugb_mmu_map* ugb_mmu_resolve_map(ugb_mmu* mmu, uint16_t addr)
     return 0;
 }
 
-int ugb_mmu_read(ugb_mmu* mmu, uint16_t addr, uint8_t* data)
+static inline int _ugb_mmu_read(ugb_mmu* mmu, uint16_t addr, uint8_t* data)
 {
     if (!mmu || !data)
         return UGB_ERR_BADARGS;
@@ -146,7 +149,7 @@ int ugb_mmu_read(ugb_mmu* mmu, uint16_t addr, uint8_t* data)
     return UGB_ERR_OK;
 }
 
-int ugb_mmu_write(ugb_mmu* mmu, uint16_t addr, uint8_t data)
+static inline int _ugb_mmu_write(ugb_mmu* mmu, uint16_t addr, uint8_t data)
 {
     if (!mmu)
         return UGB_ERR_BADARGS;
@@ -161,10 +164,22 @@ int ugb_mmu_write(ugb_mmu* mmu, uint16_t addr, uint8_t data)
     switch (map->type)
     {
         case UGB_MMU_DATA:
-            map->data[addr - map->low_addr] = data;
+        {
+            uint16_t offset = addr - map->low_addr;
+            map->data[offset] = data;
+
+            if (mmu->track_dirty)
+            {
+                unsigned page = (uint16_t) (map->dirty_addr + offset) >> UGB_MMU_PAGE_SHIFT;
+                mmu->dirty[page >> 3] |= 1 << (page & 7);
+            }
             break;
+        }
 
         case UGB_MMU_RODATA:
+            if (map->ro_write.handler)
+                return (*map->ro_write.handler)(map->ro_write.cookie, UGB_MMU_WRITE, addr - map->low_addr, &data);
+
             printf("Writing to RO at 0x%04X.\n", addr);
             return UGB_ERR_MMU_RO;
 
@@ -177,3 +192,188 @@ int ugb_mmu_write(ugb_mmu* mmu, uint16_t addr, uint8_t data)
 
     return UGB_ERR_OK;
 }
+
+static int _ugb_mmu_trap(ugb_mmu* mmu, int op, uint16_t addr, uint8_t data)
+{
+    unsigned page = addr >> UGB_MMU_PAGE_SHIFT;
+
+    for (int i = 0; i < UGB_MMU_MAX_TRAPS; ++i)
+    {
+        ugb_mmu_trap* trap = &mmu->traps[i];
+        if (!trap->handler || !(trap->pages[page >> 3] & (1 << (page & 7))))
+            continue;
+
+        int err = (*trap->handler)(trap->cookie, op, addr, data);
+        if (err != UGB_ERR_OK)
+            return err;
+    }
+
+    return UGB_ERR_OK;
+}
+
+int ugb_mmu_read(ugb_mmu* mmu, uint16_t addr, uint8_t* data)
+{
+    if (!mmu)
+        return UGB_ERR_BADARGS;
+
+    UGB_PROF_BEGIN(&mmu->gbm->prof, UGB_PROF_MMU);
+    int err = _ugb_mmu_read(mmu, addr, data);
+    UGB_PROF_END(&mmu->gbm->prof, UGB_PROF_MMU);
+
+    if (ugb_mmu_page_trapped(mmu, addr) && err == UGB_ERR_OK)
+        err = _ugb_mmu_trap(mmu, UGB_MMU_READ, addr, *data);
+
+    return err;
+}
+
+int ugb_mmu_fetch(ugb_mmu* mmu, uint16_t addr, uint8_t* data)
+{
+    if (!mmu)
+        return UGB_ERR_BADARGS;
+
+    UGB_PROF_BEGIN(&mmu->gbm->prof, UGB_PROF_MMU);
+    int err = _ugb_mmu_read(mmu, addr, data);
+    UGB_PROF_END(&mmu->gbm->prof, UGB_PROF_MMU);
+
+    if (ugb_mmu_page_trapped(mmu, addr) && err == UGB_ERR_OK)
+        err = _ugb_mmu_trap(mmu, UGB_MMU_FETCH, addr, *data);
+
+    return err;
+}
+
+int ugb_mmu_write(ugb_mmu* mmu, uint16_t addr, uint8_t data)
+{
+    if (!mmu)
+        return UGB_ERR_BADARGS;
+
+    int err;
+    if (ugb_mmu_page_trapped(mmu, addr) &&
+        (err = _ugb_mmu_trap(mmu, UGB_MMU_WRITE, addr, data)) != UGB_ERR_OK)
+    {
+        return err;
+    }
+
+    UGB_PROF_BEGIN(&mmu->gbm->prof, UGB_PROF_MMU);
+    err = _ugb_mmu_write(mmu, addr, data);
+    UGB_PROF_END(&mmu->gbm->prof, UGB_PROF_MMU);
+
+    return err;
+}
+
+int ugb_mmu_peek(ugb_mmu* mmu, uint16_t addr, uint8_t* data)
+{
+    return _ugb_mmu_read(mmu, addr, data);
+}
+
+int ugb_mmu_track_dirty(ugb_mmu* mmu, int enable)
+{
+    if (!mmu)
+        return UGB_ERR_BADARGS;
+
+    if (!enable)
+    {
+        if (mmu->track_dirty)
+            --mmu->track_dirty;
+        return UGB_ERR_OK;
+    }
+
+    // The bitmap wasn't kept up to date until now
+    if (mmu->track_dirty++)
+        return UGB_ERR_OK;
+
+    return ugb_mmu_clear_dirty(mmu);
+}
+
+int ugb_mmu_clear_dirty(ugb_mmu* mmu)
+{
+    if (!mmu)
+        return UGB_ERR_BADARGS;
+
+    memset(&mmu->dirty[0], 0, sizeof(mmu->dirty));
+    ++mmu->dirty_epoch;
+
+    return UGB_ERR_OK;
+}
+
+int ugb_mmu_mark_dirty(ugb_mmu* mmu, uint16_t low_addr, uint16_t high_addr)
+{
+    if (!mmu || low_addr > high_addr)
+        return UGB_ERR_BADARGS;
+
+    for (unsigned page = low_addr >> UGB_MMU_PAGE_SHIFT; page <= (high_addr >> UGB_MMU_PAGE_SHIFT); ++page)
+        mmu->dirty[page >> 3] |= 1 << (page & 7);
+
+    return UGB_ERR_OK;
+}
+
+// Pages of all the installed traps
+static void _ugb_mmu_update_trapped(ugb_mmu* mmu)
+{
+    memset(&mmu->trapped[0], 0, sizeof(mmu->trapped));
+
+    for (int i = 0; i < UGB_MMU_MAX_TRAPS; ++i)
+    {
+        if (!mmu->traps[i].handler)
+            continue;
+
+        for (size_t j = 0; j < sizeof(mmu->trapped); ++j)
+            mmu->trapped[j] |= mmu->traps[i].pages[j];
+    }
+}
+
+int ugb_mmu_add_trap(ugb_mmu* mmu, int (*handler)(void*, int, uint16_t, uint8_t), void* cookie)
+{
+    if (!mmu || !handler)
+        return UGB_ERR_BADARGS;
+
+    for (int i = 0; i < UGB_MMU_MAX_TRAPS; ++i)
+    {
+        ugb_mmu_trap* trap = &mmu->traps[i];
+        if (trap->handler)
+            continue;
+
+        memset(trap, 0, sizeof(ugb_mmu_trap));
+        trap->handler = handler;
+        trap->cookie = cookie;
+
+        return i;
+    }
+
+    return UGB_ERR_NOSPACE;
+}
+
+int ugb_mmu_remove_trap(ugb_mmu* mmu, int trap)
+{
+    if (!mmu || trap < 0 || trap >= UGB_MMU_MAX_TRAPS)
+        return UGB_ERR_BADARGS;
+
+    memset(&mmu->traps[trap], 0, sizeof(ugb_mmu_trap));
+    _ugb_mmu_update_trapped(mmu);
+
+    return UGB_ERR_OK;
+}
+
+int ugb_mmu_clear_traps(ugb_mmu* mmu, int trap)
+{
+    if (!mmu || trap < 0 || trap >= UGB_MMU_MAX_TRAPS)
+        return UGB_ERR_BADARGS;
+
+    memset(&mmu->traps[trap].pages[0], 0, sizeof(mmu->traps[trap].pages));
+    _ugb_mmu_update_trapped(mmu);
+
+    return UGB_ERR_OK;
+}
+
+int ugb_mmu_trap_range(ugb_mmu* mmu, int trap, uint16_t low_addr, uint16_t high_addr)
+{
+    if (!mmu || trap < 0 || trap >= UGB_MMU_MAX_TRAPS || low_addr > high_addr)
+        return UGB_ERR_BADARGS;
+
+    uint8_t* pages = &mmu->traps[trap].pages[0];
+    for (unsigned page = low_addr >> UGB_MMU_PAGE_SHIFT; page <= (high_addr >> UGB_MMU_PAGE_SHIFT); ++page)
+        pages[page >> 3] |= 1 << (page & 7);
+
+    _ugb_mmu_update_trapped(mmu);
+
+    return UGB_ERR_OK;
+}
@@ -21,6 +21,7 @@
 #include "opcodes.h"
 #include "hwio.h"
 #include "gbm.h"
+#include "profiler.h"
 #include "errno.h"
 
 #include <stdlib.h>
@@ -36,22 +37,22 @@ ssize_t ugb_read_opcode(uint8_t* buf, ugb_gbm* gbm, uint16_t addr)
     if (!buf || !gbm)
         return UGB_ERR_BADARGS;
 
-    int err = ugb_mmu_read(gbm->mmu, addr, &buf[0]);
+    int err = ugb_mmu_peek(gbm->mmu, addr, &buf[0]);
     if (err != UGB_ERR_OK)
         return err;
 
-    ugb_opcode* opcode = 0;
+    const ugb_opcode* opcode = 0;
 
     if (buf[0] == 0xCB)
     {
-        if ((err = ugb_mmu_read(gbm->mmu, addr+1, &buf[1])) != UGB_ERR_OK)
+        if ((err = ugb_mmu_peek(gbm->mmu, addr+1, &buf[1])) != UGB_ERR_OK)
             return err;
 
         opcode = &ugb_opcodes_tableCB[buf[1]];
 
         for (int i = 0; i < opcode->size-2; ++i)
         {
-            if ((err = ugb_mmu_read(gbm->mmu, addr+2+i, &buf[2+i])) != UGB_ERR_OK)
+            if ((err = ugb_mmu_peek(gbm->mmu, addr+2+i, &buf[2+i])) != UGB_ERR_OK)
                 return err;
         }
     }
@@ -61,7 +62,7 @@ ssize_t ugb_read_opcode(uint8_t* buf, ugb_gbm* gbm, uint16_t addr)
 
         for (int i = 0; i < opcode->size-1; ++i)
         {
-            if ((err = ugb_mmu_read(gbm->mmu, addr+1+i, &buf[1+i])) != UGB_ERR_OK)
+            if ((err = ugb_mmu_peek(gbm->mmu, addr+1+i, &buf[1+i])) != UGB_ERR_OK)
                 return err;
         }
     }
@@ -77,7 +78,7 @@ ssize_t ugb_disassemble(char* str, size_t size, uint8_t* code, ssize_t addr)
     if (!code)
         return UGB_ERR_BADARGS;
 
-    ugb_opcode* opcode = 0;
+    const ugb_opcode* opcode = 0;
 
     if (code[0] == 0xCB)
         opcode = &ugb_opcodes_tableCB[code[1]];
@@ -126,27 +127,68 @@ ssize_t ugb_disassemble(char* str, size_t size, uint8_t* code, ssize_t addr)
     return opcode->size;
 }
 
+ssize_t ugb_opcode_target(uint8_t const* code, uint16_t addr)
+{
+    if (!code)
+        return UGB_ERR_BADARGS;
+
+    switch (code[0])
+    {
+        // JP [cc,] a16 and CALL [cc,] a16
+        case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:
+        case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:
+            return code[1] | (code[2] << 8);
+
+        // JR [cc,] r8
+        case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+            return (uint16_t) (addr + 2 + (int8_t) code[1]);
+
+        // RST n
+        case 0xC7: case 0xCF: case 0xD7: case 0xDF:
+        case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+            return code[0] - 0xC7;
+    }
+
+    return UGB_ERR_NOENT;
+}
+
 /*************************************/
 /*** Define external opcode tables ***/
 /*************************************/
 
-ugb_opcode ugb_opcodes_table[0x100];
-ugb_opcode ugb_opcodes_tableCB[0x100];
-
 #define DEF_OPCODE(prefix, opcode, ...) extern int _ugb_opcode ## prefix ## opcode(ugb_cpu*, uint8_t[], size_t*);
 #include "opcodes.def"
 
-static void __attribute__((constructor)) _ugb_opcodes_init()
+// The tables are built at compile time from the same definitions, each
+//   one only keeping the entries with its own prefix (pasting the prefix
+//   to the selector picks either the keeping or the dropping macro)
+#define _UGB_KEEP(...) __VA_ARGS__
+#define _UGB_DROP(...)
+
+#define _UGB_OPCODE_ENTRY(prefix_, opcode_, size_, cycles_, flags_, mnemonic_) \
+    [0x ## opcode_] = { 0x ## prefix_ ## opcode_, mnemonic_, size_, cycles_, flags_, &_ugb_opcode ## prefix_ ## opcode_ },
+
+#define _UGB_TABLE_  _UGB_KEEP
+#define _UGB_TABLE_CB _UGB_DROP
+
+const ugb_opcode ugb_opcodes_table[0x100] =
 {
 #define DEF_OPCODE(prefix_, opcode_, size_, cycles_, flags_, mnemonic_, ...) \
-    ugb_opcodes_table ## prefix_[0x ## opcode_].code = 0x ## prefix_ ## opcode_; \
-    ugb_opcodes_table ## prefix_[0x ## opcode_].mnemonic = mnemonic_; \
-    ugb_opcodes_table ## prefix_[0x ## opcode_].size = size_; \
-    ugb_opcodes_table ## prefix_[0x ## opcode_].cycles = cycles_; \
-    ugb_opcodes_table ## prefix_[0x ## opcode_].flags = flags_; \
-    ugb_opcodes_table ## prefix_[0x ## opcode_].microcode = &_ugb_opcode ## prefix_ ## opcode_;
+    _UGB_TABLE_ ## prefix_(_UGB_OPCODE_ENTRY(prefix_, opcode_, size_, cycles_, flags_, mnemonic_))
 #include "opcodes.def"
-}
+};
+
+#undef _UGB_TABLE_
+#undef _UGB_TABLE_CB
+#define _UGB_TABLE_  _UGB_DROP
+#define _UGB_TABLE_CB _UGB_KEEP
+
+const ugb_opcode ugb_opcodes_tableCB[0x100] =
+{
+#define DEF_OPCODE(prefix_, opcode_, size_, cycles_, flags_, mnemonic_, ...) \
+    _UGB_TABLE_ ## prefix_(_UGB_OPCODE_ENTRY(prefix_, opcode_, size_, cycles_, flags_, mnemonic_))
+#include "opcodes.def"
+};
 
 /****************************************************/
 /*** Define actual opcode implementation routines ***/
@@ -232,11 +274,20 @@ static void __attribute__((constructor)) _ugb_opcodes_init()
     IE &= ~UGB_REG_IE_IME_MSK; \
 } while (0);
 
-extern uint16_t mednafen_daa_lookup[];
+// Call stack tracking for the guest profiler
+#ifdef UGB_GUEST_PROFILER
+#define _CALLED() do { if (cpu->profiler) ugb_profiler_call(cpu->profiler, PC, SP); } while (0);
+#define _RETURNING() do { if (cpu->profiler) ugb_profiler_ret(cpu->profiler, SP); } while (0);
+#else
+#define _CALLED()
+#define _RETURNING()
+#endif
+
+extern const uint16_t mednafen_daa_lookup[];
 
-static void _ugb_opcode_update_flags(ugb_cpu* cpu, char flags[])
+static void _ugb_opcode_update_flags(ugb_cpu* cpu, const char flags[])
 {
-    static uint8_t msk[4] = {
+    static const uint8_t msk[4] = {
         UGB_REG_F_Z_MSK,
         UGB_REG_F_N_MSK,
         UGB_REG_F_H_MSK,
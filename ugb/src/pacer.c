@@ -0,0 +1,174 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "pacer.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+ugb_pacer* ugb_pacer_create(double freq)
+{
+    if (freq <= 0.0)
+        return 0;
+
+    ugb_pacer* pacer = malloc(sizeof(ugb_pacer));
+    if (!pacer)
+        return 0;
+
+    memset(pacer, 0, sizeof(ugb_pacer));
+    pacer->mode = UGB_PACER_FREE;
+    pacer->period_ns = 1e9 / freq;
+
+    ugb_pacer_reset(pacer);
+
+    return pacer;
+}
+
+void ugb_pacer_destroy(ugb_pacer* pacer)
+{
+    if (pacer)
+    {
+        free(pacer);
+    }
+}
+
+int ugb_pacer_reset(ugb_pacer* pacer)
+{
+    if (!pacer)
+        return UGB_ERR_BADARGS;
+
+    pacer->rate = 1.0;
+    pacer->deadline_ns = ugb_pacer_now() + pacer->period_ns;
+    memset(&pacer->stats, 0, sizeof(ugb_pacer_stats));
+
+    return UGB_ERR_OK;
+}
+
+uint64_t ugb_pacer_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int ugb_pacer_wait(ugb_pacer* pacer)
+{
+    if (!pacer)
+        return UGB_ERR_BADARGS;
+
+    uint64_t deadline = pacer->deadline_ns;
+    uint64_t now = ugb_pacer_now();
+
+    if (now < deadline)
+    {
+        // Let the scheduler sleep until the start of the busy-wait tail
+        if (deadline - now > pacer->spin_ns)
+        {
+            uint64_t wake = deadline - pacer->spin_ns;
+            struct timespec ts =
+            {
+                .tv_sec = wake / 1000000000ULL,
+                .tv_nsec = wake % 1000000000ULL
+            };
+
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) != 0);
+        }
+
+        // Then spin for the remaining time
+        while ((now = ugb_pacer_now()) < deadline);
+    }
+    else
+    {
+        ++pacer->stats.missed;
+    }
+
+    // Record how late we woke up
+    uint64_t jitter = now - deadline;
+    pacer->stats.jitter_sum_ns += jitter;
+    if (jitter > pacer->stats.jitter_max_ns)
+        pacer->stats.jitter_max_ns = jitter;
+    ++pacer->stats.ticks;
+
+    // Deadlines are absolute so that errors don't accumulate, but
+    //   don't try to catch up if we're more than a whole period late
+    uint64_t period = pacer->period_ns / pacer->rate;
+    pacer->deadline_ns += period;
+    if (pacer->deadline_ns + period < now)
+        pacer->deadline_ns = now + period;
+
+    return UGB_ERR_OK;
+}
+
+int ugb_pacer_resync(ugb_pacer* pacer)
+{
+    if (!pacer)
+        return UGB_ERR_BADARGS;
+
+    // Skip the current deadline altogether, e.g. when running unthrottled
+    pacer->deadline_ns = ugb_pacer_now() + pacer->period_ns / pacer->rate;
+
+    return UGB_ERR_OK;
+}
+
+static double _clamp_rate(double rate)
+{
+    if (rate < 1.0 - UGB_PACER_MAX_SKEW)
+        return 1.0 - UGB_PACER_MAX_SKEW;
+    if (rate > 1.0 + UGB_PACER_MAX_SKEW)
+        return 1.0 + UGB_PACER_MAX_SKEW;
+    return rate;
+}
+
+int ugb_pacer_audio_feedback(ugb_pacer* pacer, double fill)
+{
+    if (!pacer || fill < 0.0 || fill > 1.0)
+        return UGB_ERR_BADARGS;
+
+    if (pacer->mode != UGB_PACER_AUDIO)
+        return UGB_ERR_OK;
+
+    // Slow down when the buffer fills up, speed up when it drains,
+    //   so that it hovers around half full
+    pacer->rate = _clamp_rate(1.0 - UGB_PACER_MAX_SKEW * (2.0 * fill - 1.0));
+
+    return UGB_ERR_OK;
+}
+
+int ugb_pacer_vsync_feedback(ugb_pacer* pacer, double host_freq)
+{
+    if (!pacer || host_freq <= 0.0)
+        return UGB_ERR_BADARGS;
+
+    if (pacer->mode != UGB_PACER_VSYNC)
+        return UGB_ERR_OK;
+
+    // Lock onto the host refresh rate only if it is close enough,
+    //   otherwise keep the nominal rate
+    double rate = host_freq * pacer->period_ns / 1e9;
+    if (rate < 1.0 - UGB_PACER_MAX_SKEW || rate > 1.0 + UGB_PACER_MAX_SKEW)
+        rate = 1.0;
+
+    pacer->rate = rate;
+
+    return UGB_ERR_OK;
+}
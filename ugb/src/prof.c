@@ -0,0 +1,106 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "prof.h"
+#include "errno.h"
+
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+// Profile being sampled, there is only one SIGPROF timer per process
+static ugb_prof* volatile _active = 0;
+
+static void _on_sigprof(int sig)
+{
+    (void) sig;
+
+    ugb_prof* prof = _active;
+    if (prof)
+        ++prof->hits[prof->current];
+}
+
+void ugb_prof_reset(ugb_prof* prof)
+{
+    if (!prof)
+        return;
+
+    memset((void*) prof, 0, sizeof(ugb_prof));
+    prof->current = UGB_PROF_OTHER;
+}
+
+int ugb_prof_start(ugb_prof* prof, int hz)
+{
+    if (!prof || hz <= 0 || hz > 1000000)
+        return UGB_ERR_BADARGS;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &_on_sigprof;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, 0) < 0)
+        return UGB_ERR_BADARGS;
+
+    _active = prof;
+
+    struct itimerval it;
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_usec = 1000000 / hz;
+    it.it_value = it.it_interval;
+    if (setitimer(ITIMER_PROF, &it, 0) < 0)
+    {
+        _active = 0;
+        return UGB_ERR_BADARGS;
+    }
+
+    return UGB_ERR_OK;
+}
+
+int ugb_prof_stop(ugb_prof* prof)
+{
+    if (!prof || _active != prof)
+        return UGB_ERR_BADARGS;
+
+    struct itimerval it;
+    memset(&it, 0, sizeof(it));
+    setitimer(ITIMER_PROF, &it, 0);
+
+    _active = 0;
+
+    return UGB_ERR_OK;
+}
+
+uint64_t ugb_prof_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t ugb_prof_total(const ugb_prof* prof)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < UGB_PROF_SIZE; ++i)
+        total += prof->hits[i];
+
+    return total;
+}
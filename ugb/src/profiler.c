@@ -0,0 +1,353 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "profiler.h"
+#include "cpu.h"
+#include "cart.h"
+#include "constants.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The BIOS gets its own slots after the non-ROM range
+#define UGB_PROFILER_BIOS_SZ 0x100
+
+ugb_profiler* ugb_profiler_create(ugb_gbm* gbm)
+{
+    if (!gbm)
+        return 0;
+
+    ugb_profiler* prof = malloc(sizeof(ugb_profiler));
+    if (!prof)
+        return 0;
+
+    memset(prof, 0, sizeof(ugb_profiler));
+    prof->gbm = gbm;
+
+    prof->flat_rom = gbm->cart->rom_banks * UGB_CART_ROMX_SZ;
+    prof->flat_size = prof->flat_rom + 0x8000 + UGB_PROFILER_BIOS_SZ;
+    prof->node_capacity = 1024;
+    prof->children_mask = 2 * prof->node_capacity - 1;
+
+    if (!(prof->flat = calloc(prof->flat_size, sizeof(uint64_t))) ||
+        !(prof->nodes = malloc(prof->node_capacity * sizeof(ugb_profiler_node))) ||
+        !(prof->children = calloc(prof->children_mask + 1, sizeof(uint32_t))))
+    {
+        ugb_profiler_destroy(prof);
+        return 0;
+    }
+
+    ugb_profiler_reset(prof);
+    gbm->cpu->profiler = prof;
+
+    return prof;
+}
+
+void ugb_profiler_destroy(ugb_profiler* prof)
+{
+    if (prof)
+    {
+        if (prof->gbm->cpu->profiler == prof)
+            prof->gbm->cpu->profiler = 0;
+
+        free(prof->children);
+        free(prof->nodes);
+        free(prof->flat);
+        free(prof);
+    }
+}
+
+void ugb_profiler_reset(ugb_profiler* prof)
+{
+    if (!prof)
+        return;
+
+    memset(prof->flat, 0, prof->flat_size * sizeof(uint64_t));
+    memset(prof->children, 0, (prof->children_mask + 1) * sizeof(uint32_t));
+
+    memset(&prof->nodes[UGB_PROFILER_ROOT], 0, sizeof(ugb_profiler_node));
+    prof->node_count = 1;
+
+    prof->current = UGB_PROFILER_ROOT;
+    prof->depth = 0;
+    prof->overflows = 0;
+}
+
+/*************************/
+/*** Address utilities ***/
+/*************************/
+
+static size_t _flat_index(ugb_profiler* prof, uint16_t pc)
+{
+    ssize_t offset = ugb_cart_rom_offset(prof->gbm->cart, pc);
+    if (offset >= 0)
+        return offset;
+
+    if (pc >= 0x8000)
+        return prof->flat_rom + (pc - 0x8000);
+
+    return prof->flat_rom + 0x8000 + (pc % UGB_PROFILER_BIOS_SZ);
+}
+
+static void _flat_address(ugb_profiler* prof, size_t index, uint16_t* bank, uint16_t* addr)
+{
+    *bank = 0;
+
+    if (index < UGB_CART_ROM0_SZ)
+    {
+        *addr = index;
+    }
+    else if (index < prof->flat_rom)
+    {
+        *bank = index / UGB_CART_ROMX_SZ;
+        *addr = UGB_CART_ROMX_LO + index % UGB_CART_ROMX_SZ;
+    }
+    else if (index < prof->flat_rom + 0x8000)
+    {
+        *addr = 0x8000 + (index - prof->flat_rom);
+    }
+    else
+    {
+        *addr = index - prof->flat_rom - 0x8000;
+    }
+}
+
+static uint32_t _func(ugb_profiler* prof, uint16_t pc)
+{
+    uint32_t bank = 0;
+    if (pc >= UGB_CART_ROMX_LO && pc <= UGB_CART_ROMX_HI)
+    {
+        ssize_t offset = ugb_cart_rom_offset(prof->gbm->cart, pc);
+        if (offset >= 0)
+            bank = offset / UGB_CART_ROMX_SZ;
+    }
+
+    return (bank << 16) | pc;
+}
+
+/*****************/
+/*** Call tree ***/
+/*****************/
+
+static size_t _hash(uint32_t parent, uint32_t func)
+{
+    return (parent * 0x9E3779B1u) ^ (func * 0x85EBCA6Bu);
+}
+
+static int _grow(ugb_profiler* prof)
+{
+    size_t capacity = 2 * prof->node_capacity;
+
+    // Keep the table at most half full
+    size_t mask = 2 * capacity - 1;
+    uint32_t* children = calloc(mask + 1, sizeof(uint32_t));
+    if (!children)
+        return UGB_ERR_MALLOC;
+
+    ugb_profiler_node* nodes = realloc(prof->nodes, capacity * sizeof(ugb_profiler_node));
+    if (!nodes)
+    {
+        free(children);
+        return UGB_ERR_MALLOC;
+    }
+
+    prof->nodes = nodes;
+    prof->node_capacity = capacity;
+
+    for (uint32_t i = 1; i < prof->node_count; ++i)
+    {
+        size_t h = _hash(nodes[i].parent, nodes[i].func) & mask;
+        while (children[h])
+            h = (h + 1) & mask;
+        children[h] = i;
+    }
+
+    free(prof->children);
+    prof->children = children;
+    prof->children_mask = mask;
+
+    return UGB_ERR_OK;
+}
+
+static uint32_t _child(ugb_profiler* prof, uint32_t parent, uint32_t func)
+{
+    size_t h = _hash(parent, func) & prof->children_mask;
+    for (uint32_t i; (i = prof->children[h]); h = (h + 1) & prof->children_mask)
+    {
+        if (prof->nodes[i].parent == parent && prof->nodes[i].func == func)
+            return i;
+    }
+
+    if (prof->node_count == prof->node_capacity)
+    {
+        if (_grow(prof) != UGB_ERR_OK)
+            return UGB_PROFILER_ROOT;
+
+        // Slots moved
+        return _child(prof, parent, func);
+    }
+
+    uint32_t i = prof->node_count++;
+    memset(&prof->nodes[i], 0, sizeof(ugb_profiler_node));
+    prof->nodes[i].parent = parent;
+    prof->nodes[i].func = func;
+    prof->children[h] = i;
+
+    return i;
+}
+
+void ugb_profiler_call(ugb_profiler* prof, uint16_t pc, uint16_t sp)
+{
+    uint32_t child;
+    if (prof->depth == UGB_PROFILER_MAX_DEPTH ||
+        (child = _child(prof, prof->current, _func(prof, pc))) == UGB_PROFILER_ROOT)
+    {
+        ++prof->overflows;
+        return;
+    }
+
+    prof->stack[prof->depth].node = prof->current;
+    prof->stack[prof->depth].sp = sp;
+    ++prof->depth;
+
+    prof->current = child;
+    ++prof->nodes[child].calls;
+}
+
+void ugb_profiler_ret(ugb_profiler* prof, uint16_t sp)
+{
+    // A RET not matching any call (like PUSH + RET used as a jump) has
+    //   its return address below the innermost frame's
+    while (prof->depth && prof->stack[prof->depth - 1].sp <= sp)
+        prof->current = prof->stack[--prof->depth].node;
+}
+
+void ugb_profiler_charge(ugb_profiler* prof, uint32_t node, uint16_t pc, size_t cycles)
+{
+    prof->flat[_flat_index(prof, pc)] += cycles;
+    prof->nodes[node].cycles += cycles;
+}
+
+/**************/
+/*** Export ***/
+/**************/
+
+// Entries carry their cycles so that sorting needs no shared state
+typedef struct ugb_profiler_entry
+{
+    size_t index;
+    uint64_t cycles;
+} ugb_profiler_entry;
+
+static int _by_cycles(const void* a, const void* b)
+{
+    const ugb_profiler_entry* ea = a;
+    const ugb_profiler_entry* eb = b;
+    if (ea->cycles != eb->cycles)
+        return (ea->cycles < eb->cycles) - (ea->cycles > eb->cycles);
+    return (ea->index > eb->index) - (ea->index < eb->index);
+}
+
+int ugb_profiler_write_flat(ugb_profiler* prof, FILE* f, const ugb_symbols* syms, size_t limit)
+{
+    if (!prof || !f)
+        return UGB_ERR_BADARGS;
+
+    size_t count = 0;
+    uint64_t total = 0;
+    for (size_t i = 0; i < prof->flat_size; ++i)
+    {
+        count += prof->flat[i] != 0;
+        total += prof->flat[i];
+    }
+
+    ugb_profiler_entry* order = malloc((count ? count : 1) * sizeof(ugb_profiler_entry));
+    if (!order)
+        return UGB_ERR_MALLOC;
+
+    for (size_t i = 0, j = 0; i < prof->flat_size; ++i)
+    {
+        if (prof->flat[i])
+        {
+            order[j].index = i;
+            order[j].cycles = prof->flat[i];
+            ++j;
+        }
+    }
+
+    qsort(order, count, sizeof(ugb_profiler_entry), &_by_cycles);
+
+    if (limit && limit < count)
+        count = limit;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint16_t bank, addr;
+        _flat_address(prof, order[i].index, &bank, &addr);
+
+        char name[128];
+        ugb_symbols_format(syms, bank, addr, name, sizeof(name));
+
+        fprintf(f, "%14llu %6.2f%%  %02X:%04X  %s\n",
+            (unsigned long long) order[i].cycles, 100.0 * order[i].cycles / total,
+            bank, addr, name);
+    }
+
+    free(order);
+    return UGB_ERR_OK;
+}
+
+int ugb_profiler_write_stacks(ugb_profiler* prof, FILE* f, const ugb_symbols* syms)
+{
+    if (!prof || !f)
+        return UGB_ERR_BADARGS;
+
+    uint32_t path[UGB_PROFILER_MAX_DEPTH + 1];
+
+    for (uint32_t i = 0; i < prof->node_count; ++i)
+    {
+        ugb_profiler_node* node = &prof->nodes[i];
+        if (!node->cycles)
+            continue;
+
+        if (i == UGB_PROFILER_ROOT)
+        {
+            fprintf(f, "[root] %llu\n", (unsigned long long) node->cycles);
+            continue;
+        }
+
+        // Outermost call first
+        size_t len = 0;
+        for (uint32_t n = i; n != UGB_PROFILER_ROOT; n = prof->nodes[n].parent)
+            path[len++] = n;
+
+        while (len--)
+        {
+            uint32_t func = prof->nodes[path[len]].func;
+
+            char name[128];
+            ugb_symbols_format(syms, func >> 16, func & 0xFFFF, name, sizeof(name));
+            fprintf(f, "%s%c", name, len ? ';' : ' ');
+        }
+
+        fprintf(f, "%llu\n", (unsigned long long) node->cycles);
+    }
+
+    return UGB_ERR_OK;
+}
@@ -0,0 +1,356 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rewind.h"
+#include "state.h"
+#include "gpu.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// The index takes a fixed share of the budget, it only becomes the
+//   limit when deltas are smaller than this on average
+#define UGB_REWIND_BYTES_PER_ENTRY 256
+
+// Zero runs shorter than this are kept in the literals. A token costs
+//   at most two 3-byte varints, so splitting never makes the encoding
+//   bigger and it stays under the size of the input plus one token
+#define UGB_REWIND_MIN_RUN 8
+
+/*****************************/
+/*** XOR delta + RLE codec ***/
+/*****************************/
+
+// The delta is a sequence of (zero run, literal count, literals)
+//   tokens, counts being LEB128 varints
+
+static inline uint8_t* _put_varint(uint8_t* p, size_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+
+    return p;
+}
+
+static inline size_t _get_varint(const uint8_t** p)
+{
+    size_t v = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+        uint8_t b = *(*p)++;
+        v |= (size_t) (b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return v;
+    }
+}
+
+// Length of the run of identical bytes starting at i
+static inline size_t _same_run(const uint8_t* a, const uint8_t* b, size_t i, size_t size)
+{
+    size_t start = i;
+
+    // Whole words first, most of the state doesn't change
+    while (i + 8 <= size)
+    {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y)
+            break;
+        i += 8;
+    }
+
+    while (i < size && a[i] == b[i])
+        ++i;
+
+    return i - start;
+}
+
+static size_t _encode(const uint8_t* prev, const uint8_t* next, size_t size, uint8_t* out)
+{
+    uint8_t* p = out;
+    size_t i = 0;
+
+    while (i < size)
+    {
+        size_t run = _same_run(prev, next, i, size);
+        i += run;
+        if (i == size)
+            break;
+
+        // Literals go on until a long enough zero run
+        size_t lit = i;
+        while (lit < size)
+        {
+            if (prev[lit] != next[lit])
+            {
+                ++lit;
+                continue;
+            }
+
+            size_t same = _same_run(prev, next, lit, size);
+            if (same >= UGB_REWIND_MIN_RUN || lit + same == size)
+                break;
+            lit += same;
+        }
+
+        p = _put_varint(p, run);
+        p = _put_varint(p, lit - i);
+        for (; i < lit; ++i)
+            *p++ = prev[i] ^ next[i];
+    }
+
+    return p - out;
+}
+
+// XOR the delta into the state in place, which goes both ways
+static void _apply(uint8_t* state, const uint8_t* delta, size_t len)
+{
+    const uint8_t* end = delta + len;
+    uint8_t* p = state;
+
+    while (delta < end)
+    {
+        p += _get_varint(&delta);
+        size_t lit = _get_varint(&delta);
+
+        for (size_t i = 0; i < lit; ++i)
+            *p++ ^= *delta++;
+    }
+}
+
+/************************/
+/*** Ring bookkeeping ***/
+/************************/
+
+static void _drop_oldest(ugb_rewind* rw)
+{
+    rw->used -= rw->entries[rw->first].len;
+    rw->first = (rw->first + 1) % rw->max_entries;
+    --rw->count;
+}
+
+static ugb_rewind_entry* _oldest(ugb_rewind* rw)
+{
+    return &rw->entries[rw->first];
+}
+
+static ugb_rewind_entry* _newest(ugb_rewind* rw)
+{
+    return &rw->entries[(rw->first + rw->count - 1) % rw->max_entries];
+}
+
+// Make room for len contiguous bytes, dropping old entries as needed
+static int _alloc(ugb_rewind* rw, size_t len, size_t* offset)
+{
+    if (len > rw->ring_size)
+        return UGB_ERR_NOSPACE;
+
+    size_t pos = rw->ring_pos;
+
+    // Wrap around, everything stored past this point is older than
+    //   what is at the beginning of the ring
+    if (pos + len > rw->ring_size)
+    {
+        while (rw->count && _oldest(rw)->offset >= pos)
+            _drop_oldest(rw);
+        pos = 0;
+    }
+
+    while (rw->count)
+    {
+        ugb_rewind_entry* e = _oldest(rw);
+        if (e->offset >= pos + len || e->offset + e->len <= pos)
+            break;
+        _drop_oldest(rw);
+    }
+
+    if (rw->count == rw->max_entries)
+        _drop_oldest(rw);
+
+    *offset = pos;
+    rw->ring_pos = pos + len;
+
+    return UGB_ERR_OK;
+}
+
+/******************/
+/*** Public API ***/
+/******************/
+
+ugb_rewind* ugb_rewind_create(ugb_gbm* gbm, size_t budget, size_t interval)
+{
+    if (!gbm || !interval)
+        return 0;
+
+    size_t state_size = ugb_gbm_state_size(gbm);
+
+    // The two whole states and the index come out of the budget too,
+    //   what is left must hold at least a couple of deltas
+    size_t max_entries = budget / UGB_REWIND_BYTES_PER_ENTRY;
+    size_t fixed = 2 * state_size + max_entries * sizeof(ugb_rewind_entry);
+    if (budget < fixed + 4 * state_size || max_entries < 2)
+        return 0;
+
+    ugb_rewind* rw = malloc(sizeof(ugb_rewind));
+    if (!rw)
+        return 0;
+
+    memset(rw, 0, sizeof(ugb_rewind));
+    rw->gbm = gbm;
+    rw->interval = interval;
+    rw->state_size = state_size;
+    rw->ring_size = budget - fixed;
+    rw->max_entries = max_entries;
+
+    if (!(rw->head = malloc(state_size)) ||
+        !(rw->scratch = malloc(state_size)) ||
+        !(rw->ring = malloc(rw->ring_size)) ||
+        !(rw->entries = malloc(max_entries * sizeof(ugb_rewind_entry))))
+    {
+        ugb_rewind_destroy(rw);
+        return 0;
+    }
+
+    ugb_rewind_reset(rw);
+
+    return rw;
+}
+
+void ugb_rewind_destroy(ugb_rewind* rw)
+{
+    if (rw)
+    {
+        free(rw->entries);
+        free(rw->ring);
+        free(rw->scratch);
+        free(rw->head);
+        free(rw);
+    }
+}
+
+int ugb_rewind_reset(ugb_rewind* rw)
+{
+    if (!rw)
+        return UGB_ERR_BADARGS;
+
+    rw->has_head = 0;
+    rw->ring_pos = 0;
+    rw->first = 0;
+    rw->count = 0;
+    rw->used = 0;
+    rw->last_frame = rw->gbm->gpu->frames;
+
+    return UGB_ERR_OK;
+}
+
+int ugb_rewind_update(ugb_rewind* rw)
+{
+    if (!rw)
+        return UGB_ERR_BADARGS;
+
+    if (rw->has_head && rw->gbm->gpu->frames - rw->last_frame < rw->interval)
+        return UGB_ERR_OK;
+
+    return ugb_rewind_capture(rw);
+}
+
+int ugb_rewind_capture(ugb_rewind* rw)
+{
+    if (!rw)
+        return UGB_ERR_BADARGS;
+
+    ssize_t len = ugb_gbm_save_state(rw->gbm, rw->scratch, rw->state_size);
+    if (len < 0)
+        return len;
+
+    rw->last_frame = rw->gbm->gpu->frames;
+
+    if (rw->has_head)
+    {
+        // Encode straight into the ring, room is made for the worst case
+        //   and whatever isn't used is given back right after
+        size_t bound = rw->state_size + 16;
+        size_t offset;
+
+        int err;
+        if ((err = _alloc(rw, bound, &offset)) != UGB_ERR_OK)
+            return err;
+
+        size_t delta = _encode(rw->head, rw->scratch, rw->state_size, rw->ring + offset);
+        rw->ring_pos = offset + delta;
+
+        ugb_rewind_entry* e = &rw->entries[(rw->first + rw->count) % rw->max_entries];
+        e->offset = offset;
+        e->len = delta;
+        ++rw->count;
+        rw->used += delta;
+    }
+
+    uint8_t* tmp = rw->head;
+    rw->head = rw->scratch;
+    rw->scratch = tmp;
+    rw->has_head = 1;
+
+    return UGB_ERR_OK;
+}
+
+int ugb_rewind_step_back(ugb_rewind* rw)
+{
+    if (!rw)
+        return UGB_ERR_BADARGS;
+
+    if (!rw->has_head)
+        return UGB_ERR_NOENT;
+
+    int err;
+    if ((err = ugb_gbm_load_state(rw->gbm, rw->head, rw->state_size)) != UGB_ERR_OK)
+        return err;
+
+    rw->last_frame = rw->gbm->gpu->frames;
+
+    // Get the previous state ready for the next step
+    if (rw->count)
+    {
+        ugb_rewind_entry* e = _newest(rw);
+        _apply(rw->head, rw->ring + e->offset, e->len);
+
+        rw->ring_pos = e->offset;
+        rw->used -= e->len;
+        --rw->count;
+    }
+    else
+    {
+        rw->has_head = 0;
+    }
+
+    return UGB_ERR_OK;
+}
+
+size_t ugb_rewind_depth(ugb_rewind* rw)
+{
+    if (!rw)
+        return 0;
+
+    return rw->count + rw->has_head;
+}
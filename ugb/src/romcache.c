@@ -0,0 +1,152 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "romcache.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+ugb_romcache* ugb_romcache_create()
+{
+    ugb_romcache* cache = malloc(sizeof(ugb_romcache));
+    if (!cache)
+        return 0;
+
+    memset(cache, 0, sizeof(ugb_romcache));
+
+    if (pthread_mutex_init(&cache->lock, 0))
+    {
+        free(cache);
+        return 0;
+    }
+
+    return cache;
+}
+
+void ugb_romcache_destroy(ugb_romcache* cache)
+{
+    if (cache)
+    {
+        // Whatever is still open goes away with the cache
+        for (ugb_rom* rom = cache->roms; rom; )
+        {
+            ugb_rom* next = rom->next;
+            munmap((void*) rom->data, rom->size);
+            free(rom);
+            rom = next;
+        }
+
+        pthread_mutex_destroy(&cache->lock);
+        free(cache);
+    }
+}
+
+int ugb_romcache_open(ugb_romcache* cache, const char* path, ugb_rom** rom)
+{
+    if (!cache || !path || !rom)
+        return UGB_ERR_BADARGS;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return UGB_ERR_NOENT;
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode) || sb.st_size <= 0)
+    {
+        close(fd);
+        return UGB_ERR_BADARGS;
+    }
+
+    int err = UGB_ERR_OK;
+    pthread_mutex_lock(&cache->lock);
+
+    ugb_rom* found = cache->roms;
+    while (found && (found->dev != sb.st_dev || found->ino != sb.st_ino))
+        found = found->next;
+
+    if (found)
+    {
+        ++found->refs;
+    }
+    else if (!(found = malloc(sizeof(ugb_rom))))
+    {
+        err = UGB_ERR_MALLOC;
+    }
+    else
+    {
+        // Shared and read-only : every instance sees the same pages,
+        //   and a stray write faults instead of corrupting the image
+        void* data = mmap(0, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            free(found);
+            found = 0;
+            err = UGB_ERR_MALLOC;
+        }
+        else
+        {
+            found->data = data;
+            found->size = sb.st_size;
+            found->dev = sb.st_dev;
+            found->ino = sb.st_ino;
+            found->refs = 1;
+            found->next = cache->roms;
+            cache->roms = found;
+        }
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    close(fd);
+
+    *rom = found;
+    return err;
+}
+
+int ugb_romcache_close(ugb_romcache* cache, ugb_rom* rom)
+{
+    if (!cache || !rom)
+        return UGB_ERR_BADARGS;
+
+    int err = UGB_ERR_NOENT;
+    pthread_mutex_lock(&cache->lock);
+
+    for (ugb_rom** link = &cache->roms; *link; link = &(*link)->next)
+    {
+        if (*link != rom)
+            continue;
+
+        if (!--rom->refs)
+        {
+            *link = rom->next;
+            munmap((void*) rom->data, rom->size);
+            free(rom);
+        }
+
+        err = UGB_ERR_OK;
+        break;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+    return err;
+}
@@ -0,0 +1,107 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "serial.h"
+#include "gbm.h"
+#include "hwio.h"
+#include "cpu.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+ugb_serial* ugb_serial_create(ugb_gbm* gbm)
+{
+    ugb_serial* serial = malloc(sizeof(ugb_serial));
+    if (!serial)
+        return 0;
+
+    memset(serial, 0, sizeof(ugb_serial));
+    serial->gbm = gbm;
+
+    if (ugb_hwio_set_hook(gbm->hwio, UGB_HWIO_REG_SC, &ugb_serial_sc_hook, (void*) gbm) != UGB_ERR_OK)
+    {
+        ugb_serial_destroy(serial);
+        return 0;
+    }
+
+    return serial;
+}
+
+void ugb_serial_destroy(ugb_serial* serial)
+{
+    if (serial)
+    {
+        free(serial);
+    }
+}
+
+int ugb_serial_reset(ugb_serial* serial)
+{
+    if (!serial)
+        return UGB_ERR_BADARGS;
+
+    serial->len = 0;
+    serial->dropped = 0;
+
+    return UGB_ERR_OK;
+}
+
+int ugb_serial_set_sink(ugb_serial* serial, int(*sink)(uint8_t, void*), void* cookie)
+{
+    if (!serial)
+        return UGB_ERR_BADARGS;
+
+    serial->sink = sink;
+    serial->cookie = cookie;
+
+    return UGB_ERR_OK;
+}
+
+int ugb_serial_sc_hook(struct ugb_hwreg* reg, void* cookie)
+{
+    if (!reg || !cookie)
+        return UGB_ERR_BADARGS;
+
+    ugb_gbm* gbm = (ugb_gbm*) cookie;
+    ugb_serial* serial = gbm->serial;
+
+    // HWIO register aliases
+    uint8_t* sb = &gbm->hwio->data[UGB_HWIO_REG_SB];
+    uint8_t* sc = &gbm->hwio->data[UGB_HWIO_REG_SC];
+
+    // Only transfers started with the internal clock do something,
+    //   there is never anybody on the other end of the link
+    if ((*sc & 0x81) != 0x81)
+        return UGB_ERR_OK;
+
+    if (serial->len < UGB_SERIAL_BUF_SZ)
+        serial->out[serial->len++] = *sb;
+    else
+        ++serial->dropped;
+
+    if (serial->sink)
+        (*serial->sink)(*sb, serial->cookie);
+
+    // The transfer completes immediately, reading back 0xFF
+    *sb = 0xFF;
+    *sc &= ~0x80;
+    gbm->hwio->data[UGB_HWIO_REG_IF] |= UGB_REG_IE_S_MSK;
+
+    return UGB_ERR_OK;
+}
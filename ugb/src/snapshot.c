@@ -0,0 +1,154 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "snapshot.h"
+#include "mmu.h"
+#include "gpu.h"
+#include "timer.h"
+#include "joypad.h"
+#include "cart.h"
+#include "errno.h"
+
+#include <string.h>
+
+// Memory areas covered by the snapshot, and their guest addresses
+typedef struct ugb_snapshot_area
+{
+    uint16_t addr;
+    size_t size;
+    uint8_t* mem;
+    uint8_t* copy;
+
+    // Dirty pages can't tell banks apart, banked areas are copied whole
+    int banked;
+} ugb_snapshot_area;
+
+static int _fill_areas(ugb_gbm* gbm, ugb_gbm_snapshot* snap, ugb_snapshot_area* areas)
+{
+    ugb_snapshot_area list[] = {
+        { UGB_VRAM_LO,     UGB_VRAM_SZ,         gbm->gpu->vram, &snap->vram[0],  0 },
+        { UGB_OAM_LO,      UGB_OAM_SZ,          gbm->gpu->oam,  &snap->oam[0],   0 },
+        { UGB_RAM0_LO,     UGB_RAM0_SZ,         gbm->mem.ram0,  &snap->ram0[0],  0 },
+        { UGB_ZPAGE_LO,    UGB_ZPAGE_SZ,        gbm->mem.zpage, &snap->zpage[0], 0 },
+        { UGB_CART_RAM_LO, gbm->cart->ram_size, gbm->cart->ram, &snap->cram[0],
+          gbm->cart->ram_size > UGB_CART_RAM_SZ },
+    };
+
+    memcpy(areas, &list[0], sizeof(list));
+    return sizeof(list) / sizeof(list[0]);
+}
+
+// Copy an area either whole or only its dirty pages
+static void _copy_area(ugb_mmu const* mmu, ugb_snapshot_area const* area, int restore, int incremental)
+{
+    uint8_t* dst = restore ? area->mem : area->copy;
+    uint8_t const* src = restore ? area->copy : area->mem;
+
+    if (!incremental || area->banked)
+    {
+        memcpy(dst, src, area->size);
+        return;
+    }
+
+    size_t offset = 0;
+    while (offset < area->size)
+    {
+        unsigned addr = area->addr + offset;
+        size_t len = (((addr >> UGB_MMU_PAGE_SHIFT) + 1) << UGB_MMU_PAGE_SHIFT) - addr;
+        if (len > area->size - offset)
+            len = area->size - offset;
+
+        if (ugb_mmu_page_dirty(mmu, addr >> UGB_MMU_PAGE_SHIFT))
+            memcpy(dst + offset, src + offset, len);
+
+        offset += len;
+    }
+}
+
+static void _sync_memory(ugb_gbm* gbm, ugb_gbm_snapshot* snap, int restore)
+{
+    ugb_mmu* mmu = gbm->mmu;
+    int incremental = mmu->track_dirty && snap->base == gbm && snap->epoch == mmu->dirty_epoch;
+
+    ugb_snapshot_area areas[8];
+    int count = _fill_areas(gbm, snap, &areas[0]);
+    for (int i = 0; i < count; ++i)
+        _copy_area(mmu, &areas[i], restore, incremental);
+
+    // Both sides are identical now
+    ugb_mmu_clear_dirty(mmu);
+    snap->base = gbm;
+    snap->epoch = mmu->dirty_epoch;
+}
+
+int ugb_gbm_snapshot_save(ugb_gbm* gbm, ugb_gbm_snapshot* snap)
+{
+    if (!gbm || !snap)
+        return UGB_ERR_BADARGS;
+
+    memcpy(&snap->cpu.regs[0], &gbm->cpu->regs.data[0], UGB_REGS_SIZE);
+    snap->cpu.state = gbm->cpu->state;
+    snap->cpu.ei_delayed = gbm->cpu->ei_delayed;
+    snap->cpu.repeat_next_byte = gbm->cpu->repeat_next_byte;
+
+    memcpy(&snap->hwio[0], &gbm->hwio->data[0], UGB_HWIO_REG_SIZE);
+
+    _sync_memory(gbm, snap, 0);
+    snap->mbc = gbm->cart->mbc;
+
+    snap->gpu.clock = gbm->gpu->clock;
+    snap->gpu.frames = gbm->gpu->frames;
+
+    snap->timer.clock0 = gbm->timer->clock0;
+    snap->timer.clock1 = gbm->timer->clock1;
+
+    snap->buttons = gbm->joypad->buttons;
+    snap->bios_enabled = gbm->mem.bios_map->type != UGB_MMU_NONE;
+    snap->cycles = gbm->cycles;
+
+    return UGB_ERR_OK;
+}
+
+int ugb_gbm_snapshot_restore(ugb_gbm* gbm, ugb_gbm_snapshot* snap)
+{
+    if (!gbm || !snap)
+        return UGB_ERR_BADARGS;
+
+    memcpy(&gbm->cpu->regs.data[0], &snap->cpu.regs[0], UGB_REGS_SIZE);
+    gbm->cpu->state = snap->cpu.state;
+    gbm->cpu->ei_delayed = snap->cpu.ei_delayed;
+    gbm->cpu->repeat_next_byte = snap->cpu.repeat_next_byte;
+
+    memcpy(&gbm->hwio->data[0], &snap->hwio[0], UGB_HWIO_REG_SIZE);
+
+    _sync_memory(gbm, snap, 1);
+    gbm->cart->mbc = snap->mbc;
+    ugb_cart_update_maps(gbm->cart);
+
+    gbm->gpu->clock = snap->gpu.clock;
+    gbm->gpu->frames = snap->gpu.frames;
+
+    gbm->timer->clock0 = snap->timer.clock0;
+    gbm->timer->clock1 = snap->timer.clock1;
+
+    gbm->joypad->buttons = snap->buttons;
+    gbm->mem.bios_map->type = snap->bios_enabled ? UGB_MMU_RODATA : UGB_MMU_NONE;
+    gbm->cycles = snap->cycles;
+
+    return UGB_ERR_OK;
+}
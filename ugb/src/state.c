@@ -0,0 +1,345 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "state.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "hwio.h"
+#include "gpu.h"
+#include "timer.h"
+#include "joypad.h"
+#include "cart.h"
+#include "history.h"
+#include "constants.h"
+#include "errno.h"
+
+#include <string.h>
+
+/************************/
+/*** Encoding helpers ***/
+/************************/
+
+static inline uint8_t* _put8(uint8_t* p, uint8_t v)
+{
+    *p++ = v;
+    return p;
+}
+
+static inline uint8_t* _put16(uint8_t* p, uint16_t v)
+{
+    *p++ = v & 0xFF;
+    *p++ = v >> 8;
+    return p;
+}
+
+static inline uint8_t* _put32(uint8_t* p, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+        *p++ = (v >> (8 * i)) & 0xFF;
+    return p;
+}
+
+static inline uint8_t* _put64(uint8_t* p, uint64_t v)
+{
+    for (int i = 0; i < 8; ++i)
+        *p++ = (v >> (8 * i)) & 0xFF;
+    return p;
+}
+
+static inline uint16_t _get16(const uint8_t** p)
+{
+    uint16_t v = (*p)[0] | ((*p)[1] << 8);
+    *p += 2;
+    return v;
+}
+
+static inline uint32_t _get32(const uint8_t** p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i)
+        v |= (uint32_t) (*p)[i] << (8 * i);
+    *p += 4;
+    return v;
+}
+
+static inline uint64_t _get64(const uint8_t** p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i)
+        v |= (uint64_t) (*p)[i] << (8 * i);
+    *p += 8;
+    return v;
+}
+
+/**************/
+/*** Chunks ***/
+/**************/
+
+#define UGB_STATE_HEADER_SZ 8
+#define UGB_STATE_CHUNK_HEADER_SZ 8
+
+#define UGB_STATE_CPU_SZ  (6 * 2 + 4)
+#define UGB_STATE_GPU_SZ  (2 * 8)
+#define UGB_STATE_TIMR_SZ (2 * 8)
+#define UGB_STATE_MISC_SZ (2 + 8)
+#define UGB_STATE_MBC_SZ  (2 + 3 + 5 + 1)
+
+static void _save_cpu(ugb_gbm* gbm, uint8_t* p)
+{
+    ugb_cpu* cpu = gbm->cpu;
+
+    #define DEF_REGW(name, index) p = _put16(p, *cpu->regs.name);
+    #include "cpu.def"
+
+    p = _put8(p, *cpu->regs.IE);
+    p = _put8(p, cpu->state);
+    p = _put8(p, cpu->ei_delayed);
+    p = _put8(p, cpu->repeat_next_byte);
+}
+
+static void _load_cpu(ugb_gbm* gbm, const uint8_t* p)
+{
+    ugb_cpu* cpu = gbm->cpu;
+
+    #define DEF_REGW(name, index) *cpu->regs.name = _get16(&p);
+    #include "cpu.def"
+
+    *cpu->regs.IE = *p++;
+    cpu->state = *p++;
+    cpu->ei_delayed = *p++;
+    cpu->repeat_next_byte = *p++;
+}
+
+static void _save_gpu(ugb_gbm* gbm, uint8_t* p)
+{
+    p = _put64(p, gbm->gpu->clock);
+    p = _put64(p, gbm->gpu->frames);
+}
+
+static void _load_gpu(ugb_gbm* gbm, const uint8_t* p)
+{
+    gbm->gpu->clock = _get64(&p);
+    gbm->gpu->frames = _get64(&p);
+}
+
+static void _save_timer(ugb_gbm* gbm, uint8_t* p)
+{
+    p = _put64(p, gbm->timer->clock0);
+    p = _put64(p, gbm->timer->clock1);
+}
+
+static void _load_timer(ugb_gbm* gbm, const uint8_t* p)
+{
+    gbm->timer->clock0 = _get64(&p);
+    gbm->timer->clock1 = _get64(&p);
+}
+
+static void _save_misc(ugb_gbm* gbm, uint8_t* p)
+{
+    p = _put8(p, gbm->joypad->buttons);
+    p = _put8(p, gbm->mem.bios_map->type != UGB_MMU_NONE);
+    p = _put64(p, gbm->cycles);
+}
+
+static void _load_misc(ugb_gbm* gbm, const uint8_t* p)
+{
+    gbm->joypad->buttons = *p++;
+    gbm->mem.bios_map->type = *p++ ? UGB_MMU_RODATA : UGB_MMU_NONE;
+    gbm->cycles = _get64(&p);
+}
+
+static void _save_mbc(ugb_gbm* gbm, uint8_t* p)
+{
+    ugb_mbc* mbc = &gbm->cart->mbc;
+
+    p = _put16(p, mbc->rom_bank);
+    p = _put8(p, mbc->ram_bank);
+    p = _put8(p, mbc->ram_enable);
+    p = _put8(p, mbc->mode);
+    memcpy(p, &mbc->rtc[0], 5);
+    p += 5;
+    p = _put8(p, mbc->rtc_latch);
+}
+
+static void _load_mbc(ugb_gbm* gbm, const uint8_t* p)
+{
+    ugb_mbc* mbc = &gbm->cart->mbc;
+
+    mbc->rom_bank = _get16(&p);
+    mbc->ram_bank = *p++;
+    mbc->ram_enable = *p++;
+    mbc->mode = *p++;
+    memcpy(&mbc->rtc[0], p, 5);
+    p += 5;
+    mbc->rtc_latch = *p++;
+}
+
+// Chunks are either a plain memory area or a fixed-size record
+//   with its own (de)serialization functions
+typedef struct ugb_state_chunk
+{
+    char tag[4];
+    size_t size;
+
+    // For chunks whose size depends on the machine, instead of size
+    size_t(*dyn_size)(ugb_gbm*);
+
+    uint8_t*(*area)(ugb_gbm*);
+    void(*save)(ugb_gbm*, uint8_t*);
+    void(*load)(ugb_gbm*, const uint8_t*);
+} ugb_state_chunk;
+
+static uint8_t* _hwio_area(ugb_gbm* gbm) { return &gbm->hwio->data[0]; }
+static uint8_t* _vram_area(ugb_gbm* gbm) { return gbm->gpu->vram; }
+static uint8_t* _oam_area(ugb_gbm* gbm) { return gbm->gpu->oam; }
+static uint8_t* _wram_area(ugb_gbm* gbm) { return gbm->mem.ram0; }
+static uint8_t* _hram_area(ugb_gbm* gbm) { return gbm->mem.zpage; }
+static uint8_t* _cram_area(ugb_gbm* gbm) { return gbm->cart->ram; }
+
+static size_t _cram_size(ugb_gbm* gbm) { return gbm->cart->ram_size; }
+
+static const ugb_state_chunk _chunks[] = {
+    { "CPU ", UGB_STATE_CPU_SZ,  0,           0,           &_save_cpu,   &_load_cpu   },
+    { "HWIO", UGB_HWIO_REG_SIZE, 0,           &_hwio_area, 0,            0            },
+    { "VRAM", UGB_VRAM_SZ,       0,           &_vram_area, 0,            0            },
+    { "OAM ", UGB_OAM_SZ,        0,           &_oam_area,  0,            0            },
+    { "WRAM", UGB_RAM0_SZ,       0,           &_wram_area, 0,            0            },
+    { "HRAM", UGB_ZPAGE_SZ,      0,           &_hram_area, 0,            0            },
+    { "CRAM", 0,                 &_cram_size, &_cram_area, 0,            0            },
+    { "MBC ", UGB_STATE_MBC_SZ,  0,           0,           &_save_mbc,   &_load_mbc   },
+    { "GPU ", UGB_STATE_GPU_SZ,  0,           0,           &_save_gpu,   &_load_gpu   },
+    { "TIMR", UGB_STATE_TIMR_SZ, 0,           0,           &_save_timer, &_load_timer },
+    { "MISC", UGB_STATE_MISC_SZ, 0,           0,           &_save_misc,  &_load_misc  },
+};
+
+#define UGB_STATE_NCHUNKS (sizeof(_chunks) / sizeof(_chunks[0]))
+
+static const ugb_state_chunk* _find_chunk(const uint8_t* tag)
+{
+    for (size_t i = 0; i < UGB_STATE_NCHUNKS; ++i)
+    {
+        if (!memcmp(&_chunks[i].tag[0], tag, 4))
+            return &_chunks[i];
+    }
+
+    return 0;
+}
+
+static inline size_t _chunk_size(ugb_gbm* gbm, const ugb_state_chunk* chunk)
+{
+    return chunk->dyn_size ? (*chunk->dyn_size)(gbm) : chunk->size;
+}
+
+/******************/
+/*** Public API ***/
+/******************/
+
+size_t ugb_gbm_state_size(ugb_gbm* gbm)
+{
+    size_t size = UGB_STATE_HEADER_SZ;
+    for (size_t i = 0; i < UGB_STATE_NCHUNKS; ++i)
+        size += UGB_STATE_CHUNK_HEADER_SZ + _chunk_size(gbm, &_chunks[i]);
+
+    return size;
+}
+
+ssize_t ugb_gbm_save_state(ugb_gbm* gbm, uint8_t* buf, size_t size)
+{
+    if (!gbm || !buf)
+        return UGB_ERR_BADARGS;
+
+    if (size < ugb_gbm_state_size(gbm))
+        return UGB_ERR_NOSPACE;
+
+    uint8_t* p = buf;
+    memcpy(p, UGB_STATE_MAGIC, 4);
+    p += 4;
+    p = _put16(p, UGB_STATE_VERSION);
+    p = _put16(p, UGB_STATE_NCHUNKS);
+
+    for (size_t i = 0; i < UGB_STATE_NCHUNKS; ++i)
+    {
+        const ugb_state_chunk* chunk = &_chunks[i];
+        size_t len = _chunk_size(gbm, chunk);
+
+        memcpy(p, &chunk->tag[0], 4);
+        p += 4;
+        p = _put32(p, len);
+
+        if (chunk->area)
+            memcpy(p, (*chunk->area)(gbm), len);
+        else
+            (*chunk->save)(gbm, p);
+        p += len;
+    }
+
+    return p - buf;
+}
+
+int ugb_gbm_load_state(ugb_gbm* gbm, const uint8_t* buf, size_t size)
+{
+    if (!gbm || !buf)
+        return UGB_ERR_BADARGS;
+
+    if (size < UGB_STATE_HEADER_SZ || memcmp(buf, UGB_STATE_MAGIC, 4))
+        return UGB_ERR_BADSTATE;
+
+    const uint8_t* p = buf + 4;
+    if (_get16(&p) != UGB_STATE_VERSION)
+        return UGB_ERR_BADSTATE;
+    size_t count = _get16(&p);
+
+    // First pass only checks the layout, so that a truncated or
+    //   corrupted state can't leave the machine half-loaded
+    const uint8_t* end = buf + size;
+    const uint8_t* q = p;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (end - q < UGB_STATE_CHUNK_HEADER_SZ)
+            return UGB_ERR_BADSTATE;
+
+        const ugb_state_chunk* chunk = _find_chunk(q);
+        q += 4;
+        size_t len = _get32(&q);
+
+        if ((size_t) (end - q) < len || (chunk && len != _chunk_size(gbm, chunk)))
+            return UGB_ERR_BADSTATE;
+        q += len;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const ugb_state_chunk* chunk = _find_chunk(p);
+        p += 4;
+        size_t len = _get32(&p);
+
+        if (chunk && chunk->area)
+            memcpy((*chunk->area)(gbm), p, len);
+        else if (chunk)
+            (*chunk->load)(gbm, p);
+        p += len;
+    }
+
+    // Loading jumps away from whatever the history recorded
+    if (gbm->history)
+        ugb_history_reset(gbm->history);
+
+    // Memory was written directly, and banks may have changed
+    ugb_cart_update_maps(gbm->cart);
+    return ugb_mmu_mark_dirty(gbm->mmu, 0x0000, 0xFFFF);
+}
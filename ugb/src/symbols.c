@@ -0,0 +1,283 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "symbols.h"
+#include "constants.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+ugb_symbols* ugb_symbols_create()
+{
+    ugb_symbols* syms = malloc(sizeof(ugb_symbols));
+    if (!syms)
+        return 0;
+
+    memset(syms, 0, sizeof(ugb_symbols));
+
+    return syms;
+}
+
+void ugb_symbols_destroy(ugb_symbols* syms)
+{
+    if (syms)
+    {
+        for (size_t i = 0; i < syms->count; ++i)
+            free(syms->list[i].name);
+
+        free(syms->by_name);
+        free(syms->list);
+        free(syms);
+    }
+}
+
+static uint32_t _key(uint16_t bank, uint16_t addr)
+{
+    return ((uint32_t) bank << 16) | addr;
+}
+
+// First symbol whose key is not below the given one
+static size_t _lower_bound(const ugb_symbols* syms, uint32_t key)
+{
+    size_t lo = 0;
+    size_t hi = syms->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (_key(syms->list[mid].bank, syms->list[mid].addr) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+// Symbols don't extend past the memory region they're in
+static int _region(uint16_t addr)
+{
+    if (addr < 0x8000)
+        return addr >> 14;
+    if (addr < 0xFE00)
+        return addr >> 13;
+    return addr < 0xFF80 ? 8 : 9;
+}
+
+static int _append(ugb_symbols* syms, uint16_t bank, uint16_t addr, const char* name)
+{
+    if (addr < UGB_CART_ROMX_LO || addr > UGB_CART_ROMX_HI)
+        bank = 0;
+
+    if (syms->count == syms->capacity)
+    {
+        size_t capacity = syms->capacity ? 2 * syms->capacity : 256;
+        ugb_symbol* list = realloc(syms->list, capacity * sizeof(ugb_symbol));
+        if (!list)
+            return UGB_ERR_MALLOC;
+
+        syms->list = list;
+        syms->capacity = capacity;
+    }
+
+    char* copy = malloc(strlen(name) + 1);
+    if (!copy)
+        return UGB_ERR_MALLOC;
+    strcpy(copy, name);
+
+    ugb_symbol* sym = &syms->list[syms->count++];
+    sym->bank = bank;
+    sym->addr = addr;
+    sym->name = copy;
+
+    return UGB_ERR_OK;
+}
+
+static int _by_address(const void* a, const void* b)
+{
+    const ugb_symbol* sa = (const ugb_symbol*) a;
+    const ugb_symbol* sb = (const ugb_symbol*) b;
+
+    uint32_t ka = _key(sa->bank, sa->addr);
+    uint32_t kb = _key(sb->bank, sb->addr);
+    if (ka != kb)
+        return (ka > kb) - (ka < kb);
+
+    return strcmp(sa->name, sb->name);
+}
+
+static int _by_name(const void* a, const void* b)
+{
+    return strcmp((*(const ugb_symbol* const*) a)->name, (*(const ugb_symbol* const*) b)->name);
+}
+
+// Sort once everything has been appended, rather than on each insertion
+static int _sort(ugb_symbols* syms)
+{
+    qsort(syms->list, syms->count, sizeof(ugb_symbol), &_by_address);
+
+    // The list may have moved, the old index can't be kept around
+    const ugb_symbol** by_name = realloc(syms->by_name, (syms->count ? syms->count : 1) * sizeof(ugb_symbol*));
+    if (!by_name)
+    {
+        free(syms->by_name);
+        syms->by_name = 0;
+        return UGB_ERR_MALLOC;
+    }
+
+    syms->by_name = by_name;
+    for (size_t i = 0; i < syms->count; ++i)
+        by_name[i] = &syms->list[i];
+
+    qsort(by_name, syms->count, sizeof(ugb_symbol*), &_by_name);
+
+    return UGB_ERR_OK;
+}
+
+int ugb_symbols_add(ugb_symbols* syms, uint16_t bank, uint16_t addr, const char* name)
+{
+    if (!syms || !name)
+        return UGB_ERR_BADARGS;
+
+    int err = _append(syms, bank, addr, name);
+    if (err != UGB_ERR_OK)
+        return err;
+
+    return _sort(syms);
+}
+
+ssize_t ugb_symbols_load(ugb_symbols* syms, const char* path)
+{
+    if (!syms || !path)
+        return UGB_ERR_BADARGS;
+
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return UGB_ERR_NOENT;
+
+    ssize_t count = 0;
+    unsigned int map_bank = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f))
+    {
+        unsigned int bank, addr;
+        char name[256];
+
+        // Map files give the bank once for all the sections in it
+        if (sscanf(line, "%*s bank #%u", &bank) == 1)
+        {
+            map_bank = bank;
+            continue;
+        }
+
+        // Anything else is a comment or something we don't care about
+        if (sscanf(line, " %x:%x %255s", &bank, &addr, name) != 3 &&
+            (bank = map_bank, sscanf(line, " $%x = %255s", &addr, name) != 2))
+        {
+            continue;
+        }
+
+        if (addr > 0xFFFF)
+            continue;
+
+        int err = _append(syms, bank, addr, name);
+        if (err != UGB_ERR_OK)
+        {
+            fclose(f);
+            _sort(syms);
+            return err;
+        }
+
+        ++count;
+    }
+
+    fclose(f);
+
+    int err = _sort(syms);
+    return err == UGB_ERR_OK ? count : err;
+}
+
+const ugb_symbol* ugb_symbols_lookup(const ugb_symbols* syms, uint16_t bank, uint16_t addr)
+{
+    if (!syms || !syms->count)
+        return 0;
+
+    if (addr < UGB_CART_ROMX_LO || addr > UGB_CART_ROMX_HI)
+        bank = 0;
+
+    // Last symbol at or before the address
+    size_t pos = _lower_bound(syms, _key(bank, addr) + 1);
+    if (!pos)
+        return 0;
+
+    // Aliases are sorted by name, prefer the first one
+    uint32_t key = _key(syms->list[pos - 1].bank, syms->list[pos - 1].addr);
+    while (pos > 1 && _key(syms->list[pos - 2].bank, syms->list[pos - 2].addr) == key)
+        --pos;
+
+    const ugb_symbol* sym = &syms->list[pos - 1];
+    if (sym->bank != bank || _region(sym->addr) != _region(addr))
+        return 0;
+
+    return sym;
+}
+
+const ugb_symbol* ugb_symbols_find(const ugb_symbols* syms, const char* name)
+{
+    if (!syms || !name || !syms->by_name)
+        return 0;
+
+    size_t lo = 0;
+    size_t hi = syms->count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        const ugb_symbol* sym = syms->by_name[mid];
+
+        int cmp = strcmp(sym->name, name);
+        if (!cmp)
+            return sym;
+
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return 0;
+}
+
+int ugb_symbols_format(const ugb_symbols* syms, uint16_t bank, uint16_t addr, char* str, size_t size)
+{
+    if (!str || !size)
+        return UGB_ERR_BADARGS;
+
+    if (addr < UGB_CART_ROMX_LO || addr > UGB_CART_ROMX_HI)
+        bank = 0;
+
+    const ugb_symbol* sym = ugb_symbols_lookup(syms, bank, addr);
+    if (!sym)
+        snprintf(str, size, "%02X:%04X", bank, addr);
+    else if (sym->addr == addr)
+        snprintf(str, size, "%s", sym->name);
+    else
+        snprintf(str, size, "%s+%X", sym->name, addr - sym->addr);
+
+    return UGB_ERR_OK;
+}
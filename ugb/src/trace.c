@@ -0,0 +1,182 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+#include "cpu.h"
+#include "cart.h"
+#include "constants.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+_Static_assert(sizeof(ugb_trace_record) == 32, "trace records must stay 32 bytes wide");
+
+static ugb_trace* _map(int fd, size_t size, int prot)
+{
+    void* ptr = mmap(0, size, prot, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED)
+        return 0;
+
+    ugb_trace* trace = malloc(sizeof(ugb_trace));
+    if (!trace)
+    {
+        munmap(ptr, size);
+        return 0;
+    }
+
+    memset(trace, 0, sizeof(ugb_trace));
+    trace->size = size;
+    trace->header = (ugb_trace_header*) ptr;
+    trace->records = (ugb_trace_record*) ((uint8_t*) ptr + UGB_TRACE_HEADER_SZ);
+
+    return trace;
+}
+
+ugb_trace* ugb_trace_create(ugb_gbm* gbm, const char* path, size_t records)
+{
+    if (!gbm || !path || !records)
+        return 0;
+
+    uint64_t capacity = 1;
+    while (capacity < records)
+        capacity <<= 1;
+
+    size_t size = UGB_TRACE_HEADER_SZ + capacity * sizeof(ugb_trace_record);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return 0;
+
+    ugb_trace* trace = 0;
+    if (ftruncate(fd, size) == 0)
+        trace = _map(fd, size, PROT_READ | PROT_WRITE);
+
+    close(fd);
+
+    if (!trace)
+        return 0;
+
+    trace->gbm = gbm;
+    trace->mask = capacity - 1;
+    trace->header->magic = UGB_TRACE_MAGIC;
+    trace->header->version = UGB_TRACE_VERSION;
+    trace->header->record_size = sizeof(ugb_trace_record);
+    trace->header->capacity = capacity;
+
+    gbm->cpu->trace = trace;
+
+    return trace;
+}
+
+ugb_trace* ugb_trace_open(const char* path)
+{
+    if (!path)
+        return 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    ugb_trace* trace = 0;
+    if (fstat(fd, &st) == 0 && st.st_size >= UGB_TRACE_HEADER_SZ)
+        trace = _map(fd, st.st_size, PROT_READ);
+
+    close(fd);
+
+    if (!trace)
+        return 0;
+
+    ugb_trace_header* header = trace->header;
+    if (header->magic != UGB_TRACE_MAGIC ||
+        header->version != UGB_TRACE_VERSION ||
+        header->record_size != sizeof(ugb_trace_record) ||
+        !header->capacity || (header->capacity & (header->capacity - 1)) ||
+        UGB_TRACE_HEADER_SZ + header->capacity * sizeof(ugb_trace_record) > trace->size)
+    {
+        ugb_trace_destroy(trace);
+        return 0;
+    }
+
+    trace->mask = header->capacity - 1;
+
+    return trace;
+}
+
+void ugb_trace_destroy(ugb_trace* trace)
+{
+    if (trace)
+    {
+        if (trace->gbm && trace->gbm->cpu->trace == trace)
+            trace->gbm->cpu->trace = 0;
+
+        munmap(trace->header, trace->size);
+        free(trace);
+    }
+}
+
+int ugb_trace_step(ugb_trace* trace, uint16_t pc, const ugb_opcode* opcode, uint8_t const* imm)
+{
+    ugb_gbm* gbm = trace->gbm;
+    ugb_cpu* cpu = gbm->cpu;
+
+    uint64_t index = trace->header->count++;
+    ugb_trace_record* rec = &trace->records[index & trace->mask];
+
+    rec->cycles = gbm->cycles;
+    rec->pc = pc;
+    rec->bank = ugb_cart_romx_bank(gbm->cart);
+    rec->af = *cpu->regs.AF;
+    rec->bc = *cpu->regs.BC;
+    rec->de = *cpu->regs.DE;
+    rec->hl = *cpu->regs.HL;
+    rec->sp = *cpu->regs.SP;
+    rec->ie = *cpu->regs.IE;
+    rec->size = opcode->size;
+
+    // Opcode bytes as fetched, the prefix being part of the code. Only
+    //   the immediates the opcode has are valid, the rest is zeroed so
+    //   that traces of the same run are identical.
+    int prefixed = opcode->code > 0xFF;
+    int imm_len = opcode->size - 1 - prefixed;
+    rec->code[0] = prefixed ? 0xCB : opcode->code;
+    rec->code[1] = prefixed ? opcode->code : (imm_len > 0 ? imm[0] : 0);
+    rec->code[2] = imm_len > 1 - prefixed ? imm[1 - prefixed] : 0;
+    rec->code[3] = 0;
+
+    return UGB_ERR_OK;
+}
+
+const ugb_trace_record* ugb_trace_get(ugb_trace* trace, uint64_t index)
+{
+    if (!trace)
+        return 0;
+
+    uint64_t count = trace->header->count;
+    if (index >= count || count - index > trace->header->capacity)
+        return 0;
+
+    return &trace->records[index & trace->mask];
+}
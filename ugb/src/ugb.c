@@ -0,0 +1,179 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ugb.h"
+#include "gbm.h"
+#include "gpu.h"
+#include "cart.h"
+#include "joypad.h"
+#include "state.h"
+#include "constants.h"
+#include "errno.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+_Static_assert(UGB_SCREEN_W == UGB_GPU_SCREEN_W && UGB_SCREEN_H == UGB_GPU_SCREEN_H,
+    "the public screen size doesn't match the GPU's");
+
+struct ugb
+{
+    ugb_gbm* gbm;
+
+    // Private copy of the ROM, the cartridge only references it
+    uint8_t* rom;
+    size_t rom_size;
+};
+
+int ugb_api_version(void)
+{
+    return UGB_API_VERSION;
+}
+
+const char* ugb_error_string(int err)
+{
+    return ugb_strerror(err);
+}
+
+ugb* ugb_create(void)
+{
+    ugb* gb = malloc(sizeof(ugb));
+    if (!gb)
+        return 0;
+
+    memset(gb, 0, sizeof(ugb));
+
+    if (!(gb->gbm = ugb_gbm_create()))
+    {
+        free(gb);
+        return 0;
+    }
+
+    return gb;
+}
+
+void ugb_destroy(ugb* gb)
+{
+    if (gb)
+    {
+        ugb_gbm_destroy(gb->gbm);
+        free(gb->rom);
+        free(gb);
+    }
+}
+
+int ugb_load_rom(ugb* gb, const void* rom, size_t size)
+{
+    if (!gb || !rom || !size)
+        return UGB_ERR_BADARGS;
+
+    uint8_t* copy = malloc(size);
+    if (!copy)
+        return UGB_ERR_MALLOC;
+
+    memcpy(copy, rom, size);
+
+    // The previous ROM is unloaded even if the new one is rejected
+    int err = ugb_cart_load(gb->gbm->cart, copy, size);
+    free(gb->rom);
+    gb->rom = 0;
+
+    if (err != UGB_ERR_OK)
+    {
+        free(copy);
+        return err;
+    }
+
+    gb->rom = copy;
+    gb->rom_size = size;
+
+    return ugb_reset(gb, 0);
+}
+
+int ugb_reset(ugb* gb, int skip_bios)
+{
+    if (!gb || !gb->rom)
+        return UGB_ERR_BADARGS;
+
+    int err;
+    if ((err = ugb_gbm_reset(gb->gbm)) != UGB_ERR_OK ||
+        (err = ugb_gbm_clear_memory(gb->gbm)) != UGB_ERR_OK)
+    {
+        return err;
+    }
+
+    return skip_bios ? ugb_gbm_skip_bios(gb->gbm) : UGB_ERR_OK;
+}
+
+int ugb_run_frame(ugb* gb)
+{
+    return ugb_run_frames(gb, 1);
+}
+
+int ugb_run_frames(ugb* gb, size_t frames)
+{
+    if (!gb || !gb->rom)
+        return UGB_ERR_BADARGS;
+
+    return ugb_gbm_run_frames(gb->gbm, frames);
+}
+
+void ugb_set_input(ugb* gb, uint8_t buttons)
+{
+    if (gb)
+    {
+        ugb_joypad_release(gb->gbm->joypad, ~buttons);
+        ugb_joypad_press(gb->gbm->joypad, buttons);
+    }
+}
+
+const uint8_t* ugb_framebuffer(ugb* gb)
+{
+    return gb ? gb->gbm->gpu->framebuf : 0;
+}
+
+size_t ugb_frame_count(ugb* gb)
+{
+    return gb ? gb->gbm->gpu->frames : 0;
+}
+
+uint64_t ugb_cycle_count(ugb* gb)
+{
+    return gb ? gb->gbm->cycles : 0;
+}
+
+size_t ugb_state_size(ugb* gb)
+{
+    return gb ? ugb_gbm_state_size(gb->gbm) : 0;
+}
+
+ssize_t ugb_save_state(ugb* gb, void* buf, size_t size)
+{
+    if (!gb || !gb->rom)
+        return UGB_ERR_BADARGS;
+
+    return ugb_gbm_save_state(gb->gbm, buf, size);
+}
+
+int ugb_load_state(ugb* gb, const void* buf, size_t size)
+{
+    if (!gb || !gb->rom)
+        return UGB_ERR_BADARGS;
+
+    return ugb_gbm_load_state(gb->gbm, buf, size);
+}
@@ -0,0 +1,420 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "romcache.h"
+#include "joypad.h"
+#include "constants.h"
+#include "errno.h"
+
+// Job list format, one job per line (# starts a comment) :
+//   <rom> [frames] [input script]
+//
+// Input script format, one joypad state per line :
+//   <frame> <buttons>
+// with buttons either "-" or names joined by '+', e.g. "120 A+RIGHT".
+
+typedef struct ugb_batch_file
+{
+    char* path;
+    uint8_t* data;
+    size_t size;
+} ugb_batch_file;
+
+typedef struct ugb_batch_files
+{
+    ugb_batch_file* list;
+    size_t count;
+    size_t capacity;
+} ugb_batch_files;
+
+static void _usage(const char* prog)
+{
+    printf("Usage: '%s [-j threads] [-p] [-f frames] [-b] <job list>'.\n", prog);
+    printf("  -j threads  Worker threads (default: one per core)\n");
+    printf("  -p          Pin each worker to a core\n");
+    printf("  -f frames   Default frame count for jobs that don't set one (600)\n");
+    printf("  -b          Skip the BIOS\n");
+}
+
+static uint8_t* _read_file(const char* path, size_t* size)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return 0;
+
+    uint8_t* data = 0;
+    if (fseek(f, 0, SEEK_END) == 0)
+    {
+        long len = ftell(f);
+        if (len > 0 && fseek(f, 0, SEEK_SET) == 0 && (data = malloc(len)))
+        {
+            if (fread(data, 1, len, f) == (size_t) len)
+            {
+                *size = len;
+            }
+            else
+            {
+                free(data);
+                data = 0;
+            }
+        }
+    }
+
+    fclose(f);
+    return data;
+}
+
+// Files used by several jobs are only read once
+static ugb_batch_file* _get_file(ugb_batch_files* files, const char* path)
+{
+    for (size_t i = 0; i < files->count; ++i)
+    {
+        if (!strcmp(files->list[i].path, path))
+            return &files->list[i];
+    }
+
+    if (files->count == files->capacity)
+    {
+        size_t capacity = files->capacity ? 2 * files->capacity : 16;
+        ugb_batch_file* list = realloc(files->list, capacity * sizeof(ugb_batch_file));
+        if (!list)
+            return 0;
+
+        files->list = list;
+        files->capacity = capacity;
+    }
+
+    ugb_batch_file* file = &files->list[files->count];
+    if (!(file->data = _read_file(path, &file->size)))
+        return 0;
+
+    if (!(file->path = strdup(path)))
+    {
+        free(file->data);
+        return 0;
+    }
+
+    ++files->count;
+    return file;
+}
+
+static int _parse_buttons(const char* str, uint8_t* buttons)
+{
+    static const struct
+    {
+        const char* name;
+        uint8_t mask;
+    } names[] =
+    {
+        { "RIGHT",  UGB_JOYPAD_RIGHT  },
+        { "LEFT",   UGB_JOYPAD_LEFT   },
+        { "UP",     UGB_JOYPAD_UP     },
+        { "DOWN",   UGB_JOYPAD_DOWN   },
+        { "A",      UGB_JOYPAD_A      },
+        { "B",      UGB_JOYPAD_B      },
+        { "SELECT", UGB_JOYPAD_SELECT },
+        { "START",  UGB_JOYPAD_START  },
+    };
+
+    *buttons = 0;
+    if (!strcmp(str, "-"))
+        return UGB_ERR_OK;
+
+    while (*str)
+    {
+        size_t len = strcspn(str, "+");
+
+        int found = 0;
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+        {
+            if (strlen(names[i].name) == len && !strncmp(names[i].name, str, len))
+            {
+                *buttons |= names[i].mask;
+                found = 1;
+            }
+        }
+
+        if (!found)
+            return UGB_ERR_BADARGS;
+
+        str += len;
+        if (*str == '+')
+            ++str;
+    }
+
+    return UGB_ERR_OK;
+}
+
+static ugb_batch_input* _parse_script(ugb_batch_file const* file, size_t* count)
+{
+    // Upper bound of the number of lines
+    size_t lines = 1;
+    for (size_t i = 0; i < file->size; ++i)
+        lines += file->data[i] == '\n';
+
+    ugb_batch_input* inputs = malloc(lines * sizeof(ugb_batch_input));
+    char* text = malloc(file->size + 1);
+    if (!inputs || !text)
+    {
+        free(inputs);
+        free(text);
+        return 0;
+    }
+
+    memcpy(text, file->data, file->size);
+    text[file->size] = '\0';
+
+    *count = 0;
+    int ok = 1;
+    for (char* line = text; ok && line && *line; )
+    {
+        char* next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+
+        char buttons[64];
+        unsigned long frame;
+        int n = sscanf(line, "%lu %63s", &frame, &buttons[0]);
+
+        if (n == 2 && _parse_buttons(&buttons[0], &inputs[*count].buttons) == UGB_ERR_OK &&
+            (!*count || frame >= inputs[*count - 1].frame))
+        {
+            inputs[(*count)++].frame = frame;
+        }
+        else if (n > 0 || line[strspn(line, " \t\r")] != '\0')
+        {
+            ok = 0;
+        }
+
+        line = next;
+    }
+
+    free(text);
+    if (!ok)
+    {
+        free(inputs);
+        return 0;
+    }
+
+    return inputs;
+}
+
+static void _print_escaped(uint8_t const* data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        if (data[i] == '\\')
+            printf("\\\\");
+        else if (isprint(data[i]))
+            putchar(data[i]);
+        else
+            printf("\\x%02X", data[i]);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int threads = 0;
+    int pin = 0;
+    size_t default_frames = 600;
+    int skip_bios = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:pf:b")) != -1)
+    {
+        char* end = 0;
+        switch (opt)
+        {
+            case 'j':
+                threads = strtol(optarg, &end, 0);
+                break;
+
+            case 'f':
+                default_frames = strtoull(optarg, &end, 0);
+                break;
+
+            case 'p': pin = 1; break;
+            case 'b': skip_bios = 1; break;
+
+            default:
+                _usage(argv[0]);
+                return 1;
+        }
+
+        if (end && (end == optarg || *end || threads < 0))
+        {
+            printf("Invalid count \"%s\".\n", optarg);
+            return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    FILE* list = fopen(argv[optind], "r");
+    if (!list)
+    {
+        printf("Unable to open \"%s\".\n", argv[optind]);
+        return 1;
+    }
+
+    /*************************************************************/
+
+    // ROMs are mapped once and shared by every worker, input
+    //   scripts are small enough to be simply read
+    ugb_romcache* romcache = ugb_romcache_create();
+    ugb_batch_files files = { 0, 0, 0 };
+    ugb_batch_job* jobs = 0;
+    const char** names = 0;
+    size_t count = 0;
+    size_t capacity = 0;
+    int ret = 1;
+
+    char line[1024];
+    for (int lineno = 1; fgets(&line[0], sizeof(line), list); ++lineno)
+    {
+        char* comment = strchr(&line[0], '#');
+        if (comment)
+            *comment = '\0';
+
+        char rom_path[512];
+        char script_path[512];
+        unsigned long frames = default_frames;
+        int n = sscanf(&line[0], "%511s %lu %511s", &rom_path[0], &frames, &script_path[0]);
+        if (n <= 0)
+            continue;
+
+        if (count == capacity)
+        {
+            capacity = capacity ? 2 * capacity : 64;
+            ugb_batch_job* more_jobs = realloc(jobs, capacity * sizeof(ugb_batch_job));
+            if (more_jobs)
+                jobs = more_jobs;
+            const char** more_names = realloc(names, capacity * sizeof(const char*));
+            if (more_names)
+                names = more_names;
+
+            if (!more_jobs || !more_names)
+            {
+                printf("Error: %s\n", ugb_strerror(UGB_ERR_MALLOC));
+                goto end;
+            }
+        }
+
+        ugb_batch_job* job = &jobs[count];
+        memset(job, 0, sizeof(ugb_batch_job));
+        job->frames = frames;
+        job->skip_bios = skip_bios;
+
+        ugb_rom* rom = 0;
+        if (!romcache || ugb_romcache_open(romcache, &rom_path[0], &rom) != UGB_ERR_OK ||
+            !(names[count] = strdup(&rom_path[0])))
+        {
+            printf("%s:%d: unable to read \"%s\".\n", argv[optind], lineno, &rom_path[0]);
+            goto end;
+        }
+        job->rom = rom->data;
+        job->rom_size = rom->size;
+
+        if (n == 3)
+        {
+            ugb_batch_file* script = _get_file(&files, &script_path[0]);
+            ugb_batch_input* inputs = 0;
+            if (!script || !(inputs = _parse_script(script, &job->inputs_count)))
+            {
+                printf("%s:%d: bad input script \"%s\".\n", argv[optind], lineno, &script_path[0]);
+                free((void*) names[count]);
+                goto end;
+            }
+            job->inputs = inputs;
+        }
+
+        ++count;
+    }
+
+    ugb_batch* batch = ugb_batch_create(threads, pin);
+    if (!batch)
+    {
+        printf("Error: %s\n", ugb_strerror(UGB_ERR_MALLOC));
+        goto end;
+    }
+
+    int err;
+    if ((err = ugb_batch_run(batch, jobs, count)) != UGB_ERR_OK)
+    {
+        printf("Error: %s\n", ugb_strerror(err));
+        ugb_batch_destroy(batch);
+        goto end;
+    }
+
+    /*************************************************************/
+
+    // Per-job results, tab-separated
+    for (size_t i = 0; i < count; ++i)
+    {
+        ugb_batch_result const* res = &jobs[i].result;
+
+        printf("%s\t%s\t%zu\t%016llX\t%016llX\t", names[i],
+            res->err == UGB_ERR_OK ? "ok" : ugb_strerror(res->err), res->frames,
+            (unsigned long long) res->state_hash, (unsigned long long) res->framebuf_hash);
+        _print_escaped(&res->serial[0], res->serial_len);
+        printf("\n");
+    }
+
+    ugb_batch_stats const* stats = &batch->stats;
+    double secs = stats->ns / 1e9;
+    fprintf(stderr, "%zu jobs (%zu failed, %zu stolen) on %d threads in %.3f s\n",
+        stats->jobs, stats->failed, stats->stolen, batch->threads, secs);
+    fprintf(stderr, "%llu frames, %.1f frames/s, %.2f MHz aggregate (%.1fx real time)\n",
+        (unsigned long long) stats->frames, stats->frames / secs, stats->cycles / secs / 1e6,
+        stats->cycles / (double) UGB_CPU_CLOCK_FREQ / secs);
+
+    ret = stats->failed != 0;
+    ugb_batch_destroy(batch);
+
+end:
+    for (size_t i = 0; i < count; ++i)
+    {
+        free((void*) jobs[i].inputs);
+        free((void*) names[i]);
+    }
+    for (size_t i = 0; i < files.count; ++i)
+    {
+        free(files.list[i].path);
+        free(files.list[i].data);
+    }
+    free(files.list);
+    ugb_romcache_destroy(romcache);
+    free(names);
+    free(jobs);
+    fclose(list);
+
+    return ret;
+}
@@ -0,0 +1,326 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gbm.h"
+#include "cart.h"
+#include "joypad.h"
+#include "romcache.h"
+#include "fuzz.h"
+#include "constants.h"
+#include "errno.h"
+
+// Random input scripts, mutated from the ones that found new edges.
+// Those are saved in the batch input script format, so that they can
+//   be replayed with ugb-batch.
+
+#define UGB_FUZZ_MAX_INPUTS 32
+
+typedef struct ugb_fuzz_entry
+{
+    ugb_batch_input inputs[UGB_FUZZ_MAX_INPUTS];
+    size_t count;
+} ugb_fuzz_entry;
+
+typedef struct ugb_fuzz_corpus
+{
+    ugb_fuzz_entry* list;
+    size_t count;
+    size_t capacity;
+} ugb_fuzz_corpus;
+
+static void _usage(const char* prog)
+{
+    printf("Usage: '%s [-w frames] [-b] [-f frames] [-n trials] [-F] [-s seed] [-o dir] <rom>'.\n", prog);
+    printf("  -w frames  Frames to run before taking the template (default 300)\n");
+    printf("  -b         Skip the BIOS\n");
+    printf("  -f frames  Frames per trial (default 60)\n");
+    printf("  -n trials  Number of trials (default 10000)\n");
+    printf("  -F         Run each trial in a forked child instead of in place\n");
+    printf("  -s seed    Random seed (default: time based)\n");
+    printf("  -o dir     Save the input scripts that found new edges there\n");
+}
+
+static uint64_t _rand(uint64_t* state)
+{
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static int _by_frame(const void* a, const void* b)
+{
+    size_t fa = ((const ugb_batch_input*) a)->frame;
+    size_t fb = ((const ugb_batch_input*) b)->frame;
+    return (fa > fb) - (fa < fb);
+}
+
+static void _generate(ugb_fuzz_entry* e, ugb_fuzz_corpus const* corpus, size_t frames, uint64_t* rng)
+{
+    if (corpus->count && (_rand(rng) & 3))
+    {
+        // Tweak one of the interesting ones
+        *e = corpus->list[_rand(rng) % corpus->count];
+
+        size_t i = e->count ? _rand(rng) % e->count : 0;
+        switch (_rand(rng) % 4)
+        {
+            case 0:
+                if (e->count)
+                {
+                    e->inputs[i].buttons ^= 1 << (_rand(rng) % 8);
+                    break;
+                }
+                // Fall through
+
+            case 1:
+                if (e->count < UGB_FUZZ_MAX_INPUTS)
+                {
+                    e->inputs[e->count].frame = _rand(rng) % frames;
+                    e->inputs[e->count].buttons = _rand(rng);
+                    ++e->count;
+                }
+                break;
+
+            case 2:
+                if (e->count)
+                    e->inputs[i].frame = _rand(rng) % frames;
+                break;
+
+            case 3:
+                if (e->count)
+                    e->inputs[i] = e->inputs[--e->count];
+                break;
+        }
+    }
+    else
+    {
+        e->count = 1 + _rand(rng) % 8;
+        for (size_t i = 0; i < e->count; ++i)
+        {
+            e->inputs[i].frame = _rand(rng) % frames;
+            e->inputs[i].buttons = _rand(rng);
+        }
+    }
+
+    qsort(&e->inputs[0], e->count, sizeof(ugb_batch_input), &_by_frame);
+}
+
+static int _keep(ugb_fuzz_corpus* corpus, ugb_fuzz_entry const* e)
+{
+    if (corpus->count == corpus->capacity)
+    {
+        size_t capacity = corpus->capacity ? 2 * corpus->capacity : 64;
+        ugb_fuzz_entry* list = realloc(corpus->list, capacity * sizeof(ugb_fuzz_entry));
+        if (!list)
+            return UGB_ERR_MALLOC;
+
+        corpus->list = list;
+        corpus->capacity = capacity;
+    }
+
+    corpus->list[corpus->count++] = *e;
+    return UGB_ERR_OK;
+}
+
+static int _save(const char* dir, size_t id, ugb_fuzz_entry const* e)
+{
+    static const char* names[8] = { "RIGHT", "LEFT", "UP", "DOWN", "A", "B", "SELECT", "START" };
+
+    char path[1024];
+    snprintf(&path[0], sizeof(path), "%s/id_%06zu.txt", dir, id);
+
+    FILE* f = fopen(&path[0], "w");
+    if (!f)
+        return UGB_ERR_BADARGS;
+
+    for (size_t i = 0; i < e->count; ++i)
+    {
+        fprintf(f, "%zu ", e->inputs[i].frame);
+        if (!e->inputs[i].buttons)
+            fprintf(f, "-");
+
+        const char* sep = "";
+        for (int b = 0; b < 8; ++b)
+        {
+            if (e->inputs[i].buttons & (1 << b))
+            {
+                fprintf(f, "%s%s", sep, names[b]);
+                sep = "+";
+            }
+        }
+        fprintf(f, "\n");
+    }
+
+    fclose(f);
+    return UGB_ERR_OK;
+}
+
+static int _parse_count(const char* str, size_t* value)
+{
+    char* end = 0;
+    *value = strtoull(str, &end, 0);
+    return end && end != str && !*end;
+}
+
+int main(int argc, char** argv)
+{
+    size_t warmup = 300;
+    size_t frames = 60;
+    size_t trials = 10000;
+    int skip_bios = 0;
+    int mode = UGB_FUZZ_IN_PLACE;
+    uint64_t seed = time(0);
+    const char* out_dir = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:bf:n:Fs:o:")) != -1)
+    {
+        int ok = 1;
+        size_t value = 0;
+        switch (opt)
+        {
+            case 'w': ok = _parse_count(optarg, &warmup); break;
+            case 'f': ok = _parse_count(optarg, &frames) && frames; break;
+            case 'n': ok = _parse_count(optarg, &trials); break;
+            case 's': ok = _parse_count(optarg, &value); seed = value; break;
+            case 'b': skip_bios = 1; break;
+            case 'F': mode = UGB_FUZZ_FORK; break;
+            case 'o': out_dir = optarg; break;
+
+            default:
+                _usage(argv[0]);
+                return 1;
+        }
+
+        if (!ok)
+        {
+            printf("Invalid count \"%s\".\n", optarg);
+            return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    const char* rom_path = argv[optind];
+
+    ugb_romcache* romcache = ugb_romcache_create();
+    ugb_rom* rom = 0;
+    if (!romcache || ugb_romcache_open(romcache, rom_path, &rom) != UGB_ERR_OK)
+    {
+        printf("Unable to open \"%s\".\n", rom_path);
+        ugb_romcache_destroy(romcache);
+        return 1;
+    }
+
+    int err = UGB_ERR_MALLOC;
+    ugb_gbm* gbm = ugb_gbm_create();
+    ugb_fuzz* fuzz = 0;
+    ugb_fuzz_corpus corpus = { 0, 0, 0 };
+
+    if (!gbm)
+        goto end;
+
+    // Get to the template
+    if ((err = ugb_cart_load(gbm->cart, rom->data, rom->size)) != UGB_ERR_OK ||
+        (skip_bios && (err = ugb_gbm_skip_bios(gbm)) != UGB_ERR_OK) ||
+        (err = ugb_gbm_run_frames(gbm, warmup)) != UGB_ERR_OK)
+    {
+        goto end;
+    }
+
+    if (!(fuzz = ugb_fuzz_create(gbm, mode)))
+    {
+        err = UGB_ERR_MALLOC;
+        goto end;
+    }
+
+    /*************************************************************/
+
+    uint64_t rng = seed ? seed : 1;
+    uint64_t reset_ns = 0;
+    uint64_t run_ns = 0;
+    size_t failed = 0;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (size_t i = 0; i < trials; ++i)
+    {
+        ugb_fuzz_entry entry;
+        _generate(&entry, &corpus, frames, &rng);
+
+        ugb_fuzz_result res;
+        if ((err = ugb_fuzz_trial(fuzz, &entry.inputs[0], entry.count, frames, &res)) != UGB_ERR_OK)
+            goto end;
+
+        reset_ns += res.reset_ns;
+        run_ns += res.run_ns;
+        failed += res.err != UGB_ERR_OK;
+
+        if (!res.new_edges)
+            continue;
+
+        printf("trial %zu: %zu edges, %zu new%s%s\n", i, res.edges, res.new_edges,
+            res.err != UGB_ERR_OK ? ", " : "", res.err != UGB_ERR_OK ? ugb_strerror(res.err) : "");
+
+        if ((err = _keep(&corpus, &entry)) != UGB_ERR_OK)
+            goto end;
+
+        if (out_dir && _save(out_dir, corpus.count - 1, &entry) != UGB_ERR_OK)
+            printf("Unable to write to \"%s\".\n", out_dir);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    size_t edges = 0;
+    for (size_t i = 0; i < UGB_CPU_COVERAGE_SZ; ++i)
+        edges += fuzz->seen[i] != 0;
+
+    fprintf(stderr, "%zu trials (%zu failed) in %.3f s, %.0f trials/s (%.2fM/hour)\n",
+        trials, failed, secs, trials / secs, trials / secs * 3600 / 1e6);
+    fprintf(stderr, "reset %.2f us, run %.2f us per trial (%s), %zu edges, %zu inputs kept\n",
+        trials ? reset_ns / 1e3 / trials : 0.0, trials ? run_ns / 1e3 / trials : 0.0,
+        mode == UGB_FUZZ_FORK ? "fork" : "in place", edges, corpus.count);
+
+end:
+    if (err != UGB_ERR_OK)
+        printf("Error: %s\n", ugb_strerror(err));
+
+    free(corpus.list);
+    ugb_fuzz_destroy(fuzz);
+    ugb_gbm_destroy(gbm);
+    ugb_romcache_close(romcache, rom);
+    ugb_romcache_destroy(romcache);
+
+    return err != UGB_ERR_OK;
+}
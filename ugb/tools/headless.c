@@ -0,0 +1,474 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gbm.h"
+#include "gpu.h"
+#include "cart.h"
+#include "romcache.h"
+#include "serial.h"
+#include "state.h"
+#include "export.h"
+#include "trace.h"
+#include "profiler.h"
+#include "symbols.h"
+#include "covmap.h"
+#include "gdbstub.h"
+#include "constants.h"
+#include "errno.h"
+
+typedef struct ugb_headless_opts
+{
+    size_t frames;
+    uint64_t cycles;
+    int hash;
+    int serial;
+    int skip_bios;
+    const char* dump;
+    const char* load_state;
+    const char* save_state;
+    const char* export_name;
+    int export_flags;
+    const char* trace;
+    size_t trace_records;
+    const char* stacks;
+    const char* flat;
+    const char* symbols;
+    const char* coverage;
+    const char* lcov;
+    const char* gdb;
+} ugb_headless_opts;
+
+static void _usage(const char* prog)
+{
+    printf("Usage: '%s [-f frames | -c cycles] [-b] [-H] [-s] [-o file.ppm] [-l state] [-S state] [-x name [-m]] [-t file [-T records]] [-p file] [-P file] [-y file.sym] [-C file] [-L file] [-g port | -g path] <rom>'.\n", prog);
+    printf("  -f frames  Run this many frames (default 600)\n");
+    printf("  -c cycles  Run this many CPU cycles instead\n");
+    printf("  -b         Skip the BIOS, start right at the cartridge entry point\n");
+    printf("  -H         Print a hash of the framebuffer after each frame\n");
+    printf("  -s         Print the serial port output when done\n");
+    printf("  -o file    Dump the final framebuffer as a binary PPM\n");
+    printf("  -l state   Load a save state before running\n");
+    printf("  -S state   Write a save state when done\n");
+    printf("  -x name    Publish each frame to the named shared memory ring\n");
+    printf("  -m         Also publish WRAM and HRAM with each frame\n");
+    printf("  -t file    Trace every instruction to this file (see ugb-trace)\n");
+    printf("  -T records Size of the trace ring (default 4M records)\n");
+    printf("  -p file    Profile the game, writing collapsed call stacks for flamegraph.pl\n");
+    printf("  -P file    Profile the game, writing the most expensive addresses\n");
+    printf("  -y file    RGBDS symbol or map file, for profiles and coverage reports\n");
+    printf("  -C file    Write the executed, read and written bitmaps there\n");
+    printf("  -L file    Write an lcov report of the labels executed (needs -y)\n");
+    printf("  -g port    Run under GDB's control instead, listening on localhost or a Unix socket\n");
+}
+
+static uint8_t* _read_file(const char* path, size_t* size)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f)
+        return 0;
+
+    uint8_t* data = 0;
+    if (fseek(f, 0, SEEK_END) == 0)
+    {
+        long len = ftell(f);
+        if (len > 0 && fseek(f, 0, SEEK_SET) == 0 && (data = malloc(len)))
+        {
+            if (fread(data, 1, len, f) == (size_t) len)
+            {
+                *size = len;
+            }
+            else
+            {
+                free(data);
+                data = 0;
+            }
+        }
+    }
+
+    fclose(f);
+    return data;
+}
+
+// 64-bit FNV-1a, good enough to spot any framebuffer difference
+static uint64_t _hash(uint8_t const* data, size_t size)
+{
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; ++i)
+    {
+        h ^= data[i];
+        h *= 0x100000001B3ULL;
+    }
+
+    return h;
+}
+
+static int _dump_ppm(const char* path, uint8_t const* framebuf)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return UGB_ERR_IO;
+
+    fprintf(f, "P6\n%d %d\n255\n", UGB_GPU_SCREEN_W, UGB_GPU_SCREEN_H);
+
+    // Expand RGB332 to RGB888
+    for (int i = 0; i < UGB_GPU_SCREEN_W * UGB_GPU_SCREEN_H; ++i)
+    {
+        uint8_t rgb[3] =
+        {
+            ((framebuf[i] >> 5) & 0x7) * 255 / 7,
+            ((framebuf[i] >> 2) & 0x7) * 255 / 7,
+            ((framebuf[i] >> 0) & 0x3) * 255 / 3
+        };
+        if (fwrite(&rgb[0], 1, 3, f) != 3)
+            break;
+    }
+
+    int ok = !ferror(f);
+    ok = !fclose(f) && ok;
+    return ok ? UGB_ERR_OK : UGB_ERR_IO;
+}
+
+static int _write_file(const char* path, uint8_t const* data, size_t size)
+{
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return UGB_ERR_IO;
+
+    int ok = fwrite(data, 1, size, f) == size;
+    ok = !fclose(f) && ok;
+    return ok ? UGB_ERR_OK : UGB_ERR_IO;
+}
+
+static double _now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv)
+{
+    ugb_headless_opts opts = { 600, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 << 22, 0, 0, 0, 0, 0, 0 };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:c:bHso:l:S:x:mt:T:p:P:y:C:L:g:")) != -1)
+    {
+        char* end = 0;
+        switch (opt)
+        {
+            case 'f':
+                opts.frames = strtoull(optarg, &end, 0);
+                opts.cycles = 0;
+                break;
+
+            case 'c':
+                opts.cycles = strtoull(optarg, &end, 0);
+                opts.frames = 0;
+                break;
+
+            case 'b': opts.skip_bios = 1; break;
+            case 'H': opts.hash = 1; break;
+            case 's': opts.serial = 1; break;
+            case 'o': opts.dump = optarg; break;
+            case 'l': opts.load_state = optarg; break;
+            case 'S': opts.save_state = optarg; break;
+            case 'x': opts.export_name = optarg; break;
+            case 'm': opts.export_flags |= UGB_EXPORT_MEMORY; break;
+            case 't': opts.trace = optarg; break;
+            case 'p': opts.stacks = optarg; break;
+            case 'P': opts.flat = optarg; break;
+            case 'y': opts.symbols = optarg; break;
+            case 'C': opts.coverage = optarg; break;
+            case 'L': opts.lcov = optarg; break;
+            case 'g': opts.gdb = optarg; break;
+
+            case 'T':
+                opts.trace_records = strtoull(optarg, &end, 0);
+                break;
+
+            default:
+                _usage(argv[0]);
+                return 1;
+        }
+
+        if (end && (end == optarg || *end))
+        {
+            printf("Invalid count \"%s\".\n", optarg);
+            return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    if (opts.hash && opts.cycles)
+    {
+        printf("Per-frame hashes need a frame count.\n");
+        return 1;
+    }
+
+    if (opts.lcov && !opts.symbols)
+    {
+        printf("Coverage reports need a symbol file.\n");
+        return 1;
+    }
+
+#ifndef UGB_GUEST_PROFILER
+    if (opts.stacks || opts.flat)
+    {
+        printf("Profiling isn't built in, rebuild with 'make GUEST_PROFILER=1'.\n");
+        return 1;
+    }
+#endif
+
+    const char* rom_path = argv[optind];
+
+    ugb_romcache* romcache = ugb_romcache_create();
+    ugb_rom* rom = 0;
+    if (!romcache || ugb_romcache_open(romcache, rom_path, &rom) != UGB_ERR_OK)
+    {
+        printf("Unable to open \"%s\".\n", rom_path);
+        ugb_romcache_destroy(romcache);
+        return 1;
+    }
+
+    // Everything optional is torn down at the end, whatever happens
+    ugb_export* exp = 0;
+    ugb_trace* trace = 0;
+    ugb_profiler* prof = 0;
+    ugb_covmap* cov = 0;
+    ugb_gdbstub* stub = 0;
+
+    int err;
+    ugb_gbm* gbm = ugb_gbm_create();
+    if (!gbm)
+    {
+        printf("Error: %s\n", ugb_strerror(UGB_ERR_MALLOC));
+        ugb_romcache_destroy(romcache);
+        return 1;
+    }
+
+    if ((err = ugb_cart_load(gbm->cart, rom->data, rom->size)) != UGB_ERR_OK)
+        goto end;
+
+    if (opts.skip_bios && (err = ugb_gbm_skip_bios(gbm)) != UGB_ERR_OK)
+        goto end;
+
+    if (opts.load_state)
+    {
+        size_t state_size = 0;
+        uint8_t* state = _read_file(opts.load_state, &state_size);
+        if (!state)
+        {
+            printf("Unable to open \"%s\".\n", opts.load_state);
+            err = UGB_ERR_NOENT;
+            goto end;
+        }
+
+        err = ugb_gbm_load_state(gbm, state, state_size);
+        free(state);
+        if (err != UGB_ERR_OK)
+            goto end;
+    }
+
+    if (opts.export_name && !(exp = ugb_export_create(gbm, opts.export_name, 8, opts.export_flags)))
+    {
+        printf("Unable to export to \"%s\".\n", opts.export_name);
+        err = UGB_ERR_NOENT;
+        goto end;
+    }
+
+    if (opts.trace && !(trace = ugb_trace_create(gbm, opts.trace, opts.trace_records)))
+    {
+        printf("Unable to trace to \"%s\".\n", opts.trace);
+        err = UGB_ERR_NOENT;
+        goto end;
+    }
+
+    if ((opts.stacks || opts.flat) && !(prof = ugb_profiler_create(gbm)))
+    {
+        err = UGB_ERR_MALLOC;
+        goto end;
+    }
+
+    if ((opts.coverage || opts.lcov) && !(cov = ugb_covmap_create(gbm)))
+    {
+        err = UGB_ERR_MALLOC;
+        goto end;
+    }
+
+    if (opts.gdb && !(stub = ugb_gdbstub_create(gbm, opts.gdb)))
+    {
+        printf("Unable to listen on \"%s\".\n", opts.gdb);
+        err = UGB_ERR_NOENT;
+        goto end;
+    }
+
+    /*************************************************************/
+
+    double start = _now();
+
+    if (stub)
+    {
+        printf("Waiting for GDB on %s.\n", opts.gdb);
+        fflush(stdout);
+        err = ugb_gdbstub_serve(stub);
+    }
+    else if (opts.cycles)
+    {
+        err = ugb_gbm_run_cycles(gbm, opts.cycles);
+    }
+    else
+    {
+        // Stop at every VBlank only when there's something to do there
+        size_t chunk = opts.hash ? 1 : opts.frames;
+        for (size_t done = 0; done < opts.frames; done += chunk)
+        {
+            if ((err = ugb_gbm_run_frames(gbm, chunk)) != UGB_ERR_OK)
+                break;
+
+            if (opts.hash)
+            {
+                uint64_t h = _hash(gbm->gpu->framebuf, UGB_GPU_SCREEN_W * UGB_GPU_SCREEN_H);
+                printf("%zu %016llX\n", gbm->gpu->frames, (unsigned long long) h);
+            }
+        }
+    }
+
+    double elapsed = _now() - start;
+
+    /*************************************************************/
+
+    if (opts.serial)
+    {
+        fwrite(&gbm->serial->out[0], 1, gbm->serial->len, stdout);
+        if (gbm->serial->dropped)
+            printf("\n(%zu serial bytes dropped)\n", gbm->serial->dropped);
+    }
+
+    if (prof)
+    {
+        ugb_symbols* syms = ugb_symbols_create();
+        if (opts.symbols && (!syms || ugb_symbols_load(syms, opts.symbols) < 0))
+            printf("Unable to read symbols from \"%s\".\n", opts.symbols);
+
+        FILE* f;
+        if (opts.stacks)
+        {
+            if ((f = fopen(opts.stacks, "w")))
+            {
+                ugb_profiler_write_stacks(prof, f, syms);
+                fclose(f);
+            }
+            else
+            {
+                printf("Unable to write \"%s\".\n", opts.stacks);
+            }
+        }
+
+        if (opts.flat)
+        {
+            if ((f = fopen(opts.flat, "w")))
+            {
+                ugb_profiler_write_flat(prof, f, syms, 0);
+                fclose(f);
+            }
+            else
+            {
+                printf("Unable to write \"%s\".\n", opts.flat);
+            }
+        }
+
+        ugb_symbols_destroy(syms);
+    }
+
+    if (cov)
+    {
+        fprintf(stderr, "%zu ROM bytes executed, %zu read\n",
+            ugb_covmap_rom_count(cov, UGB_COVMAP_EXEC), ugb_covmap_rom_count(cov, UGB_COVMAP_READ));
+
+        if (opts.coverage && ugb_covmap_save(cov, opts.coverage) != UGB_ERR_OK)
+            printf("Unable to write \"%s\".\n", opts.coverage);
+
+        if (opts.lcov)
+        {
+            ugb_symbols* syms = ugb_symbols_create();
+            FILE* f = 0;
+            if (!syms || ugb_symbols_load(syms, opts.symbols) < 0)
+                printf("Unable to read symbols from \"%s\".\n", opts.symbols);
+            else if (!(f = fopen(opts.lcov, "w")))
+                printf("Unable to write \"%s\".\n", opts.lcov);
+            else
+                ugb_covmap_write_lcov(cov, f, syms, rom_path);
+
+            if (f)
+                fclose(f);
+            ugb_symbols_destroy(syms);
+        }
+    }
+
+    if (opts.dump && (err = _dump_ppm(opts.dump, gbm->gpu->framebuf)) != UGB_ERR_OK)
+        printf("Unable to write \"%s\".\n", opts.dump);
+
+    if (opts.save_state)
+    {
+        size_t state_size = ugb_gbm_state_size(gbm);
+        uint8_t* state = malloc(state_size);
+        ssize_t len = state ? ugb_gbm_save_state(gbm, state, state_size) : UGB_ERR_MALLOC;
+
+        if (len < 0)
+            printf("Error: %s\n", ugb_strerror(len));
+        else if ((err = _write_file(opts.save_state, state, len)) != UGB_ERR_OK)
+            printf("Unable to write \"%s\".\n", opts.save_state);
+
+        free(state);
+    }
+
+    double emulated = gbm->cycles / UGB_CPU_CLOCK_FREQ;
+    fprintf(stderr, "%zu frames, %llu cycles in %.3f s (%.2f MHz, %.1fx real time)\n",
+        gbm->gpu->frames, (unsigned long long) gbm->cycles, elapsed,
+        gbm->cycles / elapsed / 1e6, elapsed > 0.0 ? emulated / elapsed : 0.0);
+
+end:
+    if (err != UGB_ERR_OK)
+        printf("Error: %s\n", ugb_strerror(err));
+
+    ugb_gdbstub_destroy(stub);
+    ugb_covmap_destroy(cov);
+    ugb_profiler_destroy(prof);
+    ugb_trace_destroy(trace);
+    ugb_export_destroy(exp);
+
+    ugb_gbm_destroy(gbm);
+    ugb_romcache_close(romcache, rom);
+    ugb_romcache_destroy(romcache);
+
+    return err != UGB_ERR_OK;
+}
@@ -0,0 +1,162 @@
+/*
+ * This file is part of uGB
+ * Copyright (C) 2017  Alexandre Monti
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "opcodes.h"
+#include "cpu.h"
+#include "symbols.h"
+#include "constants.h"
+#include "errno.h"
+
+// Offline decoder for the traces written by ugb-headless -t, prints one
+//   line per instruction from the oldest record still in the ring.
+
+static void _usage(const char* prog)
+{
+    printf("Usage: '%s [-n count] [-C] [-y file.sym] <trace>'.\n", prog);
+    printf("  -n count   Only print the last count instructions\n");
+    printf("  -C         Don't print cycle counts (to diff against other traces)\n");
+    printf("  -y file    Name addresses after this RGBDS symbol or map file\n");
+}
+
+static int _parse_count(const char* str, size_t* value)
+{
+    char* end = 0;
+    *value = strtoull(str, &end, 0);
+    return end && end != str && !*end;
+}
+
+static void _print(ugb_trace_record const* rec, int cycles, const ugb_symbols* syms)
+{
+    char bytes[16];
+    size_t pos = 0;
+    for (int i = 0; i < rec->size && i < 4; ++i)
+        pos += snprintf(bytes + pos, sizeof(bytes) - pos, "%02X ", rec->code[i]);
+    bytes[pos] = '\0';
+
+    char disasm[64];
+    uint8_t code[4];
+    memcpy(&code[0], &rec->code[0], sizeof(code));
+    if (ugb_disassemble(disasm, sizeof(disasm), code, rec->pc) < 0)
+        strcpy(disasm, "???");
+
+    if (syms)
+    {
+        // Name the jump or call target, when it has one
+        ssize_t target = ugb_opcode_target(code, rec->pc);
+        if (target >= 0 && ugb_symbols_lookup(syms, rec->bank, target))
+        {
+            size_t len = strlen(disasm);
+            len += snprintf(&disasm[len], sizeof(disasm) - len, " ; ");
+            ugb_symbols_format(syms, rec->bank, target, &disasm[len], sizeof(disasm) - len);
+        }
+    }
+
+    if (cycles)
+        printf("%12llu  ", (unsigned long long) rec->cycles);
+
+    if (syms)
+    {
+        char name[64];
+        ugb_symbols_format(syms, rec->bank, rec->pc, name, sizeof(name));
+        printf("%-24s ", name);
+    }
+
+    printf("%02X:%04X  %-10s %-32s AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X IME=%d\n",
+        rec->pc >= UGB_CART_ROMX_LO && rec->pc <= UGB_CART_ROMX_HI ? rec->bank : 0, rec->pc, bytes, disasm,
+        rec->af, rec->bc, rec->de, rec->hl, rec->sp,
+        (rec->ie & UGB_REG_IE_IME_MSK) ? 1 : 0);
+}
+
+int main(int argc, char** argv)
+{
+    size_t last = 0;
+    int cycles = 1;
+    const char* sym_path = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:Cy:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                if (!_parse_count(optarg, &last))
+                {
+                    printf("Invalid count \"%s\".\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'C': cycles = 0; break;
+            case 'y': sym_path = optarg; break;
+
+            default:
+                _usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    ugb_symbols* syms = 0;
+    if (sym_path && (!(syms = ugb_symbols_create()) || ugb_symbols_load(syms, sym_path) < 0))
+    {
+        printf("Unable to read symbols from \"%s\".\n", sym_path);
+        ugb_symbols_destroy(syms);
+        return 1;
+    }
+
+    ugb_trace* trace = ugb_trace_open(argv[optind]);
+    if (!trace)
+    {
+        printf("Unable to open \"%s\" as a trace.\n", argv[optind]);
+        ugb_symbols_destroy(syms);
+        return 1;
+    }
+
+    uint64_t count = trace->header->count;
+    uint64_t first = count > trace->header->capacity ? count - trace->header->capacity : 0;
+    if (last && count - first > last)
+        first = count - last;
+
+    for (uint64_t i = first; i < count; ++i)
+    {
+        ugb_trace_record const* rec = ugb_trace_get(trace, i);
+        if (rec)
+            _print(rec, cycles, syms);
+    }
+
+    if (first)
+        fprintf(stderr, "(%llu older instructions were overwritten or skipped)\n", (unsigned long long) first);
+
+    ugb_trace_destroy(trace);
+    ugb_symbols_destroy(syms);
+
+    return 0;
+}